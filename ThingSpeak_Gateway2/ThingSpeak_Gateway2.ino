@@ -4,7 +4,17 @@
  * FEATURES:
  * - PIR motion sensor triggers ESP32-S3-EYE via TCP command
  * - Receives face detection data from ESP32-S3-EYE
- * - Uploads detection history to ThingSpeak
+ * - Uploads detection history to ThingSpeak, queued and sent in bulk updates
+ *   from a background task so the rate limit never blocks the loop
+ * - Telegram alerts from a background worker, one digest per person per
+ *   interval, retried with backoff
+ * - Serves several cameras at once from a non-blocking event loop, each with
+ *   its own parser and state, speaking '\r' terminated JSON or the binary
+ *   wire protocol of components/who_gateway (told apart by the first byte)
+ *
+ * The wire codec is shared with the camera: who_wire.* and who_event.* in this
+ * folder are symlinks to components/who_gateway, it needs arduino-esp32 3.x
+ * (C++17). On Windows, copy the four files in instead.
  * 
  * HARDWARE:
  * - ESP32 board (any variant)
@@ -22,7 +32,7 @@
 #include <HTTPClient.h>
 #include <ArduinoJson.h>
 #include <WiFiClientSecure.h>
-#include <UniversalTelegramBot.h>
+#include "who_wire.hpp"
 
 // ============================================================================
 // 1. NETWORK CONFIGURATION
@@ -43,34 +53,101 @@ IPAddress STATIC_DNS(8,8,8,8);           // or your router
 #define TCP_PORT 5500
 WiFiServer tcpServer(TCP_PORT);
 
+// Cameras served at the same time, and cameras remembered (by IP) across reconnects
+#define MAX_CAMERAS 4
+#define MAX_DEVICES 8
+// A wire camera sends a heartbeat after at most WHO_GATEWAY_HEARTBEAT_MS of
+// silence, 20 s at most by its Kconfig range, silence for longer means a dead link
+#define WIRE_HEARTBEAT_MAX_MS 20000
+#define WIRE_IDLE_TIMEOUT_MS (WIRE_HEARTBEAT_MAX_MS + 10000)
+// Events remembered per camera to drop the ones it sends again, more than a
+// result batch holds (WIRE_MAX_PAYLOAD / 10 byte records)
+#define SEEN_EVENTS 128
+
 // PIR Sensor Initialisation [ESP-EYE Trigger]
 #define PIR_PIN 4
 #define PIR_TRIGGER_COOLDOWN 10000  // 10 seconds between triggers
+// PIR fan-out: comma separated camera IPs which get PIR triggers, "" for every camera.
+// Can be changed at runtime on the serial monitor ("pir <ip> on|off").
+const char* PIR_TARGETS = "";
 
 // ThingSpeak Database Initialisation
 #define TS_HOST "api.thingspeak.com"
+#define TS_CHANNEL_ID "0000000"
 #define TS_WRITE_KEY "[REDACTED]"
 #define TS_MIN_INTERVAL_MS 16000  // 16 seconds (ThingSpeak rate limit)
+#define TS_QUEUE_LEN 128          // detections waiting for upload
+#define TS_BATCH_MAX 64           // detections per bulk update
+
+// Local stand-in for the cloud services (tools/gateway/cloud_standin.py),
+// e.g. "http://172.20.10.2:8080". "" talks to ThingSpeak and Telegram themselves.
+#define CLOUD_STANDIN ""
 
 // Telegram Notifications Initialisation 
 #define TELEGRAM_ENABLE     1           // set 0 to disable
 const char* TELEGRAM_BOT_TOKEN = "[REDACTED]";
 const char* TELEGRAM_CHAT_ID   = "2112746975";     // your user/chat id
-WiFiClientSecure tgClient;
-UniversalTelegramBot bot(TELEGRAM_BOT_TOKEN, tgClient);
 
-// Telegram: Rate-limit notifications
-unsigned long lastTgNotify = 0;
-const unsigned long TG_MIN_INTERVAL_MS = 15000;   // 15s
+// Telegram: alerts are coalesced per person, one digest per interval
+#define TG_DIGEST_INTERVAL_MS 15000   // 15s between two messages about one person
+#define TG_MAX_PENDING 8              // people with an alert pending, more are dropped
+#define TG_RETRY_BASE_MS 2000         // first retry after a failed send, doubled per attempt
+#define TG_RETRY_MAX_MS 60000
+#define TG_MAX_ATTEMPTS 5             // a digest is given up after this many failed sends
 
 
 // ============================================================================
 // 2. GLOBAL VARIABLES
 // ============================================================================
 
+using namespace who::gateway;
+
+// Camera protocols, told apart by the first byte a camera sends
+enum CameraProto { PROTO_UNKNOWN, PROTO_JSON, PROTO_WIRE };
+
+// A wire event already processed, by its seq and camera timestamp
+struct SeenEvent {
+  bool used;
+  uint32_t seq;
+  uint32_t timestamp;
+};
+static_assert(SEEN_EVENTS >= WIRE_MAX_PAYLOAD / 10, "a resent batch must fit in the seen events");
+
+// Per-device state, kept across reconnects of the same camera
+struct Device {
+  bool used;
+  IPAddress ip;
+  bool pirSubscribed;
+  int connection;           // index into connections[], -1 if offline
+  uint32_t connects;
+  uint32_t events;
+  uint32_t duplicates;
+  uint32_t triggersSent;
+  unsigned long lastSeen;
+  int lastStatus;
+  int lastId;
+  float lastSimilarity;
+  SeenEvent seen[SEEN_EVENTS];  // slot seq % SEEN_EVENTS
+};
+
+// One connected camera with its own framed-message parser
+struct Connection {
+  bool active;
+  WiFiClient client;
+  int device;               // index into devices[]
+  CameraProto proto;
+  char line[640];           // JSON: partial line
+  size_t lineLen;
+  bool lineOverflow;
+  WhoWireParser wire;       // wire: partial frame
+  uint16_t wireSeq;
+};
+
+Device devices[MAX_DEVICES];
+Connection connections[MAX_CAMERAS];
+
 // Forward declarations
-void processDetectionData(const String& data);
-void handleClient(WiFiClient& client);
+void processDetection(Device& device, const event_t& event);
 
 // PIR State
 volatile bool pirMotionDetected = false;
@@ -82,7 +159,13 @@ bool pirEnabled = true;
 unsigned long totalDetections = 0;
 unsigned long successfulUploads = 0;
 unsigned long failedUploads = 0;
-unsigned long lastUploadTime = 0;
+unsigned long droppedUploads = 0;
+unsigned long alertsSent = 0;
+unsigned long alertsFailed = 0;
+unsigned long alertsDropped = 0;
+// Longest loop() pass since the last "status", to see what blocks the cameras
+unsigned long loopMaxUs = 0;
+volatile unsigned long lastUploadTime = 0;  // written by the upload task
 String lastDetectedPerson = "none";
 float lastConfidence = 0.0;
 
@@ -106,231 +189,719 @@ void IRAM_ATTR pirISR() {
 }
 
 // ============================================================================
-// 3b. UTILITY FUNCTIONS: URL ENCODING FOR THINGSPEAK 
+// 3b. UTILITY FUNCTIONS: TELEGRAM ALERT WORKER
 // ============================================================================
+// processDetection() only adds the detection to the digest of that person and
+// returns. A background task sends the digests: the first detection of a
+// person goes out right away, the ones within TG_DIGEST_INTERVAL_MS after it
+// are collected into one message sent when the interval is over. A failed
+// send is retried with exponential backoff, or after the wait Telegram asks
+// for, so a slow or unreachable Telegram never holds up the cameras or the PIR.
+
+struct AlertDigest {
+  bool used;
+  int status;
+  int personId;             // -1 for unknown faces, they share one digest
+  uint32_t count;           // detections not sent yet
+  float bestSimilarity;
+  unsigned long firstMs;    // millis() of the first detection not sent yet
+  unsigned long lastMs;
+  uint8_t cameras;          // bit per devices[] index
+  unsigned long notBefore;  // millis() when the next message may go out
+  uint8_t attempts;
+};
+
+AlertDigest alertDigests[TG_MAX_PENDING];
+portMUX_TYPE alertMux = portMUX_INITIALIZER_UNLOCKED;
+TaskHandle_t alertTaskHandle = nullptr;
+
+// The stand-in speaks plain HTTP, Telegram HTTPS
+WiFiClientSecure tgClient;
+WiFiClient tgPlainClient;
 
-// converts normal string into an url-safe encoded form to be appended at end of url 
-String urlEncode(const String &s) {
-  String encoded;
-  for (size_t i = 0; i < s.length(); i++) {
-    char c = s[i];
-    if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
-      encoded += c;
-    } else if (c == ' ') {
-      encoded += '+';
-    } else {
-      char hex[4];
-      sprintf(hex, "%%%02X", c);
-      encoded += hex;
+// Called from the loop, never waits
+void queueAlert(int device, int status, int personId, float similarity) {
+  if (!TELEGRAM_ENABLE) return;
+  if (status != 1) personId = -1;
+  unsigned long now = millis();
+
+  portENTER_CRITICAL(&alertMux);
+  AlertDigest* digest = nullptr;
+  AlertDigest* spare = nullptr;
+  for (auto& d : alertDigests) {
+    if (d.used && d.status == status && d.personId == personId) {
+      digest = &d;
+      break;
+    }
+    // A free slot, else the one of the person quiet for longest with nothing pending
+    if (!d.used) {
+      if (!spare || spare->used) spare = &d;
+    } else if (d.count == 0 && (!spare || (spare->used && now - d.lastMs > now - spare->lastMs))) {
+      spare = &d;
     }
   }
-  return encoded;
-}
-
-// ============================================================================
-// 3c. UTILITY FUNCTIONS: Telegram Alert Handler  
-// ============================================================================
-// Handles the structuring of JSON data into desired format for Telegram alerts
-bool sendTelegramAlert(const String& person, float similarity, int status, int pirCount) {
-  if (!TELEGRAM_ENABLE) return false;
-
-  // Enforce rate limit
-  unsigned long now = millis();
-  if (now - lastTgNotify < TG_MIN_INTERVAL_MS) return false;
+  if (!digest && spare) {
+    digest = spare;
+    *digest = AlertDigest();
+    digest->used = true;
+    digest->status = status;
+    digest->personId = personId;
+    digest->notBefore = now;
+  }
+  if (digest) {
+    if (digest->count++ == 0) {
+      digest->firstMs = now;
+      digest->bestSimilarity = 0;
+      digest->cameras = 0;
+    }
+    digest->lastMs = now;
+    digest->bestSimilarity = max(digest->bestSimilarity, similarity);
+    digest->cameras |= 1 << device;
+  }
+  portEXIT_CRITICAL(&alertMux);
 
-  // For quick start: skip cert validation
-  tgClient.setInsecure();
+  if (!digest) {
+    alertsDropped++;
+    Serial.println("[Telegram] ✗ Too many people with alerts pending, alert dropped");
+  } else if (alertTaskHandle) {
+    xTaskNotifyGive(alertTaskHandle);
+  }
+}
 
-  // build message to be sent over telegram 
+String buildAlertMessage(const AlertDigest& d) {
   String msg;
   msg += "ESP32 Gateway Alert\n";
-  msg += "• Status: ";          msg += (status==1 ? "Recognized" : "Unknown"); msg += "\n";
-  msg += "• Person: ";          msg += person;                                 msg += "\n";
-  msg += "• Similarity: ";      msg += String(similarity * 100, 1);            msg += "%\n";
-  msg += "• PIR Triggers: ";    msg += String(pirCount);                        msg += "\n";
+  msg += "• Status: ";          msg += (d.status == 1 ? "Recognized" : "Unknown"); msg += "\n";
+  if (d.status == 1) {
+    msg += "• Person: ";        msg += String(d.personId);                          msg += "\n";
+  }
+  msg += "• Detections: ";      msg += String(d.count);
+  if (d.count > 1) {
+    msg += " in ";              msg += String((d.lastMs - d.firstMs) / 1000);       msg += " s";
+  }
+  msg += "\n";
+  msg += "• Best similarity: "; msg += String(d.bestSimilarity * 100, 1);          msg += "%\n";
+  msg += "• Cameras: ";
+  for (int i = 0; i < MAX_DEVICES; i++) {
+    if (!(d.cameras & (1 << i))) continue;
+    msg += devices[i].ip.toString();
+    msg += " ";
+  }
+  msg += "\n";
+  msg += "• PIR Triggers: ";    msg += String(pirDetectionCount);                  msg += "\n";
   msg += "• TS Channel: ";      msg += "(see your ThingSpeak graphs)";
+  return msg;
+}
+
+// One sendMessage request. Returns true if Telegram took the message, else
+// retryAfterMs is the wait Telegram asked for, 0 if it did not say.
+bool postTelegramMessage(HTTPClient& http, const String& text, unsigned long& retryAfterMs) {
+  retryAfterMs = 0;
+  String url = String(CLOUD_STANDIN[0] ? CLOUD_STANDIN : "https://api.telegram.org") + "/bot" +
+               TELEGRAM_BOT_TOKEN + "/sendMessage";
+  WiFiClient& client = CLOUD_STANDIN[0] ? tgPlainClient : (WiFiClient&)tgClient;
+  if (!http.begin(client, url)) {
+    return false;
+  }
+  StaticJsonDocument<1024> doc;
+  doc["chat_id"] = TELEGRAM_CHAT_ID;
+  doc["text"] = text;
+  doc["parse_mode"] = "Markdown";
+  String body;
+  serializeJson(doc, body);
+  http.addHeader("Content-Type", "application/json");
+  int httpCode = http.POST(body);
+  String response = http.getString();
+  // No http.end(), it would close the kept-alive connection
+
+  if (httpCode == 200) {
+    return true;
+  }
+  // 429 carries the wait Telegram asks for
+  StaticJsonDocument<256> reply;
+  if (httpCode == 429 && !deserializeJson(reply, response)) {
+    retryAfterMs = (reply["parameters"]["retry_after"] | 0) * 1000UL;
+  }
+  Serial.print("[Telegram] ✗ HTTP "); Serial.println(httpCode);
+  return false;
+}
 
-  bool ok = bot.sendMessage(TELEGRAM_CHAT_ID, msg, "Markdown");
-  if (ok) lastTgNotify = now;
-  return ok;
+void alertTask(void*) {
+  HTTPClient http;
+  http.setReuse(true);
+  http.setTimeout(10000);
+  tgClient.setInsecure();  // For quick start: skip cert validation
+
+  for (;;) {
+    // Take a copy of the digest due first, or sleep until one is due
+    AlertDigest* due = nullptr;
+    AlertDigest msg;
+    TickType_t wait = portMAX_DELAY;
+    unsigned long now = millis();
+    portENTER_CRITICAL(&alertMux);
+    for (auto& d : alertDigests) {
+      if (!d.used || d.count == 0) continue;
+      long left = (long)(d.notBefore - now);
+      if (left <= 0) {
+        if (!due || (long)(d.notBefore - due->notBefore) < 0) due = &d;
+      } else if (pdMS_TO_TICKS(left) < wait) {
+        wait = pdMS_TO_TICKS(left);
+      }
+    }
+    if (due) msg = *due;
+    portEXIT_CRITICAL(&alertMux);
+    if (!due) {
+      ulTaskNotifyTake(pdTRUE, wait);
+      continue;
+    }
+    if (WiFi.status() != WL_CONNECTED) {
+      vTaskDelay(pdMS_TO_TICKS(1000));
+      continue;
+    }
+
+    unsigned long retryAfterMs;
+    bool ok = postTelegramMessage(http, buildAlertMessage(msg), retryAfterMs);
+    if (!ok) http.end();  // start over with a fresh connection
+    bool giveUp = !ok && msg.attempts + 1 >= TG_MAX_ATTEMPTS;
+
+    // Only the worker takes detections out of a digest, the loop may have added more meanwhile
+    now = millis();
+    portENTER_CRITICAL(&alertMux);
+    if (ok || giveUp) {
+      due->count -= msg.count;
+      due->attempts = 0;
+      due->notBefore = now + TG_DIGEST_INTERVAL_MS;
+      if (due->count > 0) {
+        due->firstMs = msg.lastMs;
+        due->bestSimilarity = 0;
+        due->cameras = 0;
+      }
+    } else {
+      unsigned long backoff = min((unsigned long)TG_RETRY_BASE_MS << msg.attempts, (unsigned long)TG_RETRY_MAX_MS);
+      due->attempts++;
+      due->notBefore = now + max(backoff, retryAfterMs);
+    }
+    portEXIT_CRITICAL(&alertMux);
+
+    if (ok) {
+      alertsSent++;
+      Serial.printf("[Telegram] ✓ Alert sent, %u detection(s)\n", (unsigned)msg.count);
+    } else if (giveUp) {
+      alertsFailed++;
+      Serial.printf("[Telegram] ✗ Alert given up after %d attempts\n", TG_MAX_ATTEMPTS);
+    }
+  }
 }
 
 // ============================================================================
-// 4. Detection Data Upload Function: THINGSPEAK UPLOAD
+// 4. Detection Data Upload: THINGSPEAK UPLOAD QUEUE
 // ============================================================================
-// This core function essentially extracts JSON detection data (processed) & builds the data struct
-// to be sent to ThingSpeak for visualisation. 
-// Will be called by processDetectionData()
-bool uploadToThingSpeak(const String& jsonData) {
-  if (WiFi.status() != WL_CONNECTED) {
-    Serial.println("[ThingSpeak] ✗ WiFi not connected");
-    return false;
+// processDetection() only queues the detection in RAM and returns. A background
+// task sends everything queued as one bulk-update request at most once per
+// TS_MIN_INTERVAL_MS, over a kept-alive connection, so neither the rate limit
+// nor the request itself ever holds up the cameras or the PIR. A failed request
+// keeps its detections queued for the next interval; when the queue is full the
+// oldest detection makes room.
+
+struct UploadEntry {
+  uint32_t seq;
+  time_t createdAt;         // wall clock, 0 if NTP has not synced yet
+  unsigned long ms;         // millis() when queued
+  uint8_t eventType;
+  int status;
+  int personId;
+  float similarity;
+};
+
+UploadEntry uploadQueue[TS_QUEUE_LEN];
+size_t uploadHead = 0;      // oldest entry
+size_t uploadCount = 0;
+uint32_t uploadSeq = 0;
+portMUX_TYPE uploadMux = portMUX_INITIALIZER_UNLOCKED;
+TaskHandle_t uploadTaskHandle = nullptr;
+
+// The stand-in speaks plain HTTP, ThingSpeak HTTPS
+WiFiClientSecure tsSecureClient;
+WiFiClient tsPlainClient;
+
+// Called from the loop, never waits
+void queueUpload(const event_t& event, int status, int person_id, float similarity) {
+  UploadEntry entry;
+  time_t now = time(nullptr);
+  entry.createdAt = now > 1600000000 ? now : 0;
+  entry.ms = millis();
+  entry.eventType = event.type;
+  entry.status = status;
+  entry.personId = person_id;
+  entry.similarity = similarity;
+
+  bool dropped = false;
+  portENTER_CRITICAL(&uploadMux);
+  if (uploadCount == TS_QUEUE_LEN) {
+    uploadHead = (uploadHead + 1) % TS_QUEUE_LEN;
+    uploadCount--;
+    dropped = true;
+  }
+  entry.seq = uploadSeq++;
+  uploadQueue[(uploadHead + uploadCount) % TS_QUEUE_LEN] = entry;
+  uploadCount++;
+  portEXIT_CRITICAL(&uploadMux);
+
+  if (dropped) {
+    droppedUploads++;
+    Serial.println("[ThingSpeak] ✗ Queue full, oldest detection dropped");
   }
+  if (uploadTaskHandle) xTaskNotifyGive(uploadTaskHandle);
+}
 
-  // Rate limiting as ThingSpeak only allows free users to update data every 16 seconds 
+// Builds the bulk-update body from the first n queued entries. Entries carry
+// their own time, so a batch sent 16 s later still lands at the right time.
+String buildBulkUpdate(const UploadEntry* entries, size_t n) {
+  String body = "{\"write_api_key\":\"" + String(TS_WRITE_KEY) + "\",\"updates\":[";
   unsigned long now = millis();
-  if (lastUploadTime > 0 && (now - lastUploadTime) < TS_MIN_INTERVAL_MS) {
-    unsigned long wait = TS_MIN_INTERVAL_MS - (now - lastUploadTime);
-    Serial.printf("[ThingSpeak] Rate limit: waiting %lu ms\n", wait);
-    delay(wait);
+  char item[192];
+  for (size_t i = 0; i < n; i++) {
+    const UploadEntry& e = entries[i];
+    char when[48];
+    if (e.createdAt) {
+      struct tm t;
+      gmtime_r(&e.createdAt, &t);
+      strftime(when, sizeof(when), "\"created_at\":\"%Y-%m-%dT%H:%M:%SZ\"", &t);
+    } else {
+      // Without NTP time, the age of the detection when the request is sent
+      snprintf(when, sizeof(when), "\"delta_t\":%lu", (now - e.ms) / 1000);
+    }
+    snprintf(item, sizeof(item), "%s{%s,\"field1\":%d,\"field2\":%d,\"field3\":%.3f,\"status\":\"%s\"}",
+             i ? "," : "", when, e.status, e.personId, e.similarity,
+             event_type_to_str((event_type_t)e.eventType));
+    body += item;
+  }
+  body += "]}";
+  return body;
+}
+
+// One bulk-update request. Returns true if ThingSpeak took the batch.
+bool postBulkUpdate(HTTPClient& http, const String& body) {
+  String url = String(CLOUD_STANDIN[0] ? CLOUD_STANDIN : "https://" TS_HOST) +
+               "/channels/" TS_CHANNEL_ID "/bulk_update.json";
+  WiFiClient& client = CLOUD_STANDIN[0] ? tsPlainClient : (WiFiClient&)tsSecureClient;
+  if (!http.begin(client, url)) {
+    return false;
+  }
+  http.addHeader("Content-Type", "application/json");
+  int httpCode = http.POST(body);
+  String response = http.getString();
+  // No http.end(), it would close the kept-alive connection
+
+  // ThingSpeak answers a bulk update with 202 Accepted
+  if (httpCode == 200 || httpCode == 202) {
+    return true;
+  }
+  Serial.print("[ThingSpeak] ✗ HTTP "); Serial.println(httpCode);
+  Serial.println("[ThingSpeak] Response: " + response);
+  Serial.println("[ThingSpeak] Note: 429 means rate limit, 401 a bad API key.");
+  return false;
+}
+
+void uploadTask(void*) {
+  HTTPClient http;
+  http.setReuse(true);
+  http.setTimeout(10000);
+  tsSecureClient.setInsecure();  // For quick start: skip cert validation
+  static UploadEntry batch[TS_BATCH_MAX];
+
+  for (;;) {
+    // Sleep until a detection is queued or the rate limit allows the next request
+    TickType_t wait = portMAX_DELAY;
+    if (uploadCount > 0) {
+      unsigned long since = millis() - lastUploadTime;
+      wait = lastUploadTime == 0 || since >= TS_MIN_INTERVAL_MS ? 0 : pdMS_TO_TICKS(TS_MIN_INTERVAL_MS - since);
+    }
+    if (wait) {
+      ulTaskNotifyTake(pdTRUE, wait);
+      continue;
+    }
+    if (WiFi.status() != WL_CONNECTED) {
+      vTaskDelay(pdMS_TO_TICKS(1000));
+      continue;
+    }
+
+    // Copy the oldest entries out, they stay queued until ThingSpeak took them
+    size_t n;
+    portENTER_CRITICAL(&uploadMux);
+    n = min(uploadCount, (size_t)TS_BATCH_MAX);
+    for (size_t i = 0; i < n; i++) {
+      batch[i] = uploadQueue[(uploadHead + i) % TS_QUEUE_LEN];
+    }
+    portEXIT_CRITICAL(&uploadMux);
+
+    unsigned long start = millis();
+    bool ok = postBulkUpdate(http, buildBulkUpdate(batch, n));
+    lastUploadTime = millis();
+    if (ok) {
+      // The loop may have pushed the oldest out meanwhile, drop only what is still ours
+      portENTER_CRITICAL(&uploadMux);
+      size_t sent = 0;
+      while (sent < n && uploadCount > 0 && uploadQueue[uploadHead].seq == batch[sent].seq) {
+        uploadHead = (uploadHead + 1) % TS_QUEUE_LEN;
+        uploadCount--;
+        sent++;
+      }
+      portEXIT_CRITICAL(&uploadMux);
+      successfulUploads += n;
+      Serial.printf("[ThingSpeak] ✓ %u detection(s) uploaded in %lu ms\n", (unsigned)n, lastUploadTime - start);
+    } else {
+      failedUploads++;
+      http.end();  // start over with a fresh connection
+    }
   }
+}
 
-  // Parse JSON
+// ============================================================================
+// 5. Detection Data Processing Function: PROCESS DETECTION DATA
+// ============================================================================
+// Parses one JSON line from a camera into an event. The top level status, id
+// and similarity are those of the best face, which is all the gateway uses.
+bool parseJsonEvent(const char* line, event_t& event) {
   StaticJsonDocument<1024> doc;
-  DeserializationError error = deserializeJson(doc, jsonData);
-  
-  // if JSON string has an error 
+  DeserializationError error = deserializeJson(doc, line);
   if (error) {
-    Serial.print("[ThingSpeak] ✗ JSON parse error: ");
+    Serial.print("[ERROR] Failed to parse JSON: ");
     Serial.println(error.c_str());
-    failedUploads++;
+    Serial.print("Raw data: ");
+    Serial.println(line);
     return false;
   }
+  memset(&event, 0, sizeof(event));
+  const char* type = doc["event"] | "RECOGNIZE";
+  event.type = EVENT_RECOGNIZE;
+  for (int t = EVENT_RECOGNIZE; t <= EVENT_DELETE; t++) {
+    if (strcmp(type, event_type_to_str((event_type_t)t)) == 0) {
+      event.type = (event_type_t)t;
+    }
+  }
+  event.seq = doc["seq"] | 0;
+  event.num_faces = 1;
+  event.faces[0].status = doc["status"] | 0;
+  event.faces[0].id = doc["id"] | 0;
+  event.faces[0].similarity = doc["similarity"] | 0.0;
+  return true;
+}
 
-  // Extract data
-  int event_status = doc["status"] | 0;
-  int person_id = doc["id"] | 0;
-  float similarity = doc["similarity"] | 0.0;
-  String event_type = doc["event"] | String("UNKNOWN");
+// This core function prints one detection, keeps the camera's state up to date,
+// then queues it for ThingSpeak with queueUpload() and Telegram with queueAlert().
+// Will be called for every event a camera sends, whatever its protocol
+void processDetection(Device& device, const event_t& event) {
+  Serial.println("\n╔════════════════════════════════════════╗");
+  Serial.println("║     FACE DETECTION RECEIVED            ║");
+  Serial.println("╚════════════════════════════════════════╝");
 
-  // Update last detection
+  totalDetections++;
+  int best = event_best_face(event);
+  int status = best >= 0 ? event.faces[best].status : 0;
+  int person_id = best >= 0 ? event.faces[best].id : 0;
+  float similarity = best >= 0 ? event.faces[best].similarity : 0.0;
+
+  device.events++;
+  device.lastStatus = status;
+  device.lastId = person_id;
+  device.lastSimilarity = similarity;
   lastDetectedPerson = String(person_id);
   lastConfidence = similarity;
 
-  // Build ThingSpeak POST data
-  String postData = "api_key=" + String(TS_WRITE_KEY);
-  postData += "&field1=" + String(event_status);
-  postData += "&field2=" + String(person_id);
-  postData += "&field3=" + String(similarity, 3);
-  postData += "&status=" + urlEncode(event_type);
+  Serial.println("┌────────────────────────────────────────");
+  Serial.print("│ Camera:      ");
+  Serial.println(device.ip);
+  Serial.print("│ Event:       ");
+  Serial.print(event_type_to_str(event.type));
+  Serial.print(" #");
+  Serial.println(event.seq);
+  Serial.print("│ Status:      ");
+  Serial.println(status == 1 ? "Recognized" : "Unknown");
+  Serial.print("│ Person ID:   ");
+  Serial.println(person_id);
+  Serial.print("│ Similarity:  ");
+  Serial.print(similarity * 100);
+  Serial.println("%");
+  Serial.println("└────────────────────────────────────────");
+
+  // Queue for ThingSpeak and Telegram, their tasks send it in the background
+  queueUpload(event, status, person_id, similarity);
+  queueAlert(&device - devices, status, person_id, similarity);
+}
 
-  String url = "https://" + String(TS_HOST) + "/update";
+// ============================================================================
+// 6. Camera Connections: NON-BLOCKING MULTI-CLIENT EVENT LOOP
+// ============================================================================
+// Every pass of loop() accepts new cameras, reads whatever each camera has sent
+// without waiting for more, and fans PIR triggers out. A camera never holds up
+// another one or the PIR.
+
+// true if the camera at ip is listed in PIR_TARGETS, or the list is empty
+bool isPirTarget(const IPAddress& ip) {
+  if (PIR_TARGETS[0] == '\0') return true;
+  String targets = String(",") + PIR_TARGETS + ",";
+  targets.replace(" ", "");
+  return targets.indexOf("," + ip.toString() + ",") >= 0;
+}
 
-  Serial.println("\n[ThingSpeak] ═══════════════════════════");
-  Serial.println("[ThingSpeak] Uploading detection...");
-  Serial.println("[ThingSpeak] Person ID: " + String(person_id));
-  Serial.println("[ThingSpeak] Similarity: " + String(similarity));
+// Finds the state of the camera at ip, or makes room for it
+int findDevice(const IPAddress& ip) {
+  int freeSlot = -1;
+  int oldestOffline = -1;
+  for (int i = 0; i < MAX_DEVICES; i++) {
+    if (!devices[i].used) {
+      if (freeSlot < 0) freeSlot = i;
+    } else if (devices[i].ip == ip) {
+      return i;
+    } else if (devices[i].connection < 0 &&
+               (oldestOffline < 0 || devices[i].lastSeen < devices[oldestOffline].lastSeen)) {
+      oldestOffline = i;
+    }
+  }
+  int i = freeSlot >= 0 ? freeSlot : oldestOffline;
+  if (i < 0) return -1;
+  devices[i] = Device();
+  devices[i].used = true;
+  devices[i].ip = ip;
+  devices[i].pirSubscribed = isPirTarget(ip);
+  devices[i].connection = -1;
+  return i;
+}
 
-  HTTPClient http;
-  WiFiClient client; 
+void closeConnection(int c) {
+  Connection& conn = connections[c];
+  Device& device = devices[conn.device];
+  Serial.print("[TCP] └─ Camera disconnected: ");
+  Serial.println(device.ip);
+  conn.client.stop();
+  conn.active = false;
+  device.connection = -1;
+}
 
-  http.begin(client, "http://api.thingspeak.com/update");
-  http.addHeader("Content-Type", "application/x-www-form-urlencoded");
-  int httpCode = http.POST(postData);
-  String response = http.getString();
-  http.end();
+void acceptCameras() {
+  WiFiClient client = tcpServer.available();
+  if (!client) return;
 
-  // ThingSpeak returns the entry ID as a positive integer on success, or "0" if it failed.
-  if (httpCode == 200) { //&& response != "0") {
-    Serial.println("[ThingSpeak] ✓ Upload successful! Entry ID: " + response);
-    //lastTS = millis();
-    return true;
-  } else {
-    Serial.print("[ThingSpeak] ✗ HTTP "); Serial.println(httpCode);
-    Serial.println("[ThingSpeak] Response: " + response);
-    Serial.println("[ThingSpeak] Note: '0' usually means rate limit or bad API key/fields.");
-    return false;
+  IPAddress ip = client.remoteIP();
+  int d = findDevice(ip);
+  int c = -1;
+  for (int i = 0; i < MAX_CAMERAS && c < 0; i++) {
+    if (!connections[i].active) c = i;
+  }
+  if (d < 0 || c < 0) {
+    Serial.print("[TCP] ✗ No room for camera ");
+    Serial.println(ip);
+    client.stop();
+    return;
   }
+  // A camera which reconnects has given up on its old connection
+  if (devices[d].connection >= 0) {
+    closeConnection(devices[d].connection);
+  }
+
+  Connection& conn = connections[c];
+  conn.active = true;
+  conn.client = client;
+  conn.client.setNoDelay(true);
+  conn.device = d;
+  conn.proto = PROTO_UNKNOWN;
+  conn.lineLen = 0;
+  conn.lineOverflow = false;
+  conn.wire.reset();
+  conn.wireSeq = 0;
+  devices[d].connection = c;
+  devices[d].connects++;
+  devices[d].lastSeen = millis();
+
+  Serial.println("\n[TCP] ┌─ Camera connected");
+  Serial.print("[TCP] │  IP: ");
+  Serial.println(ip);
+  Serial.print("[TCP] │  PIR triggers: ");
+  Serial.println(devices[d].pirSubscribed ? "yes" : "no");
 }
 
-// ============================================================================
-// 5. Detection Data Processing Function: PROCESS DETECTION DATA
-// ============================================================================
-// This core function parses JSON data into desired format, then calls uploadToThingSpeak() function. 
-// If ThingSpeak upload is successful, sendTelegramAlert() will also be called. 
-// Will be called by handleTCPClient() after data has been received by the ESP32 
-void processDetectionData(const String& data) {
-  Serial.println("\n╔════════════════════════════════════════╗");
-  Serial.println("║     FACE DETECTION RECEIVED            ║");
-  Serial.println("╚════════════════════════════════════════╝");
-  
-  totalDetections++;
-  Serial.print("Test for JSON string");
-  Serial.println(data);
+void sendWireFrame(Connection& conn, const uint8_t* frame, size_t len) {
+  if (len) conn.client.write(frame, len);
+}
 
-  // Parse JSON to display info
-  StaticJsonDocument<1024> doc;
-  DeserializationError error = deserializeJson(doc, data);
-
-  Serial.print("Test2 for JSON string");
-  Serial.println(data);
-
-  if (!error) {
-    String event_type = doc["event"] | String("UNKNOWN");
-    int status = doc["status"] | 0;
-    int person_id = doc["id"] | 0;
-    float similarity = doc["similarity"] | 0.0;
-
-    Serial.println("┌────────────────────────────────────────");
-    Serial.print("│ Event:       ");
-    Serial.println(event_type);
-    Serial.print("│ Status:      ");
-    Serial.println(status == 1 ? "Recognized" : "Unknown");
-    Serial.print("│ Person ID:   ");
-    Serial.println(person_id);
-    Serial.print("│ Similarity:  ");
-    Serial.print(similarity * 100);
-    Serial.println("%");
-    Serial.println("└────────────────────────────────────────");
+// Sends the PIR trigger in the camera's protocol. A camera which has not sent
+// anything yet is spoken to in JSON, like before; wire cameras say hello first.
+void sendTrigger(Connection& conn) {
+  if (conn.proto == PROTO_WIRE) {
+    uint8_t frame[WIRE_HEADER_SIZE];
+    sendWireFrame(conn, frame, wire_encode(frame, sizeof(frame), WIRE_TRIGGER, WIRE_FLAG_ACK_REQ,
+                                           conn.wireSeq++, nullptr, 0));
   } else {
-    Serial.println("[ERROR] Failed to parse JSON");
-    Serial.println("Raw data: " + data);
-  }
-
-  // Upload to ThingSpeak 
-  bool uploaded = uploadToThingSpeak(data);
-  if (uploaded) {
-    // Use already-parsed values if you have them; otherwise re-extract:
-    StaticJsonDocument<1024> doc;
-    if (deserializeJson(doc, data) == DeserializationError::Ok) {
-      String person = doc["person_id"].is<const char*>() 
-                        ? String(doc["person_id"].as<const char*>())
-                        : String( doc["id"] | -1 );
-      float similarity = doc["similarity"] | doc["confidence"] | 0.0;
-      int status = doc["status"] | doc["face_status"] | 0;
-
-      // After successfully uploading to ThingSpeak, upload to Telegram
-      sendTelegramAlert(person, similarity, status, pirDetectionCount); 
+    conn.client.print("1\r");
+  }
+  devices[conn.device].triggersSent++;
+}
+
+// A camera sends a result batch again after a reconnect if the ack was lost,
+// so the gateway may see an event twice. The seq alone does not tell: journal
+// backlogs arrive after newer live events, and it restarts from 0 with the
+// camera. Together with the camera's timestamp (ms since its boot) it does.
+bool seenBefore(Device& device, const event_t& event) {
+  SeenEvent& slot = device.seen[event.seq % SEEN_EVENTS];
+  uint32_t timestamp = (uint32_t)event.timestamp_ms;
+  if (slot.used && slot.seq == event.seq && slot.timestamp == timestamp) {
+    return true;
+  }
+  slot.used = true;
+  slot.seq = event.seq;
+  slot.timestamp = timestamp;
+  return false;
+}
+
+void onWireFrame(Connection& conn, const wire_header_t& header, const uint8_t* payload) {
+  if (header.type == WIRE_RESULT) {
+    size_t pos = 0;
+    for (int i = 0; i < header.count; i++) {
+      event_t event;
+      size_t len = decode_result_record(payload + pos, header.len - pos, event);
+      if (!len) break;
+      pos += len;
+      Device& device = devices[conn.device];
+      if (seenBefore(device, event)) {
+        device.duplicates++;
+        Serial.print("[TCP] Duplicate event #");
+        Serial.print(event.seq);
+        Serial.print(" from ");
+        Serial.println(device.ip);
+        continue;
+      }
+      processDetection(device, event);
     }
   }
+  if (header.flags & WIRE_FLAG_ACK_REQ) {
+    uint8_t frame[WIRE_HEADER_SIZE + 2];
+    sendWireFrame(conn, frame, wire_encode_ack(frame, sizeof(frame), conn.wireSeq++, header.seq));
+  }
 }
 
-// ============================================================================
-// 6. Detection Data Retrieval Function: HANDLE TCP CLIENT
-// ============================================================================
-// This core function receives RECOGNISE data from ESP-EYE via TCP client,  
-// AND sends msg to ESP-EYE if motion sensor has been triggered 
-// Called in void loop(). 
-void handleTCPClient(WiFiClient& client) {
-  Serial.println("\n[TCP] ┌─ Client connected");
-  Serial.print("[TCP] │  IP: ");
-  Serial.println(client.remoteIP());
+void onJsonBytes(Connection& conn, const uint8_t* data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    char c = data[i];
+    if (c == '\r' || c == '\n') {
+      if (!conn.lineOverflow && conn.lineLen) {
+        conn.line[conn.lineLen] = '\0';
+        event_t event;
+        if (parseJsonEvent(conn.line, event)) {
+          processDetection(devices[conn.device], event);
+        }
+      }
+      conn.lineLen = 0;
+      conn.lineOverflow = false;
+    } else if (conn.lineLen + 1 >= sizeof(conn.line)) {
+      conn.lineOverflow = true;
+    } else if (!conn.lineOverflow) {
+      conn.line[conn.lineLen++] = c;
+    }
+  }
+}
+
+// Reads what every camera has sent so far, never waiting for more
+void pollCameras() {
+  uint8_t buf[256];
+  for (int c = 0; c < MAX_CAMERAS; c++) {
+    Connection& conn = connections[c];
+    if (!conn.active) continue;
+    Device& device = devices[conn.device];
+
+    int avail;
+    while ((avail = conn.client.available()) > 0) {
+      int n = conn.client.read(buf, min(avail, (int)sizeof(buf)));
+      if (n <= 0) break;
+      device.lastSeen = millis();
+      if (conn.proto == PROTO_UNKNOWN) {
+        conn.proto = buf[0] == WIRE_MAGIC ? PROTO_WIRE : PROTO_JSON;
+        Serial.print("[TCP] Camera ");
+        Serial.print(device.ip);
+        Serial.println(conn.proto == PROTO_WIRE ? " speaks the wire protocol" : " speaks JSON");
+      }
+      if (conn.proto == PROTO_WIRE) {
+        conn.wire.feed(buf, n, [&](const wire_header_t& header, const uint8_t* payload) {
+          onWireFrame(conn, header, payload);
+        });
+      } else {
+        onJsonBytes(conn, buf, n);
+      }
+    }
 
-  String receivedData = "";
+    if (!conn.client.connected()) {
+      closeConnection(c);
+    } else if (conn.proto == PROTO_WIRE && millis() - device.lastSeen > WIRE_IDLE_TIMEOUT_MS) {
+      Serial.print("[TCP] ✗ No heartbeat from ");
+      Serial.println(device.ip);
+      closeConnection(c);
+    }
+  }
+}
 
-  while (client.connected()) {
-    if (client.available()) {
-      String response = client.readStringUntil('\r');
-      Serial.println("RECEIVED STRING: " + response); 
-      processDetectionData(response);  // this function uploads data to ThingSpeak 
+// Fans the PIR trigger out to every subscribed camera which is connected
+void triggerCameras() {
+  int sent = 0;
+  for (int c = 0; c < MAX_CAMERAS; c++) {
+    Connection& conn = connections[c];
+    if (conn.active && devices[conn.device].pirSubscribed) {
+      sendTrigger(conn);
+      sent++;
     }
+  }
+  Serial.printf("[PIR] ✓ Trigger sent to %d camera(s)\n", sent);
+}
 
-    // Check for PIR motion while connected
-    if (pirMotionDetected && pirEnabled) {
-      pirMotionDetected = false;
-      
-      Serial.println("\n[PIR] ╔════════════════════════════════════╗");
-      Serial.print("[PIR] ║   MOTION DETECTED! (#");
-      Serial.print(pirDetectionCount);
-      Serial.println(")         ║");
-      Serial.println("[PIR] ╚════════════════════════════════════╝");
-      Serial.println("[PIR] Sending trigger to ESP32-S3-EYE...");
-      
-      // Send trigger command to ESP32-S3-EYE
-      client.print("1\r");
-      Serial.println("[PIR] ✓ Trigger sent");
+// Serial monitor commands:
+//   status            list the cameras and their state
+//   trigger           send a PIR trigger now
+//   pir <ip> on|off   select the cameras which get PIR triggers
+void handleSerialCommand() {
+  static char cmd[64];
+  static size_t cmdLen = 0;
+  while (Serial.available() > 0) {
+    char ch = Serial.read();
+    if (ch != '\r' && ch != '\n') {
+      if (cmdLen + 1 < sizeof(cmd)) cmd[cmdLen++] = ch;
+      continue;
+    }
+    if (cmdLen == 0) continue;
+    cmd[cmdLen] = '\0';
+    cmdLen = 0;
+
+    String line(cmd);
+    line.trim();
+    if (line == "status") {
+      for (int i = 0; i < MAX_DEVICES; i++) {
+        Device& d = devices[i];
+        if (!d.used) continue;
+        Serial.printf("%-15s %-7s pir %-3s connects %u events %u duplicates %u triggers %u last id %d (%.1f%%)\n",
+                      d.ip.toString().c_str(), d.connection >= 0 ? "online" : "offline",
+                      d.pirSubscribed ? "on" : "off", d.connects, d.events, d.duplicates, d.triggersSent,
+                      d.lastId, d.lastSimilarity * 100);
+      }
+      Serial.printf("ThingSpeak: %u queued, %lu uploaded, %lu failed requests, %lu dropped\n",
+                    (unsigned)uploadCount, successfulUploads, failedUploads, droppedUploads);
+      Serial.printf("Telegram: %lu alerts sent, %lu given up, %lu dropped\n", alertsSent, alertsFailed, alertsDropped);
+      Serial.printf("Loop: longest pass %lu us\n", loopMaxUs);
+      loopMaxUs = 0;
+    } else if (line == "trigger") {
+      triggerCameras();
+    } else if (line.startsWith("pir ")) {
+      int space = line.indexOf(' ', 4);
+      IPAddress ip;
+      if (space < 0 || !ip.fromString(line.substring(4, space))) {
+        Serial.println("usage: pir <ip> on|off");
+        continue;
+      }
+      int d = findDevice(ip);
+      if (d >= 0) {
+        devices[d].pirSubscribed = line.substring(space + 1) == "on";
+        Serial.printf("[PIR] %s %s\n", ip.toString().c_str(), devices[d].pirSubscribed ? "on" : "off");
+      }
+    } else {
+      Serial.println("commands: status | trigger | pir <ip> on|off");
     }
-    delay(10);
   }
 }
 
@@ -393,12 +964,16 @@ void setup() {
   Serial.println(TCP_PORT);
 
   Serial.println("\n[ThingSpeak] Write Key: " + String(TS_WRITE_KEY));
+  // Wall clock time for the bulk updates
+  configTime(0, 0, "pool.ntp.org", "time.google.com");
+  xTaskCreate(uploadTask, "ts_upload", 8192, nullptr, 1, &uploadTaskHandle);
+  xTaskCreate(alertTask, "tg_alert", 8192, nullptr, 1, &alertTaskHandle);
 
   systemReady = true;
 
   Serial.println("\n╔════════════════════════════════════════╗");
   Serial.println("║  ✓ GATEWAY READY                       ║");
-  Serial.println("║  PIR will trigger ESP32-S3-EYE         ║");
+  Serial.println("║  PIR will trigger the cameras          ║");
   Serial.println("╚════════════════════════════════════════╝\n");
 }
 
@@ -407,12 +982,25 @@ void setup() {
 // ============================================================================
 
 void loop() {
-  // Handle TCP connections
-  WiFiClient client = tcpServer.available();
-  if (client) {   // if connected, call handleTCPClient to receive data 
-    handleTCPClient(client);
+  unsigned long passStart = micros();
+  // Serve every camera, each pass only handles what has already arrived
+  acceptCameras();
+  pollCameras();
+
+  // Fan PIR motion out to the cameras
+  if (pirMotionDetected && pirEnabled) {
+    pirMotionDetected = false;
+
+    Serial.println("\n[PIR] ╔════════════════════════════════════╗");
+    Serial.print("[PIR] ║   MOTION DETECTED! (#");
+    Serial.print(pirDetectionCount);
+    Serial.println(")         ║");
+    Serial.println("[PIR] ╚════════════════════════════════════╝");
+    triggerCameras();
   }
 
+  handleSerialCommand();
+
   // WiFi health check
   static unsigned long lastWiFiCheck = 0;
   if (millis() - lastWiFiCheck > 30000) {
@@ -422,5 +1010,6 @@ void loop() {
       WiFi.reconnect();
     }
   }
-  delay(10);
+  loopMaxUs = max(loopMaxUs, micros() - passStart);
+  delay(1);  // let the WiFi stack run, nothing in the loop waits on a camera
 }
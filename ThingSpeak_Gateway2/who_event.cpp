@@ -0,0 +1 @@
+../components/who_gateway/who_event.cpp
\ No newline at end of file
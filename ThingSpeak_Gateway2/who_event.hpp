@@ -0,0 +1 @@
+../components/who_gateway/who_event.hpp
\ No newline at end of file
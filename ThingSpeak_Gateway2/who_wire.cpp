@@ -0,0 +1 @@
+../components/who_gateway/who_wire.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../components/who_gateway/who_wire.hpp
\ No newline at end of file
@@ -8,6 +8,7 @@ namespace app {
 class WhoRecognitionAppBase : public WhoApp {
 public:
     WhoRecognitionAppBase(frame_cap::WhoFrameCap *frame_cap);
+    recognition::WhoRecognition *get_recognition() { return m_recognition; }
 
 protected:
     frame_cap::WhoFrameCap *m_frame_cap;
@@ -13,6 +13,11 @@ WhoRecognitionAppLCD::WhoRecognitionAppLCD(frame_cap::WhoFrameCap *frame_cap) :
     WhoApp::add_task(m_lcd_disp);
     m_lcd_disp->set_lcd_disp_cb(std::bind(&WhoRecognitionAppLCD::lcd_disp_cb, this, std::placeholders::_1));
 
+#if CONFIG_DB_MMAP_PARTITION
+    m_recognition->set_recognizer(new recognition::WhoFaceDBRecognizer(
+        CONFIG_DB_MMAP_PARTITION_LABEL,
+        new HumanFaceFeat(static_cast<HumanFaceFeat::model_type_t>(CONFIG_DEFAULT_HUMAN_FACE_FEAT_MODEL), false)));
+#else
     char db_path[64];
 #if CONFIG_DB_FATFS_FLASH
     snprintf(db_path, sizeof(db_path), "%s/face.db", CONFIG_SPIFLASH_MOUNT_POINT);
@@ -23,6 +28,7 @@ WhoRecognitionAppLCD::WhoRecognitionAppLCD(frame_cap::WhoFrameCap *frame_cap) :
 #endif
     m_recognition->set_recognizer(new HumanFaceRecognizer(
         db_path, static_cast<HumanFaceFeat::model_type_t>(CONFIG_DEFAULT_HUMAN_FACE_FEAT_MODEL), false));
+#endif
     m_recognition->set_detect_model(
         new HumanFaceDetect(static_cast<HumanFaceDetect::model_type_t>(CONFIG_DEFAULT_HUMAN_FACE_DETECT_MODEL), false));
 
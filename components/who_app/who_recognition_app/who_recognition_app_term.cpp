@@ -9,6 +9,10 @@ WhoRecognitionAppTerm::WhoRecognitionAppTerm(frame_cap::WhoFrameCap *frame_cap)
     auto recognition_task = m_recognition->get_recognition_task();
     recognition_task->set_recognition_result_cb(
         std::bind(&WhoRecognitionAppTerm::recognition_result_cb, this, std::placeholders::_1));
+#if CONFIG_DB_MMAP_PARTITION
+    m_recognition->set_recognizer(
+        new recognition::WhoFaceDBRecognizer(CONFIG_DB_MMAP_PARTITION_LABEL, new HumanFaceFeat()));
+#else
     char db_path[64];
 #if CONFIG_DB_FATFS_FLASH
     snprintf(db_path, sizeof(db_path), "%s/face.db", CONFIG_SPIFLASH_MOUNT_POINT);
@@ -18,6 +22,7 @@ WhoRecognitionAppTerm::WhoRecognitionAppTerm(frame_cap::WhoFrameCap *frame_cap)
     snprintf(db_path, sizeof(db_path), "%s/face.db", CONFIG_BSP_SD_MOUNT_POINT);
 #endif
     m_recognition->set_recognizer(new HumanFaceRecognizer(db_path));
+#endif
     m_recognition->set_detect_model(new HumanFaceDetect());
     m_recognition_button =
         button::get_recognition_button(button::recognition_button_type_t::PHYSICAL, recognition_task);
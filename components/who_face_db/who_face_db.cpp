@@ -0,0 +1,423 @@
+#include "who_face_db.hpp"
+#include "esp_log.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#if defined(ESP_PLATFORM)
+#include "esp_check.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char *TAG = "WhoFaceDB";
+
+namespace who {
+namespace face_db {
+static inline uint32_t align_up(uint32_t x, uint32_t align)
+{
+    return (x + align - 1) / align * align;
+}
+
+uint32_t crc32(uint32_t crc, const void *data, size_t len)
+{
+    // Nibble table, small enough to keep in flash without hurting the cache.
+    static const uint32_t table[16] = {0x00000000,
+                                       0x1db71064,
+                                       0x3b6e20c8,
+                                       0x26d930ac,
+                                       0x76dc4190,
+                                       0x6b6b51f4,
+                                       0x4db26158,
+                                       0x5005713c,
+                                       0xedb88320,
+                                       0xf00f9344,
+                                       0xd6d6a3e8,
+                                       0xcb61b38c,
+                                       0x9b64c2b0,
+                                       0x86d3d2d4,
+                                       0xa00ae278,
+                                       0xbdbdf21c};
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= p[i];
+        crc = (crc >> 4) ^ table[crc & 0xf];
+        crc = (crc >> 4) ^ table[crc & 0xf];
+    }
+    return ~crc;
+}
+
+size_t get_image_size(uint32_t num_feats, uint32_t feat_len)
+{
+    uint32_t ids_offset = sizeof(face_db_header_t);
+    uint32_t feats_offset = align_up(ids_offset + num_feats * sizeof(uint16_t), FACE_DB_ALIGN);
+    return feats_offset + (size_t)num_feats * align_up(feat_len * sizeof(float), 16);
+}
+
+esp_err_t build_image(const uint16_t *ids,
+                      const float *feats,
+                      uint32_t num_feats,
+                      uint32_t feat_len,
+                      uint32_t generation,
+                      uint32_t last_seq,
+                      std::vector<uint8_t> &image)
+{
+    if (feat_len == 0 || (num_feats && (!ids || !feats))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    face_db_header_t header = {};
+    header.magic = FACE_DB_MAGIC;
+    header.version = FACE_DB_VERSION;
+    header.header_size = sizeof(face_db_header_t);
+    header.flags = FACE_DB_FLAG_NORMALIZED;
+    header.feat_len = feat_len;
+    header.feat_stride = align_up(feat_len * sizeof(float), 16);
+    header.num_feats = num_feats;
+    header.ids_offset = sizeof(face_db_header_t);
+    header.feats_offset = align_up(header.ids_offset + num_feats * sizeof(uint16_t), FACE_DB_ALIGN);
+    header.image_size = get_image_size(num_feats, feat_len);
+    header.generation = generation;
+    header.last_seq = last_seq;
+
+    image.assign(header.image_size, 0);
+    memcpy(image.data() + header.ids_offset, ids, num_feats * sizeof(uint16_t));
+    for (uint32_t i = 0; i < num_feats; i++) {
+        const float *src = feats + (size_t)i * feat_len;
+        float *dst = reinterpret_cast<float *>(image.data() + header.feats_offset + (size_t)i * header.feat_stride);
+        float norm = 0;
+        for (uint32_t j = 0; j < feat_len; j++) {
+            norm += src[j] * src[j];
+        }
+        float inv_norm = norm > 0 ? 1.f / sqrtf(norm) : 0;
+        for (uint32_t j = 0; j < feat_len; j++) {
+            dst[j] = src[j] * inv_norm;
+        }
+    }
+    header.body_crc32 = crc32(0, image.data() + header.header_size, header.image_size - header.header_size);
+    header.header_crc32 = crc32(0, &header, sizeof(header));
+    memcpy(image.data(), &header, sizeof(header));
+    return ESP_OK;
+}
+
+esp_err_t import_legacy_db(const char *legacy_path, std::vector<uint8_t> &image)
+{
+    // Layout of dl::recognition::DataBase: {num_feats_total, num_feats_valid, feat_len} as uint16_t, followed by
+    // num_feats_total records of {uint16_t id, float feat[feat_len]}. Deleted records have id 0.
+    FILE *f = fopen(legacy_path, "rb");
+    if (!f) {
+        ESP_LOGE(TAG, "Failed to open %s.", legacy_path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    uint16_t meta[3];
+    if (fread(meta, sizeof(meta), 1, f) != 1 || meta[2] == 0) {
+        ESP_LOGE(TAG, "Invalid legacy database %s.", legacy_path);
+        fclose(f);
+        return ESP_ERR_INVALID_STATE;
+    }
+    uint16_t num_feats_total = meta[0];
+    uint16_t feat_len = meta[2];
+    std::vector<uint16_t> ids;
+    std::vector<float> feats;
+    ids.reserve(meta[1]);
+    feats.reserve((size_t)meta[1] * feat_len);
+    std::vector<float> feat(feat_len);
+    for (int i = 0; i < num_feats_total; i++) {
+        uint16_t id;
+        if (fread(&id, sizeof(id), 1, f) != 1 || fread(feat.data(), sizeof(float), feat_len, f) != feat_len) {
+            ESP_LOGE(TAG, "Legacy database %s is truncated at record %d.", legacy_path, i);
+            fclose(f);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        if (id == 0) {
+            continue;
+        }
+        ids.push_back(id);
+        feats.insert(feats.end(), feat.begin(), feat.end());
+    }
+    fclose(f);
+    return build_image(ids.data(), feats.data(), ids.size(), feat_len, 0, 0, image);
+}
+
+WhoFaceDB::WhoFaceDB() :
+    m_header(nullptr),
+    m_ids(nullptr),
+    m_feats(nullptr),
+#if defined(ESP_PLATFORM)
+    m_mmap_handle(0),
+    m_mmapped(false)
+#else
+    m_mmap_addr(nullptr),
+    m_mmap_size(0)
+#endif
+{
+}
+
+WhoFaceDB::~WhoFaceDB()
+{
+    close();
+}
+
+esp_err_t WhoFaceDB::validate(const void *data, size_t size, bool verify_body)
+{
+    if (!data || size < sizeof(face_db_header_t)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    face_db_header_t header;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != FACE_DB_MAGIC) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    uint32_t header_crc32 = header.header_crc32;
+    header.header_crc32 = 0;
+    if (crc32(0, &header, sizeof(header)) != header_crc32) {
+        ESP_LOGE(TAG, "Header crc mismatch.");
+        return ESP_ERR_INVALID_CRC;
+    }
+    if (header.version != FACE_DB_VERSION) {
+        ESP_LOGE(TAG, "Unsupported version %d.", header.version);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (header.image_size > size || header.feat_stride < header.feat_len * sizeof(float) ||
+        header.feats_offset % FACE_DB_ALIGN ||
+        header.feats_offset + (size_t)header.num_feats * header.feat_stride > header.image_size ||
+        header.ids_offset + header.num_feats * sizeof(uint16_t) > header.feats_offset) {
+        ESP_LOGE(TAG, "Corrupted header.");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    const uint8_t *base = static_cast<const uint8_t *>(data);
+    if (verify_body &&
+        crc32(0, base + header.header_size, header.image_size - header.header_size) != header.body_crc32) {
+        ESP_LOGE(TAG, "Body crc mismatch.");
+        return ESP_ERR_INVALID_CRC;
+    }
+    m_header = static_cast<const face_db_header_t *>(data);
+    m_ids = reinterpret_cast<const uint16_t *>(base + header.ids_offset);
+    m_feats = base + header.feats_offset;
+    return ESP_OK;
+}
+
+esp_err_t WhoFaceDB::open_mem(const void *data, size_t size, bool verify_body)
+{
+    close();
+    return validate(data, size, verify_body);
+}
+
+#if defined(ESP_PLATFORM)
+esp_err_t WhoFaceDB::open_partition(const char *label, bool verify_body)
+{
+    const esp_partition_t *partition =
+        esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (!partition) {
+        ESP_LOGE(TAG, "Partition %s not found.", label);
+        return ESP_ERR_NOT_FOUND;
+    }
+    return open_partition(partition, 0, partition->size, verify_body);
+}
+
+esp_err_t WhoFaceDB::open_partition(const esp_partition_t *partition, size_t offset, size_t size, bool verify_body)
+{
+    close();
+    const void *ptr;
+    esp_err_t ret = esp_partition_mmap(partition, offset, size, ESP_PARTITION_MMAP_DATA, &ptr, &m_mmap_handle);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to mmap partition %s: %s.", partition->label, esp_err_to_name(ret));
+        return ret;
+    }
+    m_mmapped = true;
+    ret = validate(ptr, size, verify_body);
+    if (ret != ESP_OK) {
+        close();
+    }
+    return ret;
+}
+#else
+esp_err_t WhoFaceDB::open_file(const char *path, bool verify_body)
+{
+    struct stat st;
+    if (stat(path, &st) != 0 || st.st_size == 0) {
+        ESP_LOGE(TAG, "Failed to open %s.", path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    return open_file(path, 0, st.st_size, verify_body);
+}
+
+esp_err_t WhoFaceDB::open_file(const char *path, size_t offset, size_t size, bool verify_body)
+{
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "Failed to open %s.", path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, offset);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        ESP_LOGE(TAG, "Failed to mmap %s.", path);
+        return ESP_FAIL;
+    }
+    m_mmap_addr = addr;
+    m_mmap_size = size;
+    esp_err_t ret = validate(addr, size, verify_body);
+    if (ret != ESP_OK) {
+        close();
+    }
+    return ret;
+}
+#endif
+
+void WhoFaceDB::close()
+{
+#if defined(ESP_PLATFORM)
+    if (m_mmapped) {
+        esp_partition_munmap(m_mmap_handle);
+        m_mmapped = false;
+    }
+#else
+    if (m_mmap_addr) {
+        munmap(m_mmap_addr, m_mmap_size);
+        m_mmap_addr = nullptr;
+        m_mmap_size = 0;
+    }
+#endif
+    m_header = nullptr;
+    m_ids = nullptr;
+    m_feats = nullptr;
+}
+
+void insert_match(std::vector<match_t> &matches, uint16_t id, float similarity, float thr, int top_k)
+{
+    if (similarity < thr || ((int)matches.size() == top_k && similarity <= matches.back().similarity)) {
+        return;
+    }
+    auto it = std::upper_bound(
+        matches.begin(), matches.end(), similarity, [](float s, const match_t &m) { return s > m.similarity; });
+    matches.insert(it, {id, similarity});
+    if ((int)matches.size() > top_k) {
+        matches.pop_back();
+    }
+}
+
+bool normalize_queries(const float *feats, uint32_t num_feats, uint32_t feat_len, std::vector<float> &normalized)
+{
+    normalized.resize((size_t)num_feats * feat_len);
+    bool any = false;
+    for (uint32_t q = 0; q < num_feats; q++) {
+        const float *src = feats + (size_t)q * feat_len;
+        float *dst = normalized.data() + (size_t)q * feat_len;
+        float norm = 0;
+        for (uint32_t j = 0; j < feat_len; j++) {
+            norm += src[j] * src[j];
+        }
+        // A zero query matches nothing, its similarities stay 0.
+        float inv_norm = norm > 0 ? 1.f / sqrtf(norm) : 0;
+        any |= norm > 0;
+        for (uint32_t j = 0; j < feat_len; j++) {
+            dst[j] = src[j] * inv_norm;
+        }
+    }
+    return any;
+}
+
+void dot_batch(const float *queries, uint32_t num_queries, uint32_t feat_len, const float *gallery_feat, float *sims)
+{
+    // Four queries share every load of the gallery feature.
+    uint32_t q = 0;
+    for (; q + 4 <= num_queries; q += 4) {
+        const float *q0 = queries + (size_t)q * feat_len;
+        const float *q1 = q0 + feat_len, *q2 = q1 + feat_len, *q3 = q2 + feat_len;
+        float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+        for (uint32_t j = 0; j < feat_len; j++) {
+            float g = gallery_feat[j];
+            s0 += q0[j] * g;
+            s1 += q1[j] * g;
+            s2 += q2[j] * g;
+            s3 += q3[j] * g;
+        }
+        sims[q] = s0;
+        sims[q + 1] = s1;
+        sims[q + 2] = s2;
+        sims[q + 3] = s3;
+    }
+    for (; q < num_queries; q++) {
+        const float *query_feat = queries + (size_t)q * feat_len;
+        float sim = 0;
+        for (uint32_t j = 0; j < feat_len; j++) {
+            sim += query_feat[j] * gallery_feat[j];
+        }
+        sims[q] = sim;
+    }
+}
+
+std::vector<match_t> WhoFaceDB::query(const float *feat, float thr, int top_k) const
+{
+    return query_batch(feat, 1, thr, top_k)[0];
+}
+
+std::vector<std::vector<match_t>> WhoFaceDB::query_batch(const float *feats,
+                                                          uint32_t num_feats,
+                                                          float thr,
+                                                          int top_k) const
+{
+    std::vector<std::vector<match_t>> matches(num_feats);
+    std::vector<float> queries;
+    if (!m_header || top_k <= 0 || !normalize_queries(feats, num_feats, m_header->feat_len, queries)) {
+        return matches;
+    }
+    uint32_t feat_len = m_header->feat_len;
+    // Gallery outer, queries inner: every gallery row is read from flash once and reused from the cache for all the
+    // queries, which is what makes a batch cheaper than num_feats separate queries.
+    std::vector<float> sims(num_feats);
+    for (uint32_t i = 0; i < m_header->num_feats; i++) {
+        dot_batch(queries.data(), num_feats, feat_len, get_feat(i), sims.data());
+        for (uint32_t q = 0; q < num_feats; q++) {
+            insert_match(matches[q], m_ids[i], sims[q], thr, top_k);
+        }
+    }
+    return matches;
+}
+
+#if defined(ESP_PLATFORM)
+esp_err_t write_image_to_partition(const char *label, const std::vector<uint8_t> &image)
+{
+    const esp_partition_t *partition =
+        esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (!partition) {
+        ESP_LOGE(TAG, "Partition %s not found.", label);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (image.size() > partition->size) {
+        ESP_LOGE(TAG, "Image size %u exceeds partition size %u.", (unsigned)image.size(), (unsigned)partition->size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    size_t erase_size = align_up(image.size(), partition->erase_size);
+    ESP_RETURN_ON_ERROR(esp_partition_erase_range(partition, 0, erase_size), TAG, "Failed to erase partition.");
+    // Write the header last, an interrupted write leaves an image which fails validation.
+    ESP_RETURN_ON_ERROR(esp_partition_write(partition,
+                                            sizeof(face_db_header_t),
+                                            image.data() + sizeof(face_db_header_t),
+                                            image.size() - sizeof(face_db_header_t)),
+                        TAG,
+                        "Failed to write body.");
+    ESP_RETURN_ON_ERROR(
+        esp_partition_write(partition, 0, image.data(), sizeof(face_db_header_t)), TAG, "Failed to write header.");
+    return ESP_OK;
+}
+#endif
+
+esp_err_t write_image_to_file(const char *path, const std::vector<uint8_t> &image)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        ESP_LOGE(TAG, "Failed to open %s.", path);
+        return ESP_FAIL;
+    }
+    size_t written = fwrite(image.data(), 1, image.size(), f);
+    fclose(f);
+    return written == image.size() ? ESP_OK : ESP_FAIL;
+}
+} // namespace face_db
+} // namespace who
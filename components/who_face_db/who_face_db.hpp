@@ -0,0 +1,161 @@
+#pragma once
+#include "esp_err.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#if defined(ESP_PLATFORM)
+#include "esp_partition.h"
+#endif
+
+namespace who {
+namespace face_db {
+// Read-only face gallery image.
+//
+// The image is designed to be used in place through a memory map, either from a raw flash partition
+// (esp_partition_mmap) or from a regular file on a Linux host (mmap). All fields are little-endian, which matches
+// both the ESP32 family and x86/arm hosts.
+//
+//  offset 0             face_db_header_t (64 bytes)
+//  header.ids_offset    uint16_t ids[num_feats]
+//  header.feats_offset  float feats[num_feats][feat_stride / 4], L2 normalized, aligned to FACE_DB_ALIGN
+inline constexpr uint32_t FACE_DB_MAGIC = 0x42444657; // "WFDB"
+inline constexpr uint16_t FACE_DB_VERSION = 1;
+inline constexpr uint32_t FACE_DB_ALIGN = 64;
+inline constexpr uint32_t FACE_DB_FLAG_NORMALIZED = 1 << 0;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t image_size;   // header + ids + feats, in bytes.
+    uint32_t flags;
+    uint32_t feat_len;     // number of floats in a feature.
+    uint32_t feat_stride;  // bytes between two features, multiple of 16.
+    uint32_t num_feats;
+    uint32_t ids_offset;
+    uint32_t feats_offset;
+    uint32_t generation;   // bumped every time the image is rewritten.
+    uint32_t last_seq;     // last update sequence number folded into this image.
+    uint32_t body_crc32;   // crc32 of [header_size, image_size).
+    uint8_t reserved[12];
+    uint32_t header_crc32; // crc32 of the header with this field set to 0.
+} face_db_header_t;
+static_assert(sizeof(face_db_header_t) == FACE_DB_ALIGN, "face_db_header_t must be 64 bytes.");
+
+typedef struct {
+    uint16_t id;
+    float similarity;
+} match_t;
+
+uint32_t crc32(uint32_t crc, const void *data, size_t len);
+size_t get_image_size(uint32_t num_feats, uint32_t feat_len);
+/**
+ * @brief Insert a match into a list sorted by similarity, keeping at most top_k matches above thr.
+ */
+void insert_match(std::vector<match_t> &matches, uint16_t id, float similarity, float thr, int top_k);
+/**
+ * @brief Dot products of num_queries features, stored back to back, with one gallery feature.
+ */
+void dot_batch(const float *queries, uint32_t num_queries, uint32_t feat_len, const float *gallery_feat, float *sims);
+/**
+ * @brief L2 normalize num_feats queries of feat_len floats. Returns false if all of them are zero.
+ */
+bool normalize_queries(const float *feats, uint32_t num_feats, uint32_t feat_len, std::vector<float> &normalized);
+
+/**
+ * @brief Build a gallery image in memory.
+ *
+ * @param ids        ids of the features, 0 is reserved as invalid.
+ * @param feats      num_feats * feat_len floats. They are normalized while being copied.
+ * @param num_feats  number of features.
+ * @param feat_len   number of floats in a feature.
+ * @param generation generation stored in the header.
+ * @param last_seq   last update sequence number stored in the header.
+ * @param image      output image.
+ */
+esp_err_t build_image(const uint16_t *ids,
+                      const float *feats,
+                      uint32_t num_feats,
+                      uint32_t feat_len,
+                      uint32_t generation,
+                      uint32_t last_seq,
+                      std::vector<uint8_t> &image);
+
+/**
+ * @brief Convert a face.db written by dl::recognition::DataBase into a gallery image. Deleted entries are dropped.
+ */
+esp_err_t import_legacy_db(const char *legacy_path, std::vector<uint8_t> &image);
+
+class WhoFaceDB {
+public:
+    WhoFaceDB();
+    ~WhoFaceDB();
+    WhoFaceDB(const WhoFaceDB &) = delete;
+    WhoFaceDB &operator=(const WhoFaceDB &) = delete;
+
+    /**
+     * @brief Use an image which is already in memory. The memory must outlive this object.
+     */
+    esp_err_t open_mem(const void *data, size_t size, bool verify_body = false);
+#if defined(ESP_PLATFORM)
+    /**
+     * @brief Map the image stored at the beginning of a data partition.
+     */
+    esp_err_t open_partition(const char *label, bool verify_body = false);
+    esp_err_t open_partition(const esp_partition_t *partition, size_t offset, size_t size, bool verify_body = false);
+#else
+    /**
+     * @brief Map the image stored in a file, optionally at a page aligned offset.
+     */
+    esp_err_t open_file(const char *path, bool verify_body = false);
+    esp_err_t open_file(const char *path, size_t offset, size_t size, bool verify_body = false);
+#endif
+    void close();
+    bool is_open() const { return m_header != nullptr; }
+
+    const face_db_header_t *get_header() const { return m_header; }
+    uint32_t get_num_feats() const { return m_header ? m_header->num_feats : 0; }
+    uint32_t get_feat_len() const { return m_header ? m_header->feat_len : 0; }
+    uint16_t get_id(uint32_t i) const { return m_ids[i]; }
+    const float *get_feat(uint32_t i) const
+    {
+        return reinterpret_cast<const float *>(m_feats + (size_t)i * m_header->feat_stride);
+    }
+
+    /**
+     * @brief Cosine similarity search over the gallery.
+     *
+     * @param feat   feature to query, feat_len floats, need not be normalized.
+     * @param thr    matches below thr are dropped.
+     * @param top_k  max number of matches returned, sorted by similarity.
+     */
+    std::vector<match_t> query(const float *feat, float thr, int top_k) const;
+    /**
+     * @brief Match num_feats features, stored back to back, in a single pass over the gallery.
+     */
+    std::vector<std::vector<match_t>> query_batch(const float *feats, uint32_t num_feats, float thr, int top_k) const;
+
+private:
+    esp_err_t validate(const void *data, size_t size, bool verify_body);
+
+    const face_db_header_t *m_header;
+    const uint16_t *m_ids;
+    const uint8_t *m_feats;
+#if defined(ESP_PLATFORM)
+    esp_partition_mmap_handle_t m_mmap_handle;
+    bool m_mmapped;
+#else
+    void *m_mmap_addr;
+    size_t m_mmap_size;
+#endif
+};
+
+#if defined(ESP_PLATFORM)
+/**
+ * @brief Erase the partition and write an image at its beginning.
+ */
+esp_err_t write_image_to_partition(const char *label, const std::vector<uint8_t> &image);
+#endif
+esp_err_t write_image_to_file(const char *path, const std::vector<uint8_t> &image);
+} // namespace face_db
+} // namespace who
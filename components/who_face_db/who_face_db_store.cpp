@@ -0,0 +1,578 @@
+#include "who_face_db_store.hpp"
+#include "esp_check.h"
+#include "esp_log.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#if !defined(ESP_PLATFORM)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char *TAG = "WhoFaceDBStore";
+
+namespace who {
+namespace face_db {
+static inline size_t align_up(size_t x, size_t align)
+{
+    return (x + align - 1) / align * align;
+}
+
+static inline size_t get_record_size(uint32_t feat_len)
+{
+    return align_up(sizeof(journal_record_t) + feat_len * sizeof(float), 16);
+}
+
+static void normalize(const float *src, float *dst, uint32_t len)
+{
+    float norm = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        norm += src[i] * src[i];
+    }
+    float inv_norm = norm > 0 ? 1.f / sqrtf(norm) : 0;
+    for (uint32_t i = 0; i < len; i++) {
+        dst[i] = src[i] * inv_norm;
+    }
+}
+
+#if defined(ESP_PLATFORM)
+WhoFaceDBStore::WhoFaceDBStore(const char *partition_label, size_t journal_size) :
+    m_active(-1),
+    m_region_size(0),
+    m_erase_size(0),
+    m_slot_size(0),
+    m_journal_offset(0),
+    m_journal_size(journal_size),
+    m_journal_pos(0),
+    m_next_seq(1),
+    m_feat_len(0),
+    m_compact_threshold(0.75f),
+    m_partition(esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, partition_label)),
+    m_compact_task(nullptr)
+{
+    if (!m_partition) {
+        ESP_LOGE(TAG, "Partition %s not found.", partition_label);
+        return;
+    }
+    m_region_size = m_partition->size;
+    m_erase_size = m_partition->erase_size;
+}
+#else
+WhoFaceDBStore::WhoFaceDBStore(const char *path, size_t region_size, size_t journal_size) :
+    m_active(-1),
+    m_region_size(region_size),
+    m_erase_size(4096),
+    m_slot_size(0),
+    m_journal_offset(0),
+    m_journal_size(journal_size),
+    m_journal_pos(0),
+    m_next_seq(1),
+    m_feat_len(0),
+    m_compact_threshold(0.75f),
+    m_path(path),
+    m_fd(-1)
+{
+    m_fd = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (m_fd < 0) {
+        ESP_LOGE(TAG, "Failed to open %s.", path);
+        return;
+    }
+    struct stat st;
+    if (fstat(m_fd, &st) == 0 && (size_t)st.st_size < region_size) {
+        // A new file looks like freshly erased flash.
+        region_erase(st.st_size, region_size - st.st_size);
+    }
+}
+#endif
+
+WhoFaceDBStore::~WhoFaceDBStore()
+{
+    std::lock_guard<std::mutex> write_lock(m_write_mutex);
+#if defined(ESP_PLATFORM)
+    if (m_compact_task) {
+        vTaskDelete(m_compact_task);
+    }
+#else
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+#endif
+}
+
+esp_err_t WhoFaceDBStore::region_read(size_t offset, void *buf, size_t len)
+{
+#if defined(ESP_PLATFORM)
+    return esp_partition_read(m_partition, offset, buf, len);
+#else
+    return pread(m_fd, buf, len, offset) == (ssize_t)len ? ESP_OK : ESP_FAIL;
+#endif
+}
+
+esp_err_t WhoFaceDBStore::region_write(size_t offset, const void *buf, size_t len)
+{
+#if defined(ESP_PLATFORM)
+    return esp_partition_write(m_partition, offset, buf, len);
+#else
+    return pwrite(m_fd, buf, len, offset) == (ssize_t)len ? ESP_OK : ESP_FAIL;
+#endif
+}
+
+esp_err_t WhoFaceDBStore::region_erase(size_t offset, size_t len)
+{
+#if defined(ESP_PLATFORM)
+    return esp_partition_erase_range(m_partition, offset, len);
+#else
+    std::vector<uint8_t> ff(std::min(len, (size_t)65536), 0xff);
+    for (size_t done = 0; done < len;) {
+        size_t n = std::min(len - done, ff.size());
+        if (pwrite(m_fd, ff.data(), n, offset + done) != (ssize_t)n) {
+            return ESP_FAIL;
+        }
+        done += n;
+    }
+    return ESP_OK;
+#endif
+}
+
+esp_err_t WhoFaceDBStore::map_slot(int slot, WhoFaceDB &db)
+{
+#if defined(ESP_PLATFORM)
+    return db.open_partition(m_partition, slot * m_slot_size, m_slot_size);
+#else
+    return db.open_file(m_path.c_str(), slot * m_slot_size, m_slot_size);
+#endif
+}
+
+esp_err_t WhoFaceDBStore::open()
+{
+#if defined(ESP_PLATFORM)
+    if (!m_partition) {
+        return ESP_ERR_NOT_FOUND;
+    }
+#else
+    if (m_fd < 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+#endif
+    std::lock_guard<std::mutex> write_lock(m_write_mutex);
+    if (!m_journal_size) {
+        m_journal_size = m_region_size / 4;
+    }
+    m_journal_size = align_up(m_journal_size, m_erase_size);
+    m_slot_size = (m_region_size - m_journal_size) / 2 / m_erase_size * m_erase_size;
+    m_journal_offset = 2 * m_slot_size;
+    if (m_slot_size < m_erase_size || m_journal_offset + m_journal_size > m_region_size) {
+        ESP_LOGE(TAG, "Region of %u bytes is too small.", (unsigned)m_region_size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // The newest valid image wins, an image whose header was never written is ignored.
+    m_active = -1;
+    for (int slot = 0; slot < 2; slot++) {
+        if (map_slot(slot, m_dbs[slot]) != ESP_OK) {
+            continue;
+        }
+        if (m_active < 0 ||
+            (int32_t)(m_dbs[slot].get_header()->generation - m_dbs[m_active].get_header()->generation) > 0) {
+            m_active = slot;
+        }
+    }
+    if (m_active >= 0) {
+        m_next_seq = m_dbs[m_active].get_header()->last_seq + 1;
+        // An empty image is written with a placeholder feature length, the first enroll sets the real one.
+        m_feat_len = m_dbs[m_active].get_num_feats() ? m_dbs[m_active].get_feat_len() : 0;
+    }
+    rebuild_index();
+
+    bool needs_compact = false;
+    esp_err_t ret = replay_journal(needs_compact);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    ESP_LOGI(TAG,
+             "Opened slot %d, %d faces, journal %u/%u bytes.",
+             m_active,
+             (int)(m_image_index.size() + m_overlay.size()),
+             (unsigned)m_journal_pos,
+             (unsigned)m_journal_size);
+    if (needs_compact) {
+        ESP_LOGW(TAG, "Journal is stale, has a torn tail or was not fully erased, compacting.");
+        ret = compact_locked();
+    }
+#if defined(ESP_PLATFORM)
+    if (ret == ESP_OK && !m_compact_task) {
+        xTaskCreatePinnedToCore(compact_task, "FaceDBCompact", 4096, this, 1, &m_compact_task, tskNO_AFFINITY);
+    }
+#endif
+    return ret;
+}
+
+void WhoFaceDBStore::rebuild_index()
+{
+    m_image_index.clear();
+    m_row_live.clear();
+    if (m_active < 0) {
+        return;
+    }
+    const WhoFaceDB &db = m_dbs[m_active];
+    m_row_live.assign(db.get_num_feats(), 1);
+    for (uint32_t i = 0; i < db.get_num_feats(); i++) {
+        m_image_index[db.get_id(i)] = i;
+    }
+}
+
+esp_err_t WhoFaceDBStore::replay_journal(bool &needs_compact)
+{
+    uint32_t last_seq = m_next_seq - 1;
+    std::vector<float> feat;
+    m_journal_pos = 0;
+    while (m_journal_pos + sizeof(journal_record_t) <= m_journal_size) {
+        journal_record_t record;
+        ESP_RETURN_ON_ERROR(
+            region_read(m_journal_offset + m_journal_pos, &record, sizeof(record)), TAG, "Failed to read journal.");
+        if (record.magic == 0xffff) {
+            // Erased flash, end of the journal.
+            break;
+        }
+        size_t record_size = get_record_size(record.feat_len);
+        if (record.magic != JOURNAL_MAGIC || m_journal_pos + record_size > m_journal_size) {
+            needs_compact = true;
+            break;
+        }
+        feat.resize(record.feat_len);
+        if (record.feat_len) {
+            ESP_RETURN_ON_ERROR(region_read(m_journal_offset + m_journal_pos + sizeof(record),
+                                            feat.data(),
+                                            record.feat_len * sizeof(float)),
+                                TAG,
+                                "Failed to read journal.");
+        }
+        uint32_t crc = record.crc32;
+        record.crc32 = 0;
+        if (crc32(crc32(0, &record, sizeof(record)), feat.data(), record.feat_len * sizeof(float)) != crc) {
+            // Torn write, everything before it is still good.
+            needs_compact = true;
+            break;
+        }
+        if ((int32_t)(record.seq - last_seq) <= 0) {
+            // Already folded into the image by a compaction which was interrupted before erasing the journal.
+            needs_compact = true;
+        } else {
+            apply((journal_record_type_t)record.type, record.id, record.seq, feat.data(), record.feat_len);
+            m_next_seq = record.seq + 1;
+        }
+        m_journal_pos += record_size;
+    }
+    if (needs_compact) {
+        return ESP_OK;
+    }
+    // Appends program the journal past the last record without erasing it first, so it has to be blank. A power cut
+    // while the journal was erased can leave old records in its later sectors behind a blank first one.
+    uint8_t buf[256];
+    for (size_t pos = m_journal_pos; pos < m_journal_size; pos += sizeof(buf)) {
+        size_t len = std::min(sizeof(buf), m_journal_size - pos);
+        ESP_RETURN_ON_ERROR(region_read(m_journal_offset + pos, buf, len), TAG, "Failed to read journal.");
+        if (std::any_of(buf, buf + len, [](uint8_t b) { return b != 0xff; })) {
+            needs_compact = true;
+            break;
+        }
+    }
+    return ESP_OK;
+}
+
+void WhoFaceDBStore::apply(journal_record_type_t type, uint16_t id, uint32_t seq, const float *feat, uint32_t feat_len)
+{
+    std::lock_guard<std::mutex> state_lock(m_state_mutex);
+    auto it = m_image_index.find(id);
+    if (it != m_image_index.end()) {
+        m_row_live[it->second] = 0;
+        m_image_index.erase(it);
+    }
+    if (type == JOURNAL_DELETE) {
+        m_overlay.erase(id);
+        return;
+    }
+    if (!m_feat_len) {
+        m_feat_len = feat_len;
+    }
+    overlay_feat_t &entry = m_overlay[id];
+    entry.seq = seq;
+    entry.feat.assign(feat, feat + feat_len);
+}
+
+esp_err_t WhoFaceDBStore::append(journal_record_type_t type, uint16_t id, const float *feat, uint32_t feat_len)
+{
+    size_t record_size = get_record_size(feat_len);
+    if (record_size > m_journal_size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (m_journal_pos + record_size > m_journal_size) {
+        // The background compaction did not keep up, do it inline.
+        ESP_RETURN_ON_ERROR(compact_locked(), TAG, "Failed to compact full journal.");
+    }
+    std::vector<uint8_t> buf(record_size, 0xff);
+    journal_record_t record = {};
+    record.magic = JOURNAL_MAGIC;
+    record.type = type;
+    record.id = id;
+    record.feat_len = feat_len;
+    record.seq = m_next_seq;
+    float *record_feat = reinterpret_cast<float *>(buf.data() + sizeof(record));
+    if (feat_len) {
+        normalize(feat, record_feat, feat_len);
+    }
+    record.crc32 = crc32(crc32(0, &record, sizeof(record)), record_feat, feat_len * sizeof(float));
+    memcpy(buf.data(), &record, sizeof(record));
+    ESP_RETURN_ON_ERROR(
+        region_write(m_journal_offset + m_journal_pos, buf.data(), buf.size()), TAG, "Failed to append to journal.");
+    m_journal_pos += record_size;
+    m_next_seq++;
+    apply(type, id, record.seq, record_feat, feat_len);
+    return ESP_OK;
+}
+
+esp_err_t WhoFaceDBStore::enroll(const float *feat, uint32_t feat_len, uint16_t *id)
+{
+    esp_err_t ret;
+    {
+        std::lock_guard<std::mutex> write_lock(m_write_mutex);
+        if (m_feat_len && feat_len != m_feat_len) {
+            ESP_LOGE(TAG, "Feature length %d does not match the gallery %d.", (int)feat_len, (int)m_feat_len);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        uint16_t new_id = get_last_id() + 1;
+        // Refuse early rather than fill the journal with faces the next compaction cannot fold.
+        if (new_id == 0 || get_image_size(get_num_feats() + 1, feat_len) > m_slot_size) {
+            ESP_LOGE(TAG, "Gallery is full, %d faces.", (int)get_num_feats());
+            return ESP_ERR_NO_MEM;
+        }
+        ret = append(JOURNAL_ENROLL, new_id, feat, feat_len);
+        if (ret == ESP_OK && id) {
+            *id = new_id;
+        }
+    }
+    notify_compact();
+    return ret;
+}
+
+esp_err_t WhoFaceDBStore::update(uint16_t id, const float *feat, uint32_t feat_len)
+{
+    esp_err_t ret;
+    {
+        std::lock_guard<std::mutex> write_lock(m_write_mutex);
+        if (feat_len != m_feat_len) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        if (!contains(id)) {
+            return ESP_ERR_NOT_FOUND;
+        }
+        ret = append(JOURNAL_UPDATE, id, feat, feat_len);
+    }
+    notify_compact();
+    return ret;
+}
+
+esp_err_t WhoFaceDBStore::remove(uint16_t id)
+{
+    esp_err_t ret;
+    {
+        std::lock_guard<std::mutex> write_lock(m_write_mutex);
+        if (!contains(id)) {
+            return ESP_ERR_NOT_FOUND;
+        }
+        ret = append(JOURNAL_DELETE, id, nullptr, 0);
+    }
+    notify_compact();
+    return ret;
+}
+
+std::vector<match_t> WhoFaceDBStore::query(const float *feat, float thr, int top_k)
+{
+    return query_batch(feat, 1, thr, top_k)[0];
+}
+
+std::vector<std::vector<match_t>> WhoFaceDBStore::query_batch(const float *feats,
+                                                               uint32_t num_feats,
+                                                               float thr,
+                                                               int top_k)
+{
+    std::vector<std::vector<match_t>> matches(num_feats);
+    std::lock_guard<std::mutex> state_lock(m_state_mutex);
+    std::vector<float> queries;
+    if (top_k <= 0 || !m_feat_len || !normalize_queries(feats, num_feats, m_feat_len, queries)) {
+        return matches;
+    }
+    std::vector<float> sims(num_feats);
+    auto consider = [&](uint16_t id, const float *gallery_feat) {
+        dot_batch(queries.data(), num_feats, m_feat_len, gallery_feat, sims.data());
+        for (uint32_t q = 0; q < num_feats; q++) {
+            insert_match(matches[q], id, sims[q], thr, top_k);
+        }
+    };
+    if (m_active >= 0) {
+        const WhoFaceDB &db = m_dbs[m_active];
+        for (uint32_t i = 0; i < db.get_num_feats(); i++) {
+            if (m_row_live[i]) {
+                consider(db.get_id(i), db.get_feat(i));
+            }
+        }
+    }
+    for (const auto &entry : m_overlay) {
+        consider(entry.first, entry.second.feat.data());
+    }
+    return matches;
+}
+
+bool WhoFaceDBStore::contains(uint16_t id)
+{
+    std::lock_guard<std::mutex> state_lock(m_state_mutex);
+    return m_image_index.count(id) || m_overlay.count(id);
+}
+
+uint32_t WhoFaceDBStore::get_num_feats()
+{
+    std::lock_guard<std::mutex> state_lock(m_state_mutex);
+    return m_image_index.size() + m_overlay.size();
+}
+
+uint32_t WhoFaceDBStore::get_feat_len()
+{
+    return m_feat_len;
+}
+
+uint16_t WhoFaceDBStore::get_last_id()
+{
+    std::lock_guard<std::mutex> state_lock(m_state_mutex);
+    uint16_t last_id = 0;
+    for (const auto &entry : m_image_index) {
+        last_id = std::max(last_id, entry.first);
+    }
+    for (const auto &entry : m_overlay) {
+        last_id = std::max(last_id, entry.first);
+    }
+    return last_id;
+}
+
+float WhoFaceDBStore::get_journal_usage()
+{
+    return m_journal_size ? (float)m_journal_pos / m_journal_size : 0;
+}
+
+void WhoFaceDBStore::notify_compact()
+{
+    if (get_journal_usage() < m_compact_threshold) {
+        return;
+    }
+#if defined(ESP_PLATFORM)
+    if (m_compact_task) {
+        xTaskNotifyGive(m_compact_task);
+    }
+#else
+    compact();
+#endif
+}
+
+esp_err_t WhoFaceDBStore::compact()
+{
+    std::lock_guard<std::mutex> write_lock(m_write_mutex);
+    return compact_locked();
+}
+
+esp_err_t WhoFaceDBStore::write_slot(int slot, uint32_t generation)
+{
+    // Mutations are blocked by m_write_mutex, so the state can be read without m_state_mutex. Queries only touch
+    // the active slot, the inactive one can be unmapped and erased.
+    std::vector<std::pair<uint16_t, const float *>> rows;
+    if (m_active >= 0) {
+        const WhoFaceDB &db = m_dbs[m_active];
+        for (uint32_t i = 0; i < db.get_num_feats(); i++) {
+            if (m_row_live[i]) {
+                rows.emplace_back(db.get_id(i), db.get_feat(i));
+            }
+        }
+    }
+    for (const auto &entry : m_overlay) {
+        rows.emplace_back(entry.first, entry.second.feat.data());
+    }
+    std::sort(rows.begin(), rows.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+
+    uint32_t feat_len = m_feat_len ? m_feat_len : 1;
+    face_db_header_t header = {};
+    header.magic = FACE_DB_MAGIC;
+    header.version = FACE_DB_VERSION;
+    header.header_size = sizeof(face_db_header_t);
+    header.flags = FACE_DB_FLAG_NORMALIZED;
+    header.feat_len = feat_len;
+    header.feat_stride = align_up(feat_len * sizeof(float), 16);
+    header.num_feats = rows.size();
+    header.ids_offset = sizeof(face_db_header_t);
+    header.feats_offset = align_up(header.ids_offset + rows.size() * sizeof(uint16_t), FACE_DB_ALIGN);
+    header.image_size = get_image_size(rows.size(), feat_len);
+    header.generation = generation;
+    header.last_seq = m_next_seq - 1;
+    if (header.image_size > m_slot_size) {
+        ESP_LOGE(TAG, "Gallery of %d faces does not fit in a %u bytes slot.", (int)rows.size(), (unsigned)m_slot_size);
+        return ESP_ERR_NO_MEM;
+    }
+
+    size_t base = slot * m_slot_size;
+    m_dbs[slot].close();
+    ESP_RETURN_ON_ERROR(region_erase(base, align_up(header.image_size, m_erase_size)), TAG, "Failed to erase slot.");
+    std::vector<uint8_t> buf(header.feats_offset - header.ids_offset, 0);
+    for (size_t i = 0; i < rows.size(); i++) {
+        memcpy(buf.data() + i * sizeof(uint16_t), &rows[i].first, sizeof(uint16_t));
+    }
+    ESP_RETURN_ON_ERROR(region_write(base + header.ids_offset, buf.data(), buf.size()), TAG, "Failed to write slot.");
+    uint32_t body_crc32 = crc32(0, buf.data(), buf.size());
+    buf.assign(header.feat_stride, 0);
+    for (size_t i = 0; i < rows.size(); i++) {
+        memcpy(buf.data(), rows[i].second, feat_len * sizeof(float));
+        ESP_RETURN_ON_ERROR(region_write(base + header.feats_offset + i * header.feat_stride, buf.data(), buf.size()),
+                            TAG,
+                            "Failed to write slot.");
+        body_crc32 = crc32(body_crc32, buf.data(), buf.size());
+    }
+    header.body_crc32 = body_crc32;
+    header.header_crc32 = crc32(0, &header, sizeof(header));
+    // Commit point.
+    ESP_RETURN_ON_ERROR(region_write(base, &header, sizeof(header)), TAG, "Failed to write slot header.");
+    return map_slot(slot, m_dbs[slot]);
+}
+
+esp_err_t WhoFaceDBStore::compact_locked()
+{
+    int slot = m_active < 0 ? 0 : 1 - m_active;
+    uint32_t generation = m_active < 0 ? 1 : m_dbs[m_active].get_header()->generation + 1;
+    ESP_RETURN_ON_ERROR(write_slot(slot, generation), TAG, "Failed to write slot %d.", slot);
+    {
+        std::lock_guard<std::mutex> state_lock(m_state_mutex);
+        m_active = slot;
+        m_overlay.clear();
+        rebuild_index();
+    }
+    ESP_RETURN_ON_ERROR(region_erase(m_journal_offset, m_journal_size), TAG, "Failed to erase journal.");
+    m_journal_pos = 0;
+    ESP_LOGI(TAG,
+             "Compacted into slot %d, generation %d, %d faces.",
+             slot,
+             (int)generation,
+             (int)m_dbs[slot].get_num_feats());
+    return ESP_OK;
+}
+
+#if defined(ESP_PLATFORM)
+void WhoFaceDBStore::compact_task(void *args)
+{
+    WhoFaceDBStore *self = static_cast<WhoFaceDBStore *>(args);
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        esp_err_t ret = self->compact();
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Compaction failed: %s.", esp_err_to_name(ret));
+        }
+    }
+}
+#endif
+} // namespace face_db
+} // namespace who
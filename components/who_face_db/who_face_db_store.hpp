@@ -0,0 +1,139 @@
+#pragma once
+#include "who_face_db.hpp"
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#if defined(ESP_PLATFORM)
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
+
+namespace who {
+namespace face_db {
+// Log-structured face gallery.
+//
+// The region (a data partition on the device, a plain file on the host) is split into two image slots and a
+// journal:
+//
+//  [ slot 0 | slot 1 | journal ]
+//
+// The active slot holds the newest valid WhoFaceDB image and is read in place. Enroll, update and delete append one
+// record to the journal and update a small in-RAM overlay, so their cost does not depend on the gallery size and the
+// images are never rewritten in place. Compaction folds the image and the overlay into the inactive slot, commits
+// it by writing its header last, and then erases the journal. Records carry a sequence number, on open only the
+// records newer than the active image's last_seq are replayed, which makes every step of the compaction restartable.
+inline constexpr uint16_t JOURNAL_MAGIC = 0xfdb1;
+
+typedef enum : uint8_t {
+    JOURNAL_ENROLL = 1,
+    JOURNAL_UPDATE = 2,
+    JOURNAL_DELETE = 3,
+} journal_record_type_t;
+
+typedef struct {
+    uint16_t magic;
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t id;
+    uint16_t feat_len; // 0 for JOURNAL_DELETE.
+    uint32_t seq;
+    uint32_t crc32;    // crc32 of the record with this field set to 0, including the feature.
+} journal_record_t;
+static_assert(sizeof(journal_record_t) == 16, "journal_record_t must be 16 bytes.");
+
+class WhoFaceDBStore {
+public:
+#if defined(ESP_PLATFORM)
+    /**
+     * @param partition_label data partition holding the slots and the journal.
+     * @param journal_size    bytes reserved for the journal, 0 to use a quarter of the partition.
+     */
+    WhoFaceDBStore(const char *partition_label, size_t journal_size = 0);
+#else
+    /**
+     * @param path         file holding the slots and the journal, created if it does not exist.
+     * @param region_size  size of the file.
+     * @param journal_size bytes reserved for the journal, 0 to use a quarter of the region.
+     */
+    WhoFaceDBStore(const char *path, size_t region_size, size_t journal_size = 0);
+#endif
+    ~WhoFaceDBStore();
+    WhoFaceDBStore(const WhoFaceDBStore &) = delete;
+    WhoFaceDBStore &operator=(const WhoFaceDBStore &) = delete;
+
+    /**
+     * @brief Map the newest valid image and replay the journal. Compacts right away if the journal has a torn tail.
+     */
+    esp_err_t open();
+    esp_err_t enroll(const float *feat, uint32_t feat_len, uint16_t *id);
+    esp_err_t update(uint16_t id, const float *feat, uint32_t feat_len);
+    esp_err_t remove(uint16_t id);
+    std::vector<match_t> query(const float *feat, float thr, int top_k);
+    std::vector<std::vector<match_t>> query_batch(const float *feats, uint32_t num_feats, float thr, int top_k);
+    bool contains(uint16_t id);
+    uint32_t get_num_feats();
+    uint32_t get_feat_len();
+    uint16_t get_last_id();
+    float get_journal_usage();
+
+    /**
+     * @brief Fold the journal into a new image. Mutations wait while it runs, queries do not.
+     */
+    esp_err_t compact();
+    /**
+     * @brief Ask the background task to compact once the journal is more than threshold full.
+     */
+    void set_compact_threshold(float threshold) { m_compact_threshold = threshold; }
+
+private:
+    typedef struct {
+        uint32_t seq;
+        std::vector<float> feat;
+    } overlay_feat_t;
+
+    esp_err_t region_read(size_t offset, void *buf, size_t len);
+    esp_err_t region_write(size_t offset, const void *buf, size_t len);
+    esp_err_t region_erase(size_t offset, size_t len);
+    esp_err_t map_slot(int slot, WhoFaceDB &db);
+    esp_err_t replay_journal(bool &needs_compact);
+    esp_err_t append(journal_record_type_t type, uint16_t id, const float *feat, uint32_t feat_len);
+    void apply(journal_record_type_t type, uint16_t id, uint32_t seq, const float *feat, uint32_t feat_len);
+    void rebuild_index();
+    void notify_compact();
+    esp_err_t compact_locked();
+    esp_err_t write_slot(int slot, uint32_t generation);
+#if defined(ESP_PLATFORM)
+    static void compact_task(void *args);
+#endif
+
+    WhoFaceDB m_dbs[2];
+    int m_active;
+    size_t m_region_size;
+    size_t m_erase_size;
+    size_t m_slot_size;
+    size_t m_journal_offset;
+    size_t m_journal_size;
+    size_t m_journal_pos;
+    uint32_t m_next_seq;
+    uint32_t m_feat_len;
+    float m_compact_threshold;
+    // Image ids to row indices, deleted and updated rows are removed.
+    std::unordered_map<uint16_t, uint32_t> m_image_index;
+    // Rows of the active image which are still live.
+    std::vector<uint8_t> m_row_live;
+    // Features enrolled or updated since the active image was written.
+    std::unordered_map<uint16_t, overlay_feat_t> m_overlay;
+    // Guards the in-RAM state used by queries.
+    std::mutex m_state_mutex;
+    // Serializes mutations with the compaction.
+    std::mutex m_write_mutex;
+#if defined(ESP_PLATFORM)
+    const esp_partition_t *m_partition;
+    TaskHandle_t m_compact_task;
+#else
+    std::string m_path;
+    int m_fd;
+#endif
+};
+} // namespace face_db
+} // namespace who
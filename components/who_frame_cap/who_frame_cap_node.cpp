@@ -1,6 +1,7 @@
 #include "who_frame_cap_node.hpp"
 #include "hal/cache_hal.h"
 #include "hal/cache_ll.h"
+#include <cstring>
 
 using namespace who::cam;
 static const char *TAG = "WhoFrameCapNode";
@@ -75,6 +76,40 @@ cam_fb_t *WhoFrameCapNode::cam_fb_peek(int index)
     return ret;
 }
 
+bool WhoFrameCapNode::cam_fb_copy_roi(const struct timeval &timestamp, const int *roi, dl::image::img_t &dst)
+{
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    cam_fb_t *fb = nullptr;
+    for (int i = m_cam_fbs.size() - 1; i >= 0; i--) {
+        if (m_cam_fbs[i]->timestamp.tv_sec == timestamp.tv_sec &&
+            m_cam_fbs[i]->timestamp.tv_usec == timestamp.tv_usec) {
+            fb = m_cam_fbs[i];
+            break;
+        }
+    }
+    if (!fb || (fb->format != cam_fb_fmt_t::CAM_FB_FMT_RGB565 && fb->format != cam_fb_fmt_t::CAM_FB_FMT_RGB888) ||
+        roi[0] < 0 || roi[1] < 0 || roi[2] > fb->width || roi[3] > fb->height || roi[0] >= roi[2] ||
+        roi[1] >= roi[3]) {
+        xSemaphoreGive(m_mutex);
+        return false;
+    }
+    size_t pix_size = fb->format == cam_fb_fmt_t::CAM_FB_FMT_RGB565 ? 2 : 3;
+    size_t row_size = (roi[2] - roi[0]) * pix_size;
+    const uint8_t *src = (const uint8_t *)fb->buf + (roi[1] * fb->width + roi[0]) * pix_size;
+    uint8_t *dst_row = (uint8_t *)dst.data;
+    for (int y = roi[1]; y < roi[3]; y++) {
+        memcpy(dst_row, src, row_size);
+        src += fb->width * pix_size;
+        dst_row += row_size;
+    }
+    dst.width = roi[2] - roi[0];
+    dst.height = roi[3] - roi[1];
+    dst.pix_type = fb->format == cam_fb_fmt_t::CAM_FB_FMT_RGB565 ? dl::image::DL_IMAGE_PIX_TYPE_RGB565
+                                                                 : dl::image::DL_IMAGE_PIX_TYPE_RGB888;
+    xSemaphoreGive(m_mutex);
+    return true;
+}
+
 void WhoFrameCapNode::add_new_frame_signal_subscriber(task::WhoTask *task)
 {
     m_tasks.emplace_back(task);
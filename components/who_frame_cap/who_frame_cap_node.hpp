@@ -18,6 +18,16 @@ public:
     void set_prev_node(WhoFrameCapNode *node) { m_prev_node = node; }
     void set_next_node(WhoFrameCapNode *node) { m_next_node = node; }
     who::cam::cam_fb_t *cam_fb_peek(int index = -1);
+    /**
+     * @brief Copy a region of the buffered frame taken at timestamp. The copy is done under the ringbuf mutex, so the
+     * frame can not be recycled while it is read.
+     *
+     * @param timestamp timestamp of the frame, nodes pass it on unchanged so it also matches downstream frames.
+     * @param roi       x0, y0, x1, y1 within the frame, x1 and y1 excluded.
+     * @param dst       receives the region, its data must hold the region in the frame's pixel format.
+     * @return false if the frame is no longer buffered or its pixel format can not be cropped.
+     */
+    bool cam_fb_copy_roi(const struct timeval &timestamp, const int *roi, dl::image::img_t &dst);
     void add_new_frame_signal_subscriber(task::WhoTask *task);
     WhoFrameCapNode *get_prev_node();
     WhoFrameCapNode *get_next_node();
@@ -0,0 +1,251 @@
+#include "who_frame_jpeg.hpp"
+#include "esp_log.h"
+#include "esp_timer.h"
+#if CONFIG_IDF_TARGET_ESP32S3
+#include "img_converters.h"
+#endif
+#include <algorithm>
+#include <cstring>
+
+static const char *TAG = "WhoFrameJpeg";
+
+namespace who {
+namespace frame_jpeg {
+WhoFrameJpeg::WhoFrameJpeg(const std::string &name,
+                           frame_cap::WhoFrameCapNode *frame_cap_node,
+                           uint8_t quality,
+                           uint8_t max_fps,
+                           uint32_t idle_ms) :
+    task::WhoTask(name),
+    m_frame_cap_node(frame_cap_node),
+    m_quality(quality),
+    m_scale(0),
+    m_min_interval(max_fps ? pdMS_TO_TICKS(1000 / max_fps) : 0),
+    m_idle_ticks(pdMS_TO_TICKS(idle_ms)),
+    m_last_demand(0),
+    m_slot_mutex(xSemaphoreCreateMutex()),
+    m_slot_event_group(xEventGroupCreate()),
+    m_latest(nullptr),
+    m_seq(0),
+    m_encoded(0),
+    m_failed(0),
+    m_encode_us(0),
+    m_scaled(nullptr),
+    m_scaled_size(0)
+{
+    frame_cap_node->add_new_frame_signal_subscriber(this);
+}
+
+WhoFrameJpeg::~WhoFrameJpeg()
+{
+    cleanup();
+    vEventGroupDelete(m_slot_event_group);
+    vSemaphoreDelete(m_slot_mutex);
+    free(m_scaled);
+}
+
+void WhoFrameJpeg::touch()
+{
+    m_last_demand.store(xTaskGetTickCount(), std::memory_order_relaxed);
+}
+
+jpeg_frame_t *WhoFrameJpeg::acquire(bool demand)
+{
+    if (demand) {
+        touch();
+    }
+    xSemaphoreTake(m_slot_mutex, portMAX_DELAY);
+    jpeg_frame_t *frame = m_latest;
+    if (frame) {
+        frame->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    xSemaphoreGive(m_slot_mutex);
+    return frame;
+}
+
+jpeg_frame_t *WhoFrameJpeg::acquire_newer(uint32_t seq, TickType_t timeout)
+{
+    TickType_t start = xTaskGetTickCount();
+    while (true) {
+        jpeg_frame_t *frame = acquire();
+        if (frame && (int32_t)(frame->seq - seq) > 0) {
+            return frame;
+        }
+        if (frame) {
+            release(frame);
+        }
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout) {
+            return nullptr;
+        }
+        // publish() sets and clears the bit at once, which wakes every task waiting at that moment. A frame published
+        // between acquire() and here is caught by the next pass, at most 100 ms later.
+        xEventGroupWaitBits(
+            m_slot_event_group, NEW_JPEG, pdFALSE, pdFALSE, std::min(timeout - elapsed, pdMS_TO_TICKS(100)));
+    }
+}
+
+void WhoFrameJpeg::release(jpeg_frame_t *frame)
+{
+    if (frame && frame->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        free(frame->buf);
+        delete frame;
+    }
+}
+
+const uint8_t *WhoFrameJpeg::downscale(const who::cam::cam_fb_t *fb, size_t pix_size, uint8_t scale)
+{
+    size_t size = (fb->width >> scale) * (fb->height >> scale) * pix_size;
+    if (m_scaled_size < size) {
+        free(m_scaled);
+        m_scaled = (uint8_t *)malloc(size);
+        m_scaled_size = m_scaled ? size : 0;
+        if (!m_scaled) {
+            return nullptr;
+        }
+    }
+    // Nearest pixel, a preview does not need the filtering and this costs a fraction of the encode.
+    uint8_t *dst = m_scaled;
+    for (int y = 0; y < fb->height >> scale; y++) {
+        const uint8_t *src = (const uint8_t *)fb->buf + (y << scale) * fb->width * pix_size;
+        if (pix_size == 2) {
+            for (int x = 0; x < fb->width >> scale; x++, dst += 2) {
+                memcpy(dst, src + (x << scale) * 2, 2);
+            }
+        } else {
+            for (int x = 0; x < fb->width >> scale; x++, dst += 3) {
+                memcpy(dst, src + (x << scale) * 3, 3);
+            }
+        }
+    }
+    return m_scaled;
+}
+
+jpeg_frame_t *WhoFrameJpeg::encode(const who::cam::cam_fb_t *fb)
+{
+    uint8_t *buf = nullptr;
+    size_t len = 0;
+    uint16_t width = fb->width;
+    uint16_t height = fb->height;
+    if (fb->format == who::cam::cam_fb_fmt_t::CAM_FB_FMT_JPEG) {
+        // UVC cameras deliver JPEG already.
+        buf = (uint8_t *)malloc(fb->len);
+        if (buf) {
+            memcpy(buf, fb->buf, fb->len);
+            len = fb->len;
+        }
+    } else {
+#if CONFIG_IDF_TARGET_ESP32S3
+        pixformat_t format =
+            fb->format == who::cam::cam_fb_fmt_t::CAM_FB_FMT_RGB565 ? PIXFORMAT_RGB565 : PIXFORMAT_RGB888;
+        size_t pix_size = format == PIXFORMAT_RGB565 ? 2 : 3;
+        const uint8_t *pixels = (const uint8_t *)fb->buf;
+        size_t pixels_len = fb->len;
+        uint8_t scale = m_scale.load(std::memory_order_relaxed);
+        if (scale) {
+            // Falls back to the full frame without memory for the small one.
+            const uint8_t *scaled = downscale(fb, pix_size, scale);
+            if (scaled) {
+                pixels = scaled;
+                width = fb->width >> scale;
+                height = fb->height >> scale;
+                pixels_len = width * height * pix_size;
+            }
+        }
+        if (!fmt2jpg((uint8_t *)pixels,
+                     pixels_len,
+                     width,
+                     height,
+                     format,
+                     m_quality.load(std::memory_order_relaxed),
+                     &buf,
+                     &len)) {
+            buf = nullptr;
+        }
+#else
+        ESP_LOGE(TAG, "No JPEG encoder for this target.");
+#endif
+    }
+    if (!buf) {
+        return nullptr;
+    }
+    jpeg_frame_t *frame = new jpeg_frame_t();
+    frame->buf = buf;
+    frame->len = len;
+    frame->width = width;
+    frame->height = height;
+    frame->timestamp = fb->timestamp;
+    frame->encoded_us = esp_timer_get_time();
+    frame->refs.store(1, std::memory_order_relaxed);
+    return frame;
+}
+
+void WhoFrameJpeg::publish(jpeg_frame_t *frame)
+{
+    xSemaphoreTake(m_slot_mutex, portMAX_DELAY);
+    frame->seq = ++m_seq;
+    jpeg_frame_t *old = m_latest;
+    m_latest = frame;
+    xSemaphoreGive(m_slot_mutex);
+    // Readers still sending the old frame keep it alive until they release it.
+    release(old);
+    xEventGroupSetBits(m_slot_event_group, NEW_JPEG);
+    xEventGroupClearBits(m_slot_event_group, NEW_JPEG);
+    for (const auto &new_jpeg_cb : m_new_jpeg_cbs) {
+        new_jpeg_cb(frame);
+    }
+}
+
+void WhoFrameJpeg::task()
+{
+    TickType_t last_encode = xTaskGetTickCount() - m_min_interval.load(std::memory_order_relaxed);
+    while (true) {
+        EventBits_t event_bits =
+            xEventGroupWaitBits(m_event_group, NEW_FRAME | TASK_PAUSE | TASK_STOP, pdTRUE, pdFALSE, portMAX_DELAY);
+        if (event_bits & TASK_STOP) {
+            break;
+        } else if (event_bits & TASK_PAUSE) {
+            xEventGroupSetBits(m_event_group, TASK_PAUSED);
+            EventBits_t pause_event_bits =
+                xEventGroupWaitBits(m_event_group, TASK_RESUME | TASK_STOP, pdTRUE, pdFALSE, portMAX_DELAY);
+            if (pause_event_bits & TASK_STOP) {
+                break;
+            } else {
+                continue;
+            }
+        }
+        TickType_t now = xTaskGetTickCount();
+        if (now - last_encode < m_min_interval.load(std::memory_order_relaxed) ||
+            (m_idle_ticks && now - m_last_demand.load(std::memory_order_relaxed) > m_idle_ticks)) {
+            continue;
+        }
+        auto fb = m_frame_cap_node->cam_fb_peek(-1);
+        if (!fb) {
+            continue;
+        }
+        last_encode = now;
+        int64_t start = esp_timer_get_time();
+        jpeg_frame_t *frame = encode(fb);
+        m_encode_us = (uint32_t)(esp_timer_get_time() - start);
+        if (!frame) {
+            m_failed++;
+            ESP_LOGE(TAG, "JPEG conversion failed");
+            continue;
+        }
+        m_encoded++;
+        publish(frame);
+    }
+    xEventGroupSetBits(m_event_group, TASK_STOPPED);
+    vTaskDelete(NULL);
+}
+
+void WhoFrameJpeg::cleanup()
+{
+    xSemaphoreTake(m_slot_mutex, portMAX_DELAY);
+    jpeg_frame_t *frame = m_latest;
+    m_latest = nullptr;
+    xSemaphoreGive(m_slot_mutex);
+    release(frame);
+}
+} // namespace frame_jpeg
+} // namespace who
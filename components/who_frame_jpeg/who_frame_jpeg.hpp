@@ -0,0 +1,114 @@
+#pragma once
+#include "who_frame_cap.hpp"
+#include <atomic>
+#include <functional>
+#include <vector>
+
+namespace who {
+namespace frame_jpeg {
+// One JPEG encoding of a camera frame, shared by every reader. It is freed when the last reference is released.
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    uint16_t width;
+    uint16_t height;
+    uint32_t seq;             // 1 for the first frame encoded, counts up by one per frame.
+    struct timeval timestamp; // of the camera frame, frame cap nodes pass it on unchanged.
+    int64_t encoded_us;       // esp_timer time of the encode.
+    std::atomic<int> refs;
+} jpeg_frame_t;
+
+// JPEG encoder stage of the frame cap pipeline.
+//
+// The task encodes the newest frame of a frame cap node once, at most max_fps times a second, and publishes it in a
+// latest-frame slot. HTTP stream and snapshot clients take a reference to the slot instead of grabbing and encoding
+// frames themselves, so the encode cost does not depend on the number of clients and nobody but the fetch node
+// pulls from the camera driver. Nothing is encoded while no one asked for a frame in the last idle_ms.
+//
+// Quality, scale and frame rate may be changed while the task runs, e.g. by a stream controller following the links.
+class WhoFrameJpeg : public task::WhoTask {
+public:
+    static inline constexpr EventBits_t NEW_FRAME = frame_cap::WhoFrameCapNode::NEW_FRAME;
+    static inline constexpr EventBits_t NEW_JPEG = 1 << 0;
+
+    /**
+     * @param name           task name.
+     * @param frame_cap_node node whose frames are encoded.
+     * @param quality        JPEG quality, 1-100.
+     * @param max_fps        max frames encoded per second.
+     * @param idle_ms        encoding stops when no frame was asked for for this long, 0 to always encode.
+     */
+    WhoFrameJpeg(const std::string &name,
+                 frame_cap::WhoFrameCapNode *frame_cap_node,
+                 uint8_t quality = 80,
+                 uint8_t max_fps = 10,
+                 uint32_t idle_ms = 3000);
+    ~WhoFrameJpeg();
+    /**
+     * @brief Take a reference to the latest frame.
+     *
+     * @param demand false to look at the latest frame without keeping an idle encoder busy.
+     * @return nullptr if nothing was encoded yet. Hand the frame back with release().
+     */
+    jpeg_frame_t *acquire(bool demand = true);
+    /**
+     * @brief Take a reference to the first frame encoded after the frame with sequence number seq, waiting for it if
+     * needed. Pass 0 for any frame, or the seq of the frame sent last to get the next one.
+     *
+     * @return nullptr on timeout. Hand the frame back with release().
+     */
+    jpeg_frame_t *acquire_newer(uint32_t seq, TickType_t timeout);
+    static void release(jpeg_frame_t *frame);
+    /**
+     * @brief Called on the encoder task after every frame is published, e.g. to wake a sender. Add before run().
+     */
+    void add_new_jpeg_cb(const std::function<void(const jpeg_frame_t *)> &new_jpeg_cb)
+    {
+        m_new_jpeg_cbs.emplace_back(new_jpeg_cb);
+    }
+    void set_quality(uint8_t quality) { m_quality.store(quality, std::memory_order_relaxed); }
+    /**
+     * @brief Encode every (1 << scale)th pixel of every (1 << scale)th row, 0 for full size. Frames from a JPEG
+     * camera are passed on at full size.
+     */
+    void set_scale(uint8_t scale) { m_scale.store(scale, std::memory_order_relaxed); }
+    /**
+     * @param max_fps frames encoded per second, at most.
+     */
+    void set_max_fps(uint8_t max_fps)
+    {
+        m_min_interval.store(max_fps ? pdMS_TO_TICKS(1000 / max_fps) : 0, std::memory_order_relaxed);
+    }
+    uint8_t get_quality() const { return m_quality; }
+    uint8_t get_scale() const { return m_scale; }
+    uint32_t get_encoded() const { return m_encoded; }
+    uint32_t get_failed() const { return m_failed; }
+    uint32_t get_encode_us() const { return m_encode_us; }
+
+private:
+    void task() override;
+    void cleanup() override;
+    jpeg_frame_t *encode(const who::cam::cam_fb_t *fb);
+    const uint8_t *downscale(const who::cam::cam_fb_t *fb, size_t pix_size, uint8_t scale);
+    void publish(jpeg_frame_t *frame);
+    void touch();
+
+    frame_cap::WhoFrameCapNode *m_frame_cap_node;
+    std::atomic<uint8_t> m_quality;
+    std::atomic<uint8_t> m_scale;
+    std::atomic<TickType_t> m_min_interval;
+    TickType_t m_idle_ticks;
+    std::atomic<TickType_t> m_last_demand;
+    SemaphoreHandle_t m_slot_mutex;
+    EventGroupHandle_t m_slot_event_group;
+    jpeg_frame_t *m_latest;
+    uint32_t m_seq;
+    uint32_t m_encoded;
+    uint32_t m_failed;
+    uint32_t m_encode_us; // time the last encode took.
+    uint8_t *m_scaled;    // downscaled frame, kept for the next encode.
+    size_t m_scaled_size;
+    std::vector<std::function<void(const jpeg_frame_t *)>> m_new_jpeg_cbs;
+};
+} // namespace frame_jpeg
+} // namespace who
@@ -0,0 +1,222 @@
+#include "who_event.hpp"
+#include <cmath>
+#include <cstring>
+
+namespace who {
+namespace gateway {
+namespace {
+// Appends to a fixed buffer and remembers whether anything did not fit, so the encoder can check once at the end.
+class BufWriter {
+public:
+    BufWriter(char *buf, size_t size) : m_buf(buf), m_size(size), m_pos(0), m_overflow(false) {}
+
+    void put(const char *str)
+    {
+        size_t len = strlen(str);
+        if (m_pos + len > m_size) {
+            m_overflow = true;
+            return;
+        }
+        memcpy(m_buf + m_pos, str, len);
+        m_pos += len;
+    }
+
+    void put_uint(uint64_t val)
+    {
+        char digits[20];
+        int n = 0;
+        do {
+            digits[n++] = '0' + val % 10;
+            val /= 10;
+        } while (val);
+        if (m_pos + n > m_size) {
+            m_overflow = true;
+            return;
+        }
+        while (n) {
+            m_buf[m_pos++] = digits[--n];
+        }
+    }
+
+    void put_int(int64_t val)
+    {
+        if (val < 0) {
+            put("-");
+            put_uint(-(uint64_t)val);
+        } else {
+            put_uint(val);
+        }
+    }
+
+    // Six decimals, the same text std::to_string gives.
+    void put_float(float val)
+    {
+        if (!std::isfinite(val)) {
+            put("0.0");
+            return;
+        }
+        if (val < 0) {
+            put("-");
+            val = -val;
+        }
+        uint64_t micros = (uint64_t)llround((double)val * 1000000);
+        put_uint(micros / 1000000);
+        put(".");
+        uint32_t frac = micros % 1000000;
+        char digits[7];
+        for (int i = 5; i >= 0; i--) {
+            digits[i] = '0' + frac % 10;
+            frac /= 10;
+        }
+        digits[6] = '\0';
+        put(digits);
+    }
+
+    size_t get_len() const { return m_overflow ? 0 : m_pos; }
+
+private:
+    char *m_buf;
+    size_t m_size;
+    size_t m_pos;
+    bool m_overflow;
+};
+
+size_t put_tlv(uint8_t *buf, size_t size, size_t pos, uint8_t tag, const void *val, uint8_t len)
+{
+    if (pos + 2 + len > size) {
+        return 0;
+    }
+    buf[pos] = tag;
+    buf[pos + 1] = len;
+    // All the targets and hosts are little-endian, the values are copied as they are.
+    memcpy(buf + pos + 2, val, len);
+    return pos + 2 + len;
+}
+} // namespace
+
+const char *event_type_to_str(event_type_t type)
+{
+    switch (type) {
+    case EVENT_RECOGNIZE:
+        return "RECOGNIZE";
+    case EVENT_CONTINUOUS:
+        return "CONTINUOUS";
+    case EVENT_ENROLL:
+        return "ENROLL";
+    case EVENT_DELETE:
+        return "DELETE";
+    default:
+        return "UNKNOWN";
+    }
+}
+
+int event_best_face(const event_t &event)
+{
+    int best = -1;
+    for (int i = 0; i < event.num_faces && i < EVENT_MAX_FACES; i++) {
+        if (event.faces[i].status && (best < 0 || event.faces[i].similarity > event.faces[best].similarity)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+size_t encode_json(const event_t &event, char *buf, size_t size)
+{
+    BufWriter w(buf, size);
+    int best = event_best_face(event);
+    w.put("{\"event\":\"");
+    w.put(event_type_to_str(event.type));
+    w.put("\",\"seq\":");
+    w.put_uint(event.seq);
+    w.put(",\"status\":");
+    w.put(best < 0 ? "0" : "1");
+    w.put(",\"id\":");
+    w.put_uint(best < 0 ? 0 : event.faces[best].id);
+    w.put(",\"similarity\":");
+    w.put_float(best < 0 ? 0.f : event.faces[best].similarity);
+    w.put(",\"faces\":[");
+    for (int i = 0; i < event.num_faces && i < EVENT_MAX_FACES; i++) {
+        const event_face_t &face = event.faces[i];
+        w.put(i ? ",{\"track\":" : "{\"track\":");
+        w.put_uint(face.track);
+        w.put(",\"status\":");
+        w.put_uint(face.status);
+        w.put(",\"id\":");
+        w.put_uint(face.id);
+        w.put(",\"similarity\":");
+        w.put_float(face.similarity);
+        w.put("}");
+    }
+    w.put("]}");
+    return w.get_len();
+}
+
+size_t encode_tlv(const event_t &event, uint8_t *buf, size_t size)
+{
+    size_t pos = put_tlv(buf, size, 0, EVENT_TLV_TYPE, &event.type, sizeof(event.type));
+    pos = pos ? put_tlv(buf, size, pos, EVENT_TLV_SEQ, &event.seq, sizeof(event.seq)) : 0;
+    pos = pos ? put_tlv(buf, size, pos, EVENT_TLV_TIMESTAMP, &event.timestamp_ms, sizeof(event.timestamp_ms)) : 0;
+    for (int i = 0; pos && i < event.num_faces && i < EVENT_MAX_FACES; i++) {
+        const event_face_t &face = event.faces[i];
+        uint8_t val[11];
+        memcpy(val, &face.track, 4);
+        memcpy(val + 4, &face.id, 2);
+        val[6] = face.status;
+        memcpy(val + 7, &face.similarity, 4);
+        pos = put_tlv(buf, size, pos, EVENT_TLV_FACE, val, sizeof(val));
+    }
+    return pos;
+}
+
+bool decode_tlv(const uint8_t *buf, size_t len, event_t &event)
+{
+    memset(&event, 0, sizeof(event));
+    size_t pos = 0;
+    while (pos < len) {
+        if (pos + 2 > len || pos + 2 + buf[pos + 1] > len) {
+            return false;
+        }
+        uint8_t tag = buf[pos];
+        uint8_t val_len = buf[pos + 1];
+        const uint8_t *val = buf + pos + 2;
+        switch (tag) {
+        case EVENT_TLV_TYPE:
+            if (val_len != sizeof(event.type)) {
+                return false;
+            }
+            event.type = (event_type_t)val[0];
+            break;
+        case EVENT_TLV_SEQ:
+            if (val_len != sizeof(event.seq)) {
+                return false;
+            }
+            memcpy(&event.seq, val, sizeof(event.seq));
+            break;
+        case EVENT_TLV_TIMESTAMP:
+            if (val_len != sizeof(event.timestamp_ms)) {
+                return false;
+            }
+            memcpy(&event.timestamp_ms, val, sizeof(event.timestamp_ms));
+            break;
+        case EVENT_TLV_FACE:
+            if (val_len != 11) {
+                return false;
+            }
+            if (event.num_faces < EVENT_MAX_FACES) {
+                event_face_t &face = event.faces[event.num_faces++];
+                memcpy(&face.track, val, 4);
+                memcpy(&face.id, val + 4, 2);
+                face.status = val[6];
+                memcpy(&face.similarity, val + 7, 4);
+            }
+            break;
+        default:
+            break;
+        }
+        pos += 2 + val_len;
+    }
+    return true;
+}
+} // namespace gateway
+} // namespace who
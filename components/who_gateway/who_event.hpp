@@ -0,0 +1,79 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace who {
+namespace gateway {
+// Recognition event sent to the gateway.
+//
+// The event is a plain struct of fixed size, so it can be filled on the stack of any task and encoded without a
+// single heap allocation. Three encodings are supported:
+//
+//  - compact JSON, the fields the gateway already parses plus the per-face list:
+//      {"event":"RECOGNIZE","seq":7,"status":1,"id":3,"similarity":0.812345,"faces":[{"track":2,"status":1,...}]}
+//  - binary TLV, a sequence of [tag u8][len u8][value, little-endian] items, EVENT_TLV_FACE repeated per face.
+//  - the result record of the binary wire protocol, batched into acknowledged frames, see who_wire.hpp.
+//
+// The top level status, id and similarity are those of the best matching face, or 0 when no face matched.
+inline constexpr int EVENT_MAX_FACES = 8;
+
+typedef enum : uint8_t {
+    EVENT_RECOGNIZE = 1,
+    EVENT_CONTINUOUS = 2,
+    EVENT_ENROLL = 3,
+    EVENT_DELETE = 4,
+} event_type_t;
+
+typedef enum : uint8_t {
+    EVENT_FORMAT_JSON = 0,
+    EVENT_FORMAT_TLV = 1,
+    EVENT_FORMAT_WIRE = 2, // result record of the binary wire protocol, see who_wire.hpp.
+} event_format_t;
+
+typedef enum : uint8_t {
+    EVENT_TLV_TYPE = 0x01,      // u8 event_type_t
+    EVENT_TLV_SEQ = 0x02,       // u32
+    EVENT_TLV_TIMESTAMP = 0x03, // i64 ms
+    EVENT_TLV_FACE = 0x10,      // u32 track, u16 id, u8 status, f32 similarity
+} event_tlv_tag_t;
+
+typedef struct {
+    uint32_t track;
+    uint16_t id;       // 0 if unknown.
+    uint8_t status;    // 1 if recognized.
+    float similarity;
+} event_face_t;
+
+typedef struct {
+    event_type_t type;
+    uint8_t num_faces;
+    uint32_t seq;
+    int64_t timestamp_ms;
+    event_face_t faces[EVENT_MAX_FACES];
+} event_t;
+
+const char *event_type_to_str(event_type_t type);
+/**
+ * @brief Index of the best matching face, -1 if no face matched.
+ */
+int event_best_face(const event_t &event);
+/**
+ * @brief Encode an event as compact JSON, without a terminator.
+ *
+ * @return bytes written, 0 if the buffer is too small.
+ */
+size_t encode_json(const event_t &event, char *buf, size_t size);
+/**
+ * @brief Encode an event as TLV items.
+ *
+ * @return bytes written, 0 if the buffer is too small.
+ */
+size_t encode_tlv(const event_t &event, uint8_t *buf, size_t size);
+/**
+ * @brief Decode TLV items. Unknown tags are skipped, faces beyond EVENT_MAX_FACES are dropped.
+ *
+ * @return false if the items are truncated or malformed.
+ */
+bool decode_tlv(const uint8_t *buf, size_t len, event_t &event);
+} // namespace gateway
+} // namespace who
@@ -0,0 +1,254 @@
+#include "who_event_journal.hpp"
+#include "esp_log.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char *TAG = "WhoEventJournal";
+
+namespace who {
+namespace gateway {
+static constexpr size_t COMMIT_AREA_SIZE = 2 * sizeof(event_journal_commit_t);
+
+static uint32_t crc32(const void *data, size_t len)
+{
+    static const uint32_t table[16] = {0x00000000,
+                                       0x1db71064,
+                                       0x3b6e20c8,
+                                       0x26d930ac,
+                                       0x76dc4190,
+                                       0x6b6b51f4,
+                                       0x4db26158,
+                                       0x5005713c,
+                                       0xedb88320,
+                                       0xf00f9344,
+                                       0xd6d6a3e8,
+                                       0xcb61b38c,
+                                       0x9b64c2b0,
+                                       0x86d3d2d4,
+                                       0xa00ae278,
+                                       0xbdbdf21c};
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= p[i];
+        crc = (crc >> 4) ^ table[crc & 0xf];
+        crc = (crc >> 4) ^ table[crc & 0xf];
+    }
+    return ~crc;
+}
+
+static bool check_commit(event_journal_commit_t &commit)
+{
+    uint32_t crc = commit.crc32;
+    commit.crc32 = 0;
+    bool valid = commit.magic == EVENT_JOURNAL_COMMIT_MAGIC && crc32(&commit, sizeof(commit)) == crc;
+    commit.crc32 = crc;
+    return valid;
+}
+
+WhoEventJournal::WhoEventJournal(const char *path, size_t capacity) :
+    m_path(path),
+    m_capacity(capacity),
+    m_fd(-1),
+    m_head(0),
+    m_tail(0),
+    m_read(0),
+    m_generation(0),
+    m_overwritten(0),
+    m_corrupted(0)
+{
+}
+
+WhoEventJournal::~WhoEventJournal()
+{
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+esp_err_t WhoEventJournal::file_read(size_t offset, void *buf, size_t len)
+{
+    return pread(m_fd, buf, len, offset) == (ssize_t)len ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t WhoEventJournal::file_write(size_t offset, const void *buf, size_t len)
+{
+    if (pwrite(m_fd, buf, len, offset) != (ssize_t)len || fsync(m_fd) != 0) {
+        ESP_LOGE(TAG, "Failed to write %s: errno %d", m_path.c_str(), errno);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+size_t WhoEventJournal::get_record_offset(uint32_t seq) const
+{
+    return COMMIT_AREA_SIZE + (seq % m_capacity) * sizeof(event_journal_record_t);
+}
+
+bool WhoEventJournal::check_record(event_journal_record_t &record, uint32_t seq)
+{
+    if (record.magic != EVENT_JOURNAL_MAGIC || record.seq != seq || record.len > EVENT_JOURNAL_DATA_SIZE) {
+        return false;
+    }
+    uint32_t crc = record.crc32;
+    record.crc32 = 0;
+    bool valid = crc32(&record, sizeof(record)) == crc;
+    record.crc32 = crc;
+    return valid;
+}
+
+esp_err_t WhoEventJournal::open()
+{
+    if (m_capacity == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (m_fd < 0) {
+        ESP_LOGE(TAG, "Failed to open %s: errno %d", m_path.c_str(), errno);
+        return ESP_ERR_NOT_FOUND;
+    }
+    // Preallocate the whole ring once, appending never grows the file, so it never touches the FAT afterwards.
+    size_t file_size = COMMIT_AREA_SIZE + m_capacity * sizeof(event_journal_record_t);
+    struct stat st;
+    if (fstat(m_fd, &st) != 0) {
+        return ESP_FAIL;
+    }
+    if ((size_t)st.st_size < file_size) {
+        static const uint8_t zeros[256] = {};
+        for (size_t offset = st.st_size; offset < file_size;) {
+            size_t n = std::min(file_size - offset, sizeof(zeros));
+            if (pwrite(m_fd, zeros, n, offset) != (ssize_t)n) {
+                ESP_LOGE(TAG, "Failed to preallocate %s: errno %d", m_path.c_str(), errno);
+                return ESP_ERR_NO_MEM;
+            }
+            offset += n;
+        }
+        fsync(m_fd);
+    }
+
+    // The newer of the two commit entries holds the tail.
+    event_journal_commit_t commits[2];
+    bool found = false;
+    if (file_read(0, commits, sizeof(commits)) == ESP_OK) {
+        for (auto &commit : commits) {
+            if (check_commit(commit) && (!found || (int32_t)(commit.generation - m_generation) > 0)) {
+                m_tail = commit.tail;
+                m_generation = commit.generation;
+                found = true;
+            }
+        }
+    }
+
+    // The head follows the newest valid record which was not drained yet.
+    m_head = m_tail;
+    event_journal_record_t records[4];
+    for (size_t i = 0; i < m_capacity; i += 4) {
+        size_t n = std::min(m_capacity - i, (size_t)4);
+        if (file_read(COMMIT_AREA_SIZE + i * sizeof(event_journal_record_t), records, n * sizeof(records[0])) !=
+            ESP_OK) {
+            return ESP_FAIL;
+        }
+        for (size_t j = 0; j < n; j++) {
+            event_journal_record_t &record = records[j];
+            if (record.seq % m_capacity == i + j && check_record(record, record.seq) &&
+                (int32_t)(record.seq - m_head) >= 0) {
+                m_head = record.seq + 1;
+            }
+        }
+    }
+    // Records older than one lap before the head were overwritten.
+    if (m_head - m_tail > m_capacity) {
+        m_tail = m_head - m_capacity;
+    }
+    m_read = m_tail;
+    ESP_LOGI(TAG, "%s: %u events to forward", m_path.c_str(), (unsigned)(m_head - m_tail));
+    return ESP_OK;
+}
+
+esp_err_t WhoEventJournal::append(const void *data, size_t len)
+{
+    if (m_fd < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (len > EVENT_JOURNAL_DATA_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (m_head - m_tail == m_capacity) {
+        // The oldest record makes room, newer events are worth more.
+        m_tail++;
+        m_overwritten++;
+        if ((int32_t)(m_read - m_tail) < 0) {
+            m_read = m_tail;
+        }
+    }
+    event_journal_record_t record = {};
+    record.magic = EVENT_JOURNAL_MAGIC;
+    record.len = len;
+    record.seq = m_head;
+    memcpy(record.data, data, len);
+    record.crc32 = crc32(&record, sizeof(record));
+    esp_err_t ret = file_write(get_record_offset(m_head), &record, sizeof(record));
+    if (ret == ESP_OK) {
+        m_head++;
+    }
+    return ret;
+}
+
+bool WhoEventJournal::read(void *buf, size_t size, size_t &len)
+{
+    while (m_read != m_head) {
+        event_journal_record_t record;
+        if (file_read(get_record_offset(m_read), &record, sizeof(record)) != ESP_OK) {
+            return false;
+        }
+        uint32_t seq = m_read++;
+        if (!check_record(record, seq)) {
+            m_corrupted++;
+            ESP_LOGW(TAG, "Record %u is damaged, skipped", (unsigned)seq);
+            continue;
+        }
+        if (record.len > size) {
+            m_read--;
+            return false;
+        }
+        memcpy(buf, record.data, record.len);
+        len = record.len;
+        return true;
+    }
+    return false;
+}
+
+void WhoEventJournal::unread()
+{
+    if (m_read != m_tail) {
+        m_read--;
+    }
+}
+
+esp_err_t WhoEventJournal::commit()
+{
+    if (m_fd < 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (m_read == m_tail) {
+        return ESP_OK;
+    }
+    event_journal_commit_t commit = {};
+    commit.magic = EVENT_JOURNAL_COMMIT_MAGIC;
+    commit.tail = m_read;
+    commit.generation = m_generation + 1;
+    commit.crc32 = crc32(&commit, sizeof(commit));
+    // The entry not holding the current tail is overwritten, a torn write leaves the other one intact.
+    esp_err_t ret = file_write((commit.generation & 1) * sizeof(commit), &commit, sizeof(commit));
+    if (ret == ESP_OK) {
+        m_tail = m_read;
+        m_generation = commit.generation;
+    }
+    return ret;
+}
+} // namespace gateway
+} // namespace who
@@ -0,0 +1,99 @@
+#pragma once
+#include "esp_err.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace who {
+namespace gateway {
+// Store-and-forward journal of the events produced while the gateway is away.
+//
+// A preallocated file, on the device on the FAT storage partition, holds two commit entries and a ring of fixed-size
+// records:
+//
+//  [ commit 0 | commit 1 | record 0 | record 1 | ... | record capacity-1 ]
+//
+// Every record carries a journal sequence number and a crc32, record seq lives at index seq % capacity. Appending
+// writes one record and nothing else, so a torn write can only damage the record being written. The records up to
+// the tail are drained; the tail is committed to the two entries in turn, so one of them is always intact. On open
+// the head is found by the highest valid seq, and a full ring overwrites its oldest record. The journal is not
+// thread-safe, it belongs to the gateway client task.
+inline constexpr uint16_t EVENT_JOURNAL_MAGIC = 0xe7a1;
+inline constexpr uint16_t EVENT_JOURNAL_COMMIT_MAGIC = 0xe7c0;
+inline constexpr size_t EVENT_JOURNAL_DATA_SIZE = 68;
+
+typedef struct {
+    uint16_t magic;
+    uint8_t len;
+    uint8_t reserved;
+    uint32_t seq;
+    uint32_t crc32; // crc32 of the record with this field set to 0.
+    uint8_t data[EVENT_JOURNAL_DATA_SIZE];
+} event_journal_record_t;
+static_assert(sizeof(event_journal_record_t) == 80, "event_journal_record_t must be 80 bytes.");
+
+typedef struct {
+    uint16_t magic;
+    uint16_t reserved;
+    uint32_t tail;
+    uint32_t generation;
+    uint32_t crc32; // crc32 of the entry with this field set to 0.
+} event_journal_commit_t;
+static_assert(sizeof(event_journal_commit_t) == 16, "event_journal_commit_t must be 16 bytes.");
+
+class WhoEventJournal {
+public:
+    /**
+     * @param path     journal file, created and preallocated if it does not exist.
+     * @param capacity number of records.
+     */
+    WhoEventJournal(const char *path, size_t capacity);
+    ~WhoEventJournal();
+    WhoEventJournal(const WhoEventJournal &) = delete;
+    WhoEventJournal &operator=(const WhoEventJournal &) = delete;
+
+    /**
+     * @brief Open the file and find the records not drained yet.
+     */
+    esp_err_t open();
+    /**
+     * @brief Append a record, overwriting the oldest one if the ring is full. The record is synced before it returns.
+     */
+    esp_err_t append(const void *data, size_t len);
+    /**
+     * @brief Read the next record after the read position. Damaged records are skipped.
+     *
+     * @return false if there is none.
+     */
+    bool read(void *buf, size_t size, size_t &len);
+    /**
+     * @brief Step the read position back over the record read last, e.g. when it could not be sent on.
+     */
+    void unread();
+    /**
+     * @brief Mark everything read so far as drained.
+     */
+    esp_err_t commit();
+    uint32_t get_unread() const { return m_head - m_read; }
+    uint32_t get_overwritten() const { return m_overwritten; }
+    uint32_t get_corrupted() const { return m_corrupted; }
+
+private:
+    esp_err_t file_read(size_t offset, void *buf, size_t len);
+    esp_err_t file_write(size_t offset, const void *buf, size_t len);
+    size_t get_record_offset(uint32_t seq) const;
+    bool check_record(event_journal_record_t &record, uint32_t seq);
+
+    std::string m_path;
+    size_t m_capacity;
+    int m_fd;
+    // Next seq to append, first seq not drained, next seq to read.
+    uint32_t m_head;
+    uint32_t m_tail;
+    uint32_t m_read;
+    uint32_t m_generation;
+    uint32_t m_overwritten;
+    uint32_t m_corrupted;
+};
+} // namespace gateway
+} // namespace who
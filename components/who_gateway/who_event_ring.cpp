@@ -0,0 +1,158 @@
+#include "who_event_ring.hpp"
+#include "who_wire.hpp"
+#include <cstring>
+
+namespace who {
+namespace gateway {
+WhoEventRing::WhoEventRing(size_t capacity, size_t slot_size) :
+    m_slot_size(slot_size), m_head(0), m_tail(0), m_dropped(0)
+{
+    size_t n = 2;
+    while (n < capacity) {
+        n <<= 1;
+    }
+    m_mask = n - 1;
+    m_slots.reset(new slot_t[n]);
+    m_data.reset(new uint8_t[n * slot_size]);
+    for (size_t i = 0; i < n; i++) {
+        m_slots[i].seq.store(i, std::memory_order_relaxed);
+        m_slots[i].len = 0;
+    }
+}
+
+// A slot is free for position pos when its seq equals pos, and ready to be read when it equals pos + 1.
+bool WhoEventRing::claim(size_t &pos)
+{
+    pos = m_head.load(std::memory_order_relaxed);
+    while (true) {
+        size_t seq = m_slots[pos & m_mask].seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                return true;
+            }
+        } else if (diff < 0) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = m_head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void WhoEventRing::publish(size_t pos, size_t len)
+{
+    slot_t &slot = m_slots[pos & m_mask];
+    slot.len = len;
+    slot.seq.store(pos + 1, std::memory_order_release);
+}
+
+bool WhoEventRing::push(const event_t &event, event_format_t format)
+{
+    size_t pos;
+    if (!claim(pos)) {
+        return false;
+    }
+    uint8_t *data = get_data(pos);
+    size_t len;
+    if (format == EVENT_FORMAT_JSON) {
+        len = encode_json(event, (char *)data, m_slot_size - 1);
+        if (len) {
+            data[len++] = '\r';
+        }
+    } else if (format == EVENT_FORMAT_TLV) {
+        len = encode_tlv(event, data, m_slot_size);
+    } else {
+        len = encode_result_record(event, data, m_slot_size);
+    }
+    // The slot is already claimed, an event which did not fit is published empty and skipped by front().
+    publish(pos, len);
+    if (!len) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    return len != 0;
+}
+
+bool WhoEventRing::push(const void *data, size_t len)
+{
+    if (len > m_slot_size) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    size_t pos;
+    if (!claim(pos)) {
+        return false;
+    }
+    memcpy(get_data(pos), data, len);
+    publish(pos, len);
+    return true;
+}
+
+bool WhoEventRing::pop(void *buf, size_t size, size_t &len)
+{
+    size_t pos = m_tail.load(std::memory_order_relaxed);
+    while (true) {
+        slot_t &slot = m_slots[pos & m_mask];
+        size_t seq = slot.seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff < 0) {
+            return false;
+        }
+        if (diff > 0) {
+            pos = m_tail.load(std::memory_order_relaxed);
+            continue;
+        }
+        len = slot.len;
+        if (len > size) {
+            return false;
+        }
+        if (!m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            continue;
+        }
+        memcpy(buf, get_data(pos), len);
+        // Hand the slot back to the producers one lap later.
+        slot.seq.store(pos + m_mask + 1, std::memory_order_release);
+        if (len) {
+            return true;
+        }
+        pos = m_tail.load(std::memory_order_relaxed);
+    }
+}
+
+// Hands the empty slots of events which did not fit back at the tail, so they never hold up the ones behind them.
+WhoEventRing::slot_t *WhoEventRing::front()
+{
+    size_t pos = m_tail.load(std::memory_order_relaxed);
+    while (true) {
+        slot_t &slot = m_slots[pos & m_mask];
+        size_t seq = slot.seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff < 0) {
+            return nullptr;
+        }
+        if (diff > 0) {
+            pos = m_tail.load(std::memory_order_relaxed);
+            continue;
+        }
+        if (slot.len) {
+            return &slot;
+        }
+        if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            slot.seq.store(pos + m_mask + 1, std::memory_order_release);
+            pos++;
+        }
+    }
+}
+
+size_t WhoEventRing::front_len()
+{
+    slot_t *slot = front();
+    return slot ? slot->len : 0;
+}
+
+bool WhoEventRing::empty()
+{
+    return !front();
+}
+} // namespace gateway
+} // namespace who
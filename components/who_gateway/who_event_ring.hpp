@@ -0,0 +1,72 @@
+#pragma once
+#include "who_event.hpp"
+#include <atomic>
+#include <memory>
+
+namespace who {
+namespace gateway {
+// Bounded lock-free ring of encoded events.
+//
+// All slots are allocated once in the constructor. Producers on any task claim a slot with one compare-and-swap,
+// encode the event straight into it and publish it; consumers copy it out. Each slot carries a sequence number
+// which tells whether it is free, being written or ready, so neither side ever takes a lock or waits for the other.
+// A push onto a full ring fails and is counted instead of blocking the producer.
+class WhoEventRing {
+public:
+    /**
+     * @param capacity  number of slots, rounded up to a power of two.
+     * @param slot_size largest encoded event in bytes.
+     */
+    WhoEventRing(size_t capacity, size_t slot_size);
+    WhoEventRing(const WhoEventRing &) = delete;
+    WhoEventRing &operator=(const WhoEventRing &) = delete;
+
+    /**
+     * @brief Encode an event into the next free slot. JSON events get a '\r' terminator, as the gateway reads lines.
+     *
+     * @return false if the ring is full or the event does not fit a slot.
+     */
+    bool push(const event_t &event, event_format_t format);
+    /**
+     * @brief Copy raw bytes, an already encoded message, into the next free slot.
+     */
+    bool push(const void *data, size_t len);
+    /**
+     * @brief Copy the oldest message out.
+     *
+     * @param buf  receives the message.
+     * @param size size of buf, a message which does not fit stays in the ring.
+     * @param len  length of the message.
+     * @return false if the ring is empty or the oldest message does not fit.
+     */
+    bool pop(void *buf, size_t size, size_t &len);
+    /**
+     * @brief Length of the oldest message, 0 if the ring is empty. Skips the events which did not fit a slot.
+     */
+    size_t front_len();
+    bool empty();
+    size_t get_capacity() const { return m_mask + 1; }
+    size_t get_slot_size() const { return m_slot_size; }
+    uint32_t get_dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+    typedef struct {
+        std::atomic<size_t> seq;
+        uint16_t len;
+    } slot_t;
+
+    bool claim(size_t &pos);
+    slot_t *front();
+    void publish(size_t pos, size_t len);
+    uint8_t *get_data(size_t pos) { return m_data.get() + (pos & m_mask) * m_slot_size; }
+
+    size_t m_mask;
+    size_t m_slot_size;
+    std::unique_ptr<slot_t[]> m_slots;
+    std::unique_ptr<uint8_t[]> m_data;
+    std::atomic<size_t> m_head;
+    std::atomic<size_t> m_tail;
+    std::atomic<uint32_t> m_dropped;
+};
+} // namespace gateway
+} // namespace who
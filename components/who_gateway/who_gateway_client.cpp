@@ -0,0 +1,612 @@
+#include "who_gateway_client.hpp"
+#include "esp_log.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#if defined(ESP_PLATFORM)
+#include "esp_timer.h"
+#include "esp_vfs_eventfd.h"
+#include "lwip/sockets.h"
+#else
+#include <arpa/inet.h>
+#include <chrono>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+static const char *TAG = "WhoGatewayClient";
+
+namespace who {
+namespace gateway {
+// One TCP segment on a typical link, larger batches are split over several sends anyway.
+static constexpr size_t SEND_BUF_SIZE = 1460;
+// A result batch which is not acknowledged within this time means the gateway is gone without closing the socket.
+static constexpr int ACK_TIMEOUT_MS = 5000;
+
+WhoGatewayClient::WhoGatewayClient(
+    const char *host, uint16_t port, size_t ring_len, size_t slot_size, event_format_t format) :
+    m_port(port),
+    m_format(format),
+    m_ring(ring_len, slot_size),
+    m_state(STATE_DISCONNECTED),
+    m_running(false),
+    m_sock(-1),
+    m_wake_fd(-1),
+    m_min_backoff_ms(500),
+    m_max_backoff_ms(30000),
+    m_backoff_ms(500),
+    m_next_connect_ms(0),
+    m_reconnects(0),
+    m_rand((uint32_t)get_time_ms() | 1),
+    m_send_buf(std::max(SEND_BUF_SIZE, slot_size)),
+    m_send_len(0),
+    m_send_pos(0),
+    m_wire_seq(0),
+    m_awaiting_ack(false),
+    m_unacked_seq(0),
+    m_batch_sent_ms(0),
+    m_ctrl_len(0),
+    m_ctrl_pos(0),
+    m_heartbeat_ms(10000),
+    m_start_ms(get_time_ms()),
+    m_last_tx_ms(0),
+    m_drain_batch(0),
+    m_drain_interval_ms(0),
+    m_next_drain_ms(0)
+#if defined(ESP_PLATFORM)
+    ,
+    m_task(nullptr),
+    m_stopped(xSemaphoreCreateBinary())
+#endif
+{
+    strncpy(m_host, host, sizeof(m_host) - 1);
+    m_host[sizeof(m_host) - 1] = '\0';
+}
+
+WhoGatewayClient::~WhoGatewayClient()
+{
+    stop();
+#if defined(ESP_PLATFORM)
+    vSemaphoreDelete(m_stopped);
+#endif
+}
+
+esp_err_t WhoGatewayClient::start()
+{
+    if (m_running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+#if defined(ESP_PLATFORM)
+    // Registering twice is harmless, the second call reports ESP_ERR_INVALID_STATE.
+    esp_vfs_eventfd_config_t config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+    esp_err_t ret = esp_vfs_eventfd_register(&config);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Failed to register eventfd: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    m_wake_fd = eventfd(0, 0);
+#else
+    m_wake_fd = eventfd(0, EFD_NONBLOCK);
+#endif
+    if (m_wake_fd < 0) {
+        ESP_LOGE(TAG, "Failed to create eventfd: errno %d", errno);
+        return ESP_FAIL;
+    }
+    m_running = true;
+#if defined(ESP_PLATFORM)
+    if (xTaskCreate(task, "GatewayClient", 4096, this, 4, &m_task) != pdPASS) {
+        m_running = false;
+        close(m_wake_fd);
+        m_wake_fd = -1;
+        return ESP_ERR_NO_MEM;
+    }
+#else
+    m_thread = std::thread(&WhoGatewayClient::loop, this);
+#endif
+    return ESP_OK;
+}
+
+void WhoGatewayClient::stop()
+{
+    if (!m_running.exchange(false)) {
+        return;
+    }
+    wake();
+#if defined(ESP_PLATFORM)
+    xSemaphoreTake(m_stopped, portMAX_DELAY);
+#else
+    m_thread.join();
+#endif
+    close(m_wake_fd);
+    m_wake_fd = -1;
+}
+
+bool WhoGatewayClient::push(const event_t &event)
+{
+    // The compact result record is journalled whatever the format, it is encoded again when it is drained.
+    WhoEventRing &ring = m_journal_ring && !is_connected() ? *m_journal_ring : m_ring;
+    if (!ring.push(event, &ring == &m_ring ? m_format : EVENT_FORMAT_WIRE)) {
+        return false;
+    }
+    wake();
+    return true;
+}
+
+bool WhoGatewayClient::push(const void *data, size_t len)
+{
+    if (!m_ring.push(data, len)) {
+        return false;
+    }
+    wake();
+    return true;
+}
+
+esp_err_t WhoGatewayClient::enable_journal(const char *path, size_t capacity, int drain_batch, int drain_interval_ms)
+{
+    if (m_running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    m_journal.reset(new WhoEventJournal(path, capacity));
+    esp_err_t ret = m_journal->open();
+    if (ret != ESP_OK) {
+        m_journal.reset();
+        return ret;
+    }
+    event_t event = {};
+    event.num_faces = EVENT_MAX_FACES;
+    m_journal_ring.reset(new WhoEventRing(m_ring.get_capacity(), get_result_record_size(event)));
+    m_drain_batch = std::max(1, std::min(drain_batch, (int)m_ring.get_capacity()));
+    m_drain_interval_ms = drain_interval_ms;
+    return ESP_OK;
+}
+
+void WhoGatewayClient::set_backoff(int min_backoff_ms, int max_backoff_ms)
+{
+    m_min_backoff_ms = min_backoff_ms;
+    m_max_backoff_ms = std::max(min_backoff_ms, max_backoff_ms);
+    m_backoff_ms = min_backoff_ms;
+}
+
+void WhoGatewayClient::wake()
+{
+    uint64_t one = 1;
+    if (m_wake_fd >= 0) {
+        // Only fails if the counter would overflow, the task is awake then anyway.
+        (void)!write(m_wake_fd, &one, sizeof(one));
+    }
+}
+
+void WhoGatewayClient::drain_wake()
+{
+    uint64_t count;
+    (void)!read(m_wake_fd, &count, sizeof(count));
+}
+
+int64_t WhoGatewayClient::get_time_ms()
+{
+#if defined(ESP_PLATFORM)
+    return esp_timer_get_time() / 1000;
+#else
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+#if defined(ESP_PLATFORM)
+void WhoGatewayClient::task(void *args)
+{
+    WhoGatewayClient *self = (WhoGatewayClient *)args;
+    self->loop();
+    xSemaphoreGive(self->m_stopped);
+    vTaskDelete(NULL);
+}
+#endif
+
+void WhoGatewayClient::loop()
+{
+    ESP_LOGI(TAG, "Gateway %s:%d", m_host, m_port);
+    while (m_running) {
+        int64_t now_ms = get_time_ms();
+        state_t state = m_state.load(std::memory_order_relaxed);
+        if (state == STATE_DISCONNECTED && now_ms >= m_next_connect_ms) {
+            start_connect(now_ms);
+            state = m_state.load(std::memory_order_relaxed);
+        }
+        int64_t drain_wait_ms = -1;
+        if (m_journal) {
+            write_journal();
+            if (state == STATE_CONNECTED) {
+                drain_wait_ms = drain_journal(now_ms);
+            }
+        }
+        if (state == STATE_CONNECTED && m_send_pos == m_send_len) {
+            fill_send_buf();
+        }
+        if (state == STATE_CONNECTED && m_format == EVENT_FORMAT_WIRE) {
+            if (m_awaiting_ack && m_send_pos == m_send_len && now_ms - m_batch_sent_ms > ACK_TIMEOUT_MS) {
+                ESP_LOGW(TAG, "Batch %d not acknowledged", m_unacked_seq);
+                disconnect(now_ms);
+                continue;
+            }
+            if (m_heartbeat_ms > 0 && now_ms - m_last_tx_ms >= m_heartbeat_ms) {
+                send_heartbeat(now_ms);
+            }
+        }
+
+        fd_set rfds, wfds;
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+        FD_SET(m_wake_fd, &rfds);
+        int max_fd = m_wake_fd;
+        if (state == STATE_CONNECTING ||
+            (state == STATE_CONNECTED && (m_send_pos < m_send_len || m_ctrl_pos < m_ctrl_len))) {
+            FD_SET(m_sock, &wfds);
+        }
+        if (state == STATE_CONNECTED) {
+            FD_SET(m_sock, &rfds);
+        }
+        if (state != STATE_DISCONNECTED) {
+            max_fd = std::max(max_fd, m_sock);
+        }
+        // Only a pending reconnect, a heartbeat or an ack timeout needs a timeout, everything else wakes select() up.
+        int64_t wait_ms = -1;
+        if (state == STATE_DISCONNECTED) {
+            wait_ms = m_next_connect_ms - now_ms;
+        } else if (state == STATE_CONNECTED && m_format == EVENT_FORMAT_WIRE) {
+            wait_ms = m_heartbeat_ms > 0 ? m_last_tx_ms + m_heartbeat_ms - now_ms : ACK_TIMEOUT_MS;
+            if (m_awaiting_ack) {
+                wait_ms = std::min<int64_t>(wait_ms, m_batch_sent_ms + ACK_TIMEOUT_MS + 1 - now_ms);
+            }
+        }
+        if (drain_wait_ms >= 0) {
+            wait_ms = wait_ms < 0 ? drain_wait_ms : std::min(wait_ms, drain_wait_ms);
+        }
+        struct timeval tv;
+        struct timeval *timeout = nullptr;
+        if (wait_ms >= 0 || state == STATE_DISCONNECTED) {
+            wait_ms = std::max<int64_t>(wait_ms, 0);
+            tv.tv_sec = wait_ms / 1000;
+            tv.tv_usec = (wait_ms % 1000) * 1000;
+            timeout = &tv;
+        }
+        int n = select(max_fd + 1, &rfds, &wfds, nullptr, timeout);
+        if (n < 0) {
+            if (errno != EINTR) {
+                ESP_LOGE(TAG, "select failed: errno %d", errno);
+                disconnect(get_time_ms());
+            }
+            continue;
+        }
+        now_ms = get_time_ms();
+        if (FD_ISSET(m_wake_fd, &rfds)) {
+            drain_wake();
+        }
+        if (state == STATE_CONNECTING && FD_ISSET(m_sock, &wfds)) {
+            on_connect_done(now_ms);
+        } else if (state == STATE_CONNECTED) {
+            if (FD_ISSET(m_sock, &rfds) && !receive()) {
+                disconnect(now_ms);
+            } else if (FD_ISSET(m_sock, &wfds) && !flush()) {
+                disconnect(now_ms);
+            }
+        }
+    }
+    if (m_sock >= 0) {
+        close(m_sock);
+        m_sock = -1;
+    }
+    m_state = STATE_DISCONNECTED;
+    if (m_journal) {
+        write_journal();
+    }
+}
+
+void WhoGatewayClient::start_connect(int64_t now_ms)
+{
+    struct sockaddr_in dest_addr = {};
+    dest_addr.sin_family = AF_INET;
+    dest_addr.sin_port = htons(m_port);
+    dest_addr.sin_addr.s_addr = inet_addr(m_host);
+
+    m_sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (m_sock < 0) {
+        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+        disconnect(now_ms);
+        return;
+    }
+    fcntl(m_sock, F_SETFL, fcntl(m_sock, F_GETFL, 0) | O_NONBLOCK);
+    // Batches are built here, no need to wait for more data in the stack.
+    int one = 1;
+    setsockopt(m_sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    // A gateway which is switched off does not send a FIN, the keep-alive probes find out.
+    int keepidle = 5;
+    int keepinterval = 5;
+    int keepcount = 3;
+    setsockopt(m_sock, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+    setsockopt(m_sock, IPPROTO_TCP, TCP_KEEPIDLE, &keepidle, sizeof(keepidle));
+    setsockopt(m_sock, IPPROTO_TCP, TCP_KEEPINTVL, &keepinterval, sizeof(keepinterval));
+    setsockopt(m_sock, IPPROTO_TCP, TCP_KEEPCNT, &keepcount, sizeof(keepcount));
+
+    if (connect(m_sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) == 0) {
+        m_state = STATE_CONNECTING;
+        on_connect_done(now_ms);
+    } else if (errno == EINPROGRESS) {
+        m_state = STATE_CONNECTING;
+    } else {
+        ESP_LOGW(TAG, "Connect failed: errno %d", errno);
+        disconnect(now_ms);
+    }
+}
+
+void WhoGatewayClient::on_connect_done(int64_t now_ms)
+{
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(m_sock, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err) {
+        ESP_LOGW(TAG, "Connect failed: errno %d", err);
+        disconnect(now_ms);
+        return;
+    }
+    ESP_LOGI(TAG, "Connected to gateway %s:%d", m_host, m_port);
+    m_state = STATE_CONNECTED;
+    m_backoff_ms = m_min_backoff_ms;
+    // A command cut off by the disconnect is lost, it must not prefix the first one on the new connection.
+    m_parser.reset();
+    m_wire_parser.reset();
+    // Acks and heartbeats belong to the old connection.
+    m_ctrl_len = 0;
+    m_ctrl_pos = 0;
+    m_last_tx_ms = now_ms;
+    // The first bytes on the connection tell the gateway which protocol the camera speaks, before any trigger.
+    if (m_format == EVENT_FORMAT_WIRE) {
+        send_heartbeat(now_ms);
+    }
+    // Resend the batch which was cut off or not acknowledged, from its start.
+    if (m_send_pos < m_send_len || m_awaiting_ack) {
+        m_send_pos = 0;
+    }
+}
+
+void WhoGatewayClient::disconnect(int64_t now_ms)
+{
+    if (m_sock >= 0) {
+        close(m_sock);
+        m_sock = -1;
+    }
+    if (m_state.exchange(STATE_DISCONNECTED) == STATE_CONNECTED) {
+        ESP_LOGW(TAG, "Gateway disconnected");
+        m_reconnects++;
+    }
+    // Full jitter around the backoff keeps a group of cameras from reconnecting in lockstep.
+    m_rand ^= m_rand << 13;
+    m_rand ^= m_rand >> 17;
+    m_rand ^= m_rand << 5;
+    int jitter = m_backoff_ms / 4;
+    int delay_ms = m_backoff_ms - jitter + (int)(m_rand % (uint32_t)(2 * jitter + 1));
+    m_next_connect_ms = now_ms + delay_ms;
+    ESP_LOGD(TAG, "Reconnecting in %d ms", delay_ms);
+    m_backoff_ms = std::min(m_backoff_ms * 2, m_max_backoff_ms);
+}
+
+// Coalesces the queued events into one batch. An event larger than the space left waits for the next batch.
+void WhoGatewayClient::fill_send_buf()
+{
+    if (m_format == EVENT_FORMAT_WIRE) {
+        fill_wire_batch();
+        return;
+    }
+    m_send_len = 0;
+    m_send_pos = 0;
+    size_t len;
+    while (m_ring.front_len() && m_ring.front_len() <= m_send_buf.size() - m_send_len &&
+           m_ring.pop(m_send_buf.data() + m_send_len, m_send_buf.size() - m_send_len, len)) {
+        m_send_len += len;
+    }
+}
+
+// With the wire protocol the result records go into one WIRE_RESULT frame, which is kept until it is acknowledged.
+void WhoGatewayClient::fill_wire_batch()
+{
+    if (m_awaiting_ack) {
+        return;
+    }
+    size_t size = std::min(m_send_buf.size(), WIRE_HEADER_SIZE + WIRE_MAX_PAYLOAD);
+    size_t pos = WIRE_HEADER_SIZE;
+    size_t len;
+    uint8_t count = 0;
+    while (count < UINT8_MAX && m_ring.front_len() && m_ring.front_len() <= size - pos &&
+           m_ring.pop(m_send_buf.data() + pos, size - pos, len)) {
+        pos += len;
+        count++;
+    }
+    m_send_pos = 0;
+    m_send_len = 0;
+    if (!count) {
+        return;
+    }
+    m_unacked_seq = m_wire_seq++;
+    wire_put_header(m_send_buf.data(),
+                    {WIRE_RESULT, WIRE_FLAG_ACK_REQ, count, m_unacked_seq, (uint16_t)(pos - WIRE_HEADER_SIZE)});
+    m_send_len = pos;
+    m_awaiting_ack = true;
+}
+
+void WhoGatewayClient::send_heartbeat(int64_t now_ms)
+{
+    uint8_t frame[WIRE_HEADER_SIZE + 8];
+    size_t len =
+        wire_encode_heartbeat(frame, sizeof(frame), m_wire_seq++, (now_ms - m_start_ms) / 1000, get_dropped());
+    queue_ctrl(frame, len);
+    m_last_tx_ms = now_ms;
+}
+
+void WhoGatewayClient::queue_ctrl(const uint8_t *frame, size_t len)
+{
+    if (m_ctrl_pos == m_ctrl_len) {
+        m_ctrl_pos = 0;
+        m_ctrl_len = 0;
+    }
+    // Only appended to before the first byte is out, a full buffer drops the frame. An ack lost this way is
+    // harmless, the gateway sends its frame again after a timeout like one lost on the air.
+    if (m_ctrl_pos == 0 && m_ctrl_len + len <= sizeof(m_ctrl_buf)) {
+        memcpy(m_ctrl_buf + m_ctrl_len, frame, len);
+        m_ctrl_len += len;
+    }
+}
+
+// Returns false on a socket error, true otherwise, also if the data is only partly sent
+bool WhoGatewayClient::send_pending(const uint8_t *buf, size_t len, size_t &pos)
+{
+    while (pos < len) {
+        // A reset connection reports EPIPE instead of raising SIGPIPE on the host build.
+        int sent = send(m_sock, buf + pos, len - pos, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            ESP_LOGW(TAG, "Send failed: errno %d", errno);
+            return false;
+        }
+        pos += sent;
+        m_last_tx_ms = get_time_ms();
+    }
+    return true;
+}
+
+bool WhoGatewayClient::flush()
+{
+    // Control frames go out between batches, never into the middle of one.
+    bool at_boundary = m_send_pos == 0 || m_send_pos == m_send_len;
+    if (m_ctrl_pos < m_ctrl_len && (m_ctrl_pos > 0 || at_boundary)) {
+        if (!send_pending(m_ctrl_buf, m_ctrl_len, m_ctrl_pos)) {
+            return false;
+        }
+        if (m_ctrl_pos < m_ctrl_len) {
+            return true;
+        }
+    }
+    if (m_send_pos < m_send_len) {
+        if (!send_pending(m_send_buf.data(), m_send_len, m_send_pos)) {
+            return false;
+        }
+        if (m_send_pos == m_send_len) {
+            ESP_LOGD(TAG, "Sent %d bytes", (int)m_send_len);
+            m_batch_sent_ms = get_time_ms();
+        }
+    }
+    return true;
+}
+
+void WhoGatewayClient::write_journal()
+{
+    uint8_t record[EVENT_JOURNAL_DATA_SIZE];
+    size_t len;
+    while (m_journal_ring->pop(record, sizeof(record), len)) {
+        if (m_journal->append(record, len) != ESP_OK) {
+            ESP_LOGE(TAG, "Event lost, journal not writable");
+        }
+    }
+}
+
+// Forwards the next journal batch once the link is idle, i.e. no live event waits and the previous batch is out.
+// Returns the time until the next batch is due, -1 if there is nothing to wait for.
+int64_t WhoGatewayClient::drain_journal(int64_t now_ms)
+{
+    if (!m_ring.empty() || m_send_pos < m_send_len || m_awaiting_ack) {
+        return -1;
+    }
+    m_journal->commit();
+    if (!m_journal->get_unread()) {
+        return -1;
+    }
+    if (now_ms < m_next_drain_ms) {
+        return m_next_drain_ms - now_ms;
+    }
+    uint8_t record[EVENT_JOURNAL_DATA_SIZE];
+    size_t len;
+    for (int i = 0; i < m_drain_batch && m_journal->read(record, sizeof(record), len); i++) {
+        event_t event;
+        if (!decode_result_record(record, len, event)) {
+            continue;
+        }
+        if (!m_ring.push(event, m_format)) {
+            // Live events took the room, the record goes with the next batch.
+            m_journal->unread();
+            break;
+        }
+    }
+    m_next_drain_ms = now_ms + m_drain_interval_ms;
+    return -1;
+}
+
+void WhoGatewayClient::on_frame(const wire_header_t &header, const uint8_t *payload)
+{
+    switch (header.type) {
+    case WIRE_TRIGGER:
+        if (m_command_cb) {
+            m_command_cb(GATEWAY_CMD_TRIGGER);
+        }
+        break;
+    case WIRE_ACK: {
+        uint16_t acked_seq;
+        if (wire_decode_ack(payload, header.len, acked_seq) && m_awaiting_ack && acked_seq == m_unacked_seq) {
+            m_awaiting_ack = false;
+            m_send_len = 0;
+            m_send_pos = 0;
+        }
+        break;
+    }
+    case WIRE_CONFIG: {
+        wire_config_key_t key;
+        int32_t value;
+        if (wire_decode_config(payload, header.len, key, value) && m_config_cb) {
+            m_config_cb(key, value);
+        }
+        break;
+    }
+    case WIRE_HEARTBEAT:
+        break;
+    default:
+        ESP_LOGW(TAG, "Unknown frame type %d", header.type);
+        break;
+    }
+    if (header.flags & WIRE_FLAG_ACK_REQ) {
+        uint8_t frame[WIRE_HEADER_SIZE + 2];
+        size_t len = wire_encode_ack(frame, sizeof(frame), m_wire_seq++, header.seq);
+        queue_ctrl(frame, len);
+    }
+}
+
+bool WhoGatewayClient::receive()
+{
+    int n = recv(m_sock, m_recv_buf, sizeof(m_recv_buf), 0);
+    if (n > 0 && m_format == EVENT_FORMAT_WIRE) {
+        m_wire_parser.feed(
+            m_recv_buf, n, [this](const wire_header_t &header, const uint8_t *payload) { on_frame(header, payload); });
+        return true;
+    }
+    if (n > 0) {
+        m_parser.feed(m_recv_buf, n, [this](const char *line, size_t len) {
+            gateway_cmd_t cmd = parse_command(line, len);
+            if (cmd == GATEWAY_CMD_UNKNOWN) {
+                ESP_LOGW(TAG, "Unknown command: %.*s", (int)len, line);
+            } else if (m_command_cb) {
+                m_command_cb(cmd);
+            }
+        });
+        return true;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return true;
+    }
+    return false;
+}
+} // namespace gateway
+} // namespace who
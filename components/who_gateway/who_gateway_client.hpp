@@ -0,0 +1,187 @@
+#pragma once
+#include "esp_err.h"
+#include "who_event_journal.hpp"
+#include "who_event_ring.hpp"
+#include "who_gateway_parser.hpp"
+#include "who_wire.hpp"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+#if defined(ESP_PLATFORM)
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#else
+#include <thread>
+#endif
+
+namespace who {
+namespace gateway {
+// TCP client of the Arduino gateway, running on its own task.
+//
+// Producers hand events over with push(), which encodes them into a lock-free ring and wakes the network task
+// through an eventfd, so it is O(1) and never blocks, connected or not. The network task owns a non-blocking socket
+// and waits in select() on the socket and the eventfd together:
+//
+//  - connect() is asynchronous. A failed attempt is retried after an exponential backoff with jitter, capped at
+//    max_backoff_ms, and the backoff resets once a connection is up.
+//  - Everything queued while the previous write was in flight goes out in one send(), up to the send buffer size.
+//  - Received bytes are split into commands as soon as select() reports them, however TCP chunked them, and handed
+//    to the command callback right away.
+//  - A batch interrupted by a disconnect is sent again from its start after the reconnect, so the gateway never
+//    sees a truncated event. With JSON and TLV a batch is done once send() took it, the bytes still in the socket
+//    buffers when the link drops are lost. Only EVENT_FORMAT_WIRE, below, keeps a batch until it is acknowledged,
+//    so nothing is lost and the gateway may see an event twice instead. Events carry a seq to tell.
+//
+// With EVENT_FORMAT_WIRE the client speaks the binary protocol of who_wire.hpp instead of '\r' terminated lines:
+// the queued events go out as one WIRE_RESULT frame which is kept until the gateway acknowledges it. A heartbeat is
+// sent right after connecting, so the gateway can tell the protocol, and whenever the link has been idle for
+// heartbeat_ms. A batch which is not acknowledged within 5 s drops the connection, so a half-open socket is found
+// long before the keep-alive would.
+//
+// With a journal enabled, events pushed while the gateway is away go through a second ring to the network task,
+// which appends them to a WhoEventJournal on flash, so they survive an outage longer than the ring and a reboot.
+// After the reconnect the journal is drained in batches of drain_batch events, at most one every drain_interval_ms
+// and only while no live event is waiting, so a backlog never holds up live traffic. A batch is committed as drained
+// once it is sent, or acknowledged with EVENT_FORMAT_WIRE; a reboot before that sends it again. Without the wire
+// protocol a batch still in the socket buffers at a disconnect is lost like a live one.
+//
+// The same code builds on a Linux host, where the task is a std::thread.
+class WhoGatewayClient {
+public:
+    /**
+     * @param host      IPv4 address of the gateway.
+     * @param port      TCP port of the gateway.
+     * @param ring_len  events queued while the gateway is slow or away, older ones are kept and new ones dropped.
+     * @param slot_size largest encoded event.
+     * @param format    encoding of the events.
+     */
+    WhoGatewayClient(const char *host,
+                     uint16_t port,
+                     size_t ring_len,
+                     size_t slot_size,
+                     event_format_t format = EVENT_FORMAT_JSON);
+    ~WhoGatewayClient();
+    WhoGatewayClient(const WhoGatewayClient &) = delete;
+    WhoGatewayClient &operator=(const WhoGatewayClient &) = delete;
+
+    esp_err_t start();
+    void stop();
+    /**
+     * @brief Queue an event. Safe from any task.
+     *
+     * @return false if the queue is full or the event does not fit a slot, the event is dropped.
+     */
+    bool push(const event_t &event);
+    /**
+     * @brief Queue an already encoded message.
+     */
+    bool push(const void *data, size_t len);
+    bool is_connected() const { return m_state.load(std::memory_order_relaxed) == STATE_CONNECTED; }
+    /**
+     * @brief Called on the network task with every command received from the gateway, as soon as it is complete.
+     */
+    void set_command_cb(const std::function<void(gateway_cmd_t)> &command_cb) { m_command_cb = command_cb; }
+    /**
+     * @brief Called on the network task with every WIRE_CONFIG frame. Only with EVENT_FORMAT_WIRE.
+     */
+    void set_config_cb(const std::function<void(wire_config_key_t, int32_t)> &config_cb) { m_config_cb = config_cb; }
+    void set_backoff(int min_backoff_ms, int max_backoff_ms);
+    /**
+     * @brief Idle time before a heartbeat is sent, 0 for none. Only with EVENT_FORMAT_WIRE. The Arduino gateway drops
+     * a camera silent for 30 s, keep it well below that.
+     */
+    void set_heartbeat(int heartbeat_ms) { m_heartbeat_ms = heartbeat_ms; }
+    /**
+     * @brief Keep the events pushed while disconnected in a journal file. Call before start().
+     *
+     * @param path              journal file.
+     * @param capacity          events kept, the oldest is overwritten when it is full.
+     * @param drain_batch       events forwarded from the journal at a time after a reconnect.
+     * @param drain_interval_ms min time between two batches.
+     */
+    esp_err_t enable_journal(const char *path, size_t capacity, int drain_batch, int drain_interval_ms);
+    uint32_t get_dropped() const
+    {
+        return m_ring.get_dropped() + (m_journal_ring ? m_journal_ring->get_dropped() : 0);
+    }
+    uint32_t get_reconnects() const { return m_reconnects; }
+
+private:
+    typedef enum {
+        STATE_DISCONNECTED,
+        STATE_CONNECTING,
+        STATE_CONNECTED,
+    } state_t;
+
+    void loop();
+    void start_connect(int64_t now_ms);
+    void on_connect_done(int64_t now_ms);
+    void disconnect(int64_t now_ms);
+    void fill_send_buf();
+    void fill_wire_batch();
+    void send_heartbeat(int64_t now_ms);
+    void queue_ctrl(const uint8_t *frame, size_t len);
+    bool send_pending(const uint8_t *buf, size_t len, size_t &pos);
+    bool flush();
+    void on_frame(const wire_header_t &header, const uint8_t *payload);
+    void write_journal();
+    int64_t drain_journal(int64_t now_ms);
+    bool receive();
+    void wake();
+    void drain_wake();
+    static int64_t get_time_ms();
+#if defined(ESP_PLATFORM)
+    static void task(void *args);
+#endif
+
+    char m_host[16];
+    uint16_t m_port;
+    event_format_t m_format;
+    WhoEventRing m_ring;
+    std::atomic<state_t> m_state;
+    std::atomic<bool> m_running;
+    int m_sock;
+    int m_wake_fd;
+    int m_min_backoff_ms;
+    int m_max_backoff_ms;
+    int m_backoff_ms;
+    int64_t m_next_connect_ms;
+    uint32_t m_reconnects;
+    uint32_t m_rand;
+    // Batch being sent, m_send_pos bytes of it are already out.
+    std::vector<uint8_t> m_send_buf;
+    size_t m_send_len;
+    size_t m_send_pos;
+    uint8_t m_recv_buf[256];
+    WhoLineParser m_parser;
+    WhoWireParser m_wire_parser;
+    uint16_t m_wire_seq;
+    bool m_awaiting_ack;
+    uint16_t m_unacked_seq;
+    int64_t m_batch_sent_ms;
+    // Acks and heartbeats, sent between result batches.
+    uint8_t m_ctrl_buf[64];
+    size_t m_ctrl_len;
+    size_t m_ctrl_pos;
+    int m_heartbeat_ms;
+    int64_t m_start_ms;
+    int64_t m_last_tx_ms;
+    std::function<void(gateway_cmd_t)> m_command_cb;
+    std::function<void(wire_config_key_t, int32_t)> m_config_cb;
+    // Result records pushed while disconnected, on their way into the journal.
+    std::unique_ptr<WhoEventRing> m_journal_ring;
+    std::unique_ptr<WhoEventJournal> m_journal;
+    int m_drain_batch;
+    int m_drain_interval_ms;
+    int64_t m_next_drain_ms;
+#if defined(ESP_PLATFORM)
+    TaskHandle_t m_task;
+    SemaphoreHandle_t m_stopped;
+#else
+    std::thread m_thread;
+#endif
+};
+} // namespace gateway
+} // namespace who
@@ -0,0 +1,40 @@
+#include "who_gateway_parser.hpp"
+
+namespace who {
+namespace gateway {
+gateway_cmd_t parse_command(const char *line, size_t len)
+{
+    if (len == 1 && line[0] == '1') {
+        return GATEWAY_CMD_TRIGGER;
+    }
+    return GATEWAY_CMD_UNKNOWN;
+}
+
+void WhoLineParser::feed(const uint8_t *data, size_t len, const std::function<void(const char *, size_t)> &line_cb)
+{
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+        if (c == '\r' || c == '\n') {
+            if (!m_overflow && m_len) {
+                line_cb(m_buf, m_len);
+            }
+            m_len = 0;
+            m_overflow = false;
+        } else if (m_overflow) {
+            continue;
+        } else if (m_len == sizeof(m_buf)) {
+            m_overflow = true;
+            m_dropped++;
+        } else {
+            m_buf[m_len++] = c;
+        }
+    }
+}
+
+void WhoLineParser::reset()
+{
+    m_len = 0;
+    m_overflow = false;
+}
+} // namespace gateway
+} // namespace who
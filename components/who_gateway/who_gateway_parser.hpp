@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace who {
+namespace gateway {
+typedef enum {
+    GATEWAY_CMD_UNKNOWN = 0,
+    GATEWAY_CMD_TRIGGER, // "1", the PIR sensor saw motion.
+} gateway_cmd_t;
+
+/**
+ * @brief Map one line received from the gateway to a command.
+ */
+gateway_cmd_t parse_command(const char *line, size_t len);
+
+// Splits the byte stream from the gateway into lines.
+//
+// TCP delivers whatever arrived, so one recv() may hold half a command or several of them. The parser keeps the
+// partial line in a fixed buffer across calls and hands out every complete one. Both '\r' and '\n' end a line and
+// empty lines are skipped, so "\r\n" endings work too. A line longer than the buffer is dropped up to its end.
+class WhoLineParser {
+public:
+    WhoLineParser() : m_len(0), m_overflow(false), m_dropped(0) {}
+    void feed(const uint8_t *data, size_t len, const std::function<void(const char *, size_t)> &line_cb);
+    void reset();
+    uint32_t get_dropped() const { return m_dropped; }
+
+private:
+    char m_buf[128];
+    size_t m_len;
+    bool m_overflow;
+    uint32_t m_dropped;
+};
+} // namespace gateway
+} // namespace who
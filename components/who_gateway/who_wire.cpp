@@ -0,0 +1,200 @@
+#include "who_wire.hpp"
+#include <cmath>
+#include <cstring>
+
+namespace who {
+namespace gateway {
+static void put_u16(uint8_t *buf, uint16_t val)
+{
+    buf[0] = val;
+    buf[1] = val >> 8;
+}
+
+static void put_u32(uint8_t *buf, uint32_t val)
+{
+    put_u16(buf, val);
+    put_u16(buf + 2, val >> 16);
+}
+
+static uint16_t get_u16(const uint8_t *buf)
+{
+    return buf[0] | (buf[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *buf)
+{
+    return get_u16(buf) | ((uint32_t)get_u16(buf + 2) << 16);
+}
+
+void wire_put_header(uint8_t *buf, const wire_header_t &header)
+{
+    buf[0] = WIRE_MAGIC;
+    buf[1] = header.type;
+    buf[2] = header.flags;
+    buf[3] = header.count;
+    put_u16(buf + 4, header.seq);
+    put_u16(buf + 6, header.len);
+}
+
+size_t wire_encode(uint8_t *buf,
+                   size_t size,
+                   wire_msg_type_t type,
+                   uint8_t flags,
+                   uint16_t seq,
+                   const void *payload,
+                   size_t len,
+                   uint8_t count)
+{
+    if (len > WIRE_MAX_PAYLOAD || WIRE_HEADER_SIZE + len > size) {
+        return 0;
+    }
+    wire_put_header(buf, {type, flags, count, seq, (uint16_t)len});
+    if (len) {
+        memcpy(buf + WIRE_HEADER_SIZE, payload, len);
+    }
+    return WIRE_HEADER_SIZE + len;
+}
+
+size_t wire_encode_ack(uint8_t *buf, size_t size, uint16_t seq, uint16_t acked_seq)
+{
+    uint8_t payload[2];
+    put_u16(payload, acked_seq);
+    return wire_encode(buf, size, WIRE_ACK, 0, seq, payload, sizeof(payload));
+}
+
+size_t wire_encode_heartbeat(uint8_t *buf, size_t size, uint16_t seq, uint32_t uptime_s, uint32_t dropped)
+{
+    uint8_t payload[8];
+    put_u32(payload, uptime_s);
+    put_u32(payload + 4, dropped);
+    return wire_encode(buf, size, WIRE_HEARTBEAT, 0, seq, payload, sizeof(payload));
+}
+
+size_t wire_encode_config(uint8_t *buf, size_t size, uint16_t seq, wire_config_key_t key, int32_t value)
+{
+    uint8_t payload[5];
+    payload[0] = key;
+    put_u32(payload + 1, (uint32_t)value);
+    return wire_encode(buf, size, WIRE_CONFIG, WIRE_FLAG_ACK_REQ, seq, payload, sizeof(payload));
+}
+
+bool wire_decode_ack(const uint8_t *payload, size_t len, uint16_t &acked_seq)
+{
+    if (len < 2) {
+        return false;
+    }
+    acked_seq = get_u16(payload);
+    return true;
+}
+
+bool wire_decode_config(const uint8_t *payload, size_t len, wire_config_key_t &key, int32_t &value)
+{
+    if (len < 5) {
+        return false;
+    }
+    key = (wire_config_key_t)payload[0];
+    value = (int32_t)get_u32(payload + 1);
+    return true;
+}
+
+size_t get_result_record_size(const event_t &event)
+{
+    int num_faces = event.num_faces < EVENT_MAX_FACES ? event.num_faces : EVENT_MAX_FACES;
+    return 10 + 7 * num_faces;
+}
+
+size_t encode_result_record(const event_t &event, uint8_t *buf, size_t size)
+{
+    size_t len = get_result_record_size(event);
+    if (len > size) {
+        return 0;
+    }
+    int num_faces = (len - 10) / 7;
+    put_u32(buf, event.seq);
+    put_u32(buf + 4, (uint32_t)event.timestamp_ms);
+    buf[8] = event.type;
+    buf[9] = num_faces;
+    uint8_t *p = buf + 10;
+    for (int i = 0; i < num_faces; i++, p += 7) {
+        const event_face_t &face = event.faces[i];
+        float similarity = face.similarity > 1.f ? 1.f : (face.similarity < -1.f ? -1.f : face.similarity);
+        put_u16(p, face.track);
+        put_u16(p + 2, face.id);
+        p[4] = face.status;
+        put_u16(p + 5, (uint16_t)(int16_t)lroundf(similarity * 10000));
+    }
+    return len;
+}
+
+size_t decode_result_record(const uint8_t *buf, size_t len, event_t &event)
+{
+    memset(&event, 0, sizeof(event));
+    if (len < 10 || len < 10 + 7 * (size_t)buf[9]) {
+        return 0;
+    }
+    event.seq = get_u32(buf);
+    event.timestamp_ms = get_u32(buf + 4);
+    event.type = (event_type_t)buf[8];
+    int num_faces = buf[9];
+    const uint8_t *p = buf + 10;
+    for (int i = 0; i < num_faces; i++, p += 7) {
+        if (i >= EVENT_MAX_FACES) {
+            continue;
+        }
+        event_face_t &face = event.faces[event.num_faces++];
+        face.track = get_u16(p);
+        face.id = get_u16(p + 2);
+        face.status = p[4];
+        face.similarity = (int16_t)get_u16(p + 5) / 10000.f;
+    }
+    return 10 + 7 * num_faces;
+}
+
+size_t WhoWireParser::consume(const uint8_t *data, size_t len)
+{
+    if (m_len == 0 && data[0] != WIRE_MAGIC) {
+        m_skipped++;
+        return 1;
+    }
+    size_t need;
+    if (m_len < WIRE_HEADER_SIZE) {
+        need = WIRE_HEADER_SIZE - m_len;
+    } else {
+        need = WIRE_HEADER_SIZE + get_u16(m_buf + 6) - m_len;
+    }
+    size_t n = len < need ? len : need;
+    memcpy(m_buf + m_len, data, n);
+    m_len += n;
+    if (m_len == WIRE_HEADER_SIZE && get_u16(m_buf + 6) > WIRE_MAX_PAYLOAD) {
+        // Not a frame after all, look for the next magic after this one.
+        m_skipped++;
+        m_len--;
+        memmove(m_buf, m_buf + 1, m_len);
+        uint8_t *magic = (uint8_t *)memchr(m_buf, WIRE_MAGIC, m_len);
+        if (magic) {
+            m_len -= magic - m_buf;
+            memmove(m_buf, magic, m_len);
+        } else {
+            m_len = 0;
+        }
+    }
+    return n;
+}
+
+bool WhoWireParser::get_frame(wire_header_t &header)
+{
+    if (m_len < WIRE_HEADER_SIZE) {
+        return false;
+    }
+    header.len = get_u16(m_buf + 6);
+    if (m_len != WIRE_HEADER_SIZE + header.len) {
+        return false;
+    }
+    header.type = m_buf[1];
+    header.flags = m_buf[2];
+    header.count = m_buf[3];
+    header.seq = get_u16(m_buf + 4);
+    return true;
+}
+} // namespace gateway
+} // namespace who
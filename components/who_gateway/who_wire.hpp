@@ -0,0 +1,134 @@
+#pragma once
+#include "who_event.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace who {
+namespace gateway {
+// Binary wire protocol between the camera and the gateway.
+//
+// Every message is a frame: an 8 byte header followed by len bytes of payload. All fields are little-endian.
+//
+//  offset 0  u8   magic, WIRE_MAGIC. Never '{' or a digit, so a gateway can tell the protocol from the first byte
+//  offset 1  u8   type, wire_msg_type_t
+//  offset 2  u8   flags, wire_flag_t
+//  offset 3  u8   count, number of records in a batched payload
+//  offset 4  u16  seq, per sender and connection, wraps around
+//  offset 6  u16  len, payload bytes
+//
+// Payloads:
+//  WIRE_TRIGGER    empty, the PIR sensor saw motion
+//  WIRE_RESULT     count result records, see encode_result_record()
+//  WIRE_HEARTBEAT  u32 uptime_s, u32 events dropped
+//  WIRE_CONFIG     u8 wire_config_key_t, i32 value
+//  WIRE_ACK        u16 seq of the acknowledged frame
+//
+// A frame with WIRE_FLAG_ACK_REQ is acknowledged by the receiver with a WIRE_ACK carrying its seq. The camera keeps
+// its result batch until it is acknowledged and sends it again after a reconnect. The codec never allocates.
+inline constexpr uint8_t WIRE_MAGIC = 0xa7;
+inline constexpr size_t WIRE_HEADER_SIZE = 8;
+inline constexpr size_t WIRE_MAX_PAYLOAD = 1024;
+
+typedef enum : uint8_t {
+    WIRE_TRIGGER = 1,
+    WIRE_RESULT = 2,
+    WIRE_HEARTBEAT = 3,
+    WIRE_CONFIG = 4,
+    WIRE_ACK = 5,
+} wire_msg_type_t;
+
+typedef enum : uint8_t {
+    WIRE_FLAG_ACK_REQ = 1 << 0,
+} wire_flag_t;
+
+typedef enum : uint8_t {
+    WIRE_CONFIG_CONTINUOUS = 1, // 0 or 1, continuous recognition.
+} wire_config_key_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t flags;
+    uint8_t count;
+    uint16_t seq;
+    uint16_t len;
+} wire_header_t;
+
+void wire_put_header(uint8_t *buf, const wire_header_t &header);
+/**
+ * @brief Encode a frame.
+ *
+ * @return bytes written, 0 if the buffer is too small or the payload too long.
+ */
+size_t wire_encode(uint8_t *buf,
+                   size_t size,
+                   wire_msg_type_t type,
+                   uint8_t flags,
+                   uint16_t seq,
+                   const void *payload,
+                   size_t len,
+                   uint8_t count = 0);
+size_t wire_encode_ack(uint8_t *buf, size_t size, uint16_t seq, uint16_t acked_seq);
+size_t wire_encode_heartbeat(uint8_t *buf, size_t size, uint16_t seq, uint32_t uptime_s, uint32_t dropped);
+size_t wire_encode_config(uint8_t *buf, size_t size, uint16_t seq, wire_config_key_t key, int32_t value);
+/**
+ * @brief Decode the payload of a WIRE_ACK or WIRE_CONFIG frame.
+ *
+ * @return false if the payload is too short.
+ */
+bool wire_decode_ack(const uint8_t *payload, size_t len, uint16_t &acked_seq);
+bool wire_decode_config(const uint8_t *payload, size_t len, wire_config_key_t &key, int32_t &value);
+
+/**
+ * @brief Size of the result record of an event.
+ */
+size_t get_result_record_size(const event_t &event);
+/**
+ * @brief Encode an event as a result record:
+ *
+ *  u32 seq, u32 timestamp_ms (low 32 bits), u8 type, u8 num_faces,
+ *  num_faces * (u16 track, u16 id, u8 status, i16 similarity * 10000)
+ *
+ * @return bytes written, 0 if the buffer is too small.
+ */
+size_t encode_result_record(const event_t &event, uint8_t *buf, size_t size);
+/**
+ * @brief Decode one result record.
+ *
+ * @return bytes consumed, 0 if the record is truncated.
+ */
+size_t decode_result_record(const uint8_t *buf, size_t len, event_t &event);
+
+// Splits a byte stream into frames.
+//
+// Like WhoLineParser, partial and coalesced frames are handled with a fixed buffer. A byte which can not start a
+// frame, a bad magic or a payload longer than WIRE_MAX_PAYLOAD, is skipped so the parser finds the next frame.
+class WhoWireParser {
+public:
+    WhoWireParser() : m_len(0), m_skipped(0) {}
+    template <typename F>
+    void feed(const uint8_t *data, size_t len, F &&frame_cb)
+    {
+        while (len) {
+            size_t n = consume(data, len);
+            data += n;
+            len -= n;
+            wire_header_t header;
+            if (get_frame(header)) {
+                frame_cb(header, m_buf + WIRE_HEADER_SIZE);
+                m_len = 0;
+            }
+        }
+    }
+    void reset() { m_len = 0; }
+    uint32_t get_skipped() const { return m_skipped; }
+
+private:
+    size_t consume(const uint8_t *data, size_t len);
+    bool get_frame(wire_header_t &header);
+
+    uint8_t m_buf[WIRE_HEADER_SIZE + WIRE_MAX_PAYLOAD];
+    size_t m_len;
+    uint32_t m_skipped;
+};
+} // namespace gateway
+} // namespace who
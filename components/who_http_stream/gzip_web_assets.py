@@ -0,0 +1,44 @@
+#!/usr/bin/env python3
+"""Gzips the files of a web page for embedding, see who_embed_web_assets() in project_include.cmake.
+
+usage: gzip_web_assets.py <out_dir> <file>...
+
+Every file is written to <out_dir>/<name>.gz. In the .html files {{name}} becomes /name?v=<hash of that file>, so a
+page always links the files it was built with and those may be cached for good. The output only changes with the
+input, a rebuild without changes flashes the same image.
+"""
+import gzip
+import hashlib
+import os
+import re
+import sys
+
+
+def main():
+    out_dir = sys.argv[1]
+    assets = {}
+    for path in sys.argv[2:]:
+        with open(path, "rb") as f:
+            assets[os.path.basename(path)] = f.read()
+    versions = {
+        name: hashlib.sha1(data).hexdigest()[:8]
+        for name, data in assets.items()
+        if not name.endswith(".html")
+    }
+
+    def link(match):
+        name = match.group(1).decode()
+        if name not in versions:
+            sys.exit("{{%s}} is not one of the web assets" % name)
+        return ("/%s?v=%s" % (name, versions[name])).encode()
+
+    for name, data in assets.items():
+        if name.endswith(".html"):
+            data = re.sub(rb"\{\{([^{}]+)\}\}", link, data)
+        # No file name or time in the header, that would change the output on every build.
+        with open(os.path.join(out_dir, name + ".gz"), "wb") as f:
+            f.write(gzip.compress(data, compresslevel=9, mtime=0))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,26 @@
+set(WHO_HTTP_STREAM_DIR ${CMAKE_CURRENT_LIST_DIR})
+
+# who_embed_web_assets(<dir> <file>...)
+#
+# Gzips the files of a web page in <dir> at build time and embeds them into the calling component, as
+# _binary_<file>_gz_start and _binary_<file>_gz_end with the dots of <file> as underscores. Serve them with
+# WhoWebAssets. In .html files {{<file>}} links one of the other files with its version.
+function(who_embed_web_assets dir)
+    idf_build_get_property(python PYTHON)
+    set(inputs)
+    set(outputs)
+    foreach(file ${ARGN})
+        list(APPEND inputs ${dir}/${file})
+        list(APPEND outputs ${CMAKE_CURRENT_BINARY_DIR}/${file}.gz)
+    endforeach()
+    add_custom_command(OUTPUT ${outputs}
+                       COMMAND ${python} ${WHO_HTTP_STREAM_DIR}/gzip_web_assets.py ${CMAKE_CURRENT_BINARY_DIR} ${inputs}
+                       DEPENDS ${inputs} ${WHO_HTTP_STREAM_DIR}/gzip_web_assets.py
+                       COMMENT "Compressing web assets"
+                       VERBATIM)
+    add_custom_target(${COMPONENT_NAME}_web_assets DEPENDS ${outputs})
+    add_dependencies(${COMPONENT_LIB} ${COMPONENT_NAME}_web_assets)
+    foreach(output ${outputs})
+        target_add_binary_data(${COMPONENT_LIB} ${output} BINARY)
+    endforeach()
+endfunction()
@@ -0,0 +1,314 @@
+#include "who_event_stream.hpp"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_vfs_eventfd.h"
+#include "lwip/sockets.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+static const char *TAG = "WhoEventStream";
+
+namespace who {
+namespace http_stream {
+WhoEventStream::WhoEventStream(uint8_t max_clients, uint8_t history, uint32_t keepalive_ms) :
+    m_max_clients(max_clients),
+    m_history_len(history),
+    m_keepalive_us(keepalive_ms * 1000LL),
+    m_clients(new client_t[max_clients]()),
+    m_history(new entry_t[history]()),
+    m_mutex(xSemaphoreCreateMutex()),
+    m_stopped(xSemaphoreCreateBinary()),
+    m_running(false),
+    m_num_clients(0),
+    m_last_id(0),
+    m_dropped(0),
+    m_wake_fd(-1)
+{
+}
+
+WhoEventStream::~WhoEventStream()
+{
+    stop();
+    vSemaphoreDelete(m_stopped);
+    vSemaphoreDelete(m_mutex);
+}
+
+esp_err_t WhoEventStream::start(const configSTACK_DEPTH_TYPE stack_depth, UBaseType_t priority)
+{
+    if (m_running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // Registering twice is harmless, the second call reports ESP_ERR_INVALID_STATE.
+    esp_vfs_eventfd_config_t config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+    esp_err_t ret = esp_vfs_eventfd_register(&config);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Failed to register eventfd: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    m_wake_fd = eventfd(0, 0);
+    if (m_wake_fd < 0) {
+        ESP_LOGE(TAG, "Failed to create eventfd");
+        return ESP_ERR_NO_MEM;
+    }
+    m_running = true;
+    if (xTaskCreate(task, "EventStream", stack_depth, this, priority, nullptr) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create task");
+        m_running = false;
+        close(m_wake_fd);
+        m_wake_fd = -1;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void WhoEventStream::stop()
+{
+    if (!m_running.exchange(false)) {
+        return;
+    }
+    wake();
+    xSemaphoreTake(m_stopped, portMAX_DELAY);
+    for (int i = 0; i < m_max_clients; i++) {
+        if (m_clients[i].req) {
+            close_client(m_clients[i]);
+        }
+    }
+    close(m_wake_fd);
+    m_wake_fd = -1;
+}
+
+esp_err_t WhoEventStream::add_client(httpd_req_t *req)
+{
+    if (!m_running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // A reconnecting EventSource says which event it saw last.
+    char last_event_id[16];
+    bool resume = httpd_req_get_hdr_value_str(req, "Last-Event-ID", last_event_id, sizeof(last_event_id)) == ESP_OK;
+    uint32_t seen = resume ? strtoul(last_event_id, nullptr, 10) : 0;
+
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    client_t *client = nullptr;
+    for (int i = 0; i < m_max_clients; i++) {
+        if (!m_clients[i].req) {
+            client = &m_clients[i];
+            break;
+        }
+    }
+    if (!client) {
+        xSemaphoreGive(m_mutex);
+        return ESP_ERR_NO_MEM;
+    }
+    httpd_req_t *async_req;
+    esp_err_t ret = httpd_req_async_handler_begin(req, &async_req);
+    if (ret != ESP_OK) {
+        xSemaphoreGive(m_mutex);
+        ESP_LOGE(TAG, "Failed to take the request over: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    client->fd = httpd_req_to_sockfd(async_req);
+    client->head_len = snprintf(client->head,
+                                sizeof(client->head),
+                                "HTTP/1.1 200 OK\r\n"
+                                "Content-Type: text/event-stream\r\n"
+                                "Access-Control-Allow-Origin: *\r\n"
+                                "Cache-Control: no-store\r\n"
+                                "Connection: close\r\n\r\n"
+                                "retry: 2000\n\n");
+    client->pos = 0;
+    // Replay the events missed since Last-Event-ID if the ring still has them all, a new page starts from now.
+    uint32_t last_id = m_last_id;
+    bool replay = resume && seen <= last_id && last_id - seen < m_history_len;
+    client->next_id = replay ? seen + 1 : last_id + 1;
+    client->last_send_us = esp_timer_get_time();
+    client->req = async_req;
+    m_num_clients++;
+    xSemaphoreGive(m_mutex);
+    ESP_LOGI(TAG,
+             "Event client on socket %d, %d events to replay",
+             client->fd,
+             (int)(last_id + 1 - client->next_id));
+    wake();
+    return ESP_OK;
+}
+
+uint32_t WhoEventStream::publish(const char *event, const char *data)
+{
+    static const char *format = "id: %lu\nevent: %s\ndata: %s\n\n";
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    uint32_t id = m_last_id + 1;
+    // Measured first, a slot is only overwritten with an event that fits.
+    int len = snprintf(nullptr, 0, format, (unsigned long)id, event, data);
+    if (len < 0 || len >= (int)EVENT_MAX_LEN) {
+        xSemaphoreGive(m_mutex);
+        ESP_LOGE(TAG, "Event %s too long: %d bytes", event, len);
+        return 0;
+    }
+    entry_t &entry = m_history[id % m_history_len];
+    entry.id = id;
+    entry.len = snprintf(entry.text, EVENT_MAX_LEN, format, (unsigned long)id, event, data);
+    m_last_id = id;
+    xSemaphoreGive(m_mutex);
+    wake();
+    return id;
+}
+
+void WhoEventStream::wake()
+{
+    uint64_t one = 1;
+    if (m_wake_fd >= 0) {
+        // Only fails if the counter would overflow, the task is awake then anyway.
+        (void)!write(m_wake_fd, &one, sizeof(one));
+    }
+}
+
+void WhoEventStream::task(void *args)
+{
+    WhoEventStream *self = (WhoEventStream *)args;
+    self->loop();
+    xSemaphoreGive(self->m_stopped);
+    vTaskDelete(NULL);
+}
+
+bool WhoEventStream::pending(const client_t &client) const
+{
+    return client.head_len || client.next_id <= m_last_id;
+}
+
+bool WhoEventStream::flush(client_t &client, int64_t now_us)
+{
+    while (pending(client)) {
+        const char *buf;
+        size_t len;
+        if (client.head_len) {
+            buf = client.head;
+            len = client.head_len;
+        } else {
+            const entry_t &entry = m_history[client.next_id % m_history_len];
+            if (entry.id != client.next_id) {
+                // Overwritten by newer events while this client lagged.
+                ESP_LOGW(TAG, "Event client on socket %d fell behind, dropped", client.fd);
+                m_dropped++;
+                return false;
+            }
+            buf = entry.text;
+            len = entry.len;
+        }
+        int sent = send(client.fd, buf + client.pos, len - client.pos, MSG_DONTWAIT);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            ESP_LOGI(TAG, "Event client on socket %d gone: errno %d", client.fd, errno);
+            return false;
+        }
+        client.pos += sent;
+        client.last_send_us = now_us;
+        if (client.pos == len) {
+            if (client.head_len) {
+                client.head_len = 0;
+            } else {
+                client.next_id++;
+            }
+            client.pos = 0;
+        }
+    }
+    return true;
+}
+
+void WhoEventStream::close_client(client_t &client)
+{
+    httpd_handle_t handle = client.req->handle;
+    httpd_req_async_handler_complete(client.req);
+    httpd_sess_trigger_close(handle, client.fd);
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    client.req = nullptr;
+    m_num_clients--;
+    xSemaphoreGive(m_mutex);
+}
+
+void WhoEventStream::loop()
+{
+    while (m_running) {
+        fd_set rfds, wfds;
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+        FD_SET(m_wake_fd, &rfds);
+        int max_fd = m_wake_fd;
+        uint32_t active = 0, lagged = 0;
+        int64_t now_us = esp_timer_get_time();
+
+        xSemaphoreTake(m_mutex, portMAX_DELAY);
+        for (int i = 0; i < m_max_clients; i++) {
+            client_t &client = m_clients[i];
+            if (!client.req) {
+                continue;
+            }
+            active |= 1 << i;
+            // A client whose socket stays full is not flushed, catch it falling out of the ring here.
+            if (m_last_id - client.next_id + 1 > m_history_len) {
+                lagged |= 1 << i;
+                continue;
+            }
+            if (!pending(client) && now_us - client.last_send_us > m_keepalive_us) {
+                client.head_len = snprintf(client.head, sizeof(client.head), ": keepalive\n\n");
+                client.pos = 0;
+            }
+            if (pending(client)) {
+                FD_SET(client.fd, &wfds);
+            }
+            // A closed stream shows up as readable.
+            FD_SET(client.fd, &rfds);
+            max_fd = std::max(max_fd, client.fd);
+        }
+        xSemaphoreGive(m_mutex);
+        for (int i = 0; i < m_max_clients; i++) {
+            if (lagged & (1 << i)) {
+                ESP_LOGW(TAG, "Event client on socket %d fell behind, dropped", m_clients[i].fd);
+                m_dropped++;
+                close_client(m_clients[i]);
+            }
+        }
+        active &= ~lagged;
+
+        // Events and clients wake select() up, the timeout only paces the keepalives.
+        struct timeval tv = {1, 0};
+        int n = select(max_fd + 1, &rfds, &wfds, nullptr, active ? &tv : nullptr);
+        if (n < 0) {
+            if (errno != EINTR) {
+                ESP_LOGE(TAG, "select failed: errno %d", errno);
+                vTaskDelay(pdMS_TO_TICKS(100));
+            }
+            continue;
+        }
+        if (FD_ISSET(m_wake_fd, &rfds)) {
+            uint64_t count;
+            (void)!read(m_wake_fd, &count, sizeof(count));
+        }
+        now_us = esp_timer_get_time();
+        for (int i = 0; i < m_max_clients; i++) {
+            if (!(active & (1 << i))) {
+                continue;
+            }
+            client_t &client = m_clients[i];
+            bool ok = true;
+            if (FD_ISSET(client.fd, &rfds)) {
+                char buf[64];
+                int len = recv(client.fd, buf, sizeof(buf), MSG_DONTWAIT);
+                ok = len > 0 || (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+            }
+            if (ok && FD_ISSET(client.fd, &wfds)) {
+                // The ring is only read under the mutex, publish() may be overwriting a slot.
+                xSemaphoreTake(m_mutex, portMAX_DELAY);
+                ok = flush(client, now_us);
+                xSemaphoreGive(m_mutex);
+            }
+            if (!ok) {
+                close_client(client);
+            }
+        }
+    }
+}
+} // namespace http_stream
+} // namespace who
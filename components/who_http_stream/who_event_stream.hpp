@@ -0,0 +1,95 @@
+#pragma once
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <atomic>
+#include <memory>
+
+namespace who {
+namespace http_stream {
+// Server-sent events (text/event-stream) pushed to every connected page.
+//
+// Like the MJPEG senders, add_client() takes the request over with httpd_req_async_handler_begin() and one task
+// serves all clients from a select() loop, woken by an eventfd when an event is published:
+//
+//  - publish() formats the event once into a ring of the last history events and returns, it never blocks on a
+//    client and allocates nothing, so it can be called from the recognition task.
+//  - Every client sends straight from the ring at its own pace. A client which falls more than history events
+//    behind is dropped, the browser reconnects and its Last-Event-ID header replays what the ring still holds.
+//  - A comment line goes out after keepalive_ms without an event, so a dead peer is noticed and proxies keep the
+//    connection open.
+class WhoEventStream {
+public:
+    static inline constexpr size_t EVENT_MAX_LEN = 384;
+
+    /**
+     * @param max_clients  concurrent event streams.
+     * @param history      events kept for slow and reconnecting clients.
+     * @param keepalive_ms idle time before a keepalive comment is sent.
+     */
+    WhoEventStream(uint8_t max_clients, uint8_t history = 16, uint32_t keepalive_ms = 15000);
+    ~WhoEventStream();
+    WhoEventStream(const WhoEventStream &) = delete;
+    WhoEventStream &operator=(const WhoEventStream &) = delete;
+
+    esp_err_t start(const configSTACK_DEPTH_TYPE stack_depth, UBaseType_t priority);
+    void stop();
+    /**
+     * @brief Take an event stream request over from an HTTP handler, which returns right after.
+     *
+     * @return ESP_ERR_NO_MEM if max_clients streams already run, the handler still owns the request then.
+     */
+    esp_err_t add_client(httpd_req_t *req);
+    /**
+     * @brief Send an event to every client.
+     *
+     * @param event event name, the page listens for it with addEventListener().
+     * @param data  one line of data, usually compact JSON.
+     * @return the event id, 0 if the event does not fit in EVENT_MAX_LEN.
+     */
+    uint32_t publish(const char *event, const char *data);
+    uint8_t get_num_clients() const { return m_num_clients; }
+    uint32_t get_last_id() const { return m_last_id; }
+    uint32_t get_dropped() const { return m_dropped; }
+
+private:
+    typedef struct {
+        uint32_t id;
+        uint16_t len;
+        char text[EVENT_MAX_LEN];
+    } entry_t;
+
+    typedef struct {
+        httpd_req_t *req; // async copy of the request, nullptr if the slot is free.
+        int fd;
+        char head[192]; // HTTP response header or keepalive comment, sent before the next event.
+        size_t head_len;
+        uint32_t next_id; // event to send after head.
+        size_t pos;       // bytes of head, then of the event next_id, sent.
+        int64_t last_send_us;
+    } client_t;
+
+    static void task(void *args);
+    void loop();
+    bool pending(const client_t &client) const;
+    bool flush(client_t &client, int64_t now_us);
+    void close_client(client_t &client);
+    void wake();
+
+    uint8_t m_max_clients;
+    uint8_t m_history_len;
+    int64_t m_keepalive_us;
+    std::unique_ptr<client_t[]> m_clients;
+    std::unique_ptr<entry_t[]> m_history;
+    SemaphoreHandle_t m_mutex; // guards m_history and m_last_id against publish().
+    SemaphoreHandle_t m_stopped;
+    std::atomic<bool> m_running;
+    std::atomic<uint8_t> m_num_clients;
+    std::atomic<uint32_t> m_last_id;
+    std::atomic<uint32_t> m_dropped;
+    int m_wake_fd;
+};
+} // namespace http_stream
+} // namespace who
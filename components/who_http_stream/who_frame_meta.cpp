@@ -0,0 +1,62 @@
+#include "who_frame_meta.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace who {
+namespace http_stream {
+static int64_t to_us(const struct timeval &timestamp)
+{
+    return (int64_t)timestamp.tv_sec * 1000000 + timestamp.tv_usec;
+}
+
+WhoFrameMeta::WhoFrameMeta() :
+    m_mutex(xSemaphoreCreateMutex()), m_records(new record_t[META_HISTORY]()), m_next(0)
+{
+}
+
+WhoFrameMeta::~WhoFrameMeta()
+{
+    delete[] m_records;
+    vSemaphoreDelete(m_mutex);
+}
+
+bool WhoFrameMeta::publish(const struct timeval &timestamp, const char *text, size_t len)
+{
+    if (len > META_MAX_LEN) {
+        return false;
+    }
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    record_t &record = m_records[m_next];
+    m_next = (m_next + 1) % META_HISTORY;
+    // A timestamp of 0 marks an empty slot, the first frame of a camera without clock still counts.
+    record.timestamp_us = std::max<int64_t>(to_us(timestamp), 1);
+    record.len = len;
+    memcpy(record.text, text, len);
+    xSemaphoreGive(m_mutex);
+    return true;
+}
+
+size_t WhoFrameMeta::copy_for(const struct timeval &timestamp, char *buf, struct timeval &record_timestamp)
+{
+    int64_t frame_us = std::max<int64_t>(to_us(timestamp), 1);
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    const record_t *best = nullptr;
+    for (int i = 0; i < META_HISTORY; i++) {
+        const record_t &record = m_records[i];
+        if (record.timestamp_us && record.timestamp_us <= frame_us &&
+            (!best || record.timestamp_us > best->timestamp_us)) {
+            best = &record;
+        }
+    }
+    size_t len = 0;
+    if (best) {
+        len = best->len;
+        memcpy(buf, best->text, len);
+        record_timestamp.tv_sec = best->timestamp_us / 1000000;
+        record_timestamp.tv_usec = best->timestamp_us % 1000000;
+    }
+    xSemaphoreGive(m_mutex);
+    return len;
+}
+} // namespace http_stream
+} // namespace who
@@ -0,0 +1,54 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <sys/time.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace who {
+namespace http_stream {
+// Per-frame metadata sent along with the MJPEG frames, e.g. the detection boxes as JSON.
+//
+// The detect task publishes a record for every frame it processed, keyed by the camera timestamp of the frame. The
+// encoder stage runs at its own pace on the same pipeline, so a stream frame goes out with the newest record not
+// younger than the frame: the boxes of that very frame if detection ran on it, else of the last frame before it.
+// The records are kept in a small ring and copied out under a mutex, publishing never waits for a client.
+class WhoFrameMeta {
+public:
+    static inline constexpr size_t META_MAX_LEN = 1024;
+    static inline constexpr uint8_t META_HISTORY = 8;
+
+    WhoFrameMeta();
+    ~WhoFrameMeta();
+    WhoFrameMeta(const WhoFrameMeta &) = delete;
+    WhoFrameMeta &operator=(const WhoFrameMeta &) = delete;
+
+    /**
+     * @param timestamp camera timestamp of the frame the record describes.
+     * @param text      record, not null terminated. Longer than META_MAX_LEN is refused.
+     * @return false if the record is too long.
+     */
+    bool publish(const struct timeval &timestamp, const char *text, size_t len);
+    /**
+     * @brief Copy the record that goes with a frame.
+     *
+     * @param timestamp camera timestamp of the frame.
+     * @param buf       META_MAX_LEN bytes.
+     * @param record_timestamp timestamp of the record copied.
+     * @return length of the record, 0 if there is none for the frame.
+     */
+    size_t copy_for(const struct timeval &timestamp, char *buf, struct timeval &record_timestamp);
+
+private:
+    typedef struct {
+        int64_t timestamp_us; // 0 if the slot is empty.
+        uint16_t len;
+        char text[META_MAX_LEN];
+    } record_t;
+
+    SemaphoreHandle_t m_mutex;
+    record_t *m_records;
+    uint8_t m_next;
+};
+} // namespace http_stream
+} // namespace who
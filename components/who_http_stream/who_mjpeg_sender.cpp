@@ -0,0 +1,422 @@
+#include "who_mjpeg_sender.hpp"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_vfs_eventfd.h"
+#include "lwip/sockets.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+static const char *TAG = "WhoMjpegSender";
+
+#define PART_BOUNDARY "123456789000000000000987654321"
+// Room in front of the record for the part header and the JSON around the record.
+#define META_RESERVE 320
+
+namespace who {
+namespace http_stream {
+WhoMjpegSender::WhoMjpegSender(frame_jpeg::WhoFrameJpeg *source,
+                               uint8_t max_clients,
+                               uint8_t num_senders,
+                               uint32_t stall_timeout_ms) :
+    m_source(source),
+    m_max_clients(max_clients),
+    m_num_senders(num_senders),
+    m_stall_timeout_us(stall_timeout_ms * 1000LL),
+    m_clients(new client_t[max_clients]()),
+    m_senders(new sender_t[num_senders]()),
+    m_mutex(xSemaphoreCreateMutex()),
+    m_stopped(xSemaphoreCreateCounting(num_senders, 0)),
+    m_running(false),
+    m_num_clients(0),
+    m_next_sender(0),
+    m_controller(nullptr),
+    m_frame_meta(nullptr),
+    m_sent(0),
+    m_skipped(0),
+    m_dropped(0)
+{
+    assert(max_clients <= 32 && num_senders >= 1);
+    for (int i = 0; i < num_senders; i++) {
+        m_senders[i].self = this;
+        m_senders[i].index = i;
+        m_senders[i].wake_fd = -1;
+    }
+    source->add_new_jpeg_cb([this](const frame_jpeg::jpeg_frame_t *) {
+        for (int i = 0; i < m_num_senders; i++) {
+            wake(m_senders[i]);
+        }
+    });
+}
+
+WhoMjpegSender::~WhoMjpegSender()
+{
+    stop();
+    vSemaphoreDelete(m_stopped);
+    vSemaphoreDelete(m_mutex);
+}
+
+esp_err_t WhoMjpegSender::start(const configSTACK_DEPTH_TYPE stack_depth, UBaseType_t priority)
+{
+    if (m_running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // Registering twice is harmless, the second call reports ESP_ERR_INVALID_STATE.
+    esp_vfs_eventfd_config_t config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+    esp_err_t ret = esp_vfs_eventfd_register(&config);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Failed to register eventfd: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    m_running = true;
+    for (int i = 0; i < m_num_senders; i++) {
+        sender_t &sender = m_senders[i];
+        sender.wake_fd = eventfd(0, 0);
+        char name[16];
+        snprintf(name, sizeof(name), "MjpegSender%d", i);
+        if (sender.wake_fd < 0 || xTaskCreate(task, name, stack_depth, &sender, priority, &sender.task) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to start sender %d", i);
+            if (sender.wake_fd >= 0) {
+                close(sender.wake_fd);
+                sender.wake_fd = -1;
+            }
+            // The senders already running stop as well.
+            m_num_senders = i;
+            stop();
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+
+void WhoMjpegSender::stop()
+{
+    if (!m_running.exchange(false)) {
+        return;
+    }
+    for (int i = 0; i < m_num_senders; i++) {
+        wake(m_senders[i]);
+    }
+    for (int i = 0; i < m_num_senders; i++) {
+        xSemaphoreTake(m_stopped, portMAX_DELAY);
+    }
+    for (int i = 0; i < m_max_clients; i++) {
+        if (m_clients[i].req) {
+            close_client(m_clients[i]);
+        }
+    }
+    for (int i = 0; i < m_num_senders; i++) {
+        close(m_senders[i].wake_fd);
+        m_senders[i].wake_fd = -1;
+    }
+}
+
+esp_err_t WhoMjpegSender::add_client(httpd_req_t *req, bool meta)
+{
+    if (!m_running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    client_t *client = nullptr;
+    for (int i = 0; i < m_max_clients; i++) {
+        if (!m_clients[i].req) {
+            client = &m_clients[i];
+            break;
+        }
+    }
+    if (!client) {
+        xSemaphoreGive(m_mutex);
+        return ESP_ERR_NO_MEM;
+    }
+    httpd_req_t *async_req;
+    esp_err_t ret = httpd_req_async_handler_begin(req, &async_req);
+    if (ret != ESP_OK) {
+        xSemaphoreGive(m_mutex);
+        ESP_LOGE(TAG, "Failed to take the request over: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    client->fd = httpd_req_to_sockfd(async_req);
+    client->sender = m_next_sender;
+    m_next_sender = (m_next_sender + 1) % m_num_senders;
+    client->frame = nullptr;
+    client->tail.reset(meta && m_frame_meta ? new char[META_RESERVE + WhoFrameMeta::META_MAX_LEN + 1] : nullptr);
+    client->tail_len = 0;
+    // The response header goes out like a frame without data, the stream is not chunked and ends with the connection.
+    client->head_len = snprintf(client->head,
+                                sizeof(client->head),
+                                "HTTP/1.1 200 OK\r\n"
+                                "Content-Type: multipart/x-mixed-replace;boundary=" PART_BOUNDARY "\r\n"
+                                "Access-Control-Allow-Origin: *\r\n"
+                                "Cache-Control: no-store\r\n"
+                                "Connection: close\r\n\r\n");
+    client->pos = 0;
+    client->last_seq = 0;
+    client->last_progress_us = esp_timer_get_time();
+    client->sent_len = 0;
+    if (m_controller) {
+        m_controller->reset(client->link);
+    }
+    client->req = async_req;
+    m_num_clients++;
+    xSemaphoreGive(m_mutex);
+    ESP_LOGI(TAG,
+             "Stream client on socket %d, sender %d%s",
+             client->fd,
+             client->sender,
+             client->tail ? ", with metadata" : "");
+    wake(m_senders[client->sender]);
+    return ESP_OK;
+}
+
+void WhoMjpegSender::wake(sender_t &sender)
+{
+    uint64_t one = 1;
+    if (sender.wake_fd >= 0) {
+        // Only fails if the counter would overflow, the sender is awake then anyway.
+        (void)!write(sender.wake_fd, &one, sizeof(one));
+    }
+}
+
+void WhoMjpegSender::task(void *args)
+{
+    sender_t *sender = (sender_t *)args;
+    sender->self->loop(*sender);
+    xSemaphoreGive(sender->self->m_stopped);
+    vTaskDelete(NULL);
+}
+
+bool WhoMjpegSender::start_frame(client_t &client, frame_jpeg::jpeg_frame_t *frame)
+{
+    if (frame->seq == client.last_seq) {
+        return false;
+    }
+    if (client.last_seq && frame->seq - client.last_seq > 1) {
+        m_skipped += frame->seq - client.last_seq - 1;
+    }
+    client.frame = frame;
+    client.head_len = snprintf(client.head,
+                               sizeof(client.head),
+                               "\r\n--" PART_BOUNDARY "\r\n"
+                               "Content-Type: image/jpeg\r\n"
+                               "Content-Length: %u\r\n"
+                               "X-Frame-Seq: %lu\r\n"
+                               "X-Timestamp: %lld.%06ld\r\n\r\n",
+                               (unsigned)frame->len,
+                               (unsigned long)frame->seq,
+                               (long long)frame->timestamp.tv_sec,
+                               (long)frame->timestamp.tv_usec);
+    if (client.tail) {
+        format_meta(client, frame);
+    }
+    client.pos = 0;
+    client.last_progress_us = esp_timer_get_time();
+    return true;
+}
+
+// The record is copied right behind the room for the part header and the JSON prefix, which are then put in front
+// of it, so the part goes out as one piece without another copy.
+void WhoMjpegSender::format_meta(client_t &client, const frame_jpeg::jpeg_frame_t *frame)
+{
+    char *record = client.tail.get() + META_RESERVE;
+    struct timeval record_timestamp = {};
+    size_t record_len = m_frame_meta->copy_for(frame->timestamp, record, record_timestamp);
+    if (!record_len) {
+        memcpy(record, "null", 4);
+        record_len = 4;
+    }
+    record[record_len++] = '}';
+    char prefix[160];
+    int prefix_len = snprintf(prefix,
+                              sizeof(prefix),
+                              "{\"seq\":%lu,\"ts\":%lld,\"width\":%u,\"height\":%u,\"meta_ts\":%lld,\"meta\":",
+                              (unsigned long)frame->seq,
+                              (long long)frame->timestamp.tv_sec * 1000000 + frame->timestamp.tv_usec,
+                              frame->width,
+                              frame->height,
+                              (long long)record_timestamp.tv_sec * 1000000 + record_timestamp.tv_usec);
+    char head[160];
+    int head_len = snprintf(head,
+                            sizeof(head),
+                            "\r\n--" PART_BOUNDARY "\r\n"
+                            "Content-Type: application/json\r\n"
+                            "Content-Length: %u\r\n"
+                            "X-Frame-Seq: %lu\r\n\r\n",
+                            (unsigned)(prefix_len + record_len),
+                            (unsigned long)frame->seq);
+    static_assert(sizeof(prefix) + sizeof(head) <= META_RESERVE, "no room for the metadata part header");
+    client.tail_start = META_RESERVE - prefix_len - head_len;
+    memcpy(client.tail.get() + client.tail_start, head, head_len);
+    memcpy(client.tail.get() + client.tail_start + head_len, prefix, prefix_len);
+    client.tail_len = head_len + prefix_len + record_len;
+}
+
+size_t WhoMjpegSender::total(const client_t &client)
+{
+    return client.head_len + (client.frame ? client.frame->len + client.tail_len : 0);
+}
+
+bool WhoMjpegSender::flush(client_t &client, int64_t now_us)
+{
+    size_t total = WhoMjpegSender::total(client);
+    while (client.pos < total) {
+        const uint8_t *buf;
+        size_t len;
+        size_t frame_end = client.head_len + (client.frame ? client.frame->len : 0);
+        if (client.pos < client.head_len) {
+            buf = (const uint8_t *)client.head + client.pos;
+            len = client.head_len - client.pos;
+        } else if (client.pos < frame_end) {
+            buf = client.frame->buf + client.pos - client.head_len;
+            len = frame_end - client.pos;
+        } else {
+            buf = (const uint8_t *)client.tail.get() + client.tail_start + client.pos - frame_end;
+            len = total - client.pos;
+        }
+        int sent = send(client.fd, buf, len, MSG_DONTWAIT);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            ESP_LOGI(TAG, "Stream client on socket %d gone: errno %d", client.fd, errno);
+            return false;
+        }
+        client.pos += sent;
+        client.last_progress_us = now_us;
+    }
+    if (client.frame) {
+        client.last_seq = client.frame->seq;
+        client.sent_len = client.frame->len;
+        client.sent_us = now_us;
+        frame_jpeg::WhoFrameJpeg::release(client.frame);
+        client.frame = nullptr;
+        m_sent++;
+    }
+    client.head_len = 0;
+    client.tail_len = 0;
+    client.pos = 0;
+    return true;
+}
+
+void WhoMjpegSender::close_client(client_t &client)
+{
+    frame_jpeg::WhoFrameJpeg::release(client.frame);
+    client.frame = nullptr;
+    client.tail.reset();
+    httpd_handle_t handle = client.req->handle;
+    httpd_req_async_handler_complete(client.req);
+    httpd_sess_trigger_close(handle, client.fd);
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    client.req = nullptr;
+    m_num_clients--;
+    xSemaphoreGive(m_mutex);
+}
+
+void WhoMjpegSender::loop(sender_t &sender)
+{
+    while (m_running) {
+        fd_set rfds, wfds;
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+        FD_SET(sender.wake_fd, &rfds);
+        int max_fd = sender.wake_fd;
+        uint32_t mine = 0;
+        int64_t now_us = esp_timer_get_time();
+        // Wake up for the first client the controller holds back.
+        int64_t next_due_us = INT64_MAX;
+
+        // A client done with its frame takes the latest one, whatever was published in between is skipped. The links
+        // are only touched under the mutex, the controller reads those of every sender.
+        xSemaphoreTake(m_mutex, portMAX_DELAY);
+        for (int i = 0; i < m_max_clients; i++) {
+            client_t &client = m_clients[i];
+            if (!client.req || client.sender != sender.index) {
+                continue;
+            }
+            mine |= 1 << i;
+            if (m_controller && client.sent_len) {
+                m_controller->on_frame_sent(client.link, client.sent_len, client.sent_us);
+                client.sent_len = 0;
+            }
+            bool idle = client.pos == total(client);
+            int64_t due_us;
+            if (idle && m_controller && !m_controller->due(client.link, now_us, due_us)) {
+                next_due_us = std::min(next_due_us, due_us);
+            } else if (idle) {
+                frame_jpeg::jpeg_frame_t *frame = m_source->acquire();
+                if (frame && start_frame(client, frame)) {
+                    idle = false;
+                    if (m_controller) {
+                        m_controller->start(client.link, now_us);
+                    }
+                } else {
+                    frame_jpeg::WhoFrameJpeg::release(frame);
+                }
+            }
+            if (!idle) {
+                FD_SET(client.fd, &wfds);
+            }
+            // A closed stream shows up as readable.
+            FD_SET(client.fd, &rfds);
+            max_fd = std::max(max_fd, client.fd);
+        }
+        if (m_controller) {
+            const WhoStreamController::link_t *links[32];
+            int num_links = 0;
+            for (int i = 0; i < m_max_clients; i++) {
+                if (m_clients[i].req) {
+                    links[num_links++] = &m_clients[i].link;
+                }
+            }
+            m_controller->update(links, num_links, now_us);
+        }
+        xSemaphoreGive(m_mutex);
+
+        // New frames and clients wake select() up, the timeout only catches stalled clients and clients the
+        // controller held back.
+        struct timeval tv = {1, 0};
+        if (next_due_us != INT64_MAX) {
+            int64_t wait_us = std::clamp<int64_t>(next_due_us - now_us, 1000, 1000000);
+            tv = {(time_t)(wait_us / 1000000), (suseconds_t)(wait_us % 1000000)};
+        }
+        int n = select(max_fd + 1, &rfds, &wfds, nullptr, mine ? &tv : nullptr);
+        if (n < 0) {
+            if (errno != EINTR) {
+                ESP_LOGE(TAG, "select failed: errno %d", errno);
+                vTaskDelay(pdMS_TO_TICKS(100));
+            }
+            continue;
+        }
+        if (FD_ISSET(sender.wake_fd, &rfds)) {
+            uint64_t count;
+            (void)!read(sender.wake_fd, &count, sizeof(count));
+        }
+        now_us = esp_timer_get_time();
+        for (int i = 0; i < m_max_clients; i++) {
+            if (!(mine & (1 << i))) {
+                continue;
+            }
+            client_t &client = m_clients[i];
+            bool ok = true;
+            if (FD_ISSET(client.fd, &rfds)) {
+                char buf[64];
+                int len = recv(client.fd, buf, sizeof(buf), MSG_DONTWAIT);
+                ok = len > 0 || (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+            }
+            if (ok && FD_ISSET(client.fd, &wfds)) {
+                ok = flush(client, now_us);
+            }
+            bool pending = client.pos < total(client);
+            if (ok && pending && now_us - client.last_progress_us > m_stall_timeout_us) {
+                ESP_LOGW(TAG, "Stream client on socket %d stalled, dropped", client.fd);
+                m_dropped++;
+                ok = false;
+            }
+            if (!ok) {
+                close_client(client);
+            }
+        }
+    }
+}
+} // namespace http_stream
+} // namespace who
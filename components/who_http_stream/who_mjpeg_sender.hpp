@@ -0,0 +1,123 @@
+#pragma once
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "who_frame_jpeg.hpp"
+#include "who_frame_meta.hpp"
+#include "who_stream_controller.hpp"
+#include <atomic>
+#include <memory>
+
+namespace who {
+namespace http_stream {
+// MJPEG (multipart/x-mixed-replace) stream clients served off the HTTP server workers.
+//
+// add_client() hands a stream request over with httpd_req_async_handler_begin() and the handler returns at once, so
+// a stream never holds an HTTP server worker. The clients are spread over a small pool of sender tasks, each waiting
+// in select() on its clients' sockets and an eventfd which the encoder stage signals with every new frame:
+//
+//  - Sends are non-blocking. A client takes a reference to the latest frame whenever it is done with the previous
+//    one, so the newest frame always wins and the frames published while its socket was backed up are skipped, not
+//    queued. The pace of each client is what its link absorbs, up to the encoder frame rate.
+//  - A client which made no progress for stall_timeout_ms is dropped.
+//  - At most max_clients streams run at a time, add_client() refuses more.
+//  - With a WhoStreamController, each client is paced to its link and the encoder follows the clients.
+//  - Every JPEG part carries X-Frame-Seq and X-Timestamp headers. A client asking for metadata gets a JSON part after
+//    each JPEG part with the same X-Frame-Seq, see WhoFrameMeta:
+//      {"seq":12,"ts":1718000000123456,"width":320,"height":240,"meta_ts":1718000000090000,"meta":{...}}
+//    "ts" is the camera timestamp of the frame in us, "meta" the record of "meta_ts" or null. A browser <img> does not
+//    handle a JSON part, such a client reads the stream with fetch() and draws the frames itself.
+class WhoMjpegSender {
+public:
+    /**
+     * @param source           encoder stage whose frames are streamed.
+     * @param max_clients      concurrent streams.
+     * @param num_senders      sender tasks.
+     * @param stall_timeout_ms a client whose socket took nothing for this long is dropped.
+     */
+    WhoMjpegSender(frame_jpeg::WhoFrameJpeg *source,
+                   uint8_t max_clients,
+                   uint8_t num_senders,
+                   uint32_t stall_timeout_ms = 5000);
+    ~WhoMjpegSender();
+    WhoMjpegSender(const WhoMjpegSender &) = delete;
+    WhoMjpegSender &operator=(const WhoMjpegSender &) = delete;
+
+    esp_err_t start(const configSTACK_DEPTH_TYPE stack_depth, UBaseType_t priority);
+    void stop();
+    /**
+     * @brief Take a stream request over from an HTTP handler, which returns right after.
+     *
+     * @param meta send a metadata part after every frame, if there is a WhoFrameMeta.
+     * @return ESP_ERR_NO_MEM if max_clients streams already run, the handler still owns the request then.
+     */
+    esp_err_t add_client(httpd_req_t *req, bool meta = false);
+    /**
+     * @brief Adapt the streams to the links and the CPU, see WhoStreamController. Set before start().
+     */
+    void set_controller(WhoStreamController *controller) { m_controller = controller; }
+    /**
+     * @brief Records for the clients asking for metadata. Set before start().
+     */
+    void set_frame_meta(WhoFrameMeta *frame_meta) { m_frame_meta = frame_meta; }
+    uint8_t get_num_clients() const { return m_num_clients; }
+    uint32_t get_sent() const { return m_sent; }
+    uint32_t get_skipped() const { return m_skipped; }
+    uint32_t get_dropped() const { return m_dropped; }
+
+private:
+    typedef struct {
+        httpd_req_t *req; // async copy of the request, nullptr if the slot is free.
+        int fd;
+        uint8_t sender;
+        frame_jpeg::jpeg_frame_t *frame; // being sent, nullptr between frames.
+        char head[192];                  // HTTP response header or part header sent before frame.
+        size_t head_len;
+        std::unique_ptr<char[]> tail; // metadata part sent after frame, nullptr without metadata.
+        size_t tail_start;
+        size_t tail_len;
+        size_t pos; // bytes of head, frame and tail sent.
+        uint32_t last_seq;
+        int64_t last_progress_us;
+        size_t sent_len; // of the frame sent last, until the controller accounted for it.
+        int64_t sent_us;
+        WhoStreamController::link_t link;
+    } client_t;
+
+    typedef struct {
+        WhoMjpegSender *self;
+        uint8_t index;
+        int wake_fd;
+        TaskHandle_t task;
+    } sender_t;
+
+    static void task(void *args);
+    void loop(sender_t &sender);
+    bool start_frame(client_t &client, frame_jpeg::jpeg_frame_t *frame);
+    void format_meta(client_t &client, const frame_jpeg::jpeg_frame_t *frame);
+    static size_t total(const client_t &client);
+    bool flush(client_t &client, int64_t now_us);
+    void close_client(client_t &client);
+    void wake(sender_t &sender);
+
+    frame_jpeg::WhoFrameJpeg *m_source;
+    uint8_t m_max_clients;
+    uint8_t m_num_senders;
+    int64_t m_stall_timeout_us;
+    std::unique_ptr<client_t[]> m_clients;
+    std::unique_ptr<sender_t[]> m_senders;
+    SemaphoreHandle_t m_mutex;
+    SemaphoreHandle_t m_stopped;
+    std::atomic<bool> m_running;
+    std::atomic<uint8_t> m_num_clients;
+    uint8_t m_next_sender;
+    WhoStreamController *m_controller;
+    WhoFrameMeta *m_frame_meta;
+    std::atomic<uint32_t> m_sent;
+    std::atomic<uint32_t> m_skipped;
+    std::atomic<uint32_t> m_dropped;
+};
+} // namespace http_stream
+} // namespace who
@@ -0,0 +1,125 @@
+#include "who_stream_controller.hpp"
+#include "esp_log.h"
+#include <algorithm>
+
+static const char *TAG = "WhoStreamController";
+
+namespace who {
+namespace http_stream {
+// Frames to wait after a step, and frames in a row well under the target before stepping up.
+#define LEVEL_HOLD_FRAMES 3
+#define LEVEL_UP_FRAMES 10
+#define UPDATE_INTERVAL_US 500000
+#define MIN_FPS 2
+
+WhoStreamController::WhoStreamController(frame_jpeg::WhoFrameJpeg *source,
+                                         uint8_t max_quality,
+                                         uint8_t max_fps,
+                                         uint32_t target_latency_ms,
+                                         uint8_t cpu_percent) :
+    m_source(source),
+    m_max_quality(max_quality),
+    m_max_fps(std::max<uint8_t>(max_fps, 1)),
+    m_target_latency_us(target_latency_ms * 1000),
+    m_cpu_us_per_s(cpu_percent * 10000),
+    m_level(0),
+    m_cpu_level(0),
+    m_fps(m_max_fps),
+    m_last_update_us(0)
+{
+}
+
+void WhoStreamController::reset(link_t &link) const
+{
+    link = {};
+    link.level = m_level;
+}
+
+void WhoStreamController::on_frame_sent(link_t &link, size_t len, int64_t now_us) const
+{
+    int64_t send_us = std::max<int64_t>(now_us - link.last_start_us, 1);
+    uint32_t bytes_per_s = (uint32_t)std::min<int64_t>(len * 1000000LL / send_us, UINT32_MAX);
+    uint32_t sent_us = (uint32_t)std::min<int64_t>(send_us, UINT32_MAX);
+    link.bytes_per_s = link.bytes_per_s ? (uint32_t)((3ULL * link.bytes_per_s + bytes_per_s) / 4) : bytes_per_s;
+    link.send_us = link.send_us ? (uint32_t)((3ULL * link.send_us + sent_us) / 4) : sent_us;
+    // 80 % of the link, the socket buffer drains between frames.
+    link.interval_us = link.bytes_per_s ? len * 1250000LL / link.bytes_per_s : 0;
+    if (link.hold) {
+        link.hold--;
+        return;
+    }
+    if (link.send_us > m_target_latency_us) {
+        if (link.level < NUM_LEVELS - 1) {
+            link.level++;
+            link.hold = LEVEL_HOLD_FRAMES;
+        }
+        link.good = 0;
+    } else if (link.send_us < m_target_latency_us / 2) {
+        if (++link.good >= LEVEL_UP_FRAMES && link.level > 0) {
+            link.level--;
+            link.hold = LEVEL_HOLD_FRAMES;
+            link.good = 0;
+        }
+    } else {
+        link.good = 0;
+    }
+}
+
+bool WhoStreamController::due(const link_t &link, int64_t now_us, int64_t &next_us) const
+{
+    next_us = link.last_start_us + link.interval_us;
+    return now_us >= next_us;
+}
+
+void WhoStreamController::update(const link_t *const *links, int num_links, int64_t now_us)
+{
+    if (!num_links || now_us - m_last_update_us < UPDATE_INTERVAL_US) {
+        return;
+    }
+    m_last_update_us = now_us;
+    uint8_t level = NUM_LEVELS - 1;
+    int64_t interval_us = INT64_MAX;
+    for (int i = 0; i < num_links; i++) {
+        level = std::min(level, links[i]->level);
+        interval_us = std::min(interval_us, links[i]->interval_us);
+    }
+    // No point in encoding frames faster than the fastest client takes them.
+    uint32_t fps = interval_us > 0 ? (uint32_t)std::min<int64_t>(1000000 / interval_us, m_max_fps) : m_max_fps;
+    fps = std::max<uint32_t>(fps, 1);
+
+    // The encode time is that of the level the encoder runs at, a step down costs up to a quarter of it.
+    uint32_t encode_us = m_source->get_encode_us();
+    if (encode_us) {
+        uint32_t cpu_fps = m_cpu_us_per_s / encode_us;
+        if (cpu_fps < MIN_FPS && m_level < NUM_LEVELS - 1) {
+            // The quality hardly changes the encode time, go straight to the next smaller size.
+            m_cpu_level = m_level + 1;
+            while (m_cpu_level < NUM_LEVELS - 1 && LEVELS[m_cpu_level].scale == LEVELS[m_level].scale) {
+                m_cpu_level++;
+            }
+        } else if (m_cpu_level && m_level == m_cpu_level && fps * encode_us < m_cpu_us_per_s / 4) {
+            m_cpu_level--;
+        }
+        fps = std::clamp<uint32_t>(cpu_fps, 1, fps);
+    }
+    level = std::max(level, m_cpu_level);
+
+    if (level != m_level) {
+        const level_t &next = LEVELS[level];
+        ESP_LOGI(TAG,
+                 "Level %d: quality %d%%, 1/%d size, %lu fps",
+                 level,
+                 next.quality_percent,
+                 1 << next.scale,
+                 (unsigned long)fps);
+        m_source->set_quality(std::max(m_max_quality * next.quality_percent / 100, 1));
+        m_source->set_scale(next.scale);
+        m_level = level;
+    }
+    if (fps != m_fps) {
+        m_source->set_max_fps(fps);
+        m_fps = fps;
+    }
+}
+} // namespace http_stream
+} // namespace who
@@ -0,0 +1,85 @@
+#pragma once
+#include "who_frame_jpeg.hpp"
+#include <cstddef>
+#include <cstdint>
+
+namespace who {
+namespace http_stream {
+// Adapts the MJPEG streams to their links and to the CPU time the encoder may take from detection.
+//
+// Every client has a link_t which the sender feeds with each frame it started and finished sending. From the time a
+// frame takes to go into the socket, the client asks for a level of the ladder below: it steps to a smaller frame when
+// that exceeds the target latency and back up after a run of frames well under it. From the measured throughput, the
+// client is paced to the frame rate its link carries with some headroom, so frames do not pile up in the socket
+// buffers.
+//
+// There is one encoder for all clients, so update() sets it to the best level any client asked for and to the frame
+// rate of the fastest client, within max_fps. A client asking for a lower level gets fewer of those frames instead.
+// If the encoder would take more than cpu_percent of a core at that rate, the frame rate is lowered first and then
+// the level, so a poor link or a busy core never has streaming compete with detection for cycles.
+class WhoStreamController {
+public:
+    typedef struct {
+        uint8_t quality_percent; // of the configured quality.
+        uint8_t scale;           // see WhoFrameJpeg::set_scale().
+    } level_t;
+
+    static inline constexpr level_t LEVELS[] = {{100, 0}, {75, 0}, {50, 0}, {75, 1}, {50, 1}, {50, 2}};
+    static inline constexpr uint8_t NUM_LEVELS = sizeof(LEVELS) / sizeof(LEVELS[0]);
+
+    typedef struct {
+        uint8_t level;         // asked for by this client, 0 is the best.
+        uint8_t good;          // frames in a row well under the target latency.
+        uint8_t hold;          // frames to wait before the next step, the estimates settle meanwhile.
+        uint32_t send_us;      // moving average of the time a frame takes to send.
+        uint32_t bytes_per_s;  // moving average of the throughput while sending.
+        int64_t interval_us;   // min time between the starts of two frames.
+        int64_t last_start_us; // start of the last frame.
+    } link_t;
+
+    /**
+     * @param source            encoder stage of the streams.
+     * @param max_quality       JPEG quality of level 0, 1-100.
+     * @param max_fps           max frames encoded per second.
+     * @param target_latency_ms time a frame may take to send.
+     * @param cpu_percent       share of a core the encoder may take.
+     */
+    WhoStreamController(frame_jpeg::WhoFrameJpeg *source,
+                        uint8_t max_quality,
+                        uint8_t max_fps,
+                        uint32_t target_latency_ms,
+                        uint8_t cpu_percent);
+
+    /**
+     * @brief Set a new client up at the level the encoder runs at.
+     */
+    void reset(link_t &link) const;
+    void start(link_t &link, int64_t now_us) const { link.last_start_us = now_us; }
+    /**
+     * @brief Account for the frame of len bytes started last, whose last byte was sent at now_us.
+     */
+    void on_frame_sent(link_t &link, size_t len, int64_t now_us) const;
+    /**
+     * @return whether the client may start its next frame, else the time it may in next_us.
+     */
+    bool due(const link_t &link, int64_t now_us, int64_t &next_us) const;
+    /**
+     * @brief Set the encoder up for the clients. Cheap when called often, it only acts every half second.
+     */
+    void update(const link_t *const *links, int num_links, int64_t now_us);
+    uint8_t get_level() const { return m_level; }
+    uint8_t get_fps() const { return m_fps; }
+
+private:
+    frame_jpeg::WhoFrameJpeg *m_source;
+    uint8_t m_max_quality;
+    uint8_t m_max_fps;
+    uint32_t m_target_latency_us;
+    uint32_t m_cpu_us_per_s; // encoder time allowed per second.
+    uint8_t m_level;         // the encoder runs at.
+    uint8_t m_cpu_level;     // best level the CPU budget allows.
+    uint8_t m_fps;
+    int64_t m_last_update_us;
+};
+} // namespace http_stream
+} // namespace who
@@ -0,0 +1,65 @@
+#include "who_web_assets.hpp"
+#include "esp_log.h"
+#include <cstdio>
+#include <cstring>
+
+static const char *TAG = "WhoWebAssets";
+
+namespace who {
+namespace http_stream {
+WhoWebAssets::WhoWebAssets(const web_asset_t *assets, size_t num_assets) :
+    m_num_assets(num_assets), m_entries(new entry_t[num_assets]())
+{
+    for (size_t i = 0; i < num_assets; i++) {
+        // FNV-1a of the compressed bytes, once here rather than per request.
+        uint32_t hash = 2166136261u;
+        for (const uint8_t *p = assets[i].start; p < assets[i].end; p++) {
+            hash = (hash ^ *p) * 16777619u;
+        }
+        m_entries[i].asset = &assets[i];
+        snprintf(m_entries[i].etag, sizeof(m_entries[i].etag), "\"%08lx\"", (unsigned long)hash);
+    }
+}
+
+esp_err_t WhoWebAssets::register_handlers(httpd_handle_t server)
+{
+    for (size_t i = 0; i < m_num_assets; i++) {
+        httpd_uri_t uri = {};
+        uri.uri = m_entries[i].asset->uri;
+        uri.method = HTTP_GET;
+        uri.handler = handler;
+        uri.user_ctx = &m_entries[i];
+        esp_err_t ret = httpd_register_uri_handler(server, &uri);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to register %s: %s", uri.uri, esp_err_to_name(ret));
+            return ret;
+        }
+        ESP_LOGI(TAG,
+                 "%s, %d bytes gzipped",
+                 uri.uri,
+                 (int)(m_entries[i].asset->end - m_entries[i].asset->start));
+    }
+    return ESP_OK;
+}
+
+esp_err_t WhoWebAssets::handler(httpd_req_t *req)
+{
+    const entry_t *entry = (const entry_t *)req->user_ctx;
+    const web_asset_t *asset = entry->asset;
+    // The versioned URI changes with the content, a page keeps its URI and has to be asked for each time.
+    httpd_resp_set_hdr(req, "Cache-Control", asset->versioned ? "public, max-age=31536000, immutable" : "no-cache");
+    httpd_resp_set_hdr(req, "ETag", entry->etag);
+    char if_none_match[64];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK &&
+        strstr(if_none_match, entry->etag)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    // Every browser takes gzip, there is no plain copy to fall back to.
+    httpd_resp_set_type(req, asset->type);
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    return httpd_resp_send(req, (const char *)asset->start, asset->end - asset->start);
+}
+} // namespace http_stream
+} // namespace who
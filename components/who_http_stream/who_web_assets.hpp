@@ -0,0 +1,50 @@
+#pragma once
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace who {
+namespace http_stream {
+// Static files of a web page, gzipped at build time by who_embed_web_assets() and sent as they are.
+typedef struct {
+    const char *uri;
+    const char *type;
+    const uint8_t *start; // _binary_<file>_gz_start
+    const uint8_t *end;   // _binary_<file>_gz_end
+    bool versioned;       // linked with ?v= of its content, see gzip_web_assets.py, so it may be cached for good.
+} web_asset_t;
+
+// Serves the assets from flash with Content-Encoding: gzip, the server never compresses or copies them. Each one has
+// an ETag of its content, a browser revalidating it gets a 304 without a body. A versioned asset is cached for a year
+// without asking again, a page is revalidated on every load so it picks up new firmware at once.
+class WhoWebAssets {
+public:
+    /**
+     * @param assets     kept, not copied.
+     * @param num_assets
+     */
+    WhoWebAssets(const web_asset_t *assets, size_t num_assets);
+    WhoWebAssets(const WhoWebAssets &) = delete;
+    WhoWebAssets &operator=(const WhoWebAssets &) = delete;
+
+    /**
+     * @brief Register a GET handler per asset, the server needs room for get_num_assets() more handlers.
+     */
+    esp_err_t register_handlers(httpd_handle_t server);
+    size_t get_num_assets() const { return m_num_assets; }
+
+private:
+    typedef struct {
+        const web_asset_t *asset;
+        char etag[12]; // "%08lx" with the quotes.
+    } entry_t;
+
+    static esp_err_t handler(httpd_req_t *req);
+
+    size_t m_num_assets;
+    std::unique_ptr<entry_t[]> m_entries;
+};
+} // namespace http_stream
+} // namespace who
@@ -0,0 +1,118 @@
+#include "who_face_db_recognizer.hpp"
+#include <cstring>
+
+static const char *TAG = "WhoFaceDBRecognizer";
+
+namespace who {
+namespace recognition {
+WhoFaceDBRecognizer::WhoFaceDBRecognizer(const char *partition_label,
+                                         HumanFaceFeat *feat_model,
+                                         float thr,
+                                         int top_k) :
+    m_store(new face_db::WhoFaceDBStore(partition_label)), m_feat_model(feat_model), m_thr(thr), m_top_k(top_k)
+{
+    esp_err_t ret = m_store->open();
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "Opened %s, %d faces.", partition_label, (int)m_store->get_num_feats());
+    } else {
+        ESP_LOGE(TAG, "Failed to open face db in %s (%s).", partition_label, esp_err_to_name(ret));
+    }
+}
+
+WhoFaceDBRecognizer::~WhoFaceDBRecognizer()
+{
+    delete m_store;
+    delete m_feat_model;
+}
+
+std::vector<dl::recognition::result_t> WhoFaceDBRecognizer::recognize(
+    const dl::image::img_t &img, const std::list<dl::detect::result_t> &detect_res)
+{
+    std::vector<dl::recognition::result_t> ret;
+    if (detect_res.empty() || !m_store->get_num_feats()) {
+        return ret;
+    }
+    dl::TensorBase *feat = m_feat_model->run(img, detect_res.front().keypoint);
+    if (feat->get_size() != (int)m_store->get_feat_len()) {
+        ESP_LOGE(
+            TAG, "Feature length %d does not match the face db %d.", feat->get_size(), (int)m_store->get_feat_len());
+        return ret;
+    }
+    for (const auto &match : m_store->query(feat->get_element_ptr<float>(), m_thr, m_top_k)) {
+        ret.push_back({match.id, match.similarity});
+    }
+    return ret;
+}
+
+std::vector<std::vector<dl::recognition::result_t>> WhoFaceDBRecognizer::recognize_batch(
+    const dl::image::img_t &img, const std::list<dl::detect::result_t> &detect_res)
+{
+    std::vector<std::vector<dl::recognition::result_t>> ret(detect_res.size());
+    uint32_t feat_len = m_store->get_feat_len();
+    if (detect_res.empty() || !m_store->get_num_feats()) {
+        return ret;
+    }
+    // The feature model runs one aligned face at a time, its output tensor is reused so every feature is copied out.
+    m_feats.resize(detect_res.size() * feat_len);
+    float *dst = m_feats.data();
+    for (const auto &res : detect_res) {
+        dl::TensorBase *feat = m_feat_model->run(img, res.keypoint);
+        if (feat->get_size() != (int)feat_len) {
+            ESP_LOGE(TAG, "Feature length %d does not match the face db %d.", feat->get_size(), (int)feat_len);
+            return ret;
+        }
+        memcpy(dst, feat->get_element_ptr<float>(), feat_len * sizeof(float));
+        dst += feat_len;
+    }
+    auto matches = m_store->query_batch(m_feats.data(), detect_res.size(), m_thr, m_top_k);
+    for (size_t i = 0; i < matches.size(); i++) {
+        for (const auto &match : matches[i]) {
+            ret[i].push_back({match.id, match.similarity});
+        }
+    }
+    return ret;
+}
+
+esp_err_t WhoFaceDBRecognizer::enroll(const dl::image::img_t &img, const std::list<dl::detect::result_t> &detect_res)
+{
+    if (detect_res.empty()) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    dl::TensorBase *feat = m_feat_model->run(img, detect_res.front().keypoint);
+    uint16_t id;
+    return m_store->enroll(feat->get_element_ptr<float>(), feat->get_size(), &id);
+}
+
+esp_err_t WhoFaceDBRecognizer::update_feat(uint16_t id,
+                                           const dl::image::img_t &img,
+                                           const std::list<dl::detect::result_t> &detect_res)
+{
+    if (detect_res.empty()) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    dl::TensorBase *feat = m_feat_model->run(img, detect_res.front().keypoint);
+    return m_store->update(id, feat->get_element_ptr<float>(), feat->get_size());
+}
+
+esp_err_t WhoFaceDBRecognizer::delete_feat(uint16_t id)
+{
+    return m_store->remove(id);
+}
+
+esp_err_t WhoFaceDBRecognizer::delete_last_feat()
+{
+    uint16_t id = m_store->get_last_id();
+    return id ? m_store->remove(id) : ESP_ERR_NOT_FOUND;
+}
+
+int WhoFaceDBRecognizer::get_num_feats()
+{
+    return m_store->get_num_feats();
+}
+
+uint16_t WhoFaceDBRecognizer::get_last_id()
+{
+    return m_store->get_last_id();
+}
+} // namespace recognition
+} // namespace who
@@ -0,0 +1,38 @@
+#pragma once
+#include "human_face_recognition.hpp"
+#include "who_face_db_store.hpp"
+
+namespace who {
+namespace recognition {
+// Face recognizer backed by a journaled gallery in a flash partition. Unlike HumanFaceRecognizer nothing is loaded
+// into RAM at boot, the features are read in place through the cache. Enroll, update and delete append to the
+// journal and never rewrite the gallery in place.
+class WhoFaceDBRecognizer {
+public:
+    WhoFaceDBRecognizer(const char *partition_label, HumanFaceFeat *feat_model, float thr = 0.5, int top_k = 1);
+    ~WhoFaceDBRecognizer();
+    std::vector<dl::recognition::result_t> recognize(const dl::image::img_t &img,
+                                                     const std::list<dl::detect::result_t> &detect_res);
+    /**
+     * @brief Recognize every face in detect_res. The features are gathered into one contiguous matrix and matched in a
+     * single pass over the gallery.
+     */
+    std::vector<std::vector<dl::recognition::result_t>> recognize_batch(
+        const dl::image::img_t &img, const std::list<dl::detect::result_t> &detect_res);
+    esp_err_t enroll(const dl::image::img_t &img, const std::list<dl::detect::result_t> &detect_res);
+    esp_err_t update_feat(uint16_t id, const dl::image::img_t &img, const std::list<dl::detect::result_t> &detect_res);
+    esp_err_t delete_feat(uint16_t id);
+    esp_err_t delete_last_feat();
+    int get_num_feats();
+    uint16_t get_last_id();
+
+private:
+    face_db::WhoFaceDBStore *m_store;
+    HumanFaceFeat *m_feat_model;
+    // Features of the faces of one frame, back to back.
+    std::vector<float> m_feats;
+    float m_thr;
+    int m_top_k;
+};
+} // namespace recognition
+} // namespace who
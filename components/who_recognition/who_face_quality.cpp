@@ -0,0 +1,149 @@
+#include "who_face_quality.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace who {
+namespace recognition {
+// Keypoints are ordered left eye, left mouth corner, nose, right eye, right mouth corner.
+enum { LEFT_EYE = 0, NOSE = 2, RIGHT_EYE = 3 };
+// The Laplacian is sampled on a grid of at most this many points per side, whatever the size of the face.
+static constexpr int SHARPNESS_GRID = 48;
+static constexpr float RAD2DEG = 57.29578f;
+
+WhoFaceQuality::WhoFaceQuality(int min_size, float max_yaw, float max_roll, float min_sharpness) :
+    m_min_size(min_size), m_max_yaw(max_yaw), m_max_roll(max_roll), m_min_sharpness(min_sharpness)
+{
+#if CONFIG_IDF_TARGET_ESP32P4
+    m_caps = 0;
+#else
+    m_caps = dl::image::DL_IMAGE_CAP_RGB565_BIG_ENDIAN;
+#endif
+}
+
+face_quality_t WhoFaceQuality::no_face()
+{
+    return {0, 0, 0, 0, 0, FACE_QUALITY_NO_FACE};
+}
+
+face_quality_t WhoFaceQuality::evaluate(const dl::image::img_t &img, const dl::detect::result_t &res) const
+{
+    face_quality_t quality = {};
+    int box[4] = {std::max(res.box[0], 0),
+                  std::max(res.box[1], 0),
+                  std::min(res.box[2], (int)img.width - 1),
+                  std::min(res.box[3], (int)img.height - 1)};
+    quality.size = std::max(std::min(box[2] - box[0], box[3] - box[1]), 0);
+    if (quality.size < m_min_size) {
+        quality.reject |= FACE_QUALITY_TOO_SMALL;
+    }
+
+    if (res.keypoint.size() == 10) {
+        float lx = res.keypoint[2 * LEFT_EYE], ly = res.keypoint[2 * LEFT_EYE + 1];
+        float rx = res.keypoint[2 * RIGHT_EYE], ry = res.keypoint[2 * RIGHT_EYE + 1];
+        float nx = res.keypoint[2 * NOSE], ny = res.keypoint[2 * NOSE + 1];
+        float roll = atan2f(ry - ly, rx - lx);
+        quality.roll = roll * RAD2DEG;
+        // Undo the roll, then compare the horizontal distances from the nose to each eye. A frontal face has the
+        // nose half way, a face turned by yaw has it shifted by about sin(yaw) of half the eye distance.
+        float c = cosf(roll), s = sinf(roll);
+        float eye_l = lx * c + ly * s, eye_r = rx * c + ry * s, nose = nx * c + ny * s;
+        float d_l = nose - eye_l, d_r = eye_r - nose;
+        if (d_l + d_r > 0) {
+            quality.yaw = asinf(std::clamp((d_l - d_r) / (d_l + d_r), -1.f, 1.f)) * RAD2DEG;
+        } else {
+            quality.yaw = 90;
+        }
+        if (fabsf(quality.yaw) > m_max_yaw) {
+            quality.reject |= FACE_QUALITY_YAW;
+        }
+        if (fabsf(quality.roll) > m_max_roll) {
+            quality.reject |= FACE_QUALITY_ROLL;
+        }
+    }
+
+    if (quality.size >= 3) {
+        quality.sharpness = get_sharpness(img, box);
+        if (quality.sharpness < m_min_sharpness) {
+            quality.reject |= FACE_QUALITY_BLUR;
+        }
+    }
+
+    // Each term saturates at twice its threshold, so a face well past every threshold scores close to 1.
+    float size_score = std::min(1.f, quality.size / (2.f * m_min_size));
+    float pose_score = std::max(0.f, 1 - fabsf(quality.yaw) / (2 * m_max_yaw)) *
+        std::max(0.f, 1 - fabsf(quality.roll) / (2 * m_max_roll));
+    float blur_score = std::min(1.f, quality.sharpness / (2 * m_min_sharpness));
+    quality.score = size_score * pose_score * blur_score;
+    return quality;
+}
+
+float WhoFaceQuality::get_sharpness(const dl::image::img_t &img, const int *box) const
+{
+    const uint8_t *data = static_cast<const uint8_t *>(img.data);
+    auto luma = [&](int x, int y) -> int {
+        switch (img.pix_type) {
+        case dl::image::DL_IMAGE_PIX_TYPE_RGB888: {
+            const uint8_t *p = data + ((size_t)y * img.width + x) * 3;
+            return (77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8;
+        }
+        case dl::image::DL_IMAGE_PIX_TYPE_RGB565: {
+            const uint8_t *p = data + ((size_t)y * img.width + x) * 2;
+            uint16_t v = (m_caps & dl::image::DL_IMAGE_CAP_RGB565_BIG_ENDIAN) ? (p[0] << 8 | p[1]) : (p[1] << 8 | p[0]);
+            return (77 * ((v >> 8) & 0xf8) + 150 * ((v >> 3) & 0xfc) + 29 * ((v << 3) & 0xf8)) >> 8;
+        }
+        case dl::image::DL_IMAGE_PIX_TYPE_GRAY:
+            return data[(size_t)y * img.width + x];
+        default:
+            return 0;
+        }
+    };
+
+    // step only spaces the samples. The Laplacian always takes the adjacent pixels, so it measures blur at pixel scale
+    // and the same threshold holds for a small and a large face.
+    int step = std::max(1, std::max(box[2] - box[0], box[3] - box[1]) / SHARPNESS_GRID);
+    int start = std::max(1, step / 2);
+    double sum = 0, sum_sq = 0;
+    int n = 0;
+    for (int y = box[1] + start; y < box[3]; y += step) {
+        for (int x = box[0] + start; x < box[2]; x += step) {
+            int lap = 4 * luma(x, y) - luma(x - 1, y) - luma(x + 1, y) - luma(x, y - 1) - luma(x, y + 1);
+            sum += lap;
+            sum_sq += lap * lap;
+            n++;
+        }
+    }
+    if (!n) {
+        return 0;
+    }
+    double mean = sum / n;
+    return sum_sq / n - mean * mean;
+}
+
+std::string WhoFaceQuality::reject_to_str(uint32_t reject)
+{
+    if (reject == FACE_QUALITY_OK) {
+        return "ok";
+    }
+    static const struct {
+        uint32_t bit;
+        const char *str;
+    } reasons[] = {
+        {FACE_QUALITY_NO_FACE, "no face"},
+        {FACE_QUALITY_TOO_SMALL, "too small"},
+        {FACE_QUALITY_YAW, "turned sideways"},
+        {FACE_QUALITY_ROLL, "tilted"},
+        {FACE_QUALITY_BLUR, "blurred"},
+    };
+    std::string str;
+    for (const auto &reason : reasons) {
+        if (reject & reason.bit) {
+            if (!str.empty()) {
+                str += ", ";
+            }
+            str += reason.str;
+        }
+    }
+    return str;
+}
+} // namespace recognition
+} // namespace who
@@ -0,0 +1,54 @@
+#pragma once
+#include "dl_detect_define.hpp"
+#include "dl_image_define.hpp"
+#include <cstdint>
+#include <string>
+
+namespace who {
+namespace recognition {
+// Reasons a face is rejected, several may be set at once.
+typedef enum : uint32_t {
+    FACE_QUALITY_OK = 0,
+    FACE_QUALITY_NO_FACE = 1 << 0,
+    FACE_QUALITY_TOO_SMALL = 1 << 1,
+    FACE_QUALITY_YAW = 1 << 2,
+    FACE_QUALITY_ROLL = 1 << 3,
+    FACE_QUALITY_BLUR = 1 << 4,
+} face_quality_reject_t;
+
+typedef struct {
+    int size;        // shorter side of the box, in pixels.
+    float yaw;       // degrees, estimated from the nose offset between the eyes.
+    float roll;      // degrees, angle of the line between the eyes.
+    float sharpness; // variance of the Laplacian of the luma crop.
+    float score;     // 0 to 1, higher is better. Comparable between frames of the same face.
+    uint32_t reject; // face_quality_reject_t bits, FACE_QUALITY_OK if the face may reach the feature model.
+} face_quality_t;
+
+// Cheap checks run before the feature model. A tiny, blurred or turned away face gives an embedding which matches
+// poorly, it is cheaper to wait a frame or two for a better view than to embed it.
+class WhoFaceQuality {
+public:
+    /**
+     * @param min_size       min shorter side of the box in pixels.
+     * @param max_yaw        max yaw in degrees.
+     * @param max_roll       max roll in degrees.
+     * @param min_sharpness  min Laplacian variance of the luma crop.
+     */
+    WhoFaceQuality(int min_size = 40, float max_yaw = 35, float max_roll = 30, float min_sharpness = 30);
+
+    face_quality_t evaluate(const dl::image::img_t &img, const dl::detect::result_t &res) const;
+    static face_quality_t no_face();
+    static std::string reject_to_str(uint32_t reject);
+
+private:
+    float get_sharpness(const dl::image::img_t &img, const int *box) const;
+
+    int m_min_size;
+    float m_max_yaw;
+    float m_max_roll;
+    float m_min_sharpness;
+    uint32_t m_caps;
+};
+} // namespace recognition
+} // namespace who
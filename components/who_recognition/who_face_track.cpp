@@ -0,0 +1,103 @@
+#include "who_face_track.hpp"
+#include <algorithm>
+
+namespace who {
+namespace recognition {
+WhoFaceTracker::WhoFaceTracker(float iou_thr, int max_age_ms) :
+    m_iou_thr(iou_thr), m_max_age_ms(max_age_ms), m_next_id(1)
+{
+}
+
+float WhoFaceTracker::iou(const int *a, const int *b)
+{
+    int w = std::min(a[2], b[2]) - std::max(a[0], b[0]);
+    int h = std::min(a[3], b[3]) - std::max(a[1], b[1]);
+    if (w <= 0 || h <= 0) {
+        return 0;
+    }
+    float inter = (float)w * h;
+    float area_a = (float)(a[2] - a[0]) * (a[3] - a[1]);
+    float area_b = (float)(b[2] - b[0]) * (b[3] - b[1]);
+    return inter / (area_a + area_b - inter);
+}
+
+std::vector<uint32_t> WhoFaceTracker::update(const std::list<dl::detect::result_t> &det_res, int64_t now_ms)
+{
+    std::vector<uint32_t> ids(det_res.size(), 0);
+    std::vector<const dl::detect::result_t *> dets;
+    dets.reserve(det_res.size());
+    for (const auto &res : det_res) {
+        dets.push_back(&res);
+    }
+
+    // Match the best overlapping pairs first. A handful of faces per frame keeps the O(n * m) scan cheap.
+    typedef struct {
+        float iou;
+        size_t det;
+        size_t track;
+    } pair_t;
+    std::vector<pair_t> pairs;
+    for (size_t i = 0; i < dets.size(); i++) {
+        for (size_t j = 0; j < m_tracks.size(); j++) {
+            float overlap = iou(dets[i]->box.data(), m_tracks[j].box);
+            if (overlap >= m_iou_thr) {
+                pairs.push_back({overlap, i, j});
+            }
+        }
+    }
+    std::sort(pairs.begin(), pairs.end(), [](const pair_t &a, const pair_t &b) { return a.iou > b.iou; });
+    std::vector<uint8_t> track_used(m_tracks.size(), 0);
+    for (const auto &pair : pairs) {
+        if (ids[pair.det] || track_used[pair.track]) {
+            continue;
+        }
+        track_t &track = m_tracks[pair.track];
+        std::copy_n(dets[pair.det]->box.begin(), 4, track.box);
+        track.last_seen_ms = now_ms;
+        track.hits++;
+        track_used[pair.track] = 1;
+        ids[pair.det] = track.id;
+    }
+
+    m_dropped.clear();
+    m_tracks.erase(std::remove_if(m_tracks.begin(),
+                                  m_tracks.end(),
+                                  [&](const track_t &track) {
+                                      if (now_ms - track.last_seen_ms > m_max_age_ms) {
+                                          m_dropped.push_back(track.id);
+                                          return true;
+                                      }
+                                      return false;
+                                  }),
+                   m_tracks.end());
+
+    for (size_t i = 0; i < dets.size(); i++) {
+        if (ids[i]) {
+            continue;
+        }
+        track_t track = {};
+        track.id = m_next_id++;
+        if (!m_next_id) {
+            m_next_id = 1;
+        }
+        std::copy_n(dets[i]->box.begin(), 4, track.box);
+        track.first_seen_ms = now_ms;
+        track.last_seen_ms = now_ms;
+        track.hits = 1;
+        m_tracks.push_back(track);
+        ids[i] = track.id;
+    }
+    return ids;
+}
+
+const WhoFaceTracker::track_t *WhoFaceTracker::find(uint32_t id) const
+{
+    for (const auto &track : m_tracks) {
+        if (track.id == id) {
+            return &track;
+        }
+    }
+    return nullptr;
+}
+} // namespace recognition
+} // namespace who
@@ -0,0 +1,52 @@
+#pragma once
+#include "dl_detect_define.hpp"
+#include <cstdint>
+#include <list>
+#include <vector>
+
+namespace who {
+namespace recognition {
+// Greedy IoU tracker. Gives every detected face a track id which stays the same while the face keeps overlapping its
+// box in the previous frame, so per-face state can survive between frames.
+class WhoFaceTracker {
+public:
+    typedef struct {
+        uint32_t id;
+        int box[4];
+        int64_t first_seen_ms;
+        int64_t last_seen_ms;
+        uint32_t hits;
+    } track_t;
+
+    /**
+     * @param iou_thr  min overlap with the previous box to continue a track.
+     * @param max_age_ms  a track which is not seen for this long is dropped.
+     */
+    WhoFaceTracker(float iou_thr = 0.3f, int max_age_ms = 1000);
+
+    /**
+     * @brief Associate the detections of a frame with the tracks.
+     *
+     * @param det_res  detections of the frame.
+     * @param now_ms   timestamp of the frame.
+     * @return track ids, in the same order as det_res.
+     */
+    std::vector<uint32_t> update(const std::list<dl::detect::result_t> &det_res, int64_t now_ms);
+    /**
+     * @brief Ids of the tracks dropped by the last update().
+     */
+    const std::vector<uint32_t> &get_dropped() const { return m_dropped; }
+    const std::vector<track_t> &get_tracks() const { return m_tracks; }
+    const track_t *find(uint32_t id) const;
+
+    static float iou(const int *a, const int *b);
+
+private:
+    float m_iou_thr;
+    int m_max_age_ms;
+    uint32_t m_next_id;
+    std::vector<track_t> m_tracks;
+    std::vector<uint32_t> m_dropped;
+};
+} // namespace recognition
+} // namespace who
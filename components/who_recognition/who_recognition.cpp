@@ -7,31 +7,71 @@
  * - Receives PIR motion triggers from gateway
  * - Supports RECOGNIZE, ENROLL, and DELETE operations
  ******************************************************************************/
+#include <algorithm>
 #include <string>
 
 #include "who_recognition.hpp"
-#include "shared_mem.hpp"
-#include "tcp_client.cpp"    // include tcp_client library 
+#include "esp_timer.h"
 
-// Global variables for building JSON payload
-std::string event; 
-std::string status; 
-std::string id; 
-std::string similarity; 
-std::string json_payload; 
+#if CONFIG_WHO_GATEWAY_EVENT_FORMAT_TLV
+static constexpr who::gateway::event_format_t EVENT_FORMAT = who::gateway::EVENT_FORMAT_TLV;
+#elif CONFIG_WHO_GATEWAY_EVENT_FORMAT_WIRE
+static constexpr who::gateway::event_format_t EVENT_FORMAT = who::gateway::EVENT_FORMAT_WIRE;
+#else
+static constexpr who::gateway::event_format_t EVENT_FORMAT = who::gateway::EVENT_FORMAT_JSON;
+#endif
 
 namespace who {
 namespace recognition {
 
 // Initialises a object (recognition core) with a detection module for face recognition
 WhoRecognitionCore::WhoRecognitionCore(const std::string &name, detect::WhoDetect *detect) :
-    task::WhoTask(name), m_detect(detect)
+    task::WhoTask(name),
+    m_detect(detect),
+    m_recognizer(nullptr),
+    m_face_db_recognizer(nullptr),
+    m_delete_id(0),
+    m_pending_action(0),
+    m_gallery_changed(false),
+    m_tracker(CONFIG_WHO_FACE_TRACK_IOU / 100.f, CONFIG_WHO_FACE_TRACK_MAX_AGE_MS),
+    m_cache(CONFIG_WHO_RECOGNITION_CACHE_TTL_MS,
+            CONFIG_WHO_RECOGNITION_CACHE_DECAY / 100.f,
+            CONFIG_WHO_RECOGNITION_CACHE_QUALITY_GAIN / 100.f),
+    m_quality(CONFIG_WHO_FACE_QUALITY_MIN_SIZE,
+              CONFIG_WHO_FACE_QUALITY_MAX_YAW,
+              CONFIG_WHO_FACE_QUALITY_MAX_ROLL,
+              CONFIG_WHO_FACE_QUALITY_MIN_SHARPNESS),
+    m_pending_since_ms(-1),
+    m_continuous(false),
+    m_voter(CONFIG_WHO_RECOGNITION_VOTE_WINDOW,
+            CONFIG_WHO_RECOGNITION_VOTE_MIN_VOTES,
+            CONFIG_WHO_RECOGNITION_VISIT_GAP_MS),
+    m_scheduler(CONFIG_WHO_RECOGNITION_BUDGET_MS),
+    m_hires_node(nullptr),
+    m_hires_buf(nullptr),
+    m_hires_buf_size(0),
+    m_gateway(new gateway::WhoGatewayClient(CONFIG_WHO_GATEWAY_HOST,
+                                            CONFIG_WHO_GATEWAY_PORT,
+                                            CONFIG_WHO_GATEWAY_EVENT_RING_LEN,
+                                            CONFIG_WHO_GATEWAY_EVENT_SLOT_SIZE,
+                                            EVENT_FORMAT)),
+    m_event_seq(0)
 {
+    m_gateway->set_backoff(CONFIG_WHO_GATEWAY_MIN_BACKOFF_MS, CONFIG_WHO_GATEWAY_MAX_BACKOFF_MS);
+#if CONFIG_WHO_GATEWAY_EVENT_FORMAT_WIRE
+    m_gateway->set_heartbeat(CONFIG_WHO_GATEWAY_HEARTBEAT_MS);
+#endif
+#if CONFIG_WHO_RECOGNITION_CONTINUOUS
+    m_continuous = true;
+#endif
 }
 // Handles a delete action that frees the memory allocated for m_recognizer. 
 WhoRecognitionCore::~WhoRecognitionCore()
 {
     delete m_recognizer;
+    delete m_face_db_recognizer;
+    heap_caps_free(m_hires_buf);
+    delete m_gateway;
 }
 
 // Assigns a recognizer instance (the actual engine that performs face recognition) to core
@@ -39,6 +79,11 @@ void WhoRecognitionCore::set_recognizer(HumanFaceRecognizer *recognizer)
 {
     m_recognizer = recognizer;
 }
+// Assigns a recognizer backed by the memory-mapped face db partition, used instead of HumanFaceRecognizer
+void WhoRecognitionCore::set_recognizer(WhoFaceDBRecognizer *recognizer)
+{
+    m_face_db_recognizer = recognizer;
+}
 // Stores a callback function (triggered when recognition results are available)
 void WhoRecognitionCore::set_recognition_result_cb(const std::function<void(const std::string &)> &result_cb)
 {
@@ -49,18 +94,59 @@ void WhoRecognitionCore::set_detect_result_cb(const std::function<void(const det
 {
     m_detect_result_cb = result_cb;
 }
+// Stores a callback function which gets the quality of every face gated while a RECOGNIZE or ENROLL is pending
+void WhoRecognitionCore::set_face_quality_cb(const std::function<void(const face_quality_t &)> &quality_cb)
+{
+    m_face_quality_cb = quality_cb;
+}
 // Stores a cleanup function that is called when the recognition core is shut down
 void WhoRecognitionCore::set_cleanup_func(const std::function<void()> &cleanup_func)
 {
     m_cleanup = cleanup_func;
 }
+// Stores a callback function which gets every result event, e.g. to push it to web pages
+void WhoRecognitionCore::set_event_cb(
+    const std::function<void(const gateway::event_t &, const detect::WhoDetect::result_t &, int)> &event_cb)
+{
+    m_event_cb = event_cb;
+}
+// Stores a callback function for the PIR motion trigger of the gateway
+void WhoRecognitionCore::set_motion_cb(const std::function<void()> &motion_cb)
+{
+    m_motion_cb = motion_cb;
+}
+// Stores a callback function which gets the tracks of every frame, e.g. to stream them with the video
+void WhoRecognitionCore::set_tracks_cb(const std::function<void(const detect::WhoDetect::result_t &,
+                                                                const std::vector<uint32_t> &,
+                                                                const std::vector<uint16_t> &)> &tracks_cb)
+{
+    m_tracks_cb = tracks_cb;
+}
+
+// Switches continuous recognition on or off, it runs beside the one-shot RECOGNIZE trigger
+void WhoRecognitionCore::set_continuous_mode(bool enable)
+{
+    m_continuous = enable;
+}
+// Queues a delete of one face id, handled by the DELETE event like the DOWN button
+void WhoRecognitionCore::delete_feat(uint16_t id)
+{
+    m_delete_id = id;
+    xEventGroupSetBits(m_event_group, DELETE);
+}
+
+// Sets the node whose larger frames the faces are cropped from for the feature model
+void WhoRecognitionCore::set_hires_node(frame_cap::WhoFrameCapNode *node)
+{
+    m_hires_node = node;
+}
 
 // Entry point for executing WhoRecognitionCore task. 
 bool WhoRecognitionCore::run(const configSTACK_DEPTH_TYPE uxStackDepth,
                              UBaseType_t uxPriority,
                              const BaseType_t xCoreID)
 {    // Checks if m_recognizer is set 
-    if (!m_recognizer) {
+    if (!m_recognizer && !m_face_db_recognizer) {
         ESP_LOGE("WhoRecognitionCore", "recognizer is nullptr, please call set_recognizer() first.");
         return false;
     } // Delegates execution to base class (WhoTask)
@@ -69,10 +155,6 @@ bool WhoRecognitionCore::run(const configSTACK_DEPTH_TYPE uxStackDepth,
 
 void WhoRecognitionCore::task()
 {
-    // SETUP TCP CONNECTION 
-    const char* GATEWAY_IP = "172.20.10.14";  // Arduino Code for ESP32 Uses Static IP Address 
-    const uint16_t GATEWAY_PORT = 5500;
-
     // Print connection display data for readability 
     ESP_LOGI("WhoRecognitionCore", "");
     ESP_LOGI("WhoRecognitionCore", "╔════════════════════════════════════════════╗");
@@ -80,50 +162,34 @@ void WhoRecognitionCore::task()
     ESP_LOGI("WhoRecognitionCore", "╚════════════════════════════════════════════╝");
     ESP_LOGI("WhoRecognitionCore", "");
     ESP_LOGI("WhoRecognitionCore", "Connecting to Gateway...");
-    ESP_LOGI("WhoRecognitionCore", "  Target IP:   %s", GATEWAY_IP);
-    ESP_LOGI("WhoRecognitionCore", "  Target Port: %d", GATEWAY_PORT);
+    ESP_LOGI("WhoRecognitionCore", "  Target IP:   %s", CONFIG_WHO_GATEWAY_HOST);
+    ESP_LOGI("WhoRecognitionCore", "  Target Port: %d", CONFIG_WHO_GATEWAY_PORT);
     ESP_LOGI("WhoRecognitionCore", "");
-    
-    // initiate TCP Connection with ESP32 Server 
-    bool connected = tcp_connect(GATEWAY_IP, GATEWAY_PORT);
-
-    // Displays connection status and list common failure points & troubleshooting measures if connection fails
-    if (!connected) {
-        ESP_LOGE("WhoRecognitionCore", "");
-        ESP_LOGE("WhoRecognitionCore", "╔════════════════════════════════════════════╗");
-        ESP_LOGE("WhoRecognitionCore", "║    GATEWAY CONNECTION FAILED               ║");
-        ESP_LOGE("WhoRecognitionCore", "╚════════════════════════════════════════════╝");
-        ESP_LOGE("WhoRecognitionCore", "");
-        ESP_LOGE("WhoRecognitionCore", "Troubleshooting steps:");
-        ESP_LOGE("WhoRecognitionCore", "  1. Check gateway is powered on");
-        ESP_LOGE("WhoRecognitionCore", "  2. Verify gateway IP: %s", GATEWAY_IP);
-        ESP_LOGE("WhoRecognitionCore", "  3. Confirm both on same WiFi network");
-        ESP_LOGE("WhoRecognitionCore", "  4. Check gateway Serial Monitor for IP");
-        ESP_LOGE("WhoRecognitionCore", "");
-        ESP_LOGW("WhoRecognitionCore", "System will continue without gateway...");
+
+    // The gateway client connects, reconnects and sends on its own task, recognition never waits for the network.
+    // Results are queued while the gateway is away and go out once it is back
+    m_gateway->set_command_cb(std::bind(&WhoRecognitionCore::gateway_command_cb, this, std::placeholders::_1));
+    m_gateway->set_config_cb(
+        std::bind(&WhoRecognitionCore::gateway_config_cb, this, std::placeholders::_1, std::placeholders::_2));
+#if CONFIG_WHO_GATEWAY_JOURNAL
+    if (m_gateway->enable_journal(CONFIG_WHO_GATEWAY_JOURNAL_PATH,
+                                  CONFIG_WHO_GATEWAY_JOURNAL_LEN,
+                                  CONFIG_WHO_GATEWAY_JOURNAL_DRAIN_BATCH,
+                                  CONFIG_WHO_GATEWAY_JOURNAL_DRAIN_INTERVAL_MS) != ESP_OK) {
+        ESP_LOGW("WhoRecognitionCore", "No event journal, events are kept in RAM only while the gateway is away");
+    }
+#endif
+    if (m_gateway->start() != ESP_OK) {
+        ESP_LOGW("WhoRecognitionCore", "Failed to start the gateway client");
         ESP_LOGW("WhoRecognitionCore", "Face recognition will work, but data won't upload");
-        ESP_LOGW("WhoRecognitionCore", "");
-    } else {
-        ESP_LOGI("WhoRecognitionCore", "");
-        ESP_LOGI("WhoRecognitionCore", "╔════════════════════════════════════════════╗");
-        ESP_LOGI("WhoRecognitionCore", "║    CONNECTED TO GATEWAY                    ║");
-        ESP_LOGI("WhoRecognitionCore", "╚════════════════════════════════════════════╝");
-        ESP_LOGI("WhoRecognitionCore", "");
-        ESP_LOGI("WhoRecognitionCore", "Starting PIR trigger listener...");
-        
-        // Start background task to receive PIR trigger commands -- Motion Detection Task 
-        // =====================================================
-        xTaskCreatePinnedToCore(tcp_recv, "tcp_poll_recv", 4096, NULL, 5, NULL, 0);
-        
-        ESP_LOGI("WhoRecognitionCore", "System ready");
-        ESP_LOGI("WhoRecognitionCore", "  - PIR motion will trigger face recognition");
-        ESP_LOGI("WhoRecognitionCore", "  - Results will upload to ThingSpeak");
-        ESP_LOGI("WhoRecognitionCore", "");
     }
-    
+
+    // Every detect result goes through detect_result_cb(), it tracks faces between triggers
+    m_detect->set_detect_result_cb(
+        std::bind(&WhoRecognitionCore::detect_result_cb, this, std::placeholders::_1));
+
     // MAIN LOOP 
     while (true) {
-        vTaskDelay(pdMS_TO_TICKS(100));
         // Task is blocked; waits until 1 of the listed bits is set in m_event_group
         // Means that 1 of the below events has occurred (e.g. from ESP-EYE button presses) 
         // There are 5 total possible events, each event handler will be defined later. 
@@ -160,108 +226,14 @@ void WhoRecognitionCore::task()
         }
         
         // (2) Handle RECOGNIZE event when PLAY Button selected 
+        // The next detect result is recognized by detect_result_cb()
         if (event_bits & RECOGNIZE) {
-            // Clear all previous values stored in event, status, id and similarity 
-            event = ""; 
-            status = ""; 
-            id = ""; 
-            similarity = ""; 
-            event = "RECOGNIZE";  // store event as RECOGNIZE 
-            
             ESP_LOGI("WhoRecognitionCore", "");
             ESP_LOGI("WhoRecognitionCore", "╔════════════════════════════════════════════╗");
             ESP_LOGI("WhoRecognitionCore", "║     FACE RECOGNITION TRIGGERED             ║");
             ESP_LOGI("WhoRecognitionCore", "╚════════════════════════════════════════════╝");
             ESP_LOGI("WhoRecognitionCore", "Processing camera frame...");
-            
-            // Define callback for when face is detected
-            auto new_detect_result_cb = [this](const detect::WhoDetect::result_t &result) {
-                
-                ESP_LOGI("WhoRecognitionCore", "Face detected in frame");
-                ESP_LOGI("WhoRecognitionCore", "Running recognition model...");
-                
-                // Run face recognition
-                auto ret = m_recognizer->recognize(result.img, result.det_res);
-                
-                // Call detect result callback if registered
-                if (m_detect_result_cb) {
-                    m_detect_result_cb(result);
-                }
-                
-                // Process recognition results
-                if (m_recognition_result_cb) {
-                    if (ret.empty()) { 
-                        // Face detected but not recognised (i.e. no match -> logs "UNKNOWN")
-                        m_recognition_result_cb("who?");
-                        status = "0";   // store status as 0 
-                        id = "0";
-                        similarity = "0.0";
-                        
-                        ESP_LOGW("WhoRecognitionCore", "");
-                        ESP_LOGW("WhoRecognitionCore", "┌────────────────────────────────────────┐");
-                        ESP_LOGW("WhoRecognitionCore", "│ RECOGNITION RESULT: UNKNOWN            │");
-                        ESP_LOGW("WhoRecognitionCore", "│ Face detected but not in database      │");
-                        ESP_LOGW("WhoRecognitionCore", "└────────────────────────────────────────┘");
-                        ESP_LOGW("WhoRecognitionCore", "");
-                        
-
-                        // keeps video stream running on webpage 
-                        set_flag(&shared_mem.stream_flag, 1);
-                    } else {   
-                        // Face recognised -> logs "RECOGNISED"
-                        std::string result_str = std::format("id: {}, sim: {:.2f}", 
-                                                            ret[0].id, ret[0].similarity);
-                        m_recognition_result_cb(result_str);
-                        
-                        status = "1";  // store status as 1 
-                        id = std::to_string(ret[0].id);  // store id as the detected person's id 
-                        similarity = std::to_string(ret[0].similarity);  // store similarity value 
-                        
-                        ESP_LOGI("WhoRecognitionCore", "");
-                        ESP_LOGI("WhoRecognitionCore", "╔════════════════════════════════════════════╗");
-                        ESP_LOGI("WhoRecognitionCore", "║     FACE RECOGNIZED                        ║");
-                        ESP_LOGI("WhoRecognitionCore", "╚════════════════════════════════════════════╝");
-                        ESP_LOGI("WhoRecognitionCore", "  Person ID:   %d", ret[0].id);
-                        ESP_LOGI("WhoRecognitionCore", "  Similarity:  %.2f (%.1f%%)", 
-                                ret[0].similarity, ret[0].similarity * 100);
-                        ESP_LOGI("WhoRecognitionCore", "");
-                        // tell web page to send a picture
-                        // pause streaming
-                        set_flag(&shared_mem.stream_flag, 2);
-                    }
-                    m_detect->set_detect_result_cb(m_detect_result_cb);
-                }
-
-                // Build JSON payload
-                json_payload = "{"; 
-                json_payload += "\"event\":\"" + event + "\",";
-                json_payload += "\"status\":" + status + ",";
-                json_payload += "\"id\":" + id + ",";
-                json_payload += "\"similarity\":" + similarity;
-                json_payload += "}\r";
-                
-                ESP_LOGI("WhoRecognitionCore", "Sending to gateway...");
-                ESP_LOGD("WhoRecognitionCore", "JSON: %s", json_payload.c_str());
-                    
-                // Send to ESP32 gateway (via tcp client)
-                if (tcp_is_connected()) {
-                    bool sent = tcp_send(json_payload); // send via tcp_send function declared in tcp_client.cpp
-                    if (sent) {
-                        ESP_LOGI("WhoRecognitionCore", "Detection data sent to gateway");
-                        ESP_LOGI("WhoRecognitionCore", "Gateway will upload to ThingSpeak");
-                    } else {
-                        ESP_LOGE("WhoRecognitionCore", "Failed to send to gateway");
-                    }
-                } else {
-                    ESP_LOGW("WhoRecognitionCore", "Gateway not connected, data not sent");
-                }
-                    
-                ESP_LOGI("WhoRecognitionCore", "");
-            };
-            
-            
-            // Set the callback and continue
-            m_detect->set_detect_result_cb(new_detect_result_cb);
+            m_pending_action = RECOGNIZE;
             continue;
         }
         
@@ -273,40 +245,7 @@ void WhoRecognitionCore::task()
             ESP_LOGI("WhoRecognitionCore", "║      ENROLLMENT MODE ACTIVATED             ║");
             ESP_LOGI("WhoRecognitionCore", "╚════════════════════════════════════════════╝");
             ESP_LOGI("WhoRecognitionCore", "Look at camera to enroll your face...");
-            
-            // Creates callback function to run whenever a face is detected in camera frame. 
-            auto new_detect_result_cb = [this](const detect::WhoDetect::result_t &result) {
-                // calls m_recognizer to send detected face to recognition database
-                esp_err_t ret = m_recognizer->enroll(result.img, result.det_res); 
-                
-                if (m_detect_result_cb) {
-                    m_detect_result_cb(result); // notifies external systems
-                }
-                
-                if (m_recognition_result_cb) {
-                    if (ret == ESP_FAIL) {
-                        m_recognition_result_cb("Failed to enroll.");
-                        ESP_LOGE("WhoRecognitionCore", "Enrollment failed");
-                        ESP_LOGE("WhoRecognitionCore", " Please try again with better lighting");
-                    } else {
-                        int num_feats = m_recognizer->get_num_feats(); 
-                        std::string msg = std::format("id: {} enrolled.", num_feats);
-                        m_recognition_result_cb(msg);
-                        
-                        ESP_LOGI("WhoRecognitionCore", "");
-                        ESP_LOGI("WhoRecognitionCore", "╔════════════════════════════════════════════╗");
-                        ESP_LOGI("WhoRecognitionCore", "║     ENROLLMENT SUCCESSFUL                  ║");
-                        ESP_LOGI("WhoRecognitionCore", "╚════════════════════════════════════════════╝");
-                        ESP_LOGI("WhoRecognitionCore", "  Assigned ID: %d", num_feats);
-                        ESP_LOGI("WhoRecognitionCore", "  Total faces: %d", num_feats);
-                        ESP_LOGI("WhoRecognitionCore", "");
-                    }
-                }
-                // Restores original callback after completing enrolment task (resume normal detection flow)
-                m_detect->set_detect_result_cb(m_detect_result_cb);
-            };
-            
-            m_detect->set_detect_result_cb(new_detect_result_cb);
+            m_pending_action = ENROLL;
             continue;
         }
         
@@ -314,23 +253,28 @@ void WhoRecognitionCore::task()
         if (event_bits & DELETE) {
             ESP_LOGI("WhoRecognitionCore", "");
             ESP_LOGI("WhoRecognitionCore", "╔════════════════════════════════════════════╗");
-            ESP_LOGI("WhoRecognitionCore", "║       DELETE LAST FACE                     ║");
+            ESP_LOGI("WhoRecognitionCore", "║       DELETE FACE                          ║");
             ESP_LOGI("WhoRecognitionCore", "╚════════════════════════════════════════════╝");
             
-            esp_err_t ret = m_recognizer->delete_last_feat();
+            // 0 means no id was queued by delete_feat(), fall back to the last enrolled face
+            uint16_t deleted_id = 0;
+            esp_err_t ret = delete_feat(m_delete_id.exchange(0), &deleted_id);
+            if (ret == ESP_OK) {
+                // Cached results may still point at the deleted id
+                m_gallery_changed = true;
+            }
             
             if (m_recognition_result_cb) {
-                if (ret == ESP_FAIL) {
+                if (ret != ESP_OK) {
                     m_recognition_result_cb("Failed to delete.");
-                    ESP_LOGE("WhoRecognitionCore", "Delete failed (no faces to delete?)");
+                    ESP_LOGE("WhoRecognitionCore", "Delete failed (no such face?)");
                 } else {
-                    int num_feats = m_recognizer->get_num_feats() + 1; 
-                    std::string msg = std::format("id: {} deleted.", num_feats);
+                    std::string msg = std::format("id: {} deleted.", deleted_id);
                     m_recognition_result_cb(msg);
                     
-                    ESP_LOGI("WhoRecognitionCore", "Deleted ID: %d", num_feats);
+                    ESP_LOGI("WhoRecognitionCore", "Deleted ID: %d", deleted_id);
                     ESP_LOGI("WhoRecognitionCore", "  Remaining faces: %d", 
-                            m_recognizer->get_num_feats());
+                            get_num_feats());
                 }
             }
             ESP_LOGI("WhoRecognitionCore", "");
@@ -339,16 +283,523 @@ void WhoRecognitionCore::task()
     
     // CLEANUP AND SHUTDOWN
     ESP_LOGI("WhoRecognitionCore", "Task stopping...");
+    m_detect->set_detect_result_cb(m_detect_result_cb);
     xEventGroupSetBits(m_event_group, TASK_STOPPED);
     
     // Close TCP connection when event is TASK_STOP 
-    tcp_close();
+    m_gateway->stop();
 
     // Display stop message for readability 
     ESP_LOGI("WhoRecognitionCore", "✓ Task stopped");
     vTaskDelete(NULL);
 }
 
+// Runs on the detect task for every frame. Keeps the face tracks up to date, forwards the result, and handles a
+// pending RECOGNIZE or ENROLL on this frame
+void WhoRecognitionCore::detect_result_cb(const detect::WhoDetect::result_t &result)
+{
+    int64_t now_ms = (int64_t)result.timestamp.tv_sec * 1000 + result.timestamp.tv_usec / 1000;
+    std::vector<uint32_t> track_ids = m_tracker.update(result.det_res, now_ms);
+    // Per-track state goes with its track also while continuous mode is off, a reused id starts afresh
+    m_cache.erase(m_tracker.get_dropped());
+    m_voter.drop(m_tracker.get_dropped());
+    m_scheduler.drop(m_tracker.get_dropped());
+    if (m_gallery_changed.exchange(false)) {
+        m_cache.clear();
+        m_voter.clear();
+    }
+
+    // Call detect result callback if registered
+    if (m_detect_result_cb) {
+        m_detect_result_cb(result);
+    }
+    if (m_tracks_cb) {
+        std::vector<uint16_t> ids;
+        for (uint32_t track_id : track_ids) {
+            auto entry = m_cache.peek(track_id);
+            ids.push_back(entry && !entry->result.empty() ? entry->result[0].id : 0);
+        }
+        m_tracks_cb(result, track_ids, ids);
+    }
+
+    if (m_continuous) {
+        run_continuous(result, track_ids, now_ms);
+    }
+
+    EventBits_t action = m_pending_action.load();
+    if (!action) {
+        m_pending_since_ms = -1;
+        return;
+    }
+    if (m_pending_since_ms < 0) {
+        m_pending_since_ms = now_ms;
+    }
+
+    // Gate the faces before the feature model. Recognize goes ahead once any face passes, enroll needs the front
+    // face to pass. Otherwise the next frames are tried until the wait runs out
+    std::vector<face_quality_t> qualities;
+    bool any_passed = false;
+    for (const auto &res : result.det_res) {
+        qualities.push_back(m_quality.evaluate(result.img, res));
+        any_passed |= !qualities.back().reject;
+        if (m_face_quality_cb) {
+            m_face_quality_cb(qualities.back());
+        }
+    }
+    face_quality_t front_quality = qualities.empty() ? WhoFaceQuality::no_face() : qualities.front();
+    bool passed = action == ENROLL ? !front_quality.reject : any_passed;
+    if (!passed && now_ms - m_pending_since_ms < CONFIG_WHO_FACE_QUALITY_WAIT_MS) {
+        ESP_LOGD("WhoRecognitionCore",
+                 "Face rejected: %s",
+                 WhoFaceQuality::reject_to_str(front_quality.reject).c_str());
+        return;
+    }
+    if (!m_pending_action.compare_exchange_strong(action, 0)) {
+        // A new trigger came in meanwhile, run it on the next frame
+        return;
+    }
+    m_pending_since_ms = -1;
+    if (action == RECOGNIZE) {
+        on_recognize(result, track_ids, qualities, now_ms);
+    } else if (action == ENROLL) {
+        on_enroll(result, front_quality);
+    }
+}
+
+void WhoRecognitionCore::on_recognize(const detect::WhoDetect::result_t &result,
+                                      const std::vector<uint32_t> &track_ids,
+                                      const std::vector<face_quality_t> &qualities,
+                                      int64_t now_ms)
+{
+    ESP_LOGI("WhoRecognitionCore", "%d face(s) detected in frame", (int)result.det_res.size());
+
+    std::vector<uint8_t> selected(qualities.size());
+    for (size_t i = 0; i < qualities.size(); i++) {
+        selected[i] = !qualities[i].reject;
+        if (qualities[i].reject) {
+            // No usable view of this face within the wait, an embedding of it would not match reliably
+            ESP_LOGW("WhoRecognitionCore",
+                     "Track %d quality too low (%s), score %.2f",
+                     (int)track_ids[i],
+                     WhoFaceQuality::reject_to_str(qualities[i].reject).c_str(),
+                     qualities[i].score);
+        }
+    }
+    auto rets = recognize_faces(result, track_ids, qualities, selected, now_ms, true);
+
+    std::vector<uint32_t> emit_track_ids;
+    std::vector<std::vector<dl::recognition::result_t>> emit_rets;
+    for (size_t i = 0; i < rets.size(); i++) {
+        if (selected[i]) {
+            emit_track_ids.push_back(track_ids[i]);
+            emit_rets.push_back(std::move(rets[i]));
+        }
+    }
+    emit_result(gateway::EVENT_RECOGNIZE, result, track_ids, emit_track_ids, emit_rets);
+}
+
+// Continuous mode: every undecided track is embedded on every frame in which it passes the quality gate and its
+// vote is added to the window. A track is reported once, when the votes settle, and not embedded again after that
+void WhoRecognitionCore::run_continuous(const detect::WhoDetect::result_t &result,
+                                        const std::vector<uint32_t> &track_ids,
+                                        int64_t now_ms)
+{
+    m_voter.touch(track_ids, now_ms);
+
+    std::vector<face_quality_t> qualities(track_ids.size());
+    std::vector<WhoRecognitionScheduler::candidate_t> candidates;
+    std::vector<size_t> candidate_index;
+    size_t i = 0;
+    for (auto it = result.det_res.begin(); it != result.det_res.end(); it++, i++) {
+        if (m_voter.is_decided(track_ids[i])) {
+            continue;
+        }
+        qualities[i] = m_quality.evaluate(result.img, *it);
+        if (!qualities[i].reject) {
+            candidates.push_back(
+                {track_ids[i], qualities[i].size, qualities[i].score, !m_cache.contains(track_ids[i])});
+            candidate_index.push_back(i);
+        }
+    }
+    if (candidates.empty()) {
+        return;
+    }
+
+    // In a crowd only the faces which fit the per-frame budget are embedded, the rest wait for a later frame
+    std::vector<uint8_t> selected(track_ids.size());
+    std::vector<size_t> scheduled = m_scheduler.schedule(candidates, now_ms);
+    for (auto j : scheduled) {
+        selected[candidate_index[j]] = 1;
+    }
+    if (scheduled.size() < candidates.size()) {
+        ESP_LOGD("WhoRecognitionCore",
+                 "Scheduled %d of %d faces, %.1f ms per face",
+                 (int)scheduled.size(),
+                 (int)candidates.size(),
+                 m_scheduler.get_cost_ms());
+    }
+
+    // Votes must come from fresh embeddings, a cached result would just repeat the first frame's vote
+    int64_t start_us = esp_timer_get_time();
+    auto rets = recognize_faces(result, track_ids, qualities, selected, now_ms, false);
+    m_scheduler.update_cost((esp_timer_get_time() - start_us) / 1000.f, scheduled.size());
+    std::vector<uint32_t> emit_track_ids;
+    std::vector<std::vector<dl::recognition::result_t>> emit_rets;
+    for (i = 0; i < rets.size(); i++) {
+        WhoTrackVoter::decision_t decision;
+        if (selected[i] && m_voter.vote(track_ids[i], rets[i], now_ms, decision)) {
+            ESP_LOGI("WhoRecognitionCore",
+                     "Track %d decided: id %d with %d votes",
+                     (int)decision.track_id,
+                     decision.id,
+                     decision.votes);
+            emit_track_ids.push_back(decision.track_id);
+            emit_rets.emplace_back();
+            if (decision.id) {
+                emit_rets.back().push_back({decision.id, decision.similarity});
+            }
+        }
+    }
+    if (!emit_track_ids.empty()) {
+        emit_result(gateway::EVENT_CONTINUOUS, result, track_ids, emit_track_ids, emit_rets);
+    }
+}
+
+// Recognizes the selected faces of a frame. Faces whose track has a fresh cached result reuse it when use_cache is
+// set, the other faces go to the feature model together
+std::vector<std::vector<dl::recognition::result_t>> WhoRecognitionCore::recognize_faces(
+    const detect::WhoDetect::result_t &result,
+    const std::vector<uint32_t> &track_ids,
+    const std::vector<face_quality_t> &qualities,
+    const std::vector<uint8_t> &selected,
+    int64_t now_ms,
+    bool use_cache)
+{
+    std::vector<std::vector<dl::recognition::result_t>> rets(result.det_res.size());
+    std::list<dl::detect::result_t> misses;
+    std::vector<size_t> miss_index;
+    size_t i = 0;
+    for (auto it = result.det_res.begin(); it != result.det_res.end(); it++, i++) {
+        if (!selected[i]) {
+            continue;
+        }
+        if (use_cache && m_cache.lookup(track_ids[i], qualities[i].score, now_ms, rets[i])) {
+            ESP_LOGI("WhoRecognitionCore",
+                     "Track %d cached, feature model skipped (%d hits, %d misses)",
+                     (int)track_ids[i],
+                     (int)m_cache.get_hits(),
+                     (int)m_cache.get_misses());
+        } else {
+            misses.push_back(*it);
+            miss_index.push_back(i);
+        }
+    }
+    if (!misses.empty()) {
+        ESP_LOGI("WhoRecognitionCore", "Running recognition model on %d face(s)...", (int)misses.size());
+        dl::image::img_t img;
+        std::list<dl::detect::result_t> hires_misses;
+        auto miss_rets = map_to_hires(result, misses, img, hires_misses) ? recognize_batch(img, hires_misses)
+                                                                          : recognize_batch(result.img, misses);
+        for (size_t j = 0; j < miss_index.size(); j++) {
+            size_t k = miss_index[j];
+            rets[k] = std::move(miss_rets[j]);
+            m_cache.store(track_ids[k], qualities[k].score, now_ms, rets[k]);
+        }
+    }
+    return rets;
+}
+
+// Text for the result callback, which shows it on the lcd. Only built when a callback is set
+static std::string format_result(const std::vector<std::vector<dl::recognition::result_t>> &rets)
+{
+    std::string result_str;
+    for (const auto &ret : rets) {
+        if (!result_str.empty()) {
+            result_str += "; ";
+        }
+        result_str += ret.empty() ? "who?" : std::format("id: {}, sim: {:.2f}", ret[0].id, ret[0].similarity);
+    }
+    return result_str.empty() ? "who?" : result_str;
+}
+
+void WhoRecognitionCore::emit_result(gateway::event_type_t event_type,
+                                     const detect::WhoDetect::result_t &result,
+                                     const std::vector<uint32_t> &frame_track_ids,
+                                     const std::vector<uint32_t> &track_ids,
+                                     const std::vector<std::vector<dl::recognition::result_t>> &rets)
+{
+    // The event is filled on the stack and encoded straight into a preallocated ring slot, nothing is allocated
+    gateway::event_t event = {};
+    event.type = event_type;
+    event.seq = m_event_seq++;
+    event.timestamp_ms = esp_timer_get_time() / 1000;
+    if (rets.size() > gateway::EVENT_MAX_FACES) {
+        ESP_LOGW("WhoRecognitionCore",
+                 "%d faces in one event, only the first %d are sent",
+                 (int)rets.size(),
+                 gateway::EVENT_MAX_FACES);
+    }
+    for (size_t i = 0; i < rets.size() && i < gateway::EVENT_MAX_FACES; i++) {
+        gateway::event_face_t &face = event.faces[event.num_faces++];
+        face.track = track_ids[i];
+        if (!rets[i].empty()) {
+            face.id = rets[i][0].id;
+            face.status = 1;
+            face.similarity = rets[i][0].similarity;
+        }
+    }
+    int best = gateway::event_best_face(event);
+
+    // Process recognition results
+    if (best < 0) {
+        // Face detected but not recognised (i.e. no match -> logs "UNKNOWN")
+        if (m_recognition_result_cb) {
+            m_recognition_result_cb(format_result(rets));
+        }
+
+        ESP_LOGW("WhoRecognitionCore", "");
+        ESP_LOGW("WhoRecognitionCore", "┌────────────────────────────────────────┐");
+        ESP_LOGW("WhoRecognitionCore", "│ RECOGNITION RESULT: UNKNOWN            │");
+        ESP_LOGW("WhoRecognitionCore", "│ Face detected but not in database      │");
+        ESP_LOGW("WhoRecognitionCore", "└────────────────────────────────────────┘");
+        ESP_LOGW("WhoRecognitionCore", "");
+    } else {
+        // Face recognised -> logs "RECOGNISED"
+        if (m_recognition_result_cb) {
+            m_recognition_result_cb(format_result(rets));
+        }
+
+        ESP_LOGI("WhoRecognitionCore", "");
+        ESP_LOGI("WhoRecognitionCore", "╔════════════════════════════════════════════╗");
+        ESP_LOGI("WhoRecognitionCore", "║     FACE RECOGNIZED                        ║");
+        ESP_LOGI("WhoRecognitionCore", "╚════════════════════════════════════════════╝");
+        for (const auto &ret : rets) {
+            if (ret.empty()) {
+                continue;
+            }
+            ESP_LOGI("WhoRecognitionCore", "  Person ID:   %d", ret[0].id);
+            ESP_LOGI("WhoRecognitionCore", "  Similarity:  %.2f (%.1f%%)", 
+                    ret[0].similarity, ret[0].similarity * 100);
+        }
+        ESP_LOGI("WhoRecognitionCore", "");
+    }
+
+    if (m_event_cb) {
+        // The face the event is about, in the frame's detections
+        int face = -1;
+        if (event.num_faces) {
+            uint32_t track = event.faces[best < 0 ? 0 : best].track;
+            auto it = std::find(frame_track_ids.begin(), frame_track_ids.end(), track);
+            face = it == frame_track_ids.end() ? -1 : it - frame_track_ids.begin();
+        }
+        m_event_cb(event, result, face);
+    }
+    // Queued for the gateway client task, a slow or absent gateway does not hold up recognition
+    if (!m_gateway->push(event)) {
+        ESP_LOGE("WhoRecognitionCore",
+                 "Gateway queue full, event %d dropped (%d so far)",
+                 (int)event.seq,
+                 (int)m_gateway->get_dropped());
+    } else if (!m_gateway->is_connected()) {
+        ESP_LOGW("WhoRecognitionCore", "Gateway not connected, event kept for later");
+    }
+    ESP_LOGI("WhoRecognitionCore", "");
+}
+
+// Runs on the gateway client task for every complete command. A trigger wakes the recognition task directly
+void WhoRecognitionCore::gateway_command_cb(gateway::gateway_cmd_t cmd)
+{
+    if (cmd == gateway::GATEWAY_CMD_TRIGGER) {
+        ESP_LOGI("WhoRecognitionCore", "");
+        ESP_LOGI("WhoRecognitionCore", "╔════════════════════════════════════════╗");
+        ESP_LOGI("WhoRecognitionCore", "║     PIR MOTION TRIGGER DETECTED        ║");
+        ESP_LOGI("WhoRecognitionCore", "╚════════════════════════════════════════╝");
+        xEventGroupSetBits(m_event_group, RECOGNIZE);
+        if (m_motion_cb) {
+            m_motion_cb();
+        }
+    }
+}
+
+// Runs on the gateway client task for every WIRE_CONFIG frame of the binary protocol
+void WhoRecognitionCore::gateway_config_cb(gateway::wire_config_key_t key, int32_t value)
+{
+    if (key == gateway::WIRE_CONFIG_CONTINUOUS) {
+        ESP_LOGI("WhoRecognitionCore", "Continuous recognition %s by the gateway", value ? "on" : "off");
+        set_continuous_mode(value != 0);
+    } else {
+        ESP_LOGW("WhoRecognitionCore", "Unknown config key %d", key);
+    }
+}
+
+void WhoRecognitionCore::on_enroll(const detect::WhoDetect::result_t &result, const face_quality_t &quality)
+{
+    // calls m_recognizer to send detected face to recognition database, a poor face would be enrolled for good so
+    // it is never let through
+    esp_err_t ret = ESP_FAIL;
+    if (quality.reject) {
+        ESP_LOGW("WhoRecognitionCore",
+                 "Face quality too low (%s), score %.2f",
+                 WhoFaceQuality::reject_to_str(quality.reject).c_str(),
+                 quality.score);
+    } else {
+        ret = enroll(result);
+    }
+    if (ret == ESP_OK) {
+        // A cached or voted "unknown" may be the face that was just enrolled
+        m_cache.clear();
+        m_voter.clear();
+    }
+
+    if (m_recognition_result_cb) {
+        if (ret != ESP_OK) {
+            m_recognition_result_cb("Failed to enroll.");
+            ESP_LOGE("WhoRecognitionCore", "Enrollment failed");
+            ESP_LOGE("WhoRecognitionCore", " Please try again with better lighting");
+        } else {
+            int num_feats = get_num_feats();
+            // Ids are not dense once faces are deleted by id, ask the face db for the one it assigned
+            int new_id = m_face_db_recognizer ? m_face_db_recognizer->get_last_id() : num_feats;
+            std::string msg = std::format("id: {} enrolled.", new_id);
+            m_recognition_result_cb(msg);
+
+            ESP_LOGI("WhoRecognitionCore", "");
+            ESP_LOGI("WhoRecognitionCore", "╔════════════════════════════════════════════╗");
+            ESP_LOGI("WhoRecognitionCore", "║     ENROLLMENT SUCCESSFUL                  ║");
+            ESP_LOGI("WhoRecognitionCore", "╚════════════════════════════════════════════╝");
+            ESP_LOGI("WhoRecognitionCore", "  Assigned ID: %d", new_id);
+            ESP_LOGI("WhoRecognitionCore", "  Total faces: %d", num_feats);
+            ESP_LOGI("WhoRecognitionCore", "");
+        }
+    }
+}
+
+// Dispatch to whichever recognizer was set, the face db recognizer takes precedence
+std::vector<std::vector<dl::recognition::result_t>> WhoRecognitionCore::recognize_batch(
+    const dl::image::img_t &img, const std::list<dl::detect::result_t> &faces)
+{
+    if (m_face_db_recognizer) {
+        return m_face_db_recognizer->recognize_batch(img, faces);
+    }
+    // HumanFaceRecognizer only looks at the first face of the list
+    std::vector<std::vector<dl::recognition::result_t>> rets;
+    for (const auto &face : faces) {
+        rets.push_back(m_recognizer->recognize(img, {face}));
+    }
+    return rets;
+}
+
+// Crops the faces from the full resolution frame the detected frame was resized from. The crop is the union of the
+// face boxes plus a margin, so one feature model batch still covers all faces. Returns false to fall back to the
+// detected frame, when no node is set, its frame is not larger or it has already been recycled
+bool WhoRecognitionCore::map_to_hires(const detect::WhoDetect::result_t &result,
+                                      const std::list<dl::detect::result_t> &faces,
+                                      dl::image::img_t &img,
+                                      std::list<dl::detect::result_t> &hires_faces)
+{
+#if CONFIG_WHO_RECOGNITION_HIRES_EMBED
+    if (!m_hires_node || faces.empty()) {
+        return false;
+    }
+    int width = m_hires_node->get_fb_width();
+    int height = m_hires_node->get_fb_height();
+    if (width <= result.img.width || height <= result.img.height) {
+        return false;
+    }
+    float scale_x = (float)width / result.img.width;
+    float scale_y = (float)height / result.img.height;
+
+    int roi[4] = {width, height, 0, 0};
+    hires_faces = faces;
+    for (auto &face : hires_faces) {
+        face.box[0] *= scale_x;
+        face.box[1] *= scale_y;
+        face.box[2] *= scale_x;
+        face.box[3] *= scale_y;
+        face.limit_box(width, height);
+        for (int i = 0; i < (int)face.keypoint.size() / 2; i++) {
+            face.keypoint[2 * i] *= scale_x;
+            face.keypoint[2 * i + 1] *= scale_y;
+        }
+        if (!face.keypoint.empty()) {
+            face.limit_keypoint(width, height);
+        }
+        int margin_x = (face.box[2] - face.box[0]) * CONFIG_WHO_RECOGNITION_HIRES_MARGIN / 100;
+        int margin_y = (face.box[3] - face.box[1]) * CONFIG_WHO_RECOGNITION_HIRES_MARGIN / 100;
+        roi[0] = std::min(roi[0], std::max(face.box[0] - margin_x, 0));
+        roi[1] = std::min(roi[1], std::max(face.box[1] - margin_y, 0));
+        roi[2] = std::max(roi[2], std::min(face.box[2] + margin_x, width));
+        roi[3] = std::max(roi[3], std::min(face.box[3] + margin_y, height));
+    }
+    if (roi[0] >= roi[2] || roi[1] >= roi[3]) {
+        return false;
+    }
+
+    // Room for RGB888, the widest format a frame can be cropped in
+    size_t buf_size = (size_t)(roi[2] - roi[0]) * (roi[3] - roi[1]) * 3;
+    if (buf_size > m_hires_buf_size) {
+        heap_caps_free(m_hires_buf);
+        m_hires_buf = heap_caps_malloc(buf_size, MALLOC_CAP_SPIRAM);
+        m_hires_buf_size = m_hires_buf ? buf_size : 0;
+        if (!m_hires_buf) {
+            ESP_LOGW("WhoRecognitionCore", "Failed to allocate %d bytes for the full resolution crop", (int)buf_size);
+            return false;
+        }
+    }
+    img.data = m_hires_buf;
+    if (!m_hires_node->cam_fb_copy_roi(result.timestamp, roi, img)) {
+        ESP_LOGD("WhoRecognitionCore", "Full resolution frame not buffered anymore, using the detected frame");
+        return false;
+    }
+    for (auto &face : hires_faces) {
+        face.box[0] -= roi[0];
+        face.box[1] -= roi[1];
+        face.box[2] -= roi[0];
+        face.box[3] -= roi[1];
+        for (int i = 0; i < (int)face.keypoint.size() / 2; i++) {
+            face.keypoint[2 * i] -= roi[0];
+            face.keypoint[2 * i + 1] -= roi[1];
+        }
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+esp_err_t WhoRecognitionCore::enroll(const detect::WhoDetect::result_t &result)
+{
+    // Enroll from the same source as recognize, so the gallery and the queries are embedded alike
+    dl::image::img_t img = result.img;
+    std::list<dl::detect::result_t> faces = result.det_res;
+    std::list<dl::detect::result_t> hires_faces;
+    if (map_to_hires(result, result.det_res, img, hires_faces)) {
+        faces.swap(hires_faces);
+    }
+    if (m_face_db_recognizer) {
+        return m_face_db_recognizer->enroll(img, faces);
+    }
+    return m_recognizer->enroll(img, faces);
+}
+
+esp_err_t WhoRecognitionCore::delete_feat(uint16_t id, uint16_t *deleted_id)
+{
+    if (m_face_db_recognizer) {
+        *deleted_id = id ? id : m_face_db_recognizer->get_last_id();
+        return id ? m_face_db_recognizer->delete_feat(id) : m_face_db_recognizer->delete_last_feat();
+    }
+    *deleted_id = id ? id : m_recognizer->get_num_feats();
+    return id ? m_recognizer->delete_feat(id) : m_recognizer->delete_last_feat();
+}
+
+int WhoRecognitionCore::get_num_feats()
+{
+    if (m_face_db_recognizer) {
+        return m_face_db_recognizer->get_num_feats();
+    }
+    return m_recognizer->get_num_feats();
+}
+
 void WhoRecognitionCore::cleanup()
 {
     if (m_cleanup) {
@@ -363,6 +814,10 @@ WhoRecognition::WhoRecognition(frame_cap::WhoFrameCapNode *frame_cap_node) :
 {    // registers tasks with WhoTaskGroup
     WhoTaskGroup::register_task(m_detect);
     WhoTaskGroup::register_task(m_recognition);
+    // The PPA resize node passes the upstream timestamp on, so the frame it was resized from can be found again
+    if (frame_cap_node->get_type() == "PPAResizeNode") {
+        m_recognition->set_hires_node(frame_cap_node->get_prev_node());
+    }
 }
 
 WhoRecognition::~WhoRecognition()
@@ -380,6 +835,11 @@ void WhoRecognition::set_recognizer(HumanFaceRecognizer *recognizer)
     m_recognition->set_recognizer(recognizer);
 }
 
+void WhoRecognition::set_recognizer(WhoFaceDBRecognizer *recognizer)
+{    // configures recognition task (with the memory-mapped face db recogniser)
+    m_recognition->set_recognizer(recognizer);
+}
+
 detect::WhoDetect *WhoRecognition::get_detect_task()
 {
     return m_detect;
@@ -1,6 +1,14 @@
 #pragma once
+#include <atomic>
 #include "human_face_recognition.hpp"
 #include "who_detect.hpp"
+#include "who_gateway_client.hpp"
+#include "who_face_db_recognizer.hpp"
+#include "who_face_quality.hpp"
+#include "who_face_track.hpp"
+#include "who_recognition_cache.hpp"
+#include "who_recognition_scheduler.hpp"
+#include "who_track_vote.hpp"
 
 namespace who {
 namespace recognition {
@@ -14,19 +22,98 @@ public:
     ~WhoRecognitionCore();
     // void message_handler(int flag);
     void set_recognizer(HumanFaceRecognizer *recognizer);
+    void set_recognizer(WhoFaceDBRecognizer *recognizer);
     void set_recognition_result_cb(const std::function<void(const std::string &)> &result_cb);
     void set_detect_result_cb(const std::function<void(const detect::WhoDetect::result_t &)> &result_cb);
+    void set_face_quality_cb(const std::function<void(const face_quality_t &)> &quality_cb);
     void set_cleanup_func(const std::function<void()> &cleanup_func);
+    // Called on the detect task with every result event, right before it is queued for the gateway. Also gets the
+    // frame of the result, valid only during the call, and the index in det_res of the event's best face, or of its
+    // first face if none matched
+    void set_event_cb(
+        const std::function<void(const gateway::event_t &, const detect::WhoDetect::result_t &, int)> &event_cb);
+    // Called on the gateway client task when the gateway reports motion
+    void set_motion_cb(const std::function<void()> &motion_cb);
+    // Called on the detect task for every frame with the track of each face in det_res and the id the track was last
+    // recognised as, 0 if it was not yet
+    void set_tracks_cb(const std::function<void(const detect::WhoDetect::result_t &,
+                                                const std::vector<uint32_t> &,
+                                                const std::vector<uint16_t> &)> &tracks_cb);
+    // Recognize every tracked face over a window of frames and report each person once per visit.
+    void set_continuous_mode(bool enable);
+    // Delete a face by id. Setting the DELETE bit alone deletes the last enrolled face.
+    void delete_feat(uint16_t id);
+    // Crop the faces for the feature model from the frame of this node instead of the detected frame. Frames are
+    // matched by timestamp and the boxes scaled to the node's resolution
+    void set_hires_node(frame_cap::WhoFrameCapNode *node);
     bool run(const configSTACK_DEPTH_TYPE uxStackDepth, UBaseType_t uxPriority, const BaseType_t xCoreID) override;
 
 private:
     void task() override;
     void cleanup() override;
+    void detect_result_cb(const detect::WhoDetect::result_t &result);
+    void on_recognize(const detect::WhoDetect::result_t &result,
+                      const std::vector<uint32_t> &track_ids,
+                      const std::vector<face_quality_t> &qualities,
+                      int64_t now_ms);
+    void on_enroll(const detect::WhoDetect::result_t &result, const face_quality_t &quality);
+    void run_continuous(const detect::WhoDetect::result_t &result,
+                        const std::vector<uint32_t> &track_ids,
+                        int64_t now_ms);
+    std::vector<std::vector<dl::recognition::result_t>> recognize_faces(const detect::WhoDetect::result_t &result,
+                                                                        const std::vector<uint32_t> &track_ids,
+                                                                        const std::vector<face_quality_t> &qualities,
+                                                                        const std::vector<uint8_t> &selected,
+                                                                        int64_t now_ms,
+                                                                        bool use_cache);
+    void emit_result(gateway::event_type_t event_type,
+                     const detect::WhoDetect::result_t &result,
+                     const std::vector<uint32_t> &frame_track_ids,
+                     const std::vector<uint32_t> &track_ids,
+                     const std::vector<std::vector<dl::recognition::result_t>> &rets);
+    void gateway_command_cb(gateway::gateway_cmd_t cmd);
+    void gateway_config_cb(gateway::wire_config_key_t key, int32_t value);
+    std::vector<std::vector<dl::recognition::result_t>> recognize_batch(const dl::image::img_t &img,
+                                                                        const std::list<dl::detect::result_t> &faces);
+    bool map_to_hires(const detect::WhoDetect::result_t &result,
+                      const std::list<dl::detect::result_t> &faces,
+                      dl::image::img_t &img,
+                      std::list<dl::detect::result_t> &hires_faces);
+    esp_err_t enroll(const detect::WhoDetect::result_t &result);
+    esp_err_t delete_feat(uint16_t id, uint16_t *deleted_id);
+    int get_num_feats();
     detect::WhoDetect *m_detect;
     HumanFaceRecognizer *m_recognizer;
+    WhoFaceDBRecognizer *m_face_db_recognizer;
     std::function<void(const detect::WhoDetect::result_t &)> m_detect_result_cb;
     std::function<void(const std::string &)> m_recognition_result_cb;
     std::function<void()> m_cleanup;
+    std::atomic<uint16_t> m_delete_id;
+    // RECOGNIZE or ENROLL to run on the next detect result, 0 if none
+    std::atomic<EventBits_t> m_pending_action;
+    std::atomic<bool> m_gallery_changed;
+    // Only touched from the detect task
+    WhoFaceTracker m_tracker;
+    WhoRecognitionCache m_cache;
+    WhoFaceQuality m_quality;
+    // Timestamp of the first frame checked for the pending action, -1 if none
+    int64_t m_pending_since_ms;
+    std::function<void(const face_quality_t &)> m_face_quality_cb;
+    std::function<void(const gateway::event_t &, const detect::WhoDetect::result_t &, int)> m_event_cb;
+    std::function<void()> m_motion_cb;
+    std::function<void(const detect::WhoDetect::result_t &,
+                       const std::vector<uint32_t> &,
+                       const std::vector<uint16_t> &)>
+        m_tracks_cb;
+    std::atomic<bool> m_continuous;
+    WhoTrackVoter m_voter;
+    WhoRecognitionScheduler m_scheduler;
+    frame_cap::WhoFrameCapNode *m_hires_node;
+    // Crop of the full resolution frame, grown on demand
+    void *m_hires_buf;
+    size_t m_hires_buf_size;
+    gateway::WhoGatewayClient *m_gateway;
+    uint32_t m_event_seq;
 };
 
 class WhoRecognition : public task::WhoTaskGroup {
@@ -35,6 +122,7 @@ public:
     ~WhoRecognition();
     void set_detect_model(dl::detect::Detect *model);
     void set_recognizer(HumanFaceRecognizer *recognizer);
+    void set_recognizer(WhoFaceDBRecognizer *recognizer);
     detect::WhoDetect *get_detect_task();
     WhoRecognitionCore *get_recognition_task();
 
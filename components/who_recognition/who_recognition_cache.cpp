@@ -0,0 +1,64 @@
+#include "who_recognition_cache.hpp"
+
+namespace who {
+namespace recognition {
+WhoRecognitionCache::WhoRecognitionCache(int ttl_ms, float decay_per_s, float quality_gain, float thr) :
+    m_ttl_ms(ttl_ms),
+    m_decay_per_ms(decay_per_s / 1000.f),
+    m_quality_gain(quality_gain),
+    m_thr(thr),
+    m_hits(0),
+    m_misses(0)
+{
+}
+
+bool WhoRecognitionCache::lookup(uint32_t track_id,
+                                 float quality,
+                                 int64_t now_ms,
+                                 std::vector<dl::recognition::result_t> &result)
+{
+    auto it = m_entries.find(track_id);
+    if (m_ttl_ms <= 0 || it == m_entries.end()) {
+        m_misses++;
+        return false;
+    }
+    const entry_t &entry = it->second;
+    int64_t age_ms = now_ms - entry.time_ms;
+    if (age_ms > m_ttl_ms || quality > entry.quality * (1 + m_quality_gain)) {
+        m_entries.erase(it);
+        m_misses++;
+        return false;
+    }
+    float decay = m_decay_per_ms * age_ms;
+    std::vector<dl::recognition::result_t> decayed;
+    for (const auto &res : entry.result) {
+        float similarity = res.similarity - decay;
+        if (similarity < m_thr) {
+            // Not confident enough anymore, check again.
+            m_entries.erase(it);
+            m_misses++;
+            return false;
+        }
+        decayed.push_back({res.id, similarity});
+    }
+    result = std::move(decayed);
+    m_hits++;
+    return true;
+}
+
+void WhoRecognitionCache::store(uint32_t track_id,
+                                float quality,
+                                int64_t now_ms,
+                                const std::vector<dl::recognition::result_t> &result)
+{
+    m_entries[track_id] = {result, quality, now_ms};
+}
+
+void WhoRecognitionCache::erase(const std::vector<uint32_t> &track_ids)
+{
+    for (auto track_id : track_ids) {
+        m_entries.erase(track_id);
+    }
+}
+} // namespace recognition
+} // namespace who
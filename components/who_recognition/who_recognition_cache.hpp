@@ -0,0 +1,70 @@
+#pragma once
+#include "dl_recognition_define.hpp"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace who {
+namespace recognition {
+// Recognition results cached per face track.
+//
+// A face which stays in front of the camera keeps its track id, so a fresh result for that track can be reused
+// instead of running the feature model again. The cached similarity decays linearly with age, an entry is stale once
+// it is older than the ttl or its decayed similarity drops below the match threshold. A face whose quality improves
+// by more than the given ratio is embedded again, a sharper or more frontal view gives a more reliable match.
+class WhoRecognitionCache {
+public:
+    typedef struct {
+        std::vector<dl::recognition::result_t> result;
+        float quality;
+        int64_t time_ms;
+    } entry_t;
+
+    /**
+     * @param ttl_ms          max age of a cached result.
+     * @param decay_per_s     similarity lost per second of age.
+     * @param quality_gain    re-embed when quality > cached quality * (1 + quality_gain).
+     * @param thr             match threshold, a decayed match below it is reported as stale.
+     */
+    WhoRecognitionCache(int ttl_ms = 3000, float decay_per_s = 0.05f, float quality_gain = 0.3f, float thr = 0.5f);
+
+    /**
+     * @brief Look up a fresh result for a track.
+     *
+     * @param track_id  track of the face.
+     * @param quality   quality of the face in the current frame.
+     * @param now_ms    timestamp of the current frame.
+     * @param result    cached result with decayed similarities, only written on a hit.
+     * @return true on a hit, false if the face needs to be embedded.
+     */
+    bool lookup(uint32_t track_id, float quality, int64_t now_ms, std::vector<dl::recognition::result_t> &result);
+    void store(uint32_t track_id,
+               float quality,
+               int64_t now_ms,
+               const std::vector<dl::recognition::result_t> &result);
+    bool contains(uint32_t track_id) const { return m_entries.count(track_id); }
+    // The entry as stored, without counting a hit or decaying it. nullptr if there is none
+    const entry_t *peek(uint32_t track_id) const
+    {
+        auto it = m_entries.find(track_id);
+        return it == m_entries.end() ? nullptr : &it->second;
+    }
+    void erase(uint32_t track_id) { m_entries.erase(track_id); }
+    void erase(const std::vector<uint32_t> &track_ids);
+    // Needed whenever the gallery changes, a cached id may have been deleted or a new face enrolled.
+    void clear() { m_entries.clear(); }
+
+    uint32_t get_hits() const { return m_hits; }
+    uint32_t get_misses() const { return m_misses; }
+
+private:
+    int m_ttl_ms;
+    float m_decay_per_ms;
+    float m_quality_gain;
+    float m_thr;
+    uint32_t m_hits;
+    uint32_t m_misses;
+    std::unordered_map<uint32_t, entry_t> m_entries;
+};
+} // namespace recognition
+} // namespace who
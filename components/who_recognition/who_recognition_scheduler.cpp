@@ -0,0 +1,68 @@
+#include "who_recognition_scheduler.hpp"
+#include <algorithm>
+#include <numeric>
+
+namespace who {
+namespace recognition {
+// Weights of the ranking terms. Size and quality are in [0, 1], novelty is 0 or 1, waiting is in seconds and keeps
+// growing, so a face which waited about a second outranks any face which was just attempted.
+static constexpr float SIZE_WEIGHT = 1.f;
+static constexpr float QUALITY_WEIGHT = 1.f;
+static constexpr float NOVELTY_WEIGHT = 2.f;
+static constexpr float WAIT_WEIGHT = 4.f;
+// Size at which the size term saturates.
+static constexpr float FULL_SIZE = 160.f;
+// Head start of a track which was never attempted.
+static constexpr int64_t NEVER_ATTEMPTED_MS = 1000;
+static constexpr float COST_EMA_ALPHA = 0.2f;
+
+WhoRecognitionScheduler::WhoRecognitionScheduler(int budget_ms, float init_cost_ms) :
+    m_budget_ms(budget_ms), m_cost_ms(init_cost_ms)
+{
+}
+
+float WhoRecognitionScheduler::get_priority(const candidate_t &candidate, int64_t now_ms) const
+{
+    int64_t wait_ms = now_ms - m_last_attempt_ms.at(candidate.track_id);
+    return SIZE_WEIGHT * std::min(1.f, candidate.size / FULL_SIZE) + QUALITY_WEIGHT * candidate.score +
+        NOVELTY_WEIGHT * candidate.novel + WAIT_WEIGHT * wait_ms / 1000.f;
+}
+
+std::vector<size_t> WhoRecognitionScheduler::schedule(const std::vector<candidate_t> &candidates, int64_t now_ms)
+{
+    std::vector<size_t> order(candidates.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::vector<float> priorities(candidates.size());
+    for (size_t i = 0; i < candidates.size(); i++) {
+        // A new track starts out as if it had been waiting for a while, and keeps waiting from there.
+        m_last_attempt_ms.try_emplace(candidates[i].track_id, now_ms - NEVER_ATTEMPTED_MS);
+        priorities[i] = get_priority(candidates[i], now_ms);
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return priorities[a] > priorities[b]; });
+
+    size_t num = candidates.size();
+    if (m_budget_ms > 0 && m_cost_ms > 0) {
+        num = std::clamp((size_t)(m_budget_ms / m_cost_ms), (size_t)1, candidates.size());
+    }
+    order.resize(num);
+    for (auto i : order) {
+        m_last_attempt_ms[candidates[i].track_id] = now_ms;
+    }
+    return order;
+}
+
+void WhoRecognitionScheduler::update_cost(float elapsed_ms, int num_faces)
+{
+    if (num_faces > 0) {
+        m_cost_ms += COST_EMA_ALPHA * (elapsed_ms / num_faces - m_cost_ms);
+    }
+}
+
+void WhoRecognitionScheduler::drop(const std::vector<uint32_t> &track_ids)
+{
+    for (auto track_id : track_ids) {
+        m_last_attempt_ms.erase(track_id);
+    }
+}
+} // namespace recognition
+} // namespace who
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace who {
+namespace recognition {
+// Picks which faces of a frame go to the feature model when they do not all fit in the per-frame budget.
+//
+// Faces are ranked by a weighted sum of size, quality, novelty (no cached identity yet) and time since the track was
+// last attempted, then taken in order while their estimated cost fits the budget. The cost of one face is an
+// exponential moving average of the measured feature model time. The waiting term grows without bound, so a track
+// which keeps losing to better faces is eventually picked.
+class WhoRecognitionScheduler {
+public:
+    typedef struct {
+        uint32_t track_id;
+        int size;     // shorter side of the box in pixels.
+        float score;  // face quality score, 0 to 1.
+        bool novel;   // true if the track has no cached identity.
+    } candidate_t;
+
+    /**
+     * @param budget_ms      feature model time allowed per frame, 0 for no limit.
+     * @param init_cost_ms   cost of one face until the first measurement.
+     */
+    WhoRecognitionScheduler(int budget_ms = 150, float init_cost_ms = 50);
+
+    /**
+     * @brief Choose the faces to recognize in this frame. At least one face is chosen if there is any, so the
+     * pipeline keeps moving when a single face costs more than the budget.
+     *
+     * @return indices into candidates, best first.
+     */
+    std::vector<size_t> schedule(const std::vector<candidate_t> &candidates, int64_t now_ms);
+    /**
+     * @brief Feed back the measured time of the faces recognized in this frame.
+     */
+    void update_cost(float elapsed_ms, int num_faces);
+    void drop(const std::vector<uint32_t> &track_ids);
+    float get_cost_ms() const { return m_cost_ms; }
+
+private:
+    float get_priority(const candidate_t &candidate, int64_t now_ms) const;
+
+    int m_budget_ms;
+    float m_cost_ms;
+    // Track id to the last time it was sent to the feature model.
+    std::unordered_map<uint32_t, int64_t> m_last_attempt_ms;
+};
+} // namespace recognition
+} // namespace who
@@ -0,0 +1,98 @@
+#include "who_track_vote.hpp"
+
+namespace who {
+namespace recognition {
+WhoTrackVoter::WhoTrackVoter(int window, int min_votes, int visit_gap_ms) :
+    m_window(window), m_min_votes(min_votes), m_visit_gap_ms(visit_gap_ms)
+{
+}
+
+bool WhoTrackVoter::vote(uint32_t track_id,
+                         const std::vector<dl::recognition::result_t> &result,
+                         int64_t now_ms,
+                         decision_t &decision)
+{
+    track_votes_t &track = m_tracks[track_id];
+    if (track.decided) {
+        return false;
+    }
+    track.votes.push_back(result.empty() ? vote_t{0, 0} : vote_t{result[0].id, result[0].similarity});
+    if ((int)track.votes.size() > m_window) {
+        track.votes.pop_front();
+    }
+
+    // The window is a handful of votes, counting them again every frame is cheaper than keeping counters in sync.
+    uint16_t best_id = 0;
+    int best_count = 0;
+    int unknown_count = 0;
+    for (const auto &v : track.votes) {
+        if (!v.id) {
+            unknown_count++;
+            continue;
+        }
+        int count = 0;
+        for (const auto &w : track.votes) {
+            count += w.id == v.id;
+        }
+        if (count > best_count) {
+            best_id = v.id;
+            best_count = count;
+        }
+    }
+
+    if (best_count >= m_min_votes) {
+        float sum = 0;
+        for (const auto &v : track.votes) {
+            if (v.id == best_id) {
+                sum += v.similarity;
+            }
+        }
+        decision = {track_id, best_id, sum / best_count, best_count};
+    } else if ((int)track.votes.size() == m_window && unknown_count >= m_min_votes) {
+        decision = {track_id, 0, 0, unknown_count};
+    } else {
+        return false;
+    }
+    track.decided = true;
+    track.id = decision.id;
+    track.votes.clear();
+    if (!decision.id) {
+        // Unknown faces can not be told apart across tracks, every track is its own visit.
+        return true;
+    }
+    auto it = m_last_seen_ms.find(decision.id);
+    bool new_visit = it == m_last_seen_ms.end() || now_ms - it->second > m_visit_gap_ms;
+    m_last_seen_ms[decision.id] = now_ms;
+    return new_visit;
+}
+
+bool WhoTrackVoter::is_decided(uint32_t track_id) const
+{
+    auto it = m_tracks.find(track_id);
+    return it != m_tracks.end() && it->second.decided;
+}
+
+void WhoTrackVoter::touch(const std::vector<uint32_t> &track_ids, int64_t now_ms)
+{
+    for (auto track_id : track_ids) {
+        auto it = m_tracks.find(track_id);
+        if (it != m_tracks.end() && it->second.decided && it->second.id) {
+            m_last_seen_ms[it->second.id] = now_ms;
+        }
+    }
+}
+
+void WhoTrackVoter::drop(const std::vector<uint32_t> &track_ids)
+{
+    for (auto track_id : track_ids) {
+        m_tracks.erase(track_id);
+    }
+}
+
+void WhoTrackVoter::clear()
+{
+    m_tracks.clear();
+    m_last_seen_ms.clear();
+}
+} // namespace recognition
+} // namespace who
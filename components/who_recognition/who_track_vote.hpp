@@ -0,0 +1,68 @@
+#pragma once
+#include "dl_recognition_define.hpp"
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+namespace who {
+namespace recognition {
+// Identity voting over a sliding window of frames, per face track.
+//
+// Each frame in which a tracked face is embedded adds one vote, the id of the best match or 0 for unknown. A track
+// is decided once one id collects min_votes within the last window votes, or once a full window holds min_votes
+// unknown votes. A decided track is not voted on again. A decision on a known id is emitted only once per visit: a
+// person whose track is lost and picked up again within visit_gap_ms is not reported twice.
+class WhoTrackVoter {
+public:
+    typedef struct {
+        uint32_t track_id;
+        uint16_t id;      // 0 for unknown.
+        float similarity; // mean similarity of the winning votes.
+        int votes;        // number of winning votes.
+    } decision_t;
+
+    WhoTrackVoter(int window = 5, int min_votes = 3, int visit_gap_ms = 10000);
+
+    /**
+     * @brief Add the vote of one frame.
+     *
+     * @param track_id  track of the face.
+     * @param result    recognition result of the face, empty for unknown.
+     * @param now_ms    timestamp of the frame.
+     * @param decision  written when the call returns true.
+     * @return true if the track was decided by this vote and starts a new visit.
+     */
+    bool vote(uint32_t track_id,
+              const std::vector<dl::recognition::result_t> &result,
+              int64_t now_ms,
+              decision_t &decision);
+    bool is_decided(uint32_t track_id) const;
+    /**
+     * @brief Extend the visits of the people on decided tracks which are still in view.
+     */
+    void touch(const std::vector<uint32_t> &track_ids, int64_t now_ms);
+    void drop(const std::vector<uint32_t> &track_ids);
+    // Needed whenever the gallery changes.
+    void clear();
+
+private:
+    typedef struct {
+        uint16_t id;
+        float similarity;
+    } vote_t;
+    typedef struct {
+        std::deque<vote_t> votes;
+        bool decided;
+        uint16_t id;
+    } track_votes_t;
+
+    int m_window;
+    int m_min_votes;
+    int m_visit_gap_ms;
+    std::unordered_map<uint32_t, track_votes_t> m_tracks;
+    // Person id to the last time a decided track of that person was seen.
+    std::unordered_map<uint16_t, int64_t> m_last_seen_ms;
+};
+} // namespace recognition
+} // namespace who
@@ -0,0 +1,403 @@
+#include "who_snapshot_store.hpp"
+#include "dl_image_pixel_cvt_dispatch.hpp"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#if CONFIG_IDF_TARGET_ESP32S3
+#include "img_converters.h"
+// fmt2jpg() encodes the snapshots here and the frames of the encoder stage, other targets have neither.
+#define SNAPSHOT_HAS_ENCODER 1
+#else
+#define SNAPSHOT_HAS_ENCODER 0
+#endif
+#include <algorithm>
+#include <cstring>
+
+static const char *TAG = "WhoSnapshotStore";
+
+namespace who {
+namespace snapshot {
+WhoSnapshotStore::WhoSnapshotStore(
+    frame_jpeg::WhoFrameJpeg *source, uint8_t max_entries, size_t max_bytes, uint8_t quality, uint8_t flags) :
+    m_source(source),
+    m_max_entries(max_entries),
+    m_max_bytes(max_bytes),
+    m_quality(quality),
+    m_flags(flags),
+    m_mutex(xSemaphoreCreateMutex()),
+    m_event_group(xEventGroupCreate()),
+    m_jobs(xQueueCreate(2, sizeof(job_t *))),
+    m_stopped(xSemaphoreCreateBinary()),
+    m_running(false),
+    m_next_id(esp_random()),
+    m_bytes(0),
+    m_evicted(0),
+    m_failed(0)
+{
+    source->add_new_jpeg_cb([this](const frame_jpeg::jpeg_frame_t *frame) { on_new_jpeg(frame); });
+}
+
+WhoSnapshotStore::~WhoSnapshotStore()
+{
+    stop();
+    for (auto snapshot : m_snapshots) {
+        release(snapshot);
+    }
+    vSemaphoreDelete(m_stopped);
+    vQueueDelete(m_jobs);
+    vEventGroupDelete(m_event_group);
+    vSemaphoreDelete(m_mutex);
+}
+
+esp_err_t WhoSnapshotStore::start(const configSTACK_DEPTH_TYPE stack_depth, UBaseType_t priority)
+{
+    if (m_running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+#if !SNAPSHOT_HAS_ENCODER
+    ESP_LOGW(TAG, "No JPEG encoder for this target, no snapshots are taken.");
+#endif
+    m_running = true;
+    if (xTaskCreate(task, "SnapshotStore", stack_depth, this, priority, nullptr) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create task");
+        m_running = false;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void WhoSnapshotStore::stop()
+{
+    if (!m_running.exchange(false)) {
+        return;
+    }
+    job_t *job = nullptr;
+    xQueueSend(m_jobs, &job, portMAX_DELAY);
+    xSemaphoreTake(m_stopped, portMAX_DELAY);
+    while (xQueueReceive(m_jobs, &job, 0) == pdTRUE) {
+        remove(job->snapshot);
+        release(job->snapshot);
+        heap_caps_free(job->img.data);
+        delete job;
+    }
+}
+
+snapshot_t *WhoSnapshotStore::add(const struct timeval &timestamp)
+{
+    snapshot_t *snapshot = new snapshot_t();
+    snapshot->timestamp = timestamp;
+    snapshot->refs.store(1, std::memory_order_relaxed);
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    // 0 means no snapshot.
+    if (!m_next_id) {
+        m_next_id++;
+    }
+    snapshot->id = m_next_id++;
+    m_snapshots.push_front(snapshot);
+    evict();
+    xSemaphoreGive(m_mutex);
+    return snapshot;
+}
+
+void WhoSnapshotStore::evict()
+{
+    while (m_snapshots.size() > 1 && (m_snapshots.size() > m_max_entries || m_bytes > m_max_bytes)) {
+        snapshot_t *snapshot = m_snapshots.back();
+        m_snapshots.pop_back();
+        m_next.remove(snapshot);
+        m_bytes -= snapshot->len;
+        m_evicted++;
+        // Readers still sending it keep it alive until they release it.
+        release(snapshot);
+    }
+}
+
+void WhoSnapshotStore::fill(snapshot_t *snapshot, uint8_t *buf, size_t len, uint16_t width, uint16_t height)
+{
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    if (std::find(m_snapshots.begin(), m_snapshots.end(), snapshot) != m_snapshots.end()) {
+        snapshot->buf = buf;
+        snapshot->len = len;
+        snapshot->width = width;
+        snapshot->height = height;
+        m_bytes += len;
+        evict();
+    } else {
+        // Evicted while it was encoded.
+        heap_caps_free(buf);
+    }
+    xSemaphoreGive(m_mutex);
+    xEventGroupSetBits(m_event_group, SNAPSHOT_READY);
+    xEventGroupClearBits(m_event_group, SNAPSHOT_READY);
+}
+
+void WhoSnapshotStore::remove(snapshot_t *snapshot)
+{
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    auto it = std::find(m_snapshots.begin(), m_snapshots.end(), snapshot);
+    if (it != m_snapshots.end()) {
+        m_snapshots.erase(it);
+        m_next.remove(snapshot);
+        release(snapshot);
+    }
+    xSemaphoreGive(m_mutex);
+    // Waiters give up on it.
+    xEventGroupSetBits(m_event_group, SNAPSHOT_READY);
+    xEventGroupClearBits(m_event_group, SNAPSHOT_READY);
+}
+
+uint32_t WhoSnapshotStore::capture(const detect::WhoDetect::result_t &result, int face)
+{
+    const dl::image::img_t &img = result.img;
+    if (!SNAPSHOT_HAS_ENCODER || !m_running ||
+        (img.pix_type != dl::image::DL_IMAGE_PIX_TYPE_RGB565 && img.pix_type != dl::image::DL_IMAGE_PIX_TYPE_RGB888)) {
+        m_failed++;
+        return 0;
+    }
+    // The encoder stage may have encoded this very frame for the streams already.
+    if (!m_flags) {
+        frame_jpeg::jpeg_frame_t *frame = m_source->acquire(false);
+        // Not while a stream controller has it encode a downscaled frame.
+        if (frame && frame->timestamp.tv_sec == result.timestamp.tv_sec &&
+            frame->timestamp.tv_usec == result.timestamp.tv_usec && frame->width == result.img.width) {
+            uint8_t *buf = (uint8_t *)heap_caps_malloc(frame->len, MALLOC_CAP_SPIRAM);
+            if (buf) {
+                memcpy(buf, frame->buf, frame->len);
+                snapshot_t *snapshot = add(result.timestamp);
+                uint32_t id = snapshot->id;
+                fill(snapshot, buf, frame->len, frame->width, frame->height);
+                frame_jpeg::WhoFrameJpeg::release(frame);
+                return id;
+            }
+        }
+        frame_jpeg::WhoFrameJpeg::release(frame);
+    }
+
+    // The whole frame, or the face with half its size of margin on every side.
+    int roi[4] = {0, 0, img.width, img.height};
+    if ((m_flags & SNAPSHOT_CROP) && face >= 0 && face < (int)result.det_res.size()) {
+        const auto &box = std::next(result.det_res.begin(), face)->box;
+        int margin_x = (box[2] - box[0]) / 2, margin_y = (box[3] - box[1]) / 2;
+        roi[0] = std::max(box[0] - margin_x, 0);
+        roi[1] = std::max(box[1] - margin_y, 0);
+        roi[2] = std::min(box[2] + margin_x, (int)img.width);
+        roi[3] = std::min(box[3] + margin_y, (int)img.height);
+        if (roi[0] >= roi[2] || roi[1] >= roi[3]) {
+            roi[0] = roi[1] = 0;
+            roi[2] = img.width;
+            roi[3] = img.height;
+        }
+    }
+    size_t pix_size = img.pix_type == dl::image::DL_IMAGE_PIX_TYPE_RGB565 ? 2 : 3;
+    size_t row_size = (roi[2] - roi[0]) * pix_size;
+    job_t *job = new job_t();
+    job->img.data = heap_caps_malloc(row_size * (roi[3] - roi[1]), MALLOC_CAP_SPIRAM);
+    if (!job->img.data) {
+        ESP_LOGE(TAG, "No PSRAM for a %dx%d snapshot", roi[2] - roi[0], roi[3] - roi[1]);
+        delete job;
+        m_failed++;
+        return 0;
+    }
+    job->img.width = roi[2] - roi[0];
+    job->img.height = roi[3] - roi[1];
+    job->img.pix_type = img.pix_type;
+    // Only copied here, the frame is reused as soon as the detect result callback returns.
+    const uint8_t *src = (const uint8_t *)img.data + (roi[1] * img.width + roi[0]) * pix_size;
+    uint8_t *dst = (uint8_t *)job->img.data;
+    for (int y = roi[1]; y < roi[3]; y++) {
+        memcpy(dst, src, row_size);
+        src += img.width * pix_size;
+        dst += row_size;
+    }
+    if (m_flags & SNAPSHOT_OVERLAY) {
+        for (const auto &res : result.det_res) {
+            job->boxes.push_back({std::clamp(res.box[0] - roi[0], 0, job->img.width - 1),
+                                  std::clamp(res.box[1] - roi[1], 0, job->img.height - 1),
+                                  std::clamp(res.box[2] - roi[0], 0, job->img.width - 1),
+                                  std::clamp(res.box[3] - roi[1], 0, job->img.height - 1)});
+        }
+    }
+
+    job->snapshot = add(result.timestamp);
+    uint32_t id = job->snapshot->id;
+    job->snapshot->refs.fetch_add(1, std::memory_order_relaxed);
+    if (xQueueSend(m_jobs, &job, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Encoder busy, snapshot %lu dropped", (unsigned long)id);
+        remove(job->snapshot);
+        release(job->snapshot);
+        heap_caps_free(job->img.data);
+        delete job;
+        m_failed++;
+        return 0;
+    }
+    return id;
+}
+
+uint32_t WhoSnapshotStore::capture_next()
+{
+    // The encoder stage would never publish a frame to fill it with.
+    if (!SNAPSHOT_HAS_ENCODER || !m_running) {
+        m_failed++;
+        return 0;
+    }
+    snapshot_t *snapshot = add({});
+    uint32_t id = snapshot->id;
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    m_next.push_back(snapshot);
+    xSemaphoreGive(m_mutex);
+    // Wakes an idle encoder up.
+    frame_jpeg::WhoFrameJpeg::release(m_source->acquire());
+    return id;
+}
+
+void WhoSnapshotStore::on_new_jpeg(const frame_jpeg::jpeg_frame_t *frame)
+{
+    std::list<snapshot_t *> next;
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    next.swap(m_next);
+    for (auto snapshot : next) {
+        snapshot->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    xSemaphoreGive(m_mutex);
+    for (auto snapshot : next) {
+        uint8_t *buf = (uint8_t *)heap_caps_malloc(frame->len, MALLOC_CAP_SPIRAM);
+        if (buf) {
+            memcpy(buf, frame->buf, frame->len);
+            snapshot->timestamp = frame->timestamp;
+            fill(snapshot, buf, frame->len, frame->width, frame->height);
+        } else {
+            m_failed++;
+            remove(snapshot);
+        }
+        release(snapshot);
+    }
+}
+
+snapshot_t *WhoSnapshotStore::acquire(uint32_t id, TickType_t timeout)
+{
+    TickType_t start = xTaskGetTickCount();
+    while (true) {
+        bool pending = false;
+        xSemaphoreTake(m_mutex, portMAX_DELAY);
+        auto it = std::find_if(m_snapshots.begin(), m_snapshots.end(), [id](snapshot_t *s) { return s->id == id; });
+        if (it != m_snapshots.end()) {
+            snapshot_t *snapshot = *it;
+            // Least recently read snapshots go first.
+            m_snapshots.splice(m_snapshots.begin(), m_snapshots, it);
+            if (snapshot->buf) {
+                snapshot->refs.fetch_add(1, std::memory_order_relaxed);
+                xSemaphoreGive(m_mutex);
+                return snapshot;
+            }
+            pending = true;
+        }
+        xSemaphoreGive(m_mutex);
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (!pending || elapsed >= timeout) {
+            return nullptr;
+        }
+        // Like WhoFrameJpeg::acquire_newer(), a snapshot filled between the lookup and here is found by the next
+        // pass at most 100 ms later.
+        xEventGroupWaitBits(
+            m_event_group, SNAPSHOT_READY, pdFALSE, pdFALSE, std::min(timeout - elapsed, pdMS_TO_TICKS(100)));
+    }
+}
+
+bool WhoSnapshotStore::is_pending(uint32_t id)
+{
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    auto it = std::find_if(m_snapshots.begin(), m_snapshots.end(), [id](snapshot_t *s) { return s->id == id; });
+    bool pending = it != m_snapshots.end() && !(*it)->buf;
+    xSemaphoreGive(m_mutex);
+    return pending;
+}
+
+void WhoSnapshotStore::release(snapshot_t *snapshot)
+{
+    if (snapshot && snapshot->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        heap_caps_free(snapshot->buf);
+        delete snapshot;
+    }
+}
+
+uint8_t WhoSnapshotStore::get_num_snapshots()
+{
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    uint8_t num = m_snapshots.size();
+    xSemaphoreGive(m_mutex);
+    return num;
+}
+
+void WhoSnapshotStore::encode(job_t *job)
+{
+    dl::image::img_t &img = job->img;
+    if (!job->boxes.empty()) {
+        std::vector<uint8_t> color = {0, 255, 0};
+        if (img.pix_type == dl::image::DL_IMAGE_PIX_TYPE_RGB565) {
+#if CONFIG_IDF_TARGET_ESP32P4
+            uint32_t caps = 0;
+#else
+            uint32_t caps = dl::image::DL_IMAGE_CAP_RGB565_BIG_ENDIAN;
+#endif
+            std::vector<uint8_t> rgb565(2);
+            dl::image::cvt_pix(color.data(),
+                               rgb565.data(),
+                               dl::image::DL_IMAGE_PIX_TYPE_RGB888,
+                               dl::image::DL_IMAGE_PIX_TYPE_RGB565,
+                               caps);
+            color = rgb565;
+        }
+        for (const auto &box : job->boxes) {
+            dl::image::draw_hollow_rectangle(img, box[0], box[1], box[2], box[3], color, 2);
+        }
+    }
+    uint8_t *jpeg = nullptr;
+    size_t len = 0;
+#if CONFIG_IDF_TARGET_ESP32S3
+    pixformat_t format = img.pix_type == dl::image::DL_IMAGE_PIX_TYPE_RGB565 ? PIXFORMAT_RGB565 : PIXFORMAT_RGB888;
+    size_t pix_size = img.pix_type == dl::image::DL_IMAGE_PIX_TYPE_RGB565 ? 2 : 3;
+    if (!fmt2jpg((uint8_t *)img.data,
+                 img.width * img.height * pix_size,
+                 img.width,
+                 img.height,
+                 format,
+                 m_quality,
+                 &jpeg,
+                 &len)) {
+        jpeg = nullptr;
+    }
+#else
+    ESP_LOGE(TAG, "No JPEG encoder for this target.");
+#endif
+    // The encoder output is moved to PSRAM, internal RAM is scarce.
+    uint8_t *buf = jpeg ? (uint8_t *)heap_caps_malloc(len, MALLOC_CAP_SPIRAM) : nullptr;
+    if (buf) {
+        memcpy(buf, jpeg, len);
+        fill(job->snapshot, buf, len, img.width, img.height);
+    } else {
+        ESP_LOGE(TAG, "Snapshot %lu not encoded", (unsigned long)job->snapshot->id);
+        m_failed++;
+        remove(job->snapshot);
+    }
+    free(jpeg);
+}
+
+void WhoSnapshotStore::task(void *args)
+{
+    WhoSnapshotStore *self = (WhoSnapshotStore *)args;
+    while (true) {
+        job_t *job;
+        xQueueReceive(self->m_jobs, &job, portMAX_DELAY);
+        if (!job) {
+            break;
+        }
+        self->encode(job);
+        release(job->snapshot);
+        heap_caps_free(job->img.data);
+        delete job;
+    }
+    xSemaphoreGive(self->m_stopped);
+    vTaskDelete(NULL);
+}
+} // namespace snapshot
+} // namespace who
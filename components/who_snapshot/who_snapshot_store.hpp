@@ -0,0 +1,124 @@
+#pragma once
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "who_detect.hpp"
+#include "who_frame_jpeg.hpp"
+#include <array>
+#include <atomic>
+#include <list>
+#include <vector>
+
+namespace who {
+namespace snapshot {
+// JPEG of the frame an event was raised on. It is freed once evicted and released by every reader.
+typedef struct {
+    uint32_t id;
+    uint8_t *buf; // in PSRAM, nullptr while the snapshot is being encoded.
+    size_t len;
+    uint16_t width;
+    uint16_t height;
+    struct timeval timestamp; // of the camera frame.
+    std::atomic<int> refs;
+} snapshot_t;
+
+// Event snapshots in PSRAM, looked up by id.
+//
+// capture() runs on the detect task with the frame a result came from and only copies it, or the region around the
+// face with SNAPSHOT_CROP. The store's task draws the face boxes with SNAPSHOT_OVERLAY and encodes the copy. A plain
+// frame the JPEG encoder stage already encoded is copied from there instead, so no frame is encoded twice.
+// capture_next() takes the next frame of the encoder stage, for events without a frame at hand like a PIR trigger.
+//
+// At most max_entries snapshots are kept in max_bytes, the least recently read ones are evicted first. Ids count up
+// from a random start, so the same snapshot URL never shows another image after a reboot and may be cached for good.
+class WhoSnapshotStore {
+public:
+    static inline constexpr uint8_t SNAPSHOT_CROP = 1 << 0;
+    static inline constexpr uint8_t SNAPSHOT_OVERLAY = 1 << 1;
+
+    /**
+     * @param source      encoder stage whose frames are reused and taken by capture_next().
+     * @param max_entries snapshots kept.
+     * @param max_bytes   JPEG bytes kept.
+     * @param quality     JPEG quality of the snapshots encoded here, 1-100.
+     * @param flags       SNAPSHOT_CROP, SNAPSHOT_OVERLAY.
+     */
+    WhoSnapshotStore(frame_jpeg::WhoFrameJpeg *source,
+                     uint8_t max_entries,
+                     size_t max_bytes,
+                     uint8_t quality = 80,
+                     uint8_t flags = 0);
+    ~WhoSnapshotStore();
+    WhoSnapshotStore(const WhoSnapshotStore &) = delete;
+    WhoSnapshotStore &operator=(const WhoSnapshotStore &) = delete;
+
+    esp_err_t start(const configSTACK_DEPTH_TYPE stack_depth, UBaseType_t priority);
+    void stop();
+    /**
+     * @brief Snapshot the frame of a detect result. Call it before the detect result callback returns, the frame is
+     * only valid until then.
+     *
+     * @param result detect result, its boxes in the coordinates of result.img.
+     * @param face   index in result.det_res of the face to crop to, -1 for none.
+     * @return id of the snapshot, 0 if it could not be taken, also without a JPEG encoder or while stopped.
+     */
+    uint32_t capture(const detect::WhoDetect::result_t &result, int face);
+    /**
+     * @brief Snapshot the next frame the encoder stage publishes.
+     *
+     * @return id of the snapshot, 0 without a JPEG encoder or while stopped.
+     */
+    uint32_t capture_next();
+    /**
+     * @brief Take a reference to a snapshot, waiting while it is encoded.
+     *
+     * @return nullptr if there is no such snapshot or it was not ready in time. Hand it back with release().
+     */
+    snapshot_t *acquire(uint32_t id, TickType_t timeout);
+    static void release(snapshot_t *snapshot);
+    /**
+     * @return whether the snapshot exists and is still being encoded.
+     */
+    bool is_pending(uint32_t id);
+    uint8_t get_num_snapshots();
+    size_t get_bytes() const { return m_bytes; }
+    uint32_t get_evicted() const { return m_evicted; }
+    uint32_t get_failed() const { return m_failed; }
+
+private:
+    static inline constexpr EventBits_t SNAPSHOT_READY = 1 << 0;
+
+    typedef struct {
+        snapshot_t *snapshot;
+        dl::image::img_t img;                 // copy of the frame or face region, in PSRAM.
+        std::vector<std::array<int, 4>> boxes; // face boxes to draw, in img coordinates.
+    } job_t;
+
+    static void task(void *args);
+    snapshot_t *add(const struct timeval &timestamp);
+    void fill(snapshot_t *snapshot, uint8_t *buf, size_t len, uint16_t width, uint16_t height);
+    void remove(snapshot_t *snapshot);
+    void evict();
+    void encode(job_t *job);
+    void on_new_jpeg(const frame_jpeg::jpeg_frame_t *frame);
+
+    frame_jpeg::WhoFrameJpeg *m_source;
+    uint8_t m_max_entries;
+    size_t m_max_bytes;
+    uint8_t m_quality;
+    uint8_t m_flags;
+    std::list<snapshot_t *> m_snapshots; // most recently read first.
+    std::list<snapshot_t *> m_next;      // waiting for the next frame of the encoder stage.
+    SemaphoreHandle_t m_mutex;
+    EventGroupHandle_t m_event_group;
+    QueueHandle_t m_jobs;
+    SemaphoreHandle_t m_stopped;
+    std::atomic<bool> m_running;
+    uint32_t m_next_id;
+    std::atomic<size_t> m_bytes;
+    std::atomic<uint32_t> m_evicted;
+    std::atomic<uint32_t> m_failed;
+};
+} // namespace snapshot
+} // namespace who
@@ -0,0 +1,145 @@
+#include "who_system_state.hpp"
+#include "esp_log.h"
+#include <algorithm>
+
+static const char *TAG = "WhoSystemState";
+
+namespace who {
+namespace system_state {
+#define STATE_BIT(state) (1 << SYSTEM_STATE_##state)
+#define ANY_WORD UINT32_MAX
+
+// The states each state may move to. A known visitor stays known while other faces of the same visit do not match,
+// until a new trigger or the fall back to idle.
+static const uint8_t s_legal[SYSTEM_STATE_MAX] = {
+    STATE_BIT(MOTION) | STATE_BIT(KNOWN) | STATE_BIT(UNKNOWN),                  // from idle
+    STATE_BIT(IDLE) | STATE_BIT(MOTION) | STATE_BIT(KNOWN) | STATE_BIT(UNKNOWN), // from motion
+    STATE_BIT(IDLE) | STATE_BIT(MOTION) | STATE_BIT(KNOWN),                     // from known
+    STATE_BIT(IDLE) | STATE_BIT(MOTION) | STATE_BIT(KNOWN) | STATE_BIT(UNKNOWN), // from unknown
+};
+
+const char *system_state_to_str(system_state_t state)
+{
+    switch (state) {
+    case SYSTEM_STATE_IDLE:
+        return "idle";
+    case SYSTEM_STATE_MOTION:
+        return "motion";
+    case SYSTEM_STATE_KNOWN:
+        return "known";
+    case SYSTEM_STATE_UNKNOWN:
+        return "unknown";
+    default:
+        return "invalid";
+    }
+}
+
+WhoSystemState::WhoSystemState(uint32_t hold_ms) :
+    m_hold_us(hold_ms * 1000LL),
+    m_word(SYSTEM_STATE_IDLE),
+    m_event_group(xEventGroupCreate()),
+    m_mutex(xSemaphoreCreateMutex()),
+    m_hold_timer(nullptr)
+{
+    for (auto &entered_us : m_entered_us) {
+        entered_us.store(0);
+    }
+    m_entered_us[SYSTEM_STATE_IDLE].store(esp_timer_get_time());
+    if (m_hold_us) {
+        const esp_timer_create_args_t args = {
+            .callback = hold_timer_cb, .arg = this, .dispatch_method = ESP_TIMER_TASK, .name = "SystemStateHold"};
+        ESP_ERROR_CHECK(esp_timer_create(&args, &m_hold_timer));
+    }
+}
+
+WhoSystemState::~WhoSystemState()
+{
+    if (m_hold_timer) {
+        esp_timer_stop(m_hold_timer);
+        esp_timer_delete(m_hold_timer);
+    }
+    vEventGroupDelete(m_event_group);
+    vSemaphoreDelete(m_mutex);
+}
+
+esp_err_t WhoSystemState::transition(system_state_t to)
+{
+    return transition(to, ANY_WORD);
+}
+
+esp_err_t WhoSystemState::transition(system_state_t to, uint32_t expected)
+{
+    if (to >= SYSTEM_STATE_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+    // Only transitions change the word, it holds still until the store below.
+    uint32_t word = m_word.load();
+    system_state_t from = (system_state_t)(word & STATE_MASK);
+    if ((expected != ANY_WORD && word != expected) || !(s_legal[from] & (1 << to))) {
+        xSemaphoreGive(m_mutex);
+        return ESP_ERR_INVALID_STATE;
+    }
+    // The seq wraps at 24 bits by itself, the bits above it are shifted out.
+    uint32_t seq = (word >> SEQ_SHIFT) + 1;
+
+    // Stamped before the word is published, the hold timer reading the new state always finds its entry time.
+    m_entered_us[to].store(esp_timer_get_time());
+    if (m_hold_timer && to != SYSTEM_STATE_IDLE) {
+        esp_timer_stop(m_hold_timer);
+        esp_timer_start_once(m_hold_timer, m_hold_us);
+    }
+    m_word.store((seq << SEQ_SHIFT) | to);
+    seq &= UINT32_MAX >> SEQ_SHIFT;
+    ESP_LOGI(TAG, "%s -> %s (%lu)", system_state_to_str(from), system_state_to_str(to), (unsigned long)seq);
+    // Wakes every task waiting at this moment, see wait().
+    xEventGroupSetBits(m_event_group, STATE_CHANGED);
+    xEventGroupClearBits(m_event_group, STATE_CHANGED);
+    for (const auto &subscriber : m_subscribers) {
+        subscriber(from, to, seq);
+    }
+    xSemaphoreGive(m_mutex);
+    return ESP_OK;
+}
+
+void WhoSystemState::hold_timer_cb(void *args)
+{
+    WhoSystemState *self = (WhoSystemState *)args;
+    uint32_t word = self->m_word.load();
+    system_state_t state = (system_state_t)(word & STATE_MASK);
+    if (state == SYSTEM_STATE_IDLE) {
+        return;
+    }
+    // The timer may fire just before a transition restarts it, the state entered since then waits for the rest.
+    int64_t left_us = self->m_entered_us[state].load() + self->m_hold_us - esp_timer_get_time();
+    if (left_us > 0) {
+        esp_timer_start_once(self->m_hold_timer, left_us);
+        return;
+    }
+    // Only if nothing moved since the word was read, transition() compares it under the mutex.
+    self->transition(SYSTEM_STATE_IDLE, word);
+}
+
+int64_t WhoSystemState::get_entered_us(system_state_t state) const
+{
+    return state < SYSTEM_STATE_MAX ? m_entered_us[state].load() : 0;
+}
+
+system_state_t WhoSystemState::wait(uint32_t &seq, TickType_t timeout)
+{
+    TickType_t start = xTaskGetTickCount();
+    while (true) {
+        uint32_t word = m_word.load();
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (word >> SEQ_SHIFT != seq || elapsed >= timeout) {
+            seq = word >> SEQ_SHIFT;
+            return (system_state_t)(word & STATE_MASK);
+        }
+        // transition() sets and clears the bit at once, which wakes every task waiting at that moment. A transition
+        // between the load and here is caught by the next pass, at most 100 ms later.
+        xEventGroupWaitBits(
+            m_event_group, STATE_CHANGED, pdFALSE, pdFALSE, std::min(timeout - elapsed, pdMS_TO_TICKS(100)));
+    }
+}
+} // namespace system_state
+} // namespace who
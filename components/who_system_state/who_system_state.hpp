@@ -0,0 +1,90 @@
+#pragma once
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include <atomic>
+#include <functional>
+#include <vector>
+
+namespace who {
+namespace system_state {
+typedef enum : uint8_t {
+    SYSTEM_STATE_IDLE = 0,
+    SYSTEM_STATE_MOTION = 1,  // motion triggered, nobody recognised yet.
+    SYSTEM_STATE_KNOWN = 2,   // a face in the database was recognised.
+    SYSTEM_STATE_UNKNOWN = 3, // a face was seen, none of it matched.
+    SYSTEM_STATE_MAX,
+} system_state_t;
+
+const char *system_state_to_str(system_state_t state);
+
+// What the doorbell is doing, shared by the recognition, the gateway client and the web server.
+//
+// The state and a transition counter live in one atomic word, so reading the state never blocks. Transitions take a
+// mutex and publish the word only once the entry time is stamped and the hold timer restarted, so they reach the
+// subscribers in seq order and the timer never sees a state without its entry time. transition() refuses the moves
+// the table in who_system_state.cpp does not allow. Every non-idle state falls back to idle hold_ms after it was last
+// entered.
+//
+// Each successful transition calls the subscribers on the task which made it and wakes every task blocked in wait()
+// at once.
+class WhoSystemState {
+public:
+    typedef std::function<void(system_state_t from, system_state_t to, uint32_t seq)> subscriber_t;
+
+    /**
+     * @param hold_ms time a non-idle state lasts without a new transition, 0 to stay.
+     */
+    WhoSystemState(uint32_t hold_ms = 10000);
+    ~WhoSystemState();
+    WhoSystemState(const WhoSystemState &) = delete;
+    WhoSystemState &operator=(const WhoSystemState &) = delete;
+
+    /**
+     * @brief Move to a state. Entering the current state again is a transition as well, e.g. a second visitor.
+     *
+     * @return ESP_ERR_INVALID_STATE if the current state may not move there, nothing changes then.
+     */
+    esp_err_t transition(system_state_t to);
+    system_state_t get_state() const { return (system_state_t)(m_word.load() & STATE_MASK); }
+    /**
+     * @brief Transitions so far. It wraps around at 24 bits, compare for equality only.
+     */
+    uint32_t get_seq() const { return m_word.load() >> SEQ_SHIFT; }
+    /**
+     * @return esp_timer time state was last entered, 0 if never.
+     */
+    int64_t get_entered_us(system_state_t state) const;
+    /**
+     * @brief Block until a transition after the one numbered seq.
+     *
+     * @param seq get_seq() the caller saw last.
+     * @return the state now, and its seq in seq. The state still seen if nothing changed before timeout.
+     */
+    system_state_t wait(uint32_t &seq, TickType_t timeout);
+    /**
+     * @brief Called on the task which made the transition, the hold timer task for the fall back to idle. Keep it
+     * short and do not call transition() from it, the mutex is held. Add before the first transition.
+     */
+    void add_subscriber(const subscriber_t &subscriber) { m_subscribers.emplace_back(subscriber); }
+
+private:
+    static inline constexpr uint32_t STATE_MASK = 0xff;
+    static inline constexpr int SEQ_SHIFT = 8;
+    static inline constexpr EventBits_t STATE_CHANGED = 1 << 0;
+
+    static void hold_timer_cb(void *args);
+    esp_err_t transition(system_state_t to, uint32_t expected);
+
+    int64_t m_hold_us;
+    std::atomic<uint32_t> m_word; // seq << SEQ_SHIFT | state
+    std::atomic<int64_t> m_entered_us[SYSTEM_STATE_MAX];
+    EventGroupHandle_t m_event_group;
+    SemaphoreHandle_t m_mutex; // orders transitions, readers go without it.
+    esp_timer_handle_t m_hold_timer;
+    std::vector<subscriber_t> m_subscribers;
+};
+} // namespace system_state
+} // namespace who
@@ -7,11 +7,19 @@
 #include "who_recognition_app_lcd.hpp"
 #include "who_recognition_app_term.hpp"
 #include "who_spiflash_fatfs.hpp"
+#include "who_frame_jpeg.hpp"
+#include "who_event_stream.hpp"
+#include "who_mjpeg_sender.hpp"
+#include "who_snapshot_store.hpp"
+#include "who_system_state.hpp"
 #include "web_stream.cpp"
-#include "shared_mem.hpp"
 
 using namespace who::frame_cap;
 using namespace who::app;
+using namespace who::frame_jpeg;
+using namespace who::http_stream;
+using namespace who::snapshot;
+using namespace who::system_state;
 
 // WiFi credentials
 #define WIFI_SSID "Cheran" //"DMTP5"
@@ -136,7 +144,48 @@ extern "C" void app_main(void)
     auto frame_cap = get_mipi_csi_frame_cap_pipeline();
     // auto frame_cap = get_uvc_frame_cap_pipeline();
 #endif
-    shared_mem_init();
+    // One JPEG encoder shared by every HTTP client, it reads the frames the recognition reads
+    auto frame_jpeg = new WhoFrameJpeg("FrameJpeg",
+                                       frame_cap->get_last_node(),
+                                       CONFIG_WHO_FRAME_JPEG_QUALITY,
+                                       CONFIG_WHO_FRAME_JPEG_MAX_FPS,
+                                       CONFIG_WHO_FRAME_JPEG_IDLE_MS);
+    // Streams are sent from a few tasks of their own, each client at the pace of its link
+    auto mjpeg_sender = new WhoMjpegSender(frame_jpeg,
+                                           CONFIG_WHO_MJPEG_MAX_CLIENTS,
+                                           CONFIG_WHO_MJPEG_SENDERS,
+                                           CONFIG_WHO_MJPEG_STALL_TIMEOUT_MS);
+#if CONFIG_WHO_MJPEG_ADAPTIVE
+    // Quality, size and frame rate follow the links, within the CPU time detection leaves over
+    auto stream_controller = new WhoStreamController(frame_jpeg,
+                                                     CONFIG_WHO_FRAME_JPEG_QUALITY,
+                                                     CONFIG_WHO_FRAME_JPEG_MAX_FPS,
+                                                     CONFIG_WHO_MJPEG_TARGET_LATENCY_MS,
+                                                     CONFIG_WHO_MJPEG_ENCODER_CPU_PERCENT);
+    mjpeg_sender->set_controller(stream_controller);
+#endif
+    // Boxes and identities go to the streams that ask for them, the page draws them over the frames
+    auto frame_meta = new WhoFrameMeta();
+    set_stream_source(frame_jpeg, mjpeg_sender, frame_meta);
+    // Recognition and motion events are pushed to the pages as they happen
+    auto event_stream = new WhoEventStream(CONFIG_WHO_EVENT_STREAM_MAX_CLIENTS, CONFIG_WHO_EVENT_STREAM_HISTORY);
+    // Events link to a JPEG of the frame they were raised on, kept in PSRAM
+    uint8_t snapshot_flags = 0;
+#if CONFIG_WHO_SNAPSHOT_CROP
+    snapshot_flags |= WhoSnapshotStore::SNAPSHOT_CROP;
+#endif
+#if CONFIG_WHO_SNAPSHOT_OVERLAY
+    snapshot_flags |= WhoSnapshotStore::SNAPSHOT_OVERLAY;
+#endif
+    auto snapshot_store = new WhoSnapshotStore(frame_jpeg,
+                                               CONFIG_WHO_SNAPSHOT_MAX_ENTRIES,
+                                               CONFIG_WHO_SNAPSHOT_MAX_KB * 1024,
+                                               CONFIG_WHO_SNAPSHOT_QUALITY,
+                                               snapshot_flags);
+    set_event_stream(event_stream, snapshot_store);
+    // Idle, motion, known or unknown, pushed to the pages on every change
+    auto system_state = new WhoSystemState(CONFIG_WHO_SYSTEM_STATE_HOLD_MS);
+    set_system_state(system_state);
     init_wifi();
     // hold until connection success
     EventBits_t bits = xEventGroupWaitBits(
@@ -147,5 +196,14 @@ extern "C" void app_main(void)
         portMAX_DELAY);
     
     auto recognition_app = new WhoRecognitionAppTerm(frame_cap);
+    auto recognition_task = recognition_app->get_recognition()->get_recognition_task();
+    recognition_task->set_event_cb(publish_recognition_event);
+    recognition_task->set_motion_cb(publish_motion_event);
+    recognition_task->set_tracks_cb(publish_frame_meta);
     recognition_app->run();
+    // Below the frame cap and detection tasks, streaming must not slow down recognition
+    frame_jpeg->run(8192, 1, 0);
+    ESP_ERROR_CHECK(mjpeg_sender->start(4096, 1));
+    ESP_ERROR_CHECK(snapshot_store->start(4096, 1));
+    ESP_ERROR_CHECK(event_stream->start(4096, 1));
 }
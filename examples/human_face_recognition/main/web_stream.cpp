@@ -1,232 +1,260 @@
-#include "esp_camera.h"
 #include "esp_http_server.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+
+#include "who_event.hpp"
+#include "who_event_stream.hpp"
+#include "who_frame_jpeg.hpp"
+#include "who_frame_meta.hpp"
+#include "who_mjpeg_sender.hpp"
+#include "who_snapshot_store.hpp"
+#include "who_system_state.hpp"
+#include "who_web_assets.hpp"
+
+using who::frame_jpeg::jpeg_frame_t;
+using who::frame_jpeg::WhoFrameJpeg;
+using who::http_stream::WhoEventStream;
+using who::http_stream::WhoFrameMeta;
+using who::http_stream::web_asset_t;
+using who::http_stream::WhoMjpegSender;
+using who::http_stream::WhoWebAssets;
+using who::snapshot::snapshot_t;
+using who::snapshot::WhoSnapshotStore;
+using who::system_state::system_state_t;
+using who::system_state::WhoSystemState;
 
-#include "shared_mem.hpp"
-
-// Macro headers to tell the browser what protocol to expect
-/*
---frame
-Content-Type: image/jpeg
-Content-Length: xxxx
-
-<raw jpeg bytes>
-*/
-#define PART_BOUNDARY "123456789000000000000987654321"
-static const char* STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
-// Separate payload and image
-static const char* STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
-static const char* STREAM_PAYLOAD = "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n";
 const char* TAG = "Stream";
 
-// http client id (of the webpage)
-static int client_fd = -1;
+// Every stream and snapshot client reads the frames of this one encoder, nobody here touches the camera
+static WhoFrameJpeg *frame_jpeg = NULL;
+// Streams run on the sender tasks, not on the http server task
+static WhoMjpegSender *mjpeg_sender = NULL;
+// Boxes and identities of the latest frames, sent to the streams that ask for them
+static WhoFrameMeta *frame_meta = NULL;
+// Recognition and motion events are pushed to the pages from here
+static WhoEventStream *event_stream = NULL;
+// JPEGs of the frames the events were raised on
+static WhoSnapshotStore *snapshot_store = NULL;
+// Idle, motion, known or unknown, moved on by the events below
+static WhoSystemState *system_state = NULL;
+// A snapshot older than this was taken before the encoder went idle, wait for a new one
+#define CAPTURE_MAX_AGE_US 1000000
+
+void set_stream_source(WhoFrameJpeg *source, WhoMjpegSender *sender, WhoFrameMeta *meta) {
+    frame_jpeg = source;
+    mjpeg_sender = sender;
+    frame_meta = meta;
+    mjpeg_sender->set_frame_meta(frame_meta);
+}
 
-// webpage code:
-const char index_html[] = R"rawliteral(
-<!DOCTYPE html>
-<html>
-<head>
-  <meta charset="utf-8">
-  <title>ESP Alerts</title>
-  <style>
-    body { font-family: sans-serif; text-align: center; background: #8ff4a3; }
-    img { border: 3px solid #333; border-radius: 10px; margin-bottom: 10px; }
-    #video { width: 480px; }
-    #snapshot { width: 480px; }
-    #log {
-      width: 480px; height: 200px; margin: 15px auto;
-      background: #d1df84; border: 2px solid #333;
-      border-radius: 10px; overflow-y: scroll;
-      text-align: left; padding: 10px; font-size: 16px;
+// Runs on the detect task for every frame. The page draws the boxes over the stream itself, in the coordinates of
+// the detected frame, so nothing is drawn into the frames here
+void publish_frame_meta(const who::detect::WhoDetect::result_t &result,
+                        const std::vector<uint32_t> &track_ids,
+                        const std::vector<uint16_t> &ids) {
+    char text[WhoFrameMeta::META_MAX_LEN];
+    size_t size = sizeof(text);
+    // Room for the closing "]}" is kept back, faces which do not fit any more are left out
+    size_t len = snprintf(
+        text, size - 2, "{\"width\":%d,\"height\":%d,\"faces\":[", result.img.width, result.img.height);
+    size_t i = 0;
+    for (auto it = result.det_res.begin(); it != result.det_res.end(); it++, i++) {
+        const auto &res = *it;
+        char face[256];
+        int face_len = snprintf(face,
+                                sizeof(face),
+                                "%s{\"box\":[%d,%d,%d,%d],\"score\":%.2f,\"track\":%lu,\"id\":%d,\"kp\":[",
+                                i ? "," : "",
+                                res.box[0],
+                                res.box[1],
+                                res.box[2],
+                                res.box[3],
+                                res.score,
+                                (unsigned long)(i < track_ids.size() ? track_ids[i] : 0),
+                                i < ids.size() ? ids[i] : 0);
+        for (size_t k = 0; k < res.keypoint.size() && face_len < (int)sizeof(face) - 16; k++) {
+            face_len += snprintf(face + face_len, sizeof(face) - face_len, "%s%d", k ? "," : "", res.keypoint[k]);
+        }
+        face_len += snprintf(face + face_len, sizeof(face) - face_len, "]}");
+        if (len + face_len > size - 2) {
+            break;
+        }
+        memcpy(text + len, face, face_len);
+        len += face_len;
     }
-  </style>
-</head>
-<body>
-  
-  <h2>Latest Captured Frame</h2>
-  <img id="snapshot" src="/capture" alt="No snapshot yet" />
+    memcpy(text + len, "]}", 2);
+    frame_meta->publish(result.timestamp, text, len + 2);
+}
+
+// Runs on the detect task with the frame of the result. The store only copies the frame, and publish() only formats
+// the event into the ring of the event stream
+void publish_recognition_event(const who::gateway::event_t &event,
+                               const who::detect::WhoDetect::result_t &result,
+                               int face) {
+    int best = who::gateway::event_best_face(event);
+    // A known visitor stays known while other faces of the visit do not match, the state refuses that move
+    system_state->transition(best < 0 ? who::system_state::SYSTEM_STATE_UNKNOWN
+                                      : who::system_state::SYSTEM_STATE_KNOWN);
+    // Without PSRAM for a snapshot the page falls back to a fresh capture
+    uint32_t snapshot = snapshot_store->capture(result, face);
+    char url[32] = "/capture";
+    if (snapshot) {
+        snprintf(url, sizeof(url), "/snapshot?id=%lu", (unsigned long)snapshot);
+    }
+    char data[160];
+    snprintf(data,
+             sizeof(data),
+             "{\"seq\":%lu,\"time_ms\":%lld,\"id\":%d,\"similarity\":%.2f,\"faces\":%d,"
+             "\"snapshot\":\"%s\"}",
+             (unsigned long)event.seq,
+             (long long)event.timestamp_ms,
+             best < 0 ? 0 : event.faces[best].id,
+             best < 0 ? 0.0f : event.faces[best].similarity,
+             event.num_faces,
+             url);
+    event_stream->publish(best < 0 ? "unknown" : "known", data);
+}
 
-  <h2>Event Log</h2>
-  <div id="log"></div>
+// Runs on the gateway client task, the snapshot is the next frame the encoder publishes
+void publish_motion_event() {
+    system_state->transition(who::system_state::SYSTEM_STATE_MOTION);
+    // Like a recognition event, the page falls back to a fresh capture without a snapshot
+    uint32_t snapshot = snapshot_store->capture_next();
+    char url[32] = "/capture";
+    if (snapshot) {
+        snprintf(url, sizeof(url), "/snapshot?id=%lu", (unsigned long)snapshot);
+    }
+    char data[96];
+    snprintf(data,
+             sizeof(data),
+             "{\"time_ms\":%lld,\"snapshot\":\"%s\"}",
+             (long long)(esp_timer_get_time() / 1000),
+             url);
+    event_stream->publish("motion", data);
+}
 
-  <script>
-  const logBox = document.getElementById("log");
-  const snapshot = document.getElementById("snapshot");
+void set_event_stream(WhoEventStream *stream, WhoSnapshotStore *snapshots) {
+    event_stream = stream;
+    snapshot_store = snapshots;
+}
 
-  function fetchInfo() {
-    fetch("/info")
-      .then(response => response.json())
-      .then(data => {
-        const now = new Date().toLocaleTimeString();
-        const line = document.createElement("div");
-        if (data.msg) {
-            line.textContent = `[${now}] ${data.msg}`;
-            logBox.appendChild(line);
-            logBox.scrollTop = logBox.scrollHeight;
+// Every state change goes to the pages as it happens, including the fall back to idle. Call after set_event_stream()
+void set_system_state(WhoSystemState *state) {
+    system_state = state;
+    system_state->add_subscriber([](system_state_t, system_state_t to, uint32_t seq) {
+        char data[64];
+        snprintf(data,
+                 sizeof(data),
+                 "{\"state\":\"%s\",\"seq\":%lu}",
+                 who::system_state::system_state_to_str(to),
+                 (unsigned long)seq);
+        event_stream->publish("state", data);
+    });
+}
 
-            if (data.flag === 3 || data.flag === 2 || data.flag === 1) {
-                snapshot.src = `/capture?nocache=${Date.now()}`;
-            }
-        }
-      })
-      .catch(err => {
-        const line = document.createElement("div");
-        line.style.color = "red";
-        line.textContent = `[Error] ${err}`;
-        logBox.appendChild(line);
-      });
-    }
+// webpage code: www/, gzipped at build time, the page links the other files with their version
+extern const uint8_t index_html_gz_start[] asm("_binary_index_html_gz_start");
+extern const uint8_t index_html_gz_end[] asm("_binary_index_html_gz_end");
+extern const uint8_t app_js_gz_start[] asm("_binary_app_js_gz_start");
+extern const uint8_t app_js_gz_end[] asm("_binary_app_js_gz_end");
+extern const uint8_t style_css_gz_start[] asm("_binary_style_css_gz_start");
+extern const uint8_t style_css_gz_end[] asm("_binary_style_css_gz_end");
+extern const uint8_t favicon_svg_gz_start[] asm("_binary_favicon_svg_gz_start");
+extern const uint8_t favicon_svg_gz_end[] asm("_binary_favicon_svg_gz_end");
 
-    // Poll every 1 second
-    setInterval(fetchInfo, 1500);
-    </script>
+static const web_asset_t web_assets[] = {
+    {"/", "text/html", index_html_gz_start, index_html_gz_end, false},
+    {"/app.js", "text/javascript", app_js_gz_start, app_js_gz_end, true},
+    {"/style.css", "text/css", style_css_gz_start, style_css_gz_end, true},
+    {"/favicon.svg", "image/svg+xml", favicon_svg_gz_start, favicon_svg_gz_end, true},
+};
 
-</body>
-</html>
-)rawliteral";
 
+// A snapshot still being encoded is waited for this long on the http server task, then the page asks again
+#define SNAPSHOT_WAIT_MS 100
 
+// Current state, how long it has lasted and the last event id, each client tells for itself what changed
 static esp_err_t info_handler(httpd_req_t *req) {
     httpd_resp_set_type(req, "application/json");
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    system_state_t state = system_state->get_state();
+    char buffer[128];
+    int len = snprintf(buffer,
+                       sizeof(buffer),
+                       "{\"state\":\"%s\",\"seq\":%lu,\"since_ms\":%lld,\"event\":%lu}",
+                       who::system_state::system_state_to_str(state),
+                       (unsigned long)system_state->get_seq(),
+                       (long long)((esp_timer_get_time() - system_state->get_entered_us(state)) / 1000),
+                       event_stream ? (unsigned long)event_stream->get_last_id() : 0UL);
+    return httpd_resp_send(req, buffer, len);
+}
 
-    static int old_flag = -1;
-    int flag = get_flag(&shared_mem.stream_flag);
-    const char *msg = "";
-
-    if (old_flag != flag) {
-        if (flag == 2) { 
-            msg = "Known visitor detected!";
-        } else if (flag == 1) {
-            msg = "Unknown visitor detected!";
-        } else if (flag == 3) {
-            msg = "Motion detected!";
-            set_flag(&shared_mem.stream_flag, 1);
-        }
+static esp_err_t events_handler(httpd_req_t *req) {
+    if (!event_stream) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No event stream");
+        return ESP_FAIL;
     }
-    old_flag = flag;
-    char buffer[64];
-    int len = snprintf(buffer, sizeof(buffer), "{\"flag\": %d, \"msg\": \"%s\"}", flag, msg);
-    // ESP_LOGI("Browser", "A message is fetchde by browser");
-    httpd_resp_send(req, buffer, len);
-
-    return ESP_OK;
+    esp_err_t res = event_stream->add_client(req);
+    if (res == ESP_ERR_NO_MEM) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "5");
+        return httpd_resp_sendstr(req, "Too many event streams");
+    }
+    if (res != ESP_OK) {
+        httpd_resp_send_500(req);
+    }
+    return res;
 }
 
 static esp_err_t stream_handler(httpd_req_t *req) {
-    size_t jpg_buf_len = 0;
-    uint8_t *jpg_buf = NULL;
-    camera_fb_t *cam_fb = NULL;
-    // Buffer for headers (not frames)
-    char buffer[128];
-
-    // Check if  http response is ok
-    auto res = httpd_resp_set_type(req, STREAM_CONTENT_TYPE);
-    if (res != ESP_OK) {
-        return res;
+    if (!mjpeg_sender) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No stream source");
+        return ESP_FAIL;
     }
-
-    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");      
-    httpd_resp_set_hdr(req, "X-Framerate", "60");
-
-    while (true) {
-        int flag = get_flag(&shared_mem.stream_flag);
-
-        if (flag == 1 || flag == 3) {
-            cam_fb = esp_camera_fb_get();
-            // Handle when no frame captured
-            if (!cam_fb) {
-                ESP_LOGE(TAG, "Camera capture failed");
-                return ESP_FAIL;
-            }
-            // ESP_LOGI(TAG, "FRAME INFO: len=%u format=%d", (unsigned)cam_fb->len, cam_fb->format);
-            
-            // Make sure frame is of JPG before sending
-            bool converted = frame2jpg(cam_fb, 80, &jpg_buf, &jpg_buf_len);
-            // Return frame buffer
-            esp_camera_fb_return(cam_fb);
-            if (!converted) {
-                ESP_LOGE(TAG, "JPEG conversion failed");
-                break;
-            }
-
-            // Send a boundary string
-            res = httpd_resp_send_chunk(req, STREAM_BOUNDARY, strlen(STREAM_BOUNDARY));        
-            if (res != ESP_OK) {
-                break;
-            }
-            // ESP_LOGI(TAG, "Boundary sent, res=%d", res);
-            
-            // Send payboad string
-            // snprintf: put formatted string into buffer
-            // params: ptr to buffer, size of buffer, formatted string
-            int l = snprintf(buffer, sizeof(buffer), STREAM_PAYLOAD, jpg_buf_len);
-            res = httpd_resp_send_chunk(req, buffer, l);
-            if (res != ESP_OK) {
-                break;
-            }
-            // ESP_LOGI(TAG, "Payload sent, res=%d, jpg_len=%d", res, jpg_buf_len);
-
-            // Send actual frame
-            res = httpd_resp_send_chunk(req, (const char *)jpg_buf, jpg_buf_len);
-            free(jpg_buf);
-            jpg_buf = NULL;
-            if (res != ESP_OK) {
-                break;
-            }
-            // ESP_LOGI(TAG, "JPEG frame size=%u bytes", jpg_buf_len);
-            vTaskDelay(pdMS_TO_TICKS(240));
-        } else if (flag == 2) {
-            // another handler (capture handler) will send a frame
-            // pause streaming until a motion triggers
-            vTaskDelay(pdMS_TO_TICKS(1000));
-        } else {
-            // do nothing
-            // pause a second and start streaming
-            vTaskDelay(pdMS_TO_TICKS(1000));
-            set_flag(&shared_mem.stream_flag, 1);
-        }
+    // /stream?meta=1 adds a JSON part with the boxes after every frame, for pages that draw the stream themselves
+    char query[32];
+    char value[4];
+    bool meta = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+                httpd_query_key_value(query, "meta", value, sizeof(value)) == ESP_OK && !strcmp(value, "1");
+    // The sender takes the request over and the handler returns, the server task is free for the next request
+    esp_err_t res = mjpeg_sender->add_client(req, meta);
+    if (res == ESP_ERR_NO_MEM) {
+        ESP_LOGW(TAG, "Stream refused, %d streams running", mjpeg_sender->get_num_clients());
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "5");
+        httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+        return httpd_resp_sendstr(req, "Too many streams");
     }
-
-    // if loop is broken, so error has occured
-    if (jpg_buf) {
-        free(jpg_buf);
+    if (res != ESP_OK) {
+        httpd_resp_send_500(req);
     }
-    cam_fb = NULL;
-    jpg_buf = NULL;
-    // Program comes here only if errors happen
-    ESP_LOGE(TAG, "An error occured when streaming video");
     return res;
 }
 
 static esp_err_t capture_handler(httpd_req_t *req)
 {
     esp_err_t res;
-    size_t jpg_buf_len = 0;
-    uint8_t *jpg_buf = NULL;
-    camera_fb_t *cam_fb = esp_camera_fb_get();
-    if (!cam_fb) {
-        ESP_LOGE("Frame", "Camera capture failed");
+    if (!frame_jpeg) {
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
-
-    // Make sure frame is of JPG before sending
-    bool converted = frame2jpg(cam_fb, 80, &jpg_buf, &jpg_buf_len);
-    // return frame buffer
-    esp_camera_fb_return(cam_fb);
-    if (!converted) {
-        ESP_LOGE(TAG, "JPEG conversion failed");
-        res = ESP_FAIL;
-        return res;
+    // The latest encoded frame, unless the encoder was idle and it is stale
+    jpeg_frame_t *frame = frame_jpeg->acquire();
+    if (!frame || esp_timer_get_time() - frame->encoded_us > CAPTURE_MAX_AGE_US) {
+        uint32_t seq = frame ? frame->seq : 0;
+        WhoFrameJpeg::release(frame);
+        frame = frame_jpeg->acquire_newer(seq, pdMS_TO_TICKS(2000));
+    }
+    if (!frame) {
+        ESP_LOGE("Frame", "Camera capture failed");
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
     }
 
     httpd_resp_set_type(req, "image/jpeg");
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    res = httpd_resp_send(req, (const char *)jpg_buf, jpg_buf_len);
-    free(jpg_buf);
-    jpg_buf = NULL;
+    res = httpd_resp_send(req, (const char *)frame->buf, frame->len);
+    WhoFrameJpeg::release(frame);
     if (res != ESP_OK) {
         return res;
     }
@@ -234,19 +262,67 @@ static esp_err_t capture_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
-static esp_err_t html_code_handler(httpd_req_t *req) {
-    httpd_resp_set_type(req, "text/html");
-    return httpd_resp_send(req, index_html, strlen(index_html));
+// An event snapshot never changes, so the browser may keep it for good and revalidates with the id as ETag
+static esp_err_t snapshot_handler(httpd_req_t *req)
+{
+    char query[32];
+    char value[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, "id", value, sizeof(value)) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "No snapshot id");
+        return ESP_FAIL;
+    }
+    uint32_t id = strtoul(value, NULL, 10);
+    char etag[16];
+    snprintf(etag, sizeof(etag), "\"%08lx\"", (unsigned long)id);
+    char if_none_match[16];
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK &&
+        !strcmp(if_none_match, etag)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        httpd_resp_set_hdr(req, "ETag", etag);
+        return httpd_resp_send(req, NULL, 0);
+    }
+    // Encoding takes longer than the server task may block, a snapshot not ready by then is asked for again
+    snapshot_t *snapshot = snapshot_store ? snapshot_store->acquire(id, pdMS_TO_TICKS(SNAPSHOT_WAIT_MS)) : NULL;
+    if (!snapshot && snapshot_store && snapshot_store->is_pending(id)) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+        return httpd_resp_sendstr(req, "Snapshot not ready");
+    }
+    if (!snapshot) {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "image/jpeg");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "public, max-age=31536000, immutable");
+    esp_err_t res = httpd_resp_send(req, (const char *)snapshot->buf, snapshot->len);
+    WhoSnapshotStore::release(snapshot);
+    return res;
 }
 
-
 httpd_handle_t init_http() {
     httpd_handle_t server;
     // Set http config
     httpd_config_t http_config = HTTPD_DEFAULT_CONFIG();
     // Increase stack size to prevent overflow
     http_config.stack_size = 24 * 1024;
+    // Every stream and event page holds a socket, a few more serve the other requests. httpd_start() refuses more
+    // than LWIP_MAX_SOCKETS - 3, and the gateway client needs one of those too
+    int max_sockets = CONFIG_WHO_MJPEG_MAX_CLIENTS + CONFIG_WHO_EVENT_STREAM_MAX_CLIENTS + 3;
+    if (max_sockets > CONFIG_LWIP_MAX_SOCKETS - 4) {
+        ESP_LOGW(TAG,
+                 "%d sockets wanted for the streams, only %d left by LWIP_MAX_SOCKETS, further connections are refused",
+                 max_sockets,
+                 CONFIG_LWIP_MAX_SOCKETS - 4);
+        max_sockets = CONFIG_LWIP_MAX_SOCKETS - 4;
+    }
+    http_config.max_open_sockets = max_sockets;
     http_config.recv_wait_timeout = 5;
+    // The web assets and the five handlers below
+    http_config.max_uri_handlers = sizeof(web_assets) / sizeof(web_assets[0]) + 5;
     http_config.send_wait_timeout = 5;
 
     // Set handler
@@ -255,14 +331,9 @@ httpd_handle_t init_http() {
         return NULL;
     }
 
-    // for set up webpage
-    httpd_uri_t html_uri = {
-    .uri       = "/",
-    .method    = HTTP_GET,
-    .handler   = html_code_handler,
-    .user_ctx  = NULL
-    };
-    httpd_register_uri_handler(server, &html_uri);    
+    // for set up webpage, the assets live as long as the server
+    static WhoWebAssets *assets = new WhoWebAssets(web_assets, sizeof(web_assets) / sizeof(web_assets[0]));
+    assets->register_handlers(server);
 
     // for display text info
     httpd_uri_t info_uri = {
@@ -282,6 +353,24 @@ httpd_handle_t init_http() {
     };
     httpd_register_uri_handler(server, &capture_uri);
 
+    // for pushing recognition events
+    httpd_uri_t events_uri = {
+        .uri = "/events",
+        .method = HTTP_GET,
+        .handler = events_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(server, &events_uri);
+
+    // for the snapshot of an event
+    httpd_uri_t snapshot_uri = {
+        .uri = "/snapshot",
+        .method = HTTP_GET,
+        .handler = snapshot_handler,
+        .user_ctx = NULL
+    };
+    httpd_register_uri_handler(server, &snapshot_uri);
+
     // for stream video
     httpd_uri_t stream_uri = {
         .uri = "/stream",
@@ -0,0 +1,107 @@
+const logBox = document.getElementById("log");
+const snapshot = document.getElementById("snapshot");
+const state = document.getElementById("state");
+
+function log(text, color) {
+  const line = document.createElement("div");
+  if (color) {
+    line.style.color = color;
+  }
+  line.textContent = `[${new Date().toLocaleTimeString()}] ${text}`;
+  logBox.appendChild(line);
+  logBox.scrollTop = logBox.scrollHeight;
+}
+
+// A snapshot still being encoded is answered with 503, it is asked for again a few times
+let snapshotUrl = null, snapshotRetries = 0;
+function showSnapshot(url) {
+  snapshotUrl = url;
+  snapshotRetries = 0;
+  snapshot.src = url;
+}
+snapshot.addEventListener("error", () => {
+  if (!snapshotUrl || snapshotRetries >= 10) return;
+  const retry = ++snapshotRetries;
+  setTimeout(() => {
+    if (snapshotRetries === retry) snapshot.src = `${snapshotUrl}&retry=${retry}`;
+  }, 200);
+});
+
+// The server pushes every event as it happens, the browser reconnects by itself and gets what it missed
+const events = new EventSource("/events");
+function on(name, message) {
+  events.addEventListener(name, e => {
+    const data = JSON.parse(e.data);
+    log(message(data));
+    if (data.snapshot.startsWith("/snapshot")) {
+      showSnapshot(data.snapshot);
+    } else {
+      snapshotUrl = null;
+      snapshot.src = data.snapshot;
+    }
+  });
+}
+on("known", d => `Known visitor detected! (id ${d.id}, ${(d.similarity * 100).toFixed(0)}%)`);
+on("unknown", d => "Unknown visitor detected!");
+on("motion", d => "Motion detected!");
+events.addEventListener("state", e => {
+  const name = JSON.parse(e.data).state;
+  state.textContent = name.charAt(0).toUpperCase() + name.slice(1);
+});
+events.onerror = () => log("Event stream lost, reconnecting", "red");
+
+// Live view: every JPEG part is followed by a JSON part with the same X-Frame-Seq, the boxes are drawn here
+const video = document.getElementById("video");
+const ctx = video.getContext("2d");
+function find(buf, from) {
+  for (let i = from; i + 3 < buf.length; i++) {
+    if (buf[i] === 13 && buf[i + 1] === 10 && buf[i + 2] === 13 && buf[i + 3] === 10) return i;
+  }
+  return -1;
+}
+async function draw(jpeg, info) {
+  const img = await createImageBitmap(jpeg);
+  video.width = img.width;
+  video.height = img.height;
+  ctx.drawImage(img, 0, 0);
+  if (!info.meta) return;
+  const sx = img.width / info.meta.width, sy = img.height / info.meta.height;
+  ctx.lineWidth = 2;
+  ctx.font = "14px sans-serif";
+  for (const f of info.meta.faces) {
+    ctx.strokeStyle = ctx.fillStyle = f.id ? "lime" : "red";
+    ctx.strokeRect(f.box[0] * sx, f.box[1] * sy, (f.box[2] - f.box[0]) * sx, (f.box[3] - f.box[1]) * sy);
+    for (let k = 0; k + 1 < f.kp.length; k += 2) ctx.fillRect(f.kp[k] * sx - 2, f.kp[k + 1] * sy - 2, 4, 4);
+    ctx.fillText(`#${f.track} ${f.id ? "id " + f.id : "unknown"}`, f.box[0] * sx, f.box[1] * sy - 4);
+  }
+}
+async function live() {
+  const reader = (await fetch("/stream?meta=1")).body.getReader();
+  const text = new TextDecoder();
+  let buf = new Uint8Array(0), jpeg = null;
+  while (true) {
+    const { value, done } = await reader.read();
+    if (done) break;
+    const joined = new Uint8Array(buf.length + value.length);
+    joined.set(buf);
+    joined.set(value, buf.length);
+    buf = joined;
+    let end;
+    while ((end = find(buf, 0)) >= 0) {
+      const head = text.decode(buf.subarray(0, end));
+      const len = parseInt((/Content-Length: (\d+)/i.exec(head) || [])[1]);
+      if (buf.length < end + 4 + len) break;
+      const body = buf.slice(end + 4, end + 4 + len);
+      buf = buf.subarray(end + 4 + len);
+      const seq = (/X-Frame-Seq: (\d+)/i.exec(head) || [])[1];
+      if (/image\/jpeg/i.test(head)) {
+        jpeg = { seq: seq, blob: new Blob([body], { type: "image/jpeg" }) };
+      } else if (jpeg && jpeg.seq === seq) {
+        draw(jpeg.blob, JSON.parse(text.decode(body)));
+        jpeg = null;
+      }
+    }
+  }
+}
+function restart() { setTimeout(() => live().then(restart, restart), 2000); }
+live().then(restart, restart);
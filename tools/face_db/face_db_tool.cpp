@@ -0,0 +1,229 @@
+// Host tool for the memory-mapped face gallery image (components/who_face_db).
+//
+//   face_db_tool import <face.db> <out.img>     convert a dl::recognition::DataBase file
+//   face_db_tool gen <out.img> <num> [feat_len] generate a random gallery
+//   face_db_tool info <img>                     print the header and verify crc
+//   face_db_tool bench <img> [queries]          time cosine search on the mmapped image
+//   face_db_tool store <region> <ops> [kb]      random enroll/update/delete on a journaled store, then reopen and
+//                                               check that every face survived
+//
+// Flash an image to the face_db partition with:
+//   parttool.py write_partition --partition-name face_db --input <img>
+#include "who_face_db.hpp"
+#include "who_face_db_store.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+
+using namespace who::face_db;
+
+static int usage()
+{
+    fprintf(stderr,
+            "usage: face_db_tool import <face.db> <out.img>\n"
+            "       face_db_tool gen <out.img> <num> [feat_len]\n"
+            "       face_db_tool info <img>\n"
+            "       face_db_tool bench <img> [queries]\n"
+            "       face_db_tool store <region> <ops> [kb]\n");
+    return 1;
+}
+
+static int cmd_import(const char *src, const char *dst)
+{
+    std::vector<uint8_t> image;
+    if (import_legacy_db(src, image) != ESP_OK || write_image_to_file(dst, image) != ESP_OK) {
+        return 1;
+    }
+    printf("wrote %s, %zu bytes\n", dst, image.size());
+    return 0;
+}
+
+static int cmd_gen(const char *dst, uint32_t num, uint32_t feat_len)
+{
+    std::mt19937 rng(4216);
+    std::normal_distribution<float> dist;
+    std::vector<uint16_t> ids(num);
+    std::vector<float> feats((size_t)num * feat_len);
+    for (uint32_t i = 0; i < num; i++) {
+        ids[i] = i + 1;
+    }
+    for (auto &f : feats) {
+        f = dist(rng);
+    }
+    std::vector<uint8_t> image;
+    if (build_image(ids.data(), feats.data(), num, feat_len, 0, 0, image) != ESP_OK ||
+        write_image_to_file(dst, image) != ESP_OK) {
+        return 1;
+    }
+    printf("wrote %s, %u feats, %zu bytes\n", dst, num, image.size());
+    return 0;
+}
+
+static int cmd_info(const char *path)
+{
+    WhoFaceDB db;
+    esp_err_t ret = db.open_file(path, true);
+    if (ret != ESP_OK) {
+        fprintf(stderr, "invalid image: %s\n", esp_err_to_name(ret));
+        return 1;
+    }
+    const face_db_header_t *h = db.get_header();
+    printf("version     %u\n", h->version);
+    printf("image_size  %u\n", h->image_size);
+    printf("feat_len    %u\n", h->feat_len);
+    printf("feat_stride %u\n", h->feat_stride);
+    printf("num_feats   %u\n", h->num_feats);
+    printf("generation  %u\n", h->generation);
+    printf("last_seq    %u\n", h->last_seq);
+    printf("ids        ");
+    for (uint32_t i = 0; i < h->num_feats; i++) {
+        printf(" %u", db.get_id(i));
+    }
+    printf("\n");
+    return 0;
+}
+
+static int cmd_bench(const char *path, int queries)
+{
+    WhoFaceDB db;
+    auto t0 = std::chrono::steady_clock::now();
+    if (db.open_file(path) != ESP_OK) {
+        return 1;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    std::mt19937 rng(1645);
+    std::uniform_int_distribution<uint32_t> pick(0, db.get_num_feats() ? db.get_num_feats() - 1 : 0);
+    std::normal_distribution<float> noise(0, 0.02f);
+    std::vector<float> feat(db.get_feat_len());
+    int hits = 0;
+    double total_us = 0;
+    for (int q = 0; q < queries && db.get_num_feats(); q++) {
+        uint32_t i = pick(rng);
+        const float *src = db.get_feat(i);
+        for (uint32_t j = 0; j < feat.size(); j++) {
+            feat[j] = src[j] + noise(rng);
+        }
+        auto q0 = std::chrono::steady_clock::now();
+        auto matches = db.query(feat.data(), 0.5f, 1);
+        auto q1 = std::chrono::steady_clock::now();
+        total_us += std::chrono::duration<double, std::micro>(q1 - q0).count();
+        hits += !matches.empty() && matches[0].id == db.get_id(i);
+    }
+    printf("open        %.1f us\n", std::chrono::duration<double, std::micro>(t1 - t0).count());
+    printf("queries     %d\n", queries);
+    printf("avg query   %.1f us over %u feats\n", queries ? total_us / queries : 0, db.get_num_feats());
+    printf("top-1 hits  %d\n", hits);
+
+    // Same queries in batches of 4, the gallery is scanned once per batch.
+    constexpr uint32_t batch = 4;
+    std::vector<float> feats(batch * db.get_feat_len());
+    for (uint32_t j = 0; j < feats.size(); j++) {
+        feats[j] = noise(rng);
+    }
+    auto b0 = std::chrono::steady_clock::now();
+    for (int q = 0; q < queries; q += batch) {
+        db.query_batch(feats.data(), batch, 0.5f, 1);
+    }
+    auto b1 = std::chrono::steady_clock::now();
+    printf("avg batched %.1f us per query, batch %u\n",
+           queries ? std::chrono::duration<double, std::micro>(b1 - b0).count() / queries : 0,
+           batch);
+    return 0;
+}
+
+static int cmd_store(const char *path, int ops, size_t region_size)
+{
+    constexpr uint32_t feat_len = 512;
+    std::map<uint16_t, std::vector<float>> expected;
+    std::mt19937 rng(1645);
+    std::normal_distribution<float> gauss(0, 1);
+    auto random_feat = [&]() {
+        std::vector<float> feat(feat_len);
+        for (auto &v : feat) {
+            v = gauss(rng);
+        }
+        return feat;
+    };
+    {
+        WhoFaceDBStore store(path, region_size);
+        if (store.open() != ESP_OK) {
+            return 1;
+        }
+        // Pick up whatever a previous run left behind.
+        for (uint16_t id = 1; id <= store.get_last_id(); id++) {
+            if (store.contains(id)) {
+                expected[id] = {};
+            }
+        }
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < ops; i++) {
+            uint32_t op = rng() % 4;
+            esp_err_t ret = ESP_OK;
+            if ((op == 0 || op == 1) && !expected.empty()) {
+                auto it = std::next(expected.begin(), rng() % expected.size());
+                if (op == 0) {
+                    ret = store.remove(it->first);
+                    expected.erase(it);
+                } else {
+                    it->second = random_feat();
+                    ret = store.update(it->first, it->second.data(), feat_len);
+                }
+            } else {
+                uint16_t id;
+                auto feat = random_feat();
+                ret = store.enroll(feat.data(), feat_len, &id);
+                if (ret == ESP_OK) {
+                    expected[id] = feat;
+                } else if (ret == ESP_ERR_NO_MEM) {
+                    ret = ESP_OK;
+                }
+            }
+            if (ret != ESP_OK) {
+                fprintf(stderr, "op %d failed: %s\n", i, esp_err_to_name(ret));
+                return 1;
+            }
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        printf("ops         %d in %.1f ms\n", ops, std::chrono::duration<double, std::milli>(t1 - t0).count());
+        printf("journal     %.0f%% used\n", store.get_journal_usage() * 100);
+    }
+
+    WhoFaceDBStore store(path, region_size);
+    if (store.open() != ESP_OK) {
+        return 1;
+    }
+    int errors = store.get_num_feats() != expected.size();
+    for (const auto &entry : expected) {
+        if (!store.contains(entry.first)) {
+            errors++;
+        } else if (!entry.second.empty()) {
+            auto matches = store.query(entry.second.data(), 0.99f, 1);
+            errors += matches.empty() || matches[0].id != entry.first;
+        }
+    }
+    printf("faces       %u\n", store.get_num_feats());
+    printf("errors      %d\n", errors);
+    return errors != 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        return usage();
+    }
+    if (!strcmp(argv[1], "import") && argc == 4) {
+        return cmd_import(argv[2], argv[3]);
+    } else if (!strcmp(argv[1], "gen") && argc >= 4) {
+        return cmd_gen(argv[2], atoi(argv[3]), argc > 4 ? atoi(argv[4]) : 512);
+    } else if (!strcmp(argv[1], "info")) {
+        return cmd_info(argv[2]);
+    } else if (!strcmp(argv[1], "bench")) {
+        return cmd_bench(argv[2], argc > 3 ? atoi(argv[3]) : 1000);
+    } else if (!strcmp(argv[1], "store") && argc >= 4) {
+        return cmd_store(argv[2], atoi(argv[3]), (argc > 4 ? atoi(argv[4]) : 512) * 1024);
+    }
+    return usage();
+}
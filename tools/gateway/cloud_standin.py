@@ -0,0 +1,182 @@
+#!/usr/bin/env python3
+"""Local stand-in for the cloud services of the Arduino gateway (ThingSpeak_Gateway2), for testing its upload queue
+and alert worker without a ThingSpeak account or a Telegram bot.
+
+Point CLOUD_STANDIN in the sketch at it, e.g. "http://172.20.10.2:8080". It answers ThingSpeak's bulk update
+(POST /channels/<id>/bulk_update.json) and single update (/update) like ThingSpeak does, 429 for a request sooner
+than --interval seconds after the last one taken, and prints every batch with the age of its entries and every new
+connection, so a kept-alive connection shows as one connect for many requests.
+
+Telegram's sendMessage (POST /bot<token>/sendMessage) takes --tg-delay seconds to answer, like a slow TLS round
+trip, and fails a --tg-fail fraction of the messages with 429 and a retry_after of --tg-retry-after seconds. Every
+message is printed with the detections its digest covers. To measure the gateway's loop latency under bursty
+detections, run device_loadgen against the gateway with a short --continuous-ms, say "status" on its serial
+monitor to read the longest loop pass, and compare --tg-delay 0 with --tg-delay 3.
+
+    python3 tools/gateway/cloud_standin.py --port 8080 --interval 15 --tg-delay 2 --tg-fail 0.2
+"""
+import argparse
+import datetime
+import json
+import random
+import re
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlparse
+
+
+class Stats:
+    def __init__(self, args):
+        self.lock = threading.Lock()
+        self.interval = args.interval
+        self.args = args
+        self.last_update = None
+        self.connections = 0
+        self.requests = 0
+        self.entries = 0
+        self.limited = 0
+        self.messages = 0
+        self.detections = 0
+        self.refused = 0
+
+    def take(self):
+        """True if an update arriving now is within the rate limit."""
+        with self.lock:
+            now = time.monotonic()
+            if self.last_update is not None and now - self.last_update < self.interval:
+                self.limited += 1
+                return False
+            self.last_update = now
+            return True
+
+
+def entry_age(entry, now):
+    if "delta_t" in entry:
+        return float(entry["delta_t"])
+    if "created_at" in entry:
+        created = datetime.datetime.strptime(entry["created_at"], "%Y-%m-%dT%H:%M:%SZ")
+        return (now - created.replace(tzinfo=datetime.timezone.utc)).total_seconds()
+    return 0.0
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def setup(self):
+        super().setup()
+        stats = self.server.stats
+        with stats.lock:
+            stats.connections += 1
+            print(f"connection {stats.connections} from {self.client_address[0]}:{self.client_address[1]}")
+
+    def log_message(self, format, *args):
+        pass
+
+    def reply(self, code, body):
+        data = json.dumps(body).encode()
+        self.send_response(code)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def do_POST(self):
+        length = int(self.headers.get("Content-Length", 0))
+        payload = self.rfile.read(length)
+        path = urlparse(self.path).path
+        stats = self.server.stats
+        with stats.lock:
+            stats.requests += 1
+        if path.startswith("/channels/") and path.endswith("/bulk_update.json"):
+            self.bulk_update(payload)
+        elif path.startswith("/bot") and path.endswith("/sendMessage"):
+            self.send_message(payload)
+        elif path == "/update":
+            self.update(parse_qs(payload.decode(errors="replace")))
+        else:
+            self.reply(404, {"error": "not found"})
+
+    def bulk_update(self, payload):
+        try:
+            updates = json.loads(payload)["updates"]
+        except (ValueError, KeyError):
+            self.reply(400, {"error": "bad bulk update"})
+            return
+        if not self.server.stats.take():
+            print(f"429: {len(updates)} entries, sooner than {self.server.stats.interval:g} s after the last update")
+            self.reply(429, {"error": "rate limited"})
+            return
+        now = datetime.datetime.now(datetime.timezone.utc)
+        ages = [entry_age(entry, now) for entry in updates]
+        with self.server.stats.lock:
+            self.server.stats.entries += len(updates)
+        oldest = max(ages) if ages else 0
+        print(f"bulk update: {len(updates)} entries, oldest {oldest:.0f} s, newest {min(ages, default=0):.0f} s")
+        self.reply(202, {"success": True})
+
+    def send_message(self, payload):
+        try:
+            text = json.loads(payload)["text"]
+        except (ValueError, KeyError):
+            self.reply(400, {"ok": False, "error_code": 400, "description": "Bad Request: message text is empty"})
+            return
+        args = self.server.stats.args
+        time.sleep(args.tg_delay)
+        if random.random() < args.tg_fail:
+            print(f"sendMessage: 429, retry after {args.tg_retry_after} s")
+            with self.server.stats.lock:
+                self.server.stats.refused += 1
+            self.reply(429, {"ok": False, "error_code": 429, "description": "Too Many Requests",
+                             "parameters": {"retry_after": args.tg_retry_after}})
+            return
+        # The gateway's digest says how many detections it covers.
+        match = re.search(r"Detections: (\d+)", text)
+        detections = int(match.group(1)) if match else 1
+        with self.server.stats.lock:
+            self.server.stats.messages += 1
+            self.server.stats.detections += detections
+        lines = [line.lstrip("• ") for line in text.splitlines()[1:]]
+        print(f"sendMessage: {' | '.join(lines)}")
+        self.reply(200, {"ok": True, "result": {"message_id": self.server.stats.messages}})
+
+    def update(self, fields):
+        if not self.server.stats.take():
+            self.reply(429, {"error": "rate limited"})
+            return
+        with self.server.stats.lock:
+            self.server.stats.entries += 1
+        print(f"update: {' '.join(f'{k}={v[0]}' for k, v in sorted(fields.items()) if k != 'api_key')}")
+        # ThingSpeak answers with the entry id.
+        self.send_response(200)
+        self.send_header("Content-Length", "1")
+        self.end_headers()
+        self.wfile.write(b"1")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--interval", type=float, default=15, help="ThingSpeak rate limit in seconds, 0 for none")
+    parser.add_argument("--tg-delay", type=float, default=0, help="seconds before Telegram answers")
+    parser.add_argument("--tg-fail", type=float, default=0, help="fraction of Telegram messages refused with 429")
+    parser.add_argument("--tg-retry-after", type=int, default=3, help="retry_after of a refused message, seconds")
+    args = parser.parse_args()
+
+    server = ThreadingHTTPServer((args.host, args.port), Handler)
+    server.daemon_threads = True
+    server.stats = Stats(args)
+    print(f"cloud stand-in listening on {args.host}:{args.port}")
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    stats = server.stats
+    print(f"{stats.connections} connections, {stats.requests} requests, {stats.entries} entries, "
+          f"{stats.limited} rate limited")
+    print(f"{stats.messages} Telegram messages for {stats.detections} detections, {stats.refused} refused")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,173 @@
+// Load generator for the gateway: dozens of simulated cameras on one host.
+//
+//   device_loadgen [--host 127.0.0.1] [--port 5500] [--devices 24] [--format json|wire] [--recognize-ms 150]
+//                  [--continuous-ms 0] [--duration 30]
+//
+// Every device runs the camera's own WhoGatewayClient, so connect, backoff, batching and the protocol are the code
+// which runs on the device. A PIR trigger is answered with a RECOGNIZE event after --recognize-ms, +-20%, like the
+// camera after running the models; --continuous-ms adds a CONTINUOUS event per device at that period. Run it
+// against gateway_emulator to measure trigger-to-result latency under load, or against the real gateway.
+#include "who_gateway_client.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace who::gateway;
+
+typedef struct {
+    std::unique_ptr<WhoGatewayClient> client;
+    uint32_t seq;
+    uint32_t triggers;
+    uint32_t pushed;
+    int64_t max_push_us;
+} device_t;
+
+typedef struct {
+    int64_t due_us;
+    int device;
+    event_type_t type;
+} reply_t;
+
+struct reply_later {
+    bool operator()(const reply_t &a, const reply_t &b) const { return a.due_us > b.due_us; }
+};
+
+static int64_t now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static int usage()
+{
+    fprintf(stderr,
+            "usage: device_loadgen [--host 127.0.0.1] [--port 5500] [--devices 24] [--format json|wire]\n"
+            "                      [--recognize-ms 150] [--continuous-ms 0] [--duration 30]\n");
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *host = "127.0.0.1";
+    int port = 5500;
+    int num_devices = 24;
+    event_format_t format = EVENT_FORMAT_JSON;
+    int recognize_ms = 150;
+    int continuous_ms = 0;
+    int duration_s = 30;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            return usage();
+        }
+        const char *arg = argv[i];
+        const char *value = argv[++i];
+        if (!strcmp(arg, "--host")) {
+            host = value;
+        } else if (!strcmp(arg, "--port")) {
+            port = atoi(value);
+        } else if (!strcmp(arg, "--devices")) {
+            num_devices = atoi(value);
+        } else if (!strcmp(arg, "--format")) {
+            format = !strcmp(value, "wire") ? EVENT_FORMAT_WIRE : EVENT_FORMAT_JSON;
+        } else if (!strcmp(arg, "--recognize-ms")) {
+            recognize_ms = atoi(value);
+        } else if (!strcmp(arg, "--continuous-ms")) {
+            continuous_ms = atoi(value);
+        } else if (!strcmp(arg, "--duration")) {
+            duration_s = atoi(value);
+        } else {
+            return usage();
+        }
+    }
+
+    // Replies are scheduled from the client tasks and pushed by one responder thread, the command callback must not
+    // block the network task.
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::priority_queue<reply_t, std::vector<reply_t>, reply_later> replies;
+    std::mt19937 rng(4216);
+    std::uniform_real_distribution<double> jitter(0.8, 1.2);
+
+    std::vector<device_t> devices(num_devices);
+    int64_t start_us = now_us();
+    for (int i = 0; i < num_devices; i++) {
+        device_t &device = devices[i];
+        device.client.reset(new WhoGatewayClient(host, port, 16, 640, format));
+        device.client->set_backoff(200, 5000);
+        device.client->set_command_cb([&, i](gateway_cmd_t cmd) {
+            if (cmd != GATEWAY_CMD_TRIGGER) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            devices[i].triggers++;
+            replies.push({now_us() + (int64_t)(recognize_ms * 1000 * jitter(rng)), i, EVENT_RECOGNIZE});
+            cond.notify_one();
+        });
+        if (continuous_ms > 0) {
+            // Staggered, so the devices do not send in lockstep.
+            std::lock_guard<std::mutex> lock(mutex);
+            replies.push({start_us + (int64_t)continuous_ms * 1000 * i / num_devices, i, EVENT_CONTINUOUS});
+        }
+        if (device.client->start() != ESP_OK) {
+            return 1;
+        }
+    }
+
+    int64_t end_us = start_us + duration_s * 1000000LL;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (now_us() < end_us) {
+        if (replies.empty() || replies.top().due_us > now_us()) {
+            int64_t due_us = replies.empty() ? end_us : std::min(end_us, replies.top().due_us);
+            cond.wait_for(lock, std::chrono::microseconds(std::max<int64_t>(due_us - now_us(), 0)));
+            continue;
+        }
+        reply_t reply = replies.top();
+        replies.pop();
+        device_t &device = devices[reply.device];
+        event_t event = {};
+        event.type = reply.type;
+        event.seq = device.seq++;
+        event.timestamp_ms = (now_us() - start_us) / 1000;
+        event.num_faces = 1;
+        event.faces[0] = {1, (uint16_t)(reply.device % 5), (uint8_t)(reply.device % 5 != 0), 0.8f};
+        int64_t push_start_us = now_us();
+        if (device.client->push(event)) {
+            device.pushed++;
+        }
+        device.max_push_us = std::max(device.max_push_us, now_us() - push_start_us);
+        if (reply.type == EVENT_CONTINUOUS) {
+            replies.push({reply.due_us + continuous_ms * 1000LL, reply.device, EVENT_CONTINUOUS});
+        }
+    }
+    lock.unlock();
+
+    uint32_t connected = 0, triggers = 0, pushed = 0, dropped = 0, reconnects = 0;
+    int64_t max_push_us = 0;
+    for (auto &device : devices) {
+        connected += device.client->is_connected();
+        device.client->stop();
+        triggers += device.triggers;
+        pushed += device.pushed;
+        dropped += device.client->get_dropped();
+        reconnects += device.client->get_reconnects();
+        max_push_us = std::max(max_push_us, device.max_push_us);
+    }
+    printf("%d devices, %u connected at the end, %u triggers, %u events pushed, %u dropped, %u reconnects, "
+           "max push %lld us\n",
+           num_devices,
+           connected,
+           triggers,
+           pushed,
+           dropped,
+           reconnects,
+           (long long)max_push_us);
+    return 0;
+}
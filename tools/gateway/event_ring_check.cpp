@@ -0,0 +1,74 @@
+// Host check of the event ring (components/who_gateway), run by ctest.
+//
+// An event too large for its slot is dropped, and the events pushed after it still come out in order, through both
+// front_len() and pop() as the client's batching uses them.
+#include "who_event_ring.hpp"
+#include <cstdio>
+#include <cstring>
+
+using namespace who::gateway;
+
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);                                   \
+            return 1;                                                                                                  \
+        }                                                                                                              \
+    } while (0)
+
+static event_t make_event(uint32_t seq, uint8_t num_faces)
+{
+    event_t event = {};
+    event.type = EVENT_RECOGNIZE;
+    event.seq = seq;
+    event.timestamp_ms = seq * 100;
+    event.num_faces = num_faces;
+    for (uint8_t i = 0; i < num_faces; i++) {
+        event.faces[i] = {i + 1u, (uint16_t)(i + 1), 1, 0.8f};
+    }
+    return event;
+}
+
+static int check_format(event_format_t format, size_t slot_size)
+{
+    WhoEventRing ring(4, slot_size);
+    uint8_t buf[4096];
+    size_t len;
+    // Several laps, so the skipped slots are handed back and used again.
+    for (uint32_t seq = 0; seq < 16; seq += 2) {
+        CHECK(!ring.push(make_event(seq, EVENT_MAX_FACES), format));
+        CHECK(ring.push(make_event(seq + 1, 1), format));
+        CHECK(!ring.empty());
+        size_t front = ring.front_len();
+        CHECK(front > 0);
+        CHECK(ring.pop(buf, sizeof(buf), len));
+        CHECK(len == front);
+        if (format == EVENT_FORMAT_JSON) {
+            char seq_field[32];
+            snprintf(seq_field, sizeof(seq_field), "\"seq\":%u,", (unsigned)seq + 1);
+            CHECK(memmem(buf, len, seq_field, strlen(seq_field)));
+        }
+        CHECK(ring.empty());
+        CHECK(ring.front_len() == 0);
+        CHECK(!ring.pop(buf, sizeof(buf), len));
+    }
+    CHECK(ring.get_dropped() == 8);
+    // Only oversized events: the ring stays empty and takes new events.
+    for (int i = 0; i < 8; i++) {
+        CHECK(!ring.push(make_event(100, EVENT_MAX_FACES), format));
+    }
+    CHECK(ring.empty());
+    CHECK(ring.push(make_event(101, 1), format));
+    CHECK(ring.pop(buf, sizeof(buf), len) && len > 0);
+    return 0;
+}
+
+int main()
+{
+    if (check_format(EVENT_FORMAT_JSON, 160) || check_format(EVENT_FORMAT_TLV, 48) ||
+        check_format(EVENT_FORMAT_WIRE, 32)) {
+        return 1;
+    }
+    printf("event ring ok\n");
+    return 0;
+}
@@ -0,0 +1,64 @@
+// Host tool for the gateway client (components/who_gateway).
+//
+//   gateway_client_tool <host> <port> [events] [interval_ms] [json|wire] [journal]
+//
+// Runs the same client as the camera against a gateway, e.g. gateway_standin.py, pushes a recognition event every
+// interval_ms and prints the commands the gateway sends back. Stop and restart the gateway meanwhile to watch the
+// reconnect backoff; the events queued while it is away are sent once it is back. With "wire" the client speaks the
+// binary protocol of who_wire.hpp, acknowledged batches and heartbeats included. With a
+// journal file the events pushed while disconnected are kept there and forwarded after the reconnect.
+#include "who_gateway_client.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+using namespace who::gateway;
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: gateway_client_tool <host> <port> [events] [interval_ms] [json|wire] [journal]\n");
+        return 1;
+    }
+    int num_events = argc > 3 ? atoi(argv[3]) : 20;
+    int interval_ms = argc > 4 ? atoi(argv[4]) : 500;
+    event_format_t format = argc > 5 && !strcmp(argv[5], "wire") ? EVENT_FORMAT_WIRE : EVENT_FORMAT_JSON;
+
+    WhoGatewayClient client(argv[1], atoi(argv[2]), 16, 640, format);
+    client.set_backoff(200, 5000);
+    client.set_heartbeat(2000);
+    if (argc > 6 && client.enable_journal(argv[6], 256, 4, 100) != ESP_OK) {
+        return 1;
+    }
+    client.set_command_cb([](gateway_cmd_t cmd) { printf("command %d received\n", (int)cmd); });
+    client.set_config_cb(
+        [](wire_config_key_t key, int32_t value) { printf("config %d = %d\n", (int)key, (int)value); });
+    if (client.start() != ESP_OK) {
+        return 1;
+    }
+    for (int i = 0; i < num_events; i++) {
+        event_t event = {};
+        event.type = EVENT_RECOGNIZE;
+        event.seq = i;
+        event.timestamp_ms = i * interval_ms;
+        event.num_faces = 1;
+        event.faces[0] = {1, (uint16_t)(i % 3), (uint8_t)(i % 3 != 0), i % 3 ? 0.8f : 0.f};
+        auto start = std::chrono::steady_clock::now();
+        bool queued = client.push(event);
+        auto push_us =
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        printf("event %d %s in %lld us, %s\n",
+               i,
+               queued ? "queued" : "dropped",
+               (long long)push_us,
+               client.is_connected() ? "connected" : "disconnected");
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+    }
+    // Give the last batch a moment to go out.
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    printf("dropped %u, reconnects %u\n", client.get_dropped(), client.get_reconnects());
+    client.stop();
+    return 0;
+}
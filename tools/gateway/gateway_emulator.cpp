@@ -0,0 +1,514 @@
+// Linux emulator of the Arduino gateway (ThingSpeak_Gateway2.ino), without ThingSpeak, Telegram or a PIR sensor.
+//
+//   gateway_emulator [--port 5500] [--pir ms] [--pir-jitter ms] [--timeout ms] [--duration s] [--record file.csv]
+//                    [--continuous]
+//
+// Accepts any number of cameras on the gateway port and tells their protocol from the first byte they send: the
+// wire protocol of who_wire.hpp starts with WIRE_MAGIC, anything else is '\r' terminated JSON lines like the sketch
+// reads. Until a camera has sent something it is spoken to like the sketch does.
+//
+// Every --pir ms (plus up to --pir-jitter ms) a PIR trigger goes to all cameras. The first RECOGNIZE result a camera
+// sends after a trigger closes it, and the time in between is the trigger-to-result latency; a trigger without a
+// result after --timeout ms counts as lost. Every result is appended to --record as CSV, a summary is printed every
+// 5 s and on exit, after --duration s or Ctrl-C. --continuous switches continuous recognition on for wire cameras.
+#include "who_event.hpp"
+#include "who_wire.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <random>
+#include <string>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace who::gateway;
+
+typedef enum {
+    PROTO_UNKNOWN,
+    PROTO_LINE,
+    PROTO_WIRE,
+} proto_t;
+
+typedef struct {
+    int fd;
+    std::string name;
+    proto_t proto;
+    std::string line;
+    WhoWireParser wire_parser;
+    std::string out;
+    uint16_t wire_seq;
+    int64_t trigger_us; // oldest trigger without a result, -1 if none.
+    uint32_t triggers;
+    uint32_t results;
+    uint32_t lost;
+    uint32_t heartbeats;
+    std::vector<double> latencies_ms;
+} client_t;
+
+static volatile sig_atomic_t s_stop = 0;
+
+static int64_t now_us()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static const char *proto_to_str(proto_t proto)
+{
+    return proto == PROTO_WIRE ? "wire" : (proto == PROTO_LINE ? "json" : "-");
+}
+
+// Value of "key": in one of the compact JSON events, good enough for the fields the camera writes.
+static const char *json_find(const std::string &line, const char *key)
+{
+    std::string pattern = std::string("\"") + key + "\":";
+    size_t pos = line.find(pattern);
+    return pos == std::string::npos ? nullptr : line.c_str() + pos + pattern.size();
+}
+
+static bool json_to_event(const std::string &line, event_t &event)
+{
+    memset(&event, 0, sizeof(event));
+    const char *type = json_find(line, "event");
+    if (!type) {
+        return false;
+    }
+    static const event_type_t types[] = {EVENT_RECOGNIZE, EVENT_CONTINUOUS, EVENT_ENROLL, EVENT_DELETE};
+    for (event_type_t t : types) {
+        const char *name = event_type_to_str(t);
+        if (type[0] == '"' && !strncmp(type + 1, name, strlen(name)) && type[1 + strlen(name)] == '"') {
+            event.type = t;
+        }
+    }
+    const char *value;
+    if ((value = json_find(line, "seq"))) {
+        event.seq = strtoul(value, nullptr, 10);
+    }
+    // The top level fields are those of the best face, which is all the summary needs.
+    event.num_faces = 1;
+    if ((value = json_find(line, "status"))) {
+        event.faces[0].status = atoi(value);
+    }
+    if ((value = json_find(line, "id"))) {
+        event.faces[0].id = atoi(value);
+    }
+    if ((value = json_find(line, "similarity"))) {
+        event.faces[0].similarity = strtof(value, nullptr);
+    }
+    return event.type != 0;
+}
+
+class GatewayEmulator {
+public:
+    GatewayEmulator() :
+        m_listen_fd(-1),
+        m_pir_ms(5000),
+        m_pir_jitter_ms(0),
+        m_timeout_ms(5000),
+        m_continuous(false),
+        m_record(nullptr),
+        m_rng(4216)
+    {
+    }
+    ~GatewayEmulator()
+    {
+        for (auto &client : m_clients) {
+            close(client->fd);
+        }
+        if (m_listen_fd >= 0) {
+            close(m_listen_fd);
+        }
+        if (m_record) {
+            fclose(m_record);
+        }
+    }
+
+    bool listen_on(uint16_t port)
+    {
+        m_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        if (bind(m_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(m_listen_fd, 64) != 0) {
+            fprintf(stderr, "cannot listen on port %d: %s\n", port, strerror(errno));
+            return false;
+        }
+        fcntl(m_listen_fd, F_SETFL, fcntl(m_listen_fd, F_GETFL, 0) | O_NONBLOCK);
+        printf("gateway emulator listening on port %d\n", port);
+        return true;
+    }
+
+    bool open_record(const char *path)
+    {
+        m_record = fopen(path, "w");
+        if (!m_record) {
+            fprintf(stderr, "cannot open %s\n", path);
+            return false;
+        }
+        fprintf(m_record, "time_ms,client,proto,seq,type,num_faces,status,id,similarity,latency_ms\n");
+        return true;
+    }
+
+    void set_pir(int pir_ms, int pir_jitter_ms)
+    {
+        m_pir_ms = pir_ms;
+        m_pir_jitter_ms = pir_jitter_ms;
+    }
+    void set_timeout(int timeout_ms) { m_timeout_ms = timeout_ms; }
+    void set_continuous(bool continuous) { m_continuous = continuous; }
+
+    void run(int duration_s)
+    {
+        m_start_us = now_us();
+        int64_t end_us = duration_s > 0 ? m_start_us + duration_s * 1000000LL : INT64_MAX;
+        int64_t next_pir_us = m_pir_ms > 0 ? m_start_us + next_pir_delay_us() : INT64_MAX;
+        int64_t next_summary_us = m_start_us + 5000000;
+        while (!s_stop) {
+            int64_t now = now_us();
+            if (now >= end_us) {
+                break;
+            }
+            if (now >= next_pir_us) {
+                trigger_all(now);
+                next_pir_us = now + next_pir_delay_us();
+            }
+            expire_triggers(now);
+            if (now >= next_summary_us) {
+                print_summary(false);
+                next_summary_us += 5000000;
+            }
+
+            fd_set rfds, wfds;
+            FD_ZERO(&rfds);
+            FD_ZERO(&wfds);
+            FD_SET(m_listen_fd, &rfds);
+            int max_fd = m_listen_fd;
+            for (auto &client : m_clients) {
+                FD_SET(client->fd, &rfds);
+                if (!client->out.empty()) {
+                    FD_SET(client->fd, &wfds);
+                }
+                max_fd = std::max(max_fd, client->fd);
+            }
+            int64_t wait_us = std::min({next_pir_us, next_summary_us, end_us, now + 100000}) - now;
+            struct timeval tv = {(time_t)(wait_us / 1000000), (suseconds_t)(wait_us % 1000000)};
+            if (select(max_fd + 1, &rfds, &wfds, nullptr, &tv) < 0) {
+                continue;
+            }
+            if (FD_ISSET(m_listen_fd, &rfds)) {
+                accept_clients();
+            }
+            for (size_t i = 0; i < m_clients.size();) {
+                client_t &client = *m_clients[i];
+                bool alive = true;
+                if (FD_ISSET(client.fd, &rfds)) {
+                    alive = receive(client);
+                }
+                if (alive && !client.out.empty() && FD_ISSET(client.fd, &wfds)) {
+                    alive = flush(client);
+                }
+                if (alive) {
+                    i++;
+                    continue;
+                }
+                printf("%s disconnected\n", client.name.c_str());
+                close(client.fd);
+                m_finished.push_back(std::move(m_clients[i]));
+                m_clients.erase(m_clients.begin() + i);
+            }
+        }
+        print_summary(true);
+    }
+
+private:
+    int64_t next_pir_delay_us()
+    {
+        int jitter = m_pir_jitter_ms > 0 ? std::uniform_int_distribution<int>(0, m_pir_jitter_ms)(m_rng) : 0;
+        return (m_pir_ms + jitter) * 1000LL;
+    }
+
+    void accept_clients()
+    {
+        while (true) {
+            struct sockaddr_in addr;
+            socklen_t addr_len = sizeof(addr);
+            int fd = accept(m_listen_fd, (struct sockaddr *)&addr, &addr_len);
+            if (fd < 0) {
+                return;
+            }
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            std::unique_ptr<client_t> client(new client_t());
+            client->fd = fd;
+            client->name = std::string(inet_ntoa(addr.sin_addr)) + ":" + std::to_string(ntohs(addr.sin_port));
+            client->proto = PROTO_UNKNOWN;
+            client->wire_seq = 0;
+            client->trigger_us = -1;
+            printf("%s connected\n", client->name.c_str());
+            m_clients.push_back(std::move(client));
+        }
+    }
+
+    void trigger_all(int64_t now)
+    {
+        for (auto &client : m_clients) {
+            if (client->proto == PROTO_WIRE) {
+                uint8_t frame[WIRE_HEADER_SIZE];
+                size_t len = wire_encode(frame, sizeof(frame), WIRE_TRIGGER, WIRE_FLAG_ACK_REQ, client->wire_seq++,
+                                         nullptr, 0);
+                client->out.append((const char *)frame, len);
+            } else {
+                client->out.append("1\r");
+            }
+            client->triggers++;
+            if (client->trigger_us < 0) {
+                client->trigger_us = now;
+            }
+        }
+        printf("PIR trigger -> %d cameras\n", (int)m_clients.size());
+    }
+
+    void expire_triggers(int64_t now)
+    {
+        for (auto &client : m_clients) {
+            if (client->trigger_us >= 0 && now - client->trigger_us > m_timeout_ms * 1000LL) {
+                client->lost++;
+                client->trigger_us = -1;
+                printf("%s: no result within %d ms\n", client->name.c_str(), m_timeout_ms);
+            }
+        }
+    }
+
+    bool receive(client_t &client)
+    {
+        uint8_t buf[2048];
+        ssize_t n = recv(client.fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+        if (client.proto == PROTO_UNKNOWN) {
+            client.proto = buf[0] == WIRE_MAGIC ? PROTO_WIRE : PROTO_LINE;
+            printf("%s speaks %s\n", client.name.c_str(), proto_to_str(client.proto));
+            if (client.proto == PROTO_WIRE && m_continuous) {
+                uint8_t frame[WIRE_HEADER_SIZE + 5];
+                size_t len = wire_encode_config(frame, sizeof(frame), client.wire_seq++, WIRE_CONFIG_CONTINUOUS, 1);
+                client.out.append((const char *)frame, len);
+            }
+        }
+        if (client.proto == PROTO_WIRE) {
+            client.wire_parser.feed(buf, n, [&](const wire_header_t &header, const uint8_t *payload) {
+                on_frame(client, header, payload);
+            });
+            return true;
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            char c = buf[i];
+            if (c != '\r' && c != '\n') {
+                client.line.push_back(c);
+                continue;
+            }
+            event_t event;
+            if (!client.line.empty() && json_to_event(client.line, event)) {
+                on_result(client, event);
+            }
+            client.line.clear();
+        }
+        return true;
+    }
+
+    void on_frame(client_t &client, const wire_header_t &header, const uint8_t *payload)
+    {
+        if (header.type == WIRE_RESULT) {
+            size_t pos = 0;
+            for (int i = 0; i < header.count; i++) {
+                event_t event;
+                size_t len = decode_result_record(payload + pos, header.len - pos, event);
+                if (!len) {
+                    break;
+                }
+                pos += len;
+                on_result(client, event);
+            }
+        } else if (header.type == WIRE_HEARTBEAT) {
+            client.heartbeats++;
+        }
+        if (header.flags & WIRE_FLAG_ACK_REQ) {
+            uint8_t frame[WIRE_HEADER_SIZE + 2];
+            size_t len = wire_encode_ack(frame, sizeof(frame), client.wire_seq++, header.seq);
+            client.out.append((const char *)frame, len);
+        }
+    }
+
+    void on_result(client_t &client, const event_t &event)
+    {
+        int64_t now = now_us();
+        client.results++;
+        double latency_ms = -1;
+        if (event.type == EVENT_RECOGNIZE && client.trigger_us >= 0) {
+            latency_ms = (now - client.trigger_us) / 1000.0;
+            client.latencies_ms.push_back(latency_ms);
+            client.trigger_us = -1;
+        }
+        int best = event_best_face(event);
+        const event_face_t *face = best >= 0 ? &event.faces[best] : nullptr;
+        if (m_record) {
+            fprintf(m_record,
+                    "%.1f,%s,%s,%u,%s,%d,%d,%d,%.4f,",
+                    (now - m_start_us) / 1000.0,
+                    client.name.c_str(),
+                    proto_to_str(client.proto),
+                    (unsigned)event.seq,
+                    event_type_to_str(event.type),
+                    event.num_faces,
+                    face ? face->status : 0,
+                    face ? face->id : 0,
+                    face ? face->similarity : 0.f);
+            if (latency_ms >= 0) {
+                fprintf(m_record, "%.1f", latency_ms);
+            }
+            fprintf(m_record, "\n");
+        }
+    }
+
+    bool flush(client_t &client)
+    {
+        ssize_t n = send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL);
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        client.out.erase(0, n);
+        return true;
+    }
+
+    void print_summary(bool final)
+    {
+        std::vector<double> latencies;
+        uint32_t triggers = 0, results = 0, lost = 0;
+        auto add = [&](const client_t &client) {
+            latencies.insert(latencies.end(), client.latencies_ms.begin(), client.latencies_ms.end());
+            triggers += client.triggers;
+            results += client.results;
+            lost += client.lost;
+        };
+        for (auto &client : m_clients) {
+            add(*client);
+        }
+        for (auto &client : m_finished) {
+            add(*client);
+        }
+        std::sort(latencies.begin(), latencies.end());
+        auto pct = [&](double p) { return latencies[std::min(latencies.size() - 1, (size_t)(p * latencies.size()))]; };
+        printf("%s: %d cameras, %u triggers, %u results, %u lost",
+               final ? "final" : "summary",
+               (int)m_clients.size(),
+               triggers,
+               results,
+               lost);
+        if (!latencies.empty()) {
+            printf(", latency ms min %.1f p50 %.1f p95 %.1f p99 %.1f max %.1f",
+                   latencies.front(),
+                   pct(0.5),
+                   pct(0.95),
+                   pct(0.99),
+                   latencies.back());
+        }
+        printf("\n");
+        if (final) {
+            for (auto *clients : {&m_clients, &m_finished}) {
+                for (auto &client : *clients) {
+                    printf("  %-21s %-4s triggers %u results %u lost %u heartbeats %u\n",
+                           client->name.c_str(),
+                           proto_to_str(client->proto),
+                           client->triggers,
+                           client->results,
+                           client->lost,
+                           client->heartbeats);
+                }
+            }
+        }
+        fflush(stdout);
+    }
+
+    int m_listen_fd;
+    int m_pir_ms;
+    int m_pir_jitter_ms;
+    int m_timeout_ms;
+    bool m_continuous;
+    FILE *m_record;
+    int64_t m_start_us;
+    std::mt19937 m_rng;
+    std::vector<std::unique_ptr<client_t>> m_clients;
+    std::vector<std::unique_ptr<client_t>> m_finished;
+};
+
+static int usage()
+{
+    fprintf(stderr,
+            "usage: gateway_emulator [--port 5500] [--pir ms] [--pir-jitter ms] [--timeout ms] [--duration s]\n"
+            "                        [--record file.csv] [--continuous]\n");
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    int port = 5500;
+    int pir_ms = 5000;
+    int pir_jitter_ms = 0;
+    int timeout_ms = 5000;
+    int duration_s = 0;
+    bool continuous = false;
+    const char *record = nullptr;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (!strcmp(arg, "--continuous")) {
+            continuous = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return usage();
+        }
+        const char *value = argv[++i];
+        if (!strcmp(arg, "--port")) {
+            port = atoi(value);
+        } else if (!strcmp(arg, "--pir")) {
+            pir_ms = atoi(value);
+        } else if (!strcmp(arg, "--pir-jitter")) {
+            pir_jitter_ms = atoi(value);
+        } else if (!strcmp(arg, "--timeout")) {
+            timeout_ms = atoi(value);
+        } else if (!strcmp(arg, "--duration")) {
+            duration_s = atoi(value);
+        } else if (!strcmp(arg, "--record")) {
+            record = value;
+        } else {
+            return usage();
+        }
+    }
+
+    signal(SIGINT, [](int) { s_stop = 1; });
+    signal(SIGTERM, [](int) { s_stop = 1; });
+    GatewayEmulator emulator;
+    emulator.set_pir(pir_ms, pir_jitter_ms);
+    emulator.set_timeout(timeout_ms);
+    emulator.set_continuous(continuous);
+    if (!emulator.listen_on(port) || (record && !emulator.open_record(record))) {
+        return 1;
+    }
+    emulator.run(duration_s);
+    return 0;
+}
@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+"""Local stand-in for the Arduino gateway (ThingSpeak_Gateway2), for testing the camera's gateway client on a host.
+
+Accepts one camera at a time on the gateway port, prints every '\\r' terminated event it sends and, like the PIR
+sensor, sends "1\\r" every --pir seconds. --drop closes the connection after every N events to exercise the
+client's reconnect.
+
+    python3 tools/gateway/gateway_standin.py --port 5500 --pir 5 --drop 7
+"""
+import argparse
+import select
+import socket
+import time
+
+
+def serve(conn, addr, args):
+    print(f"camera connected from {addr[0]}:{addr[1]}")
+    buf = b""
+    events = 0
+    next_pir = time.monotonic() + args.pir if args.pir > 0 else None
+    while True:
+        timeout = max(next_pir - time.monotonic(), 0) if next_pir else None
+        readable, _, _ = select.select([conn], [], [], timeout)
+        if next_pir and time.monotonic() >= next_pir:
+            conn.sendall(b"1\r")
+            print("-> PIR trigger")
+            next_pir += args.pir
+        if not readable:
+            continue
+        data = conn.recv(4096)
+        if not data:
+            print("camera disconnected")
+            return
+        buf += data
+        while b"\r" in buf:
+            line, buf = buf.split(b"\r", 1)
+            events += 1
+            print(f"<- {line.decode(errors='replace')}")
+            if args.drop and events % args.drop == 0:
+                print(f"dropping the connection after {events} events")
+                return
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="0.0.0.0")
+    parser.add_argument("--port", type=int, default=5500)
+    parser.add_argument("--pir", type=float, default=0, help="seconds between PIR triggers, 0 for none")
+    parser.add_argument("--drop", type=int, default=0, help="close the connection after every N events")
+    args = parser.parse_args()
+
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind((args.host, args.port))
+    server.listen(1)
+    print(f"gateway stand-in listening on {args.host}:{args.port}")
+    while True:
+        conn, addr = server.accept()
+        with conn:
+            serve(conn, addr, args)
+
+
+if __name__ == "__main__":
+    main()